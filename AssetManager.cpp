@@ -0,0 +1,305 @@
+#include "AssetManager.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+
+namespace gps {
+
+    static uint64_t hashBytes(const std::vector<char>& bytes) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        for (char byte : bytes) {
+            hash = (hash ^ (unsigned char)byte) * 1099511628211ull;
+        }
+        return hash;
+    }
+
+    std::string normalizePath(const std::string& path) {
+        std::string unified = path;
+        std::replace(unified.begin(), unified.end(), '\\', '/');
+#if defined (_WIN32)
+        std::transform(unified.begin(), unified.end(), unified.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+#endif
+
+        bool absolute = !unified.empty() && unified[0] == '/';
+        std::vector<std::string> segments;
+        size_t begin = 0;
+        while (begin <= unified.size()) {
+            size_t end = unified.find('/', begin);
+            if (end == std::string::npos) {
+                end = unified.size();
+            }
+            std::string segment = unified.substr(begin, end - begin);
+            if (segment == "..") {
+                // a leading ".." has nothing to cancel and stays
+                if (!segments.empty() && segments.back() != "..") {
+                    segments.pop_back();
+                }
+                else if (!absolute) {
+                    segments.push_back(segment);
+                }
+            }
+            else if (!segment.empty() && segment != ".") {
+                segments.push_back(segment);
+            }
+            begin = end + 1;
+        }
+
+        std::string normalized = absolute ? "/" : "";
+        for (size_t i = 0; i < segments.size(); i++) {
+            normalized += (i > 0 ? "/" : "") + segments[i];
+        }
+        return normalized;
+    }
+
+    AssetHandle AssetManager::acquireTexture(const std::string& path) {
+        std::string key = normalizePath(path);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = texturePaths.find(key);
+            if (found != texturePaths.end()) {
+                return share(found->second, key);
+            }
+        }
+
+        // read and decoded outside the lock, so other threads are not held up
+        std::ifstream file(path, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file || bytes.empty()) {
+            fprintf(stderr, "ERROR: could not load %s\n", path.c_str());
+            return 0;
+        }
+        uint64_t contentHash = hashBytes(bytes);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            auto found = textureContents.find(contentHash);
+            if (found != textureContents.end() && textures.at(found->second).fileSize == bytes.size()) {
+                return share(found->second, key);
+            }
+        }
+
+        int x, y, n;
+        unsigned char* image_data = stbi_load_from_memory((const unsigned char*)bytes.data(), (int)bytes.size(), &x, &y, &n, 4);
+        if (!image_data) {
+            fprintf(stderr, "ERROR: could not load %s\n", path.c_str());
+            return 0;
+        }
+        // NPOT check
+        if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
+            fprintf(stderr, "WARNING: texture %s is not power-of-2 dimensions\n", path.c_str());
+        }
+
+        TextureAsset texture;
+        texture.id = 0;
+        texture.width = x;
+        texture.height = y;
+        // rows flipped, GL starts at the bottom
+        size_t rowBytes = (size_t)x * 4;
+        texture.pixels.resize(rowBytes * y);
+        for (int row = 0; row < y; row++) {
+            std::copy(image_data + row * rowBytes, image_data + (row + 1) * rowBytes, texture.pixels.begin() + (y - row - 1) * rowBytes);
+        }
+        stbi_image_free(image_data);
+        texture.bytes = texture.pixels.size() * 4 / 3;
+        texture.contentHash = contentHash;
+        texture.fileSize = bytes.size();
+        texture.paths.push_back(key);
+        texture.references = 1;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // another thread may have loaded the same image meanwhile
+        auto samePath = texturePaths.find(key);
+        if (samePath != texturePaths.end()) {
+            return share(samePath->second, key);
+        }
+        auto sameContent = textureContents.find(contentHash);
+        if (sameContent != textureContents.end() && textures.at(sameContent->second).fileSize == bytes.size()) {
+            return share(sameContent->second, key);
+        }
+
+        AssetHandle handle = nextHandle++;
+        texturePaths[key] = handle;
+        textureContents[contentHash] = handle;
+        textures[handle] = std::move(texture);
+        return handle;
+    }
+
+    AssetHandle AssetManager::share(AssetHandle handle, const std::string& path) {
+        TextureAsset& texture = textures.at(handle);
+        texture.references++;
+        if (texturePaths.find(path) == texturePaths.end()) {
+            texturePaths[path] = handle;
+            texture.paths.push_back(path);
+        }
+        sharedCount++;
+        savedBytes += texture.bytes;
+        return handle;
+    }
+
+    GLuint AssetManager::uploadTexture(AssetHandle handle, size_t& uploadedBytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = textures.find(handle);
+        if (found == textures.end()) {
+            return 0;
+        }
+        TextureAsset& texture = found->second;
+        if (texture.id != 0) {
+            return texture.id;
+        }
+
+        glGenTextures(1, &texture.id);
+        glBindTexture(GL_TEXTURE_2D, texture.id);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, texture.width, texture.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, texture.pixels.data());
+        glGenerateMipmap(GL_TEXTURE_2D);
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        uploadedBytes += texture.pixels.size();
+        std::vector<unsigned char>().swap(texture.pixels);
+        return texture.id;
+    }
+
+    size_t AssetManager::getTextureBytes(AssetHandle handle) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = textures.find(handle);
+        return found == textures.end() ? 0 : found->second.bytes;
+    }
+
+    void AssetManager::releaseTexture(AssetHandle handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = textures.find(handle);
+        if (found == textures.end() || --found->second.references > 0) {
+            return;
+        }
+        TextureAsset& texture = found->second;
+        if (texture.id != 0) {
+            glDeleteTextures(1, &texture.id);
+        }
+        for (const std::string& path : texture.paths) {
+            texturePaths.erase(path);
+        }
+        auto sameContent = textureContents.find(texture.contentHash);
+        if (sameContent != textureContents.end() && sameContent->second == handle) {
+            textureContents.erase(sameContent);
+        }
+        textures.erase(found);
+    }
+
+    // A second 64-bit hash, independent of hashMeshData's FNV-1a: a word at
+    // a time, multiplied by the golden ratio and rotated
+    static uint64_t fingerprintMeshData(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices) {
+        uint64_t hash = 0x9E3779B97F4A7C15ull ^ ((uint64_t)vertices.size() << 32) ^ (uint64_t)indices.size();
+        auto mix = [&hash](const void* data, size_t size) {
+            const uint32_t* words = (const uint32_t*)data;
+            for (size_t i = 0; i < size / sizeof(uint32_t); i++) {
+                hash = (hash ^ words[i]) * 0x9E3779B97F4A7C15ull;
+                hash = (hash << 31) | (hash >> 33);
+            }
+        };
+        // Vertex is all floats and the indices are 32 bits, so both are whole words
+        mix(vertices.data(), vertices.size() * sizeof(Vertex));
+        mix(indices.data(), indices.size() * sizeof(GLuint));
+        return hash;
+    }
+
+    AssetHandle AssetManager::acquireMeshBuffers(uint64_t hash, const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, GLuint& VBO, GLuint& EBO) {
+        // hashed outside the lock, other threads acquiring textures are not held up
+        uint64_t fingerprint = fingerprintMeshData(vertices, indices);
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // different data with the same hash sits next to it, told apart by
+        // the counts and the fingerprint
+        auto candidates = meshBuffers.equal_range(hash);
+        for (auto found = candidates.first; found != candidates.second; ++found) {
+            MeshBuffersAsset& shared = found->second;
+            if (shared.vertexCount == vertices.size() && shared.indexCount == indices.size() && shared.fingerprint == fingerprint) {
+                shared.references++;
+                sharedCount++;
+                savedBytes += shared.bytes;
+                VBO = shared.VBO;
+                EBO = shared.EBO;
+                return shared.handle;
+            }
+        }
+
+        MeshBuffersAsset buffers;
+        glGenBuffers(1, &buffers.VBO);
+        glGenBuffers(1, &buffers.EBO);
+        glBindBuffer(GL_ARRAY_BUFFER, buffers.VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // the element binding belongs to the VAO bound by the caller, so it is left alone
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffers.EBO);
+        glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        buffers.handle = nextHandle++;
+        buffers.vertexCount = vertices.size();
+        buffers.indexCount = indices.size();
+        buffers.fingerprint = fingerprint;
+        buffers.bytes = vertices.size() * sizeof(Vertex) + indices.size() * sizeof(GLuint);
+        buffers.references = 1;
+        meshBuffers.insert(std::make_pair(hash, buffers));
+        meshBufferHashes[buffers.handle] = hash;
+
+        VBO = buffers.VBO;
+        EBO = buffers.EBO;
+        return buffers.handle;
+    }
+
+    void AssetManager::releaseMeshBuffers(AssetHandle handle) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto hash = meshBufferHashes.find(handle);
+        if (hash == meshBufferHashes.end()) {
+            return;
+        }
+        auto candidates = meshBuffers.equal_range(hash->second);
+        for (auto found = candidates.first; found != candidates.second; ++found) {
+            if (found->second.handle != handle) {
+                continue;
+            }
+            if (--found->second.references > 0) {
+                return;
+            }
+            glDeleteBuffers(1, &found->second.VBO);
+            glDeleteBuffers(1, &found->second.EBO);
+            meshBuffers.erase(found);
+            meshBufferHashes.erase(hash);
+            return;
+        }
+    }
+
+    size_t AssetManager::getTextureCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return textures.size();
+    }
+
+    size_t AssetManager::getMeshBufferCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return meshBuffers.size();
+    }
+
+    size_t AssetManager::getSharedCount() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return sharedCount;
+    }
+
+    size_t AssetManager::getSavedBytes() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return savedBytes;
+    }
+
+    AssetManager& getAssetManager() {
+        // never deleted: models that are globals release into it at exit
+        static AssetManager* manager = new AssetManager();
+        return *manager;
+    }
+}
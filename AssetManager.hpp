@@ -0,0 +1,111 @@
+#ifndef AssetManager_hpp
+#define AssetManager_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // 0 is never a valid handle
+    typedef uint32_t AssetHandle;
+
+    // Textures and mesh buffers shared by every model that uses the same
+    // data. A texture is found by its normalised path, then by a hash of the
+    // file's bytes, so a copy of an image under another name loads once too;
+    // mesh buffers are found by a hash of their vertices and indices, and
+    // checked against a second hash before they are shared. Every
+    // acquire takes a reference and every release drops one; the GL object
+    // goes with the last. Textures may be acquired on any thread, their
+    // pixels wait for uploadTexture; the rest runs on the GL thread.
+    class AssetManager {
+
+    public:
+        // Decodes the image unless it is loaded already; 0 when it cannot be read
+        AssetHandle acquireTexture(const std::string& path);
+
+        // The texture's id, uploading (and freeing) its pixels the first
+        // time; uploadedBytes grows by what that sent to the GPU
+        GLuint uploadTexture(AssetHandle texture, size_t& uploadedBytes);
+
+        // with its mipmaps
+        size_t getTextureBytes(AssetHandle texture) const;
+
+        void releaseTexture(AssetHandle texture);
+
+        // Vertex and index buffers holding this data, shared with another
+        // mesh only when the hash, the counts and a second, independent hash
+        // all match. Returns the handle to release them with.
+        AssetHandle acquireMeshBuffers(uint64_t hash, const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices, GLuint& VBO, GLuint& EBO);
+
+        void releaseMeshBuffers(AssetHandle buffers);
+
+        size_t getTextureCount() const;
+        size_t getMeshBufferCount() const;
+        // acquires answered by an asset already loaded, and the bytes those
+        // would have taken again
+        size_t getSharedCount() const;
+        size_t getSavedBytes() const;
+
+    private:
+        struct TextureAsset {
+            GLuint id;
+            int width;
+            int height;
+            // decoded, until uploaded
+            std::vector<unsigned char> pixels;
+            size_t bytes;
+            uint64_t contentHash;
+            size_t fileSize;
+            // normalised paths that lead here
+            std::vector<std::string> paths;
+            int references;
+        };
+
+        struct MeshBuffersAsset {
+            GLuint VBO;
+            GLuint EBO;
+            AssetHandle handle;
+            size_t vertexCount;
+            size_t indexCount;
+            // the second hash, checked on a hash match
+            uint64_t fingerprint;
+            size_t bytes;
+            int references;
+        };
+
+        mutable std::mutex mutex;
+        AssetHandle nextHandle = 1;
+        std::unordered_map<AssetHandle, TextureAsset> textures;
+        std::unordered_map<std::string, AssetHandle> texturePaths;
+        std::unordered_map<uint64_t, AssetHandle> textureContents;
+        // by hashMeshData, which different data may share
+        std::unordered_multimap<uint64_t, MeshBuffersAsset> meshBuffers;
+        std::unordered_map<AssetHandle, uint64_t> meshBufferHashes;
+        size_t sharedCount = 0;
+        size_t savedBytes = 0;
+
+        // Takes a reference on a known texture, adding path as another way to it
+        AssetHandle share(AssetHandle handle, const std::string& path);
+    };
+
+    // The one shared by every model
+    AssetManager& getAssetManager();
+
+    // Forward slashes, without "." and "name/.." segments (lower case on Windows)
+    std::string normalizePath(const std::string& path);
+}
+
+#endif /* AssetManager_hpp */
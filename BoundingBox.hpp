@@ -0,0 +1,77 @@
+#ifndef BoundingBox_hpp
+#define BoundingBox_hpp
+
+#include <glm/glm.hpp>
+
+#include <cfloat>
+
+namespace gps {
+
+    // Axis aligned bounding box; an empty box has min > max
+    struct BoundingBox {
+        glm::vec3 min;
+        glm::vec3 max;
+
+        BoundingBox() : min(FLT_MAX), max(-FLT_MAX) {}
+        BoundingBox(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+        bool isEmpty() const {
+            return min.x > max.x;
+        }
+
+        glm::vec3 getCenter() const {
+            return (min + max) * 0.5f;
+        }
+
+        glm::vec3 getExtents() const {
+            return (max - min) * 0.5f;
+        }
+
+        void expand(const glm::vec3& point) {
+            min = glm::min(min, point);
+            max = glm::max(max, point);
+        }
+
+        void expand(const BoundingBox& box) {
+            min = glm::min(min, box.min);
+            max = glm::max(max, box.max);
+        }
+
+        bool intersects(const BoundingBox& box) const {
+            return min.x <= box.max.x && max.x >= box.min.x
+                && min.y <= box.max.y && max.y >= box.min.y
+                && min.z <= box.max.z && max.z >= box.min.z;
+        }
+
+        float distanceSquared(const glm::vec3& point) const {
+            glm::vec3 delta = glm::max(glm::max(min - point, point - max), glm::vec3(0.0f));
+            return glm::dot(delta, delta);
+        }
+
+        // to the farthest point of the box
+        float farthestDistanceSquared(const glm::vec3& point) const {
+            glm::vec3 delta = glm::max(glm::abs(min - point), glm::abs(max - point));
+            return glm::dot(delta, delta);
+        }
+
+        bool intersectsSphere(const glm::vec3& center, float radius) const {
+            return distanceSquared(center) <= radius * radius;
+        }
+
+        // Box enclosing this box after an affine transform
+        BoundingBox transformed(const glm::mat4& matrix) const {
+            if (isEmpty()) {
+                return *this;
+            }
+            glm::vec3 center = glm::vec3(matrix * glm::vec4(getCenter(), 1.0f));
+            glm::vec3 extents = getExtents();
+            glm::vec3 newExtents(0.0f);
+            for (int axis = 0; axis < 3; axis++) {
+                newExtents += glm::abs(glm::vec3(matrix[axis])) * extents[axis];
+            }
+            return BoundingBox(center - newExtents, center + newExtents);
+        }
+    };
+}
+
+#endif /* BoundingBox_hpp */
@@ -0,0 +1,896 @@
+#include "Bvh.hpp"
+#include "Parallel.hpp"
+#include "tiny_obj_loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define BVH_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    static const int BIN_COUNT = 16;
+    // leaves the SAH may choose; larger ranges are always split
+    static const uint32_t MAX_LEAF_SIZE = 8;
+    // cost of visiting a node, relative to testing one triangle
+    static const float TRAVERSAL_COST = 1.0f;
+    // nodes with this many triangles are binned on the worker pool
+    static const uint32_t PARALLEL_BIN_MIN = 1 << 16;
+    static const size_t PARALLEL_BIN_GRAIN = 1 << 14;
+    static const int STACK_SIZE = 128;
+
+    struct Bvh::BuildInput {
+        std::vector<BoundingBox> boxes;
+        std::vector<glm::vec3> centroids;
+        // triangle indices, partitioned in place as the tree is built
+        std::vector<uint32_t> order;
+    };
+
+    // a range left for the parallel phase; its root is nodes[nodeIndex]
+    struct Bvh::Subtree {
+        uint32_t nodeIndex;
+        uint32_t begin;
+        uint32_t end;
+        std::vector<Node> nodes;
+    };
+
+    namespace {
+
+        struct Bin {
+            BoundingBox box;
+            uint32_t count = 0;
+        };
+
+        struct Bins {
+            Bin bins[3][BIN_COUNT];
+        };
+
+        struct RangeBounds {
+            BoundingBox box;
+            BoundingBox centroids;
+        };
+
+        float surfaceArea(const BoundingBox& box) {
+            if (box.isEmpty()) {
+                return 0.0f;
+            }
+            glm::vec3 size = box.max - box.min;
+            return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+        }
+
+        int binOf(float centroid, float axisMin, float binScale) {
+            return std::min((int)((centroid - axisMin) * binScale), BIN_COUNT - 1);
+        }
+    }
+
+    void Bvh::build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices) {
+        nodes.clear();
+        bounds = BoundingBox();
+        triangles.clear();
+        triangleIds.clear();
+
+        uint32_t triangleCount = (uint32_t)(indices.size() / 3);
+        if (triangleCount == 0) {
+            return;
+        }
+
+        BuildInput input;
+        input.boxes.resize(triangleCount);
+        input.centroids.resize(triangleCount);
+        input.order.resize(triangleCount);
+        parallelFor(triangleCount, PARALLEL_BIN_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                BoundingBox box;
+                box.expand(positions[indices[3 * t]]);
+                box.expand(positions[indices[3 * t + 1]]);
+                box.expand(positions[indices[3 * t + 2]]);
+                input.boxes[t] = box;
+                input.centroids[t] = box.getCenter();
+                input.order[t] = (uint32_t)t;
+            }
+        });
+
+        // top levels on this thread (binning on the pool), then one subtree per job
+        std::vector<Subtree> subtrees;
+        uint32_t subtreeSize = std::max(triangleCount / (getThreadCount() * 8), 1024u);
+        nodes.push_back(Node());
+        buildNode(input, nodes, 0, 0, triangleCount, &subtrees, subtreeSize);
+
+        parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                Subtree& subtree = subtrees[i];
+                subtree.nodes.push_back(Node());
+                buildNode(input, subtree.nodes, 0, subtree.begin, subtree.end, nullptr, 0);
+            }
+        });
+
+        // the subtrees allocate their children from 1, in pairs; append them after the top levels
+        for (Subtree& subtree : subtrees) {
+            uint32_t base = (uint32_t)nodes.size() - 1;
+            for (size_t k = 0; k < subtree.nodes.size(); k++) {
+                Node node = subtree.nodes[k];
+                if (node.count == 0) {
+                    node.leftOrFirst += base;
+                }
+                if (k == 0) {
+                    nodes[subtree.nodeIndex] = node;
+                } else {
+                    nodes.push_back(node);
+                }
+            }
+        }
+
+        bounds = BoundingBox(nodes[0].boundsMin, nodes[0].boundsMax);
+
+        triangles.resize(triangleCount);
+        triangleIds = input.order;
+        for (uint32_t i = 0; i < triangleCount; i++) {
+            uint32_t t = triangleIds[i];
+            const glm::vec3& v0 = positions[indices[3 * t]];
+            triangles[i].v0 = v0;
+            triangles[i].edge1 = positions[indices[3 * t + 1]] - v0;
+            triangles[i].edge2 = positions[indices[3 * t + 2]] - v0;
+        }
+    }
+
+    void Bvh::buildNode(BuildInput& input, std::vector<Node>& target, uint32_t nodeIndex, uint32_t begin, uint32_t end,
+        std::vector<Subtree>* subtrees, uint32_t subtreeSize) const {
+
+        uint32_t count = end - begin;
+        bool parallel = subtrees != nullptr && count >= PARALLEL_BIN_MIN;
+        size_t chunkCount = parallel ? (count + PARALLEL_BIN_GRAIN - 1) / PARALLEL_BIN_GRAIN : 1;
+        size_t grain = parallel ? PARALLEL_BIN_GRAIN : count;
+
+        // small nodes skip the pool (and its std::function) altogether
+        std::vector<RangeBounds> chunkBounds(chunkCount);
+        auto measure = [&](size_t first, size_t last) {
+            RangeBounds& chunk = chunkBounds[first / grain];
+            for (size_t i = begin + first; i < begin + last; i++) {
+                uint32_t t = input.order[i];
+                chunk.box.expand(input.boxes[t]);
+                chunk.centroids.expand(input.centroids[t]);
+            }
+        };
+        if (parallel) {
+            parallelFor(count, grain, measure);
+        } else {
+            measure(0, count);
+        }
+        RangeBounds range;
+        for (const RangeBounds& chunk : chunkBounds) {
+            range.box.expand(chunk.box);
+            range.centroids.expand(chunk.centroids);
+        }
+
+        Node node;
+        node.boundsMin = range.box.min;
+        node.boundsMax = range.box.max;
+        node.leftOrFirst = begin;
+        node.count = (uint16_t)std::min(count, 0xffffu);
+        node.axis = 0;
+        target[nodeIndex] = node;
+
+        if (count <= 2) {
+            return;
+        }
+        if (subtrees != nullptr && count <= subtreeSize) {
+            Subtree subtree;
+            subtree.nodeIndex = nodeIndex;
+            subtree.begin = begin;
+            subtree.end = end;
+            subtrees->push_back(subtree);
+            return;
+        }
+
+        glm::vec3 centroidMin = range.centroids.min;
+        glm::vec3 centroidSize = range.centroids.max - range.centroids.min;
+        glm::vec3 binScale;
+        for (int axis = 0; axis < 3; axis++) {
+            binScale[axis] = centroidSize[axis] > 0.0f ? BIN_COUNT / centroidSize[axis] : 0.0f;
+        }
+
+        std::vector<Bins> chunkBins(chunkCount);
+        auto binTriangles = [&](size_t first, size_t last) {
+            Bins& bins = chunkBins[first / grain];
+            for (size_t i = begin + first; i < begin + last; i++) {
+                uint32_t t = input.order[i];
+                for (int axis = 0; axis < 3; axis++) {
+                    Bin& bin = bins.bins[axis][binOf(input.centroids[t][axis], centroidMin[axis], binScale[axis])];
+                    bin.box.expand(input.boxes[t]);
+                    bin.count++;
+                }
+            }
+        };
+        if (parallel) {
+            parallelFor(count, grain, binTriangles);
+        } else {
+            binTriangles(0, count);
+        }
+        Bins bins = chunkBins[0];
+        for (size_t c = 1; c < chunkCount; c++) {
+            for (int axis = 0; axis < 3; axis++) {
+                for (int b = 0; b < BIN_COUNT; b++) {
+                    bins.bins[axis][b].box.expand(chunkBins[c].bins[axis][b].box);
+                    bins.bins[axis][b].count += chunkBins[c].bins[axis][b].count;
+                }
+            }
+        }
+
+        // sweep the split planes between bins from both sides
+        float bestCost = FLT_MAX;
+        int bestAxis = -1;
+        int bestSplit = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (binScale[axis] == 0.0f) {
+                continue;
+            }
+            float rightCost[BIN_COUNT];
+            BoundingBox rightBox;
+            uint32_t rightCount = 0;
+            for (int b = BIN_COUNT - 1; b > 0; b--) {
+                rightBox.expand(bins.bins[axis][b].box);
+                rightCount += bins.bins[axis][b].count;
+                rightCost[b] = surfaceArea(rightBox) * rightCount;
+            }
+            BoundingBox leftBox;
+            uint32_t leftCount = 0;
+            for (int b = 0; b < BIN_COUNT - 1; b++) {
+                leftBox.expand(bins.bins[axis][b].box);
+                leftCount += bins.bins[axis][b].count;
+                float cost = surfaceArea(leftBox) * leftCount + rightCost[b + 1];
+                if (leftCount > 0 && leftCount < count && cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = b + 1;
+                }
+            }
+        }
+
+        uint32_t middle;
+        if (bestAxis >= 0) {
+            float area = surfaceArea(range.box);
+            float splitCost = TRAVERSAL_COST + (area > 0.0f ? bestCost / area : (float)count);
+            if (count <= MAX_LEAF_SIZE && splitCost >= (float)count) {
+                return;
+            }
+            float axisMin = centroidMin[bestAxis];
+            float scale = binScale[bestAxis];
+            middle = (uint32_t)(std::partition(input.order.begin() + begin, input.order.begin() + end, [&](uint32_t t) {
+                return binOf(input.centroids[t][bestAxis], axisMin, scale) < bestSplit;
+            }) - input.order.begin());
+        } else {
+            // every centroid in one point: halve the range to keep the leaves small
+            if (count <= MAX_LEAF_SIZE) {
+                return;
+            }
+            bestAxis = 0;
+            middle = begin + count / 2;
+        }
+
+        uint32_t left = (uint32_t)target.size();
+        target.push_back(Node());
+        target.push_back(Node());
+        target[nodeIndex].leftOrFirst = left;
+        target[nodeIndex].count = 0;
+        target[nodeIndex].axis = (uint16_t)bestAxis;
+
+        buildNode(input, target, left, begin, middle, subtrees, subtreeSize);
+        buildNode(input, target, left + 1, middle, end, subtrees, subtreeSize);
+    }
+
+    // 1 / direction without infinities, whose 0 * inf products would be NaN
+    // for rays starting exactly on a box face
+    static glm::vec3 safeInverse(const glm::vec3& direction) {
+        glm::vec3 inverse;
+        for (int axis = 0; axis < 3; axis++) {
+            float component = direction[axis];
+            if (std::fabs(component) < 1e-20f) {
+                component = component < 0.0f ? -1e-20f : 1e-20f;
+            }
+            inverse[axis] = 1.0f / component;
+        }
+        return inverse;
+    }
+
+    // entry distance of the ray into the box, FLT_MAX when it misses within maxDistance
+    static float slabTest(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const glm::vec3& origin, const glm::vec3& inverseDirection, float maxDistance) {
+        float entry = 0.0f;
+        float exit = maxDistance;
+        for (int axis = 0; axis < 3; axis++) {
+            float t0 = (boundsMin[axis] - origin[axis]) * inverseDirection[axis];
+            float t1 = (boundsMax[axis] - origin[axis]) * inverseDirection[axis];
+            entry = std::max(entry, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        return entry <= exit ? entry : FLT_MAX;
+    }
+
+    template <bool anyHit>
+    bool Bvh::traverse(const Ray& ray, RayHit& hit) const {
+        if (nodes.empty()) {
+            return false;
+        }
+        glm::vec3 inverseDirection = safeInverse(ray.direction);
+        float maxDistance = ray.maxDistance;
+        if (slabTest(nodes[0].boundsMin, nodes[0].boundsMax, ray.origin, inverseDirection, maxDistance) == FLT_MAX) {
+            return false;
+        }
+
+        uint32_t stack[STACK_SIZE];
+        int stackSize = 0;
+        uint32_t current = 0;
+        bool found = false;
+        while (true) {
+            const Node& node = nodes[current];
+            if (node.count > 0) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    // Moller-Trumbore, both sides
+                    const Triangle& triangle = triangles[i];
+                    glm::vec3 p = glm::cross(ray.direction, triangle.edge2);
+                    float determinant = glm::dot(triangle.edge1, p);
+                    if (determinant == 0.0f) {
+                        continue;
+                    }
+                    float inverseDeterminant = 1.0f / determinant;
+                    glm::vec3 s = ray.origin - triangle.v0;
+                    float u = glm::dot(s, p) * inverseDeterminant;
+                    if (u < 0.0f || u > 1.0f) {
+                        continue;
+                    }
+                    glm::vec3 q = glm::cross(s, triangle.edge1);
+                    float v = glm::dot(ray.direction, q) * inverseDeterminant;
+                    if (v < 0.0f || u + v > 1.0f) {
+                        continue;
+                    }
+                    float t = glm::dot(triangle.edge2, q) * inverseDeterminant;
+                    if (t > 0.0f && t < maxDistance) {
+                        maxDistance = t;
+                        hit.distance = t;
+                        hit.triangle = triangleIds[i];
+                        hit.u = u;
+                        hit.v = v;
+                        if (anyHit) {
+                            return true;
+                        }
+                        found = true;
+                    }
+                }
+            } else {
+                const Node& left = nodes[node.leftOrFirst];
+                const Node& right = nodes[node.leftOrFirst + 1];
+                float leftEntry = slabTest(left.boundsMin, left.boundsMax, ray.origin, inverseDirection, maxDistance);
+                float rightEntry = slabTest(right.boundsMin, right.boundsMax, ray.origin, inverseDirection, maxDistance);
+                uint32_t nearChild = node.leftOrFirst;
+                uint32_t farChild = node.leftOrFirst + 1;
+                if (rightEntry < leftEntry) {
+                    std::swap(leftEntry, rightEntry);
+                    std::swap(nearChild, farChild);
+                }
+                if (leftEntry != FLT_MAX) {
+                    if (rightEntry != FLT_MAX && stackSize < STACK_SIZE) {
+                        stack[stackSize++] = farChild;
+                    }
+                    current = nearChild;
+                    continue;
+                }
+            }
+
+            if (stackSize == 0) {
+                return found;
+            }
+            current = stack[--stackSize];
+        }
+    }
+
+    bool Bvh::intersect(const Ray& ray, RayHit& hit) const {
+        hit = RayHit();
+        return traverse<false>(ray, hit);
+    }
+
+    bool Bvh::occluded(const Ray& ray) const {
+        RayHit hit;
+        return traverse<true>(ray, hit);
+    }
+
+    namespace {
+
+        glm::vec3 closestPointOnTriangle(const glm::vec3& point, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+            glm::vec3 ab = b - a, ac = c - a, ap = point - a;
+            float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+            if (d1 <= 0.0f && d2 <= 0.0f) {
+                return a;
+            }
+            glm::vec3 bp = point - b;
+            float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+            if (d3 >= 0.0f && d4 <= d3) {
+                return b;
+            }
+            float vc = d1 * d4 - d3 * d2;
+            if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+                return a + ab * (d1 / (d1 - d3));
+            }
+            glm::vec3 cp = point - c;
+            float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+            if (d6 >= 0.0f && d5 <= d6) {
+                return c;
+            }
+            float vb = d5 * d2 - d1 * d6;
+            if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+                return a + ac * (d2 / (d2 - d6));
+            }
+            float va = d3 * d6 - d5 * d4;
+            if (va <= 0.0f && d4 - d3 >= 0.0f && d5 - d6 >= 0.0f) {
+                return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+            }
+            float denominator = 1.0f / (va + vb + vc);
+            return a + ab * (vb * denominator) + ac * (vc * denominator);
+        }
+
+        // smallest root in [0, best) of a t^2 + b t + c = 0
+        bool smallestRoot(float a, float b, float c, float best, float& root) {
+            if (a <= 0.0f) {
+                return false;
+            }
+            float discriminant = b * b - 4.0f * a * c;
+            if (discriminant < 0.0f) {
+                return false;
+            }
+            float t = (-b - std::sqrt(discriminant)) / (2.0f * a);
+            if (t < 0.0f || t >= best) {
+                return false;
+            }
+            root = t;
+            return true;
+        }
+
+        // Earliest t in [0, best) at which the moving sphere touches the triangle
+        bool sweepTriangle(const glm::vec3& origin, const glm::vec3& direction, float radius,
+            const glm::vec3& a, const glm::vec3& b, const glm::vec3& c, float best, float& t) {
+
+            // already touching: stop at once when heading further in
+            glm::vec3 closest = closestPointOnTriangle(origin, a, b, c);
+            glm::vec3 away = origin - closest;
+            if (glm::dot(away, away) < radius * radius) {
+                if (glm::dot(direction, away) < 0.0f) {
+                    t = 0.0f;
+                    return true;
+                }
+                return false;
+            }
+
+            // the face, from the side the sphere starts on
+            glm::vec3 winding = glm::cross(b - a, c - a);
+            float normalLength = glm::length(winding);
+            if (normalLength == 0.0f) {
+                return false;
+            }
+            glm::vec3 normal = winding / normalLength;
+            float startDistance = glm::dot(normal, origin - a);
+            if (startDistance < 0.0f) {
+                normal = -normal;
+                startDistance = -startDistance;
+            }
+            float approach = glm::dot(normal, direction);
+            // a sphere already closer than radius to the plane (but not to the
+            // triangle) can only meet an edge or a vertex, the face t would be negative
+            if (approach < 0.0f && startDistance >= radius) {
+                float faceT = (radius - startDistance) / approach;
+                if (faceT >= best) {
+                    return false;
+                }
+                glm::vec3 contact = origin + direction * faceT - normal * radius;
+                bool inside = glm::dot(glm::cross(b - a, contact - a), winding) >= 0.0f
+                    && glm::dot(glm::cross(c - b, contact - b), winding) >= 0.0f
+                    && glm::dot(glm::cross(a - c, contact - c), winding) >= 0.0f;
+                if (inside) {
+                    t = faceT;
+                    return true;
+                }
+            }
+
+            // otherwise the sphere can only meet a vertex or an edge
+            bool found = false;
+            float dd = glm::dot(direction, direction);
+            const glm::vec3* corners[3] = { &a, &b, &c };
+            for (int k = 0; k < 3; k++) {
+                glm::vec3 toOrigin = origin - *corners[k];
+                float root;
+                if (smallestRoot(dd, 2.0f * glm::dot(direction, toOrigin), glm::dot(toOrigin, toOrigin) - radius * radius, best, root)) {
+                    best = root;
+                    found = true;
+                }
+
+                const glm::vec3& start = *corners[k];
+                glm::vec3 edge = *corners[(k + 1) % 3] - start;
+                glm::vec3 m = origin - start;
+                float ee = glm::dot(edge, edge), ed = glm::dot(edge, direction), em = glm::dot(edge, m);
+                float quadratic = ee * dd - ed * ed;
+                float linear = 2.0f * (ee * glm::dot(direction, m) - ed * em);
+                float constant = ee * (glm::dot(m, m) - radius * radius) - em * em;
+                if (smallestRoot(quadratic, linear, constant, best, root)) {
+                    float along = (ed * root + em) / ee;
+                    if (along >= 0.0f && along <= 1.0f) {
+                        best = root;
+                        found = true;
+                    }
+                }
+            }
+            if (found) {
+                t = best;
+            }
+            return found;
+        }
+    }
+
+    bool Bvh::sweepSphere(const Ray& ray, float radius, SweepHit& hit) const {
+        hit = SweepHit();
+        if (nodes.empty()) {
+            return false;
+        }
+        glm::vec3 inverseDirection = safeInverse(ray.direction);
+        glm::vec3 grow(radius);
+        float best = ray.maxDistance;
+
+        uint32_t stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+            if (slabTest(node.boundsMin - grow, node.boundsMax + grow, ray.origin, inverseDirection, best) == FLT_MAX) {
+                continue;
+            }
+            if (node.count == 0) {
+                if (stackSize + 2 <= STACK_SIZE) {
+                    stack[stackSize++] = node.leftOrFirst + 1;
+                    stack[stackSize++] = node.leftOrFirst;
+                }
+                continue;
+            }
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle& triangle = triangles[i];
+                glm::vec3 b = triangle.v0 + triangle.edge1;
+                glm::vec3 c = triangle.v0 + triangle.edge2;
+                float t;
+                if (sweepTriangle(ray.origin, ray.direction, radius, triangle.v0, b, c, best, t)) {
+                    best = t;
+                    hit.distance = t;
+                    hit.triangle = triangleIds[i];
+                    glm::vec3 center = ray.origin + ray.direction * t;
+                    glm::vec3 away = center - closestPointOnTriangle(center, triangle.v0, b, c);
+                    float awayLength = glm::length(away);
+                    hit.normal = awayLength > 0.0f ? away / awayLength : -glm::normalize(ray.direction);
+                }
+            }
+        }
+        return hit.isHit();
+    }
+
+#if defined(BVH_SSE)
+    namespace {
+
+        inline __m128 select(__m128 mask, __m128 a, __m128 b) {
+            return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+        }
+    }
+
+    // Up to four rays traced together: a node is entered when any live ray hits
+    // it, and each triangle is tested against all four rays at once
+    template <bool anyHit>
+    void Bvh::traversePacket(const Ray* rays, RayHit* hits, size_t count) const {
+        alignas(16) float lanes[10][4];
+        for (int lane = 0; lane < 4; lane++) {
+            // missing lanes repeat the first ray with nothing left to find
+            const Ray& ray = rays[(size_t)lane < count ? lane : 0];
+            glm::vec3 inverseDirection = safeInverse(ray.direction);
+            for (int axis = 0; axis < 3; axis++) {
+                lanes[axis][lane] = ray.origin[axis];
+                lanes[3 + axis][lane] = ray.direction[axis];
+                lanes[6 + axis][lane] = inverseDirection[axis];
+            }
+            lanes[9][lane] = (size_t)lane < count ? ray.maxDistance : -1.0f;
+        }
+        __m128 origin[3] = { _mm_load_ps(lanes[0]), _mm_load_ps(lanes[1]), _mm_load_ps(lanes[2]) };
+        __m128 direction[3] = { _mm_load_ps(lanes[3]), _mm_load_ps(lanes[4]), _mm_load_ps(lanes[5]) };
+        __m128 inverseDirection[3] = { _mm_load_ps(lanes[6]), _mm_load_ps(lanes[7]), _mm_load_ps(lanes[8]) };
+        __m128 maxDistance = _mm_load_ps(lanes[9]);
+        __m128 zero = _mm_setzero_ps();
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 alive = _mm_cmpge_ps(maxDistance, zero);
+        __m128 hitU = zero, hitV = zero;
+        uint32_t hitTriangle[4] = { RayHit::NONE, RayHit::NONE, RayHit::NONE, RayHit::NONE };
+
+        // children are visited in the order the first ray would meet them
+        bool negative[3] = { rays[0].direction.x < 0.0f, rays[0].direction.y < 0.0f, rays[0].direction.z < 0.0f };
+
+        uint32_t stack[STACK_SIZE];
+        int stackSize = 0;
+        if (!nodes.empty()) {
+            stack[stackSize++] = 0;
+        }
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+
+            __m128 entry = zero;
+            __m128 exit = maxDistance;
+            for (int axis = 0; axis < 3; axis++) {
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMin[axis]), origin[axis]), inverseDirection[axis]);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.boundsMax[axis]), origin[axis]), inverseDirection[axis]);
+                entry = _mm_max_ps(entry, _mm_min_ps(t0, t1));
+                exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+            }
+            if (_mm_movemask_ps(_mm_and_ps(_mm_cmple_ps(entry, exit), alive)) == 0) {
+                continue;
+            }
+
+            if (node.count == 0) {
+                // the near child goes on top
+                bool swapChildren = negative[node.axis];
+                if (stackSize + 2 <= STACK_SIZE) {
+                    stack[stackSize++] = node.leftOrFirst + (swapChildren ? 0 : 1);
+                    stack[stackSize++] = node.leftOrFirst + (swapChildren ? 1 : 0);
+                }
+                continue;
+            }
+
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                const Triangle& triangle = triangles[i];
+                __m128 e1[3] = { _mm_set1_ps(triangle.edge1.x), _mm_set1_ps(triangle.edge1.y), _mm_set1_ps(triangle.edge1.z) };
+                __m128 e2[3] = { _mm_set1_ps(triangle.edge2.x), _mm_set1_ps(triangle.edge2.y), _mm_set1_ps(triangle.edge2.z) };
+
+                __m128 p[3] = {
+                    _mm_sub_ps(_mm_mul_ps(direction[1], e2[2]), _mm_mul_ps(direction[2], e2[1])),
+                    _mm_sub_ps(_mm_mul_ps(direction[2], e2[0]), _mm_mul_ps(direction[0], e2[2])),
+                    _mm_sub_ps(_mm_mul_ps(direction[0], e2[1]), _mm_mul_ps(direction[1], e2[0]))
+                };
+                __m128 determinant = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1[0], p[0]), _mm_mul_ps(e1[1], p[1])), _mm_mul_ps(e1[2], p[2]));
+                __m128 inverseDeterminant = _mm_div_ps(one, determinant);
+
+                __m128 s[3] = {
+                    _mm_sub_ps(origin[0], _mm_set1_ps(triangle.v0.x)),
+                    _mm_sub_ps(origin[1], _mm_set1_ps(triangle.v0.y)),
+                    _mm_sub_ps(origin[2], _mm_set1_ps(triangle.v0.z))
+                };
+                __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(s[0], p[0]), _mm_mul_ps(s[1], p[1])), _mm_mul_ps(s[2], p[2])), inverseDeterminant);
+
+                __m128 q[3] = {
+                    _mm_sub_ps(_mm_mul_ps(s[1], e1[2]), _mm_mul_ps(s[2], e1[1])),
+                    _mm_sub_ps(_mm_mul_ps(s[2], e1[0]), _mm_mul_ps(s[0], e1[2])),
+                    _mm_sub_ps(_mm_mul_ps(s[0], e1[1]), _mm_mul_ps(s[1], e1[0]))
+                };
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], q[0]), _mm_mul_ps(direction[1], q[1])), _mm_mul_ps(direction[2], q[2])), inverseDeterminant);
+                __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2[0], q[0]), _mm_mul_ps(e2[1], q[1])), _mm_mul_ps(e2[2], q[2])), inverseDeterminant);
+
+                // NaNs from a zero determinant fail every comparison
+                __m128 mask = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+                mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), one));
+                mask = _mm_and_ps(mask, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, maxDistance)));
+                mask = _mm_and_ps(mask, _mm_cmpneq_ps(determinant, zero));
+                mask = _mm_and_ps(mask, alive);
+                int laneMask = _mm_movemask_ps(mask);
+                if (laneMask == 0) {
+                    continue;
+                }
+
+                maxDistance = select(mask, t, maxDistance);
+                hitU = select(mask, u, hitU);
+                hitV = select(mask, v, hitV);
+                for (int lane = 0; lane < 4; lane++) {
+                    if (laneMask & (1 << lane)) {
+                        hitTriangle[lane] = triangleIds[i];
+                    }
+                }
+                if (anyHit) {
+                    alive = _mm_andnot_ps(mask, alive);
+                    if (_mm_movemask_ps(alive) == 0) {
+                        stackSize = 0;
+                        break;
+                    }
+                }
+            }
+        }
+
+        alignas(16) float distances[4], us[4], vs[4];
+        _mm_store_ps(distances, maxDistance);
+        _mm_store_ps(us, hitU);
+        _mm_store_ps(vs, hitV);
+        for (size_t lane = 0; lane < count; lane++) {
+            hits[lane] = RayHit();
+            if (hitTriangle[lane] != RayHit::NONE) {
+                hits[lane].distance = distances[lane];
+                hits[lane].triangle = hitTriangle[lane];
+                hits[lane].u = us[lane];
+                hits[lane].v = vs[lane];
+            }
+        }
+    }
+#else
+    template <bool anyHit>
+    void Bvh::traversePacket(const Ray* rays, RayHit* hits, size_t count) const {
+        for (size_t i = 0; i < count; i++) {
+            hits[i] = RayHit();
+            traverse<anyHit>(rays[i], hits[i]);
+        }
+    }
+#endif
+
+    void Bvh::intersect(const Ray* rays, RayHit* hits, size_t count) const {
+        for (size_t i = 0; i < count; i += 4) {
+            traversePacket<false>(rays + i, hits + i, std::min(count - i, (size_t)4));
+        }
+    }
+
+    void Bvh::occluded(const Ray* rays, uint8_t* hidden, size_t count) const {
+        RayHit hits[4];
+        for (size_t i = 0; i < count; i += 4) {
+            size_t packet = std::min(count - i, (size_t)4);
+            traversePacket<true>(rays + i, hits, packet);
+            for (size_t lane = 0; lane < packet; lane++) {
+                hidden[i + lane] = hits[lane].isHit();
+            }
+        }
+    }
+
+    bool Bvh::isEmpty() const {
+        return nodes.empty();
+    }
+
+    const BoundingBox& Bvh::getBounds() const {
+        return bounds;
+    }
+
+    size_t Bvh::getTriangleCount() const {
+        return triangles.size();
+    }
+
+    size_t Bvh::getNodeCount() const {
+        return nodes.size();
+    }
+}
+
+namespace gps {
+
+    namespace {
+
+        // milliseconds taken by body over [0, count) on the worker pool
+        double timeParallel(size_t count, const std::function<void(size_t, size_t)>& body) {
+            auto start = std::chrono::high_resolution_clock::now();
+            parallelFor(count, 1024, body);
+            auto stop = std::chrono::high_resolution_clock::now();
+            return std::chrono::duration<double, std::milli>(stop - start).count();
+        }
+    }
+
+    void benchmarkBvh(const std::string& fileName, const std::string& basePath, const glm::mat4& view, float fieldOfView, int width, int height) {
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+        bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true);
+        if (!ret) {
+            std::cerr << "Failed to load " << fileName << ": " << err << std::endl;
+            return;
+        }
+
+        std::vector<glm::vec3> positions;
+        for (size_t i = 0; i + 2 < attrib.vertices.size(); i += 3) {
+            positions.push_back(glm::vec3(attrib.vertices[i], attrib.vertices[i + 1], attrib.vertices[i + 2]));
+        }
+        std::vector<uint32_t> indices;
+        for (const tinyobj::shape_t& shape : shapes) {
+            for (const tinyobj::index_t& index : shape.mesh.indices) {
+                indices.push_back((uint32_t)index.vertex_index);
+            }
+        }
+        size_t triangleCount = indices.size() / 3;
+        std::cout << fileName << ": " << triangleCount << " triangles" << std::endl;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // primary rays through every pixel
+        glm::mat4 cameraToWorld = glm::inverse(view);
+        glm::vec3 cameraPosition = glm::vec3(cameraToWorld[3]);
+        float halfHeight = std::tan(fieldOfView * 0.5f);
+        float halfWidth = halfHeight * width / height;
+        std::vector<Ray> cameraRays(width * height);
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                float px = ((x + 0.5f) / width * 2.0f - 1.0f) * halfWidth;
+                float py = (1.0f - (y + 0.5f) / height * 2.0f) * halfHeight;
+                Ray& ray = cameraRays[y * width + x];
+                ray.origin = cameraPosition;
+                ray.direction = glm::vec3(cameraToWorld * glm::vec4(px, py, -1.0f, 0.0f));
+            }
+        }
+
+        // short ambient occlusion rays leaving random points of the surfaces
+        Bvh bvh;
+        bvh.build(positions, indices);
+        float sceneSize = glm::length(bvh.getBounds().max - bvh.getBounds().min);
+        std::mt19937 random(7);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<Ray> occlusionRays;
+        while (occlusionRays.size() < (size_t)1 << 20) {
+            size_t t = (size_t)(unit(random) * (triangleCount - 1));
+            glm::vec3 a = positions[indices[3 * t]], b = positions[indices[3 * t + 1]], c = positions[indices[3 * t + 2]];
+            glm::vec3 normal = glm::cross(b - a, c - a);
+            if (glm::length(normal) == 0.0f) {
+                continue;
+            }
+            normal = glm::normalize(normal);
+            float u = unit(random), v = unit(random);
+            if (u + v > 1.0f) {
+                u = 1.0f - u;
+                v = 1.0f - v;
+            }
+            glm::vec3 direction(unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f, unit(random) * 2.0f - 1.0f);
+            if (glm::dot(direction, direction) > 1.0f || glm::dot(direction, direction) < 1e-4f) {
+                continue;
+            }
+            if (glm::dot(direction, normal) < 0.0f) {
+                direction = -direction;
+            }
+
+            Ray ray;
+            ray.origin = a + u * (b - a) + v * (c - a) + normal * (sceneSize * 1e-5f);
+            ray.direction = glm::normalize(direction);
+            ray.maxDistance = sceneSize * 0.05f;
+            occlusionRays.push_back(ray);
+        }
+
+        std::vector<RayHit> hits(cameraRays.size());
+        std::vector<RayHit> packetHits(cameraRays.size());
+        std::vector<uint8_t> hidden(occlusionRays.size());
+
+        unsigned int limits[2] = { 1, 0 };
+        for (int run = 0; run < 2; run++) {
+            setThreadLimit(limits[run]);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            bvh.build(positions, indices);
+            auto stop = std::chrono::high_resolution_clock::now();
+            double buildMs = std::chrono::duration<double, std::milli>(stop - start).count();
+
+            double singleMs = timeParallel(cameraRays.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    bvh.intersect(cameraRays[i], hits[i]);
+                }
+            });
+            double packetMs = timeParallel(cameraRays.size(), [&](size_t begin, size_t end) {
+                bvh.intersect(&cameraRays[begin], &packetHits[begin], end - begin);
+            });
+            double anySingleMs = timeParallel(occlusionRays.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    hidden[i] = bvh.occluded(occlusionRays[i]);
+                }
+            });
+            double anyPacketMs = timeParallel(occlusionRays.size(), [&](size_t begin, size_t end) {
+                bvh.occluded(&occlusionRays[begin], &hidden[begin], end - begin);
+            });
+
+            size_t cameraHits = 0, mismatches = 0, occludedCount = 0;
+            for (size_t i = 0; i < hits.size(); i++) {
+                cameraHits += hits[i].isHit();
+                mismatches += hits[i].triangle != packetHits[i].triangle;
+            }
+            for (size_t i = 0; i < hidden.size(); i++) {
+                occludedCount += hidden[i];
+            }
+
+            std::cout << getThreadCount() << " thread(s): build " << buildMs << " ms (" << bvh.getNodeCount() << " nodes)" << std::endl;
+            std::cout << "  closest hit, " << cameraRays.size() << " camera rays (" << cameraHits << " hits, "
+                << mismatches << " packet mismatches): " << cameraRays.size() / singleMs / 1000.0 << " Mrays/s single, "
+                << cameraRays.size() / packetMs / 1000.0 << " Mrays/s packets" << std::endl;
+            std::cout << "  any hit, " << occlusionRays.size() << " occlusion rays (" << occludedCount << " occluded): "
+                << occlusionRays.size() / anySingleMs / 1000.0 << " Mrays/s single, "
+                << occlusionRays.size() / anyPacketMs / 1000.0 << " Mrays/s packets" << std::endl;
+        }
+        setThreadLimit(0);
+    }
+}
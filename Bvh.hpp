@@ -0,0 +1,122 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include <glm/glm.hpp>
+
+#include "BoundingBox.hpp"
+
+#include <cfloat>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    struct Ray {
+        glm::vec3 origin;
+        // need not be normalized; distances are in units of its length
+        glm::vec3 direction;
+        float maxDistance = FLT_MAX;
+    };
+
+    struct RayHit {
+        static const uint32_t NONE = 0xffffffffu;
+
+        float distance = FLT_MAX;
+        // index of the triangle as passed to build, or NONE
+        uint32_t triangle = NONE;
+        // barycentrics of the hit against the triangle's second and third vertex
+        float u = 0.0f;
+        float v = 0.0f;
+
+        bool isHit() const {
+            return triangle != NONE;
+        }
+    };
+
+    struct SweepHit {
+        // fraction of the ray's direction travelled before the sphere touches
+        float distance = FLT_MAX;
+        uint32_t triangle = RayHit::NONE;
+        // away from the surface, through the contact point
+        glm::vec3 normal = glm::vec3(0.0f);
+
+        bool isHit() const {
+            return triangle != RayHit::NONE;
+        }
+    };
+
+    // Bounding volume hierarchy over a triangle soup, for ray queries on the CPU
+    // (picking, ground following, baking). Built top-down with a binned surface
+    // area heuristic; the upper levels are binned on the worker pool and the
+    // subtrees below them are built in parallel. Queries take single rays or
+    // streams, which are traced four at a time as SSE packets.
+    class Bvh {
+
+    public:
+        // Triangles are indices[3 * i], indices[3 * i + 1], indices[3 * i + 2]
+        void build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices);
+
+        bool isEmpty() const;
+        const BoundingBox& getBounds() const;
+        size_t getTriangleCount() const;
+        size_t getNodeCount() const;
+
+        // Closest hit along the ray
+        bool intersect(const Ray& ray, RayHit& hit) const;
+
+        // Whether anything lies along the ray (shadow and visibility rays)
+        bool occluded(const Ray& ray) const;
+
+        // First contact of a sphere of the given radius whose center moves along
+        // the ray; a sphere starting in contact only stops when moving inwards
+        bool sweepSphere(const Ray& ray, float radius, SweepHit& hit) const;
+
+        // The same for a stream of rays, traced as packets of four
+        void intersect(const Ray* rays, RayHit* hits, size_t count) const;
+        void occluded(const Ray* rays, uint8_t* hidden, size_t count) const;
+
+    private:
+        struct Node {
+            glm::vec3 boundsMin;
+            // first child (the second one follows it) or first triangle of a leaf
+            uint32_t leftOrFirst;
+            glm::vec3 boundsMax;
+            // triangles of a leaf, 0 for an inner node
+            uint16_t count;
+            // axis the children were split along
+            uint16_t axis;
+        };
+
+        // first vertex and the two edges leaving it, in build order
+        struct Triangle {
+            glm::vec3 v0;
+            glm::vec3 edge1;
+            glm::vec3 edge2;
+        };
+
+        std::vector<Node> nodes;
+        BoundingBox bounds;
+        std::vector<Triangle> triangles;
+        // build order -> index passed to build
+        std::vector<uint32_t> triangleIds;
+
+        struct BuildInput;
+        struct Subtree;
+        void buildNode(BuildInput& input, std::vector<Node>& target, uint32_t nodeIndex, uint32_t begin, uint32_t end,
+            std::vector<Subtree>* subtrees, uint32_t subtreeSize) const;
+
+        template <bool anyHit>
+        bool traverse(const Ray& ray, RayHit& hit) const;
+
+        template <bool anyHit>
+        void traversePacket(const Ray* rays, RayHit* hits, size_t count) const;
+    };
+
+    // Loads an OBJ without a GL context and times building a Bvh over it and
+    // tracing camera rays (through a width x height image seen from view) and
+    // ambient occlusion rays through it, single-threaded and on all cores
+    void benchmarkBvh(const std::string& fileName, const std::string& basePath, const glm::mat4& view, float fieldOfView, int width, int height);
+}
+
+#endif /* Bvh_hpp */
@@ -53,4 +53,21 @@ namespace gps {
 
         cameraTarget = cameraPosition + cameraFrontDirection;
     }
-}
\ No newline at end of file
+
+    glm::vec3 Camera::getPosition() const {
+        return cameraPosition;
+    }
+
+    void Camera::setPosition(const glm::vec3& position) {
+        cameraPosition = position;
+        cameraTarget = cameraPosition + cameraFrontDirection;
+    }
+
+    glm::vec3 Camera::getFrontDirection() const {
+        return cameraFrontDirection;
+    }
+
+    glm::vec3 Camera::getRightDirection() const {
+        return cameraRightDirection;
+    }
+}
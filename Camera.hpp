@@ -15,6 +15,12 @@ namespace gps {
         glm::mat4 getViewMatrix();
         void move(MOVE_DIRECTION direction, float speed);
         void rotate(float pitch, float yaw);
+
+        glm::vec3 getPosition() const;
+        // keeps the viewing direction
+        void setPosition(const glm::vec3& position);
+        glm::vec3 getFrontDirection() const;
+        glm::vec3 getRightDirection() const;
         
     private:
         glm::vec3 cameraPosition;
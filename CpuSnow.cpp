@@ -0,0 +1,587 @@
+#include "CpuSnow.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cfloat>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define SNOW_SSE
+    #include <emmintrin.h>
+#endif
+
+// the AVX2 kernel is compiled for AVX2 on its own and only called when the
+// CPU reports it, so the rest of the build keeps the SSE2 baseline
+#if defined(SNOW_SSE) && (defined(_M_X64) || defined(__x86_64__))
+    #define SNOW_AVX2
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define SNOW_AVX2_TARGET
+    #else
+        #define SNOW_AVX2_TARGET __attribute__((target("avx2")))
+    #endif
+#endif
+
+namespace gps {
+
+    // flakes per parallelFor chunk, a multiple of the SIMD width
+    static const size_t SNOW_GRAIN = 16384;
+    // radians per second the flutter direction turns
+    static const float FLUTTER_RATE = 1.1f;
+
+    struct CpuSnow::FrameConstants {
+        float deltaTime;
+        // how far velocities move towards their target this frame
+        float drag;
+        float windX, windZ;
+        float turbulence;
+        float flutterCos, flutterSin;
+        float cameraX, cameraY, cameraZ;
+        float radius, halfHeight;
+    };
+
+    CpuSnow::~CpuSnow() {
+        if (buffers[0] != 0) {
+            glDeleteBuffers(2, buffers);
+            glDeleteVertexArrays(2, vaos);
+        }
+    }
+
+    void CpuSnow::init(size_t flakeCount, const glm::vec3& center) {
+        this->flakeCount = flakeCount;
+        std::vector<float>* arrays[] = { &positionX, &positionY, &positionZ, &velocityX, &velocityY, &velocityZ,
+            &flutterX, &flutterZ, &fallSpeed, &size };
+        for (std::vector<float>* array : arrays) {
+            array->assign(flakeCount, 0.0f);
+        }
+        randomState.assign(flakeCount, 0);
+
+        std::mt19937 generator(11);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (size_t i = 0; i < flakeCount; i++) {
+            positionX[i] = center.x + (unit(generator) * 2.0f - 1.0f) * settings.radius;
+            positionY[i] = center.y + (unit(generator) * 2.0f - 1.0f) * settings.halfHeight;
+            positionZ[i] = center.z + (unit(generator) * 2.0f - 1.0f) * settings.radius;
+            float phase = unit(generator) * 6.2831853f;
+            flutterX[i] = std::cos(phase);
+            flutterZ[i] = std::sin(phase);
+            fallSpeed[i] = settings.fallSpeed * (0.6f + 0.8f * unit(generator));
+            velocityY[i] = -fallSpeed[i];
+            size[i] = settings.flakeSize * (0.5f + unit(generator));
+            randomState[i] = (uint32_t)generator() | 1u;
+        }
+    }
+
+    void CpuSnow::setOccluder(const Heightfield& heights) {
+        occluderHeights = heights.getHeights();
+        occluderOrigin = heights.getOrigin();
+        occluderCellSize = heights.getCellSize();
+        occluderWidth = heights.getWidth();
+        occluderDepth = heights.getDepth();
+    }
+
+    static inline uint32_t nextRandom(uint32_t& state) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    static inline float randomUnit(uint32_t& state) {
+        return (float)(nextRandom(state) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    void CpuSnow::simulateScalar(const FrameConstants& frame, size_t begin, size_t end, glm::vec4* out) {
+        float invCellSize = 1.0f / occluderCellSize;
+        float span = 2.0f * frame.radius;
+        float invSpan = 1.0f / span;
+        for (size_t i = begin; i < end; i++) {
+            float fx = flutterX[i] * frame.flutterCos - flutterZ[i] * frame.flutterSin;
+            float fz = flutterX[i] * frame.flutterSin + flutterZ[i] * frame.flutterCos;
+            flutterX[i] = fx;
+            flutterZ[i] = fz;
+
+            float vx = velocityX[i] + (frame.windX + fx * frame.turbulence - velocityX[i]) * frame.drag;
+            float vy = velocityY[i] + (-fallSpeed[i] - velocityY[i]) * frame.drag;
+            float vz = velocityZ[i] + (frame.windZ + fz * frame.turbulence - velocityZ[i]) * frame.drag;
+            float px = positionX[i] + vx * frame.deltaTime;
+            float py = positionY[i] + vy * frame.deltaTime;
+            float pz = positionZ[i] + vz * frame.deltaTime;
+
+            // horizontal wrap around the camera
+            float ox = px - frame.cameraX + frame.radius;
+            float oz = pz - frame.cameraZ + frame.radius;
+            px = frame.cameraX + ox - std::floor(ox * invSpan) * span - frame.radius;
+            pz = frame.cameraZ + oz - std::floor(oz * invSpan) * span - frame.radius;
+            if (py > frame.cameraY + frame.halfHeight) {
+                py -= 2.0f * frame.halfHeight;
+            }
+
+            float surface = -FLT_MAX;
+            int cellX = (int)std::floor((px - occluderOrigin.x) * invCellSize + 0.5f);
+            int cellZ = (int)std::floor((pz - occluderOrigin.y) * invCellSize + 0.5f);
+            if (cellX >= 0 && cellZ >= 0 && cellX < occluderWidth && cellZ < occluderDepth) {
+                surface = occluderHeights[(size_t)cellZ * occluderWidth + cellX];
+            }
+
+            if (py < surface || py < frame.cameraY - frame.halfHeight) {
+                uint32_t state = randomState[i];
+                px = frame.cameraX + (randomUnit(state) * 2.0f - 1.0f) * frame.radius;
+                py = frame.cameraY + frame.halfHeight * (1.0f - 0.2f * randomUnit(state));
+                pz = frame.cameraZ + (randomUnit(state) * 2.0f - 1.0f) * frame.radius;
+                randomState[i] = state;
+                vx = frame.windX;
+                vy = -fallSpeed[i];
+                vz = frame.windZ;
+            }
+
+            velocityX[i] = vx;
+            velocityY[i] = vy;
+            velocityZ[i] = vz;
+            positionX[i] = px;
+            positionY[i] = py;
+            positionZ[i] = pz;
+            out[i] = glm::vec4(px, py, pz, size[i]);
+        }
+    }
+
+#if defined(SNOW_SSE)
+    static inline __m128 floor4(__m128 x) {
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+        return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+    }
+
+    static inline __m128 select4(__m128 mask, __m128 a, __m128 b) {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    static inline __m128i nextRandom4(__m128i state) {
+        state = _mm_xor_si128(state, _mm_slli_epi32(state, 13));
+        state = _mm_xor_si128(state, _mm_srli_epi32(state, 17));
+        return _mm_xor_si128(state, _mm_slli_epi32(state, 5));
+    }
+
+    static inline __m128 randomUnit4(__m128i state) {
+        return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srli_epi32(state, 8)), _mm_set1_ps(1.0f / 16777216.0f));
+    }
+#endif
+
+    // Same arithmetic as simulateScalar, four flakes per step; begin is a
+    // multiple of four and the leftover flakes go through the scalar path
+    void CpuSnow::simulateSimd(const FrameConstants& frame, size_t begin, size_t end, glm::vec4* out) {
+#if defined(SNOW_SSE)
+        const __m128 deltaTime = _mm_set1_ps(frame.deltaTime);
+        const __m128 drag = _mm_set1_ps(frame.drag);
+        const __m128 windX = _mm_set1_ps(frame.windX);
+        const __m128 windZ = _mm_set1_ps(frame.windZ);
+        const __m128 turbulence = _mm_set1_ps(frame.turbulence);
+        const __m128 flutterCos = _mm_set1_ps(frame.flutterCos);
+        const __m128 flutterSin = _mm_set1_ps(frame.flutterSin);
+        const __m128 cameraX = _mm_set1_ps(frame.cameraX);
+        const __m128 cameraY = _mm_set1_ps(frame.cameraY);
+        const __m128 cameraZ = _mm_set1_ps(frame.cameraZ);
+        const __m128 radius = _mm_set1_ps(frame.radius);
+        const __m128 span = _mm_set1_ps(2.0f * frame.radius);
+        const __m128 invSpan = _mm_set1_ps(1.0f / (2.0f * frame.radius));
+        const __m128 top = _mm_set1_ps(frame.cameraY + frame.halfHeight);
+        const __m128 bottom = _mm_set1_ps(frame.cameraY - frame.halfHeight);
+        const __m128 height = _mm_set1_ps(2.0f * frame.halfHeight);
+        const __m128 halfHeight = _mm_set1_ps(frame.halfHeight);
+        const __m128 originX = _mm_set1_ps(occluderOrigin.x);
+        const __m128 originZ = _mm_set1_ps(occluderOrigin.y);
+        const __m128 invCellSize = _mm_set1_ps(1.0f / occluderCellSize);
+        const __m128 half = _mm_set1_ps(0.5f);
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 two = _mm_set1_ps(2.0f);
+        const __m128 respawnBand = _mm_set1_ps(0.2f);
+
+        size_t i = begin;
+        for (; i + 4 <= end; i += 4) {
+            __m128 fx0 = _mm_loadu_ps(&flutterX[i]);
+            __m128 fz0 = _mm_loadu_ps(&flutterZ[i]);
+            __m128 fx = _mm_sub_ps(_mm_mul_ps(fx0, flutterCos), _mm_mul_ps(fz0, flutterSin));
+            __m128 fz = _mm_add_ps(_mm_mul_ps(fx0, flutterSin), _mm_mul_ps(fz0, flutterCos));
+            _mm_storeu_ps(&flutterX[i], fx);
+            _mm_storeu_ps(&flutterZ[i], fz);
+
+            __m128 fall = _mm_loadu_ps(&fallSpeed[i]);
+            __m128 vx = _mm_loadu_ps(&velocityX[i]);
+            __m128 vy = _mm_loadu_ps(&velocityY[i]);
+            __m128 vz = _mm_loadu_ps(&velocityZ[i]);
+            vx = _mm_add_ps(vx, _mm_mul_ps(_mm_sub_ps(_mm_add_ps(windX, _mm_mul_ps(fx, turbulence)), vx), drag));
+            vy = _mm_add_ps(vy, _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(_mm_setzero_ps(), fall), vy), drag));
+            vz = _mm_add_ps(vz, _mm_mul_ps(_mm_sub_ps(_mm_add_ps(windZ, _mm_mul_ps(fz, turbulence)), vz), drag));
+            __m128 px = _mm_add_ps(_mm_loadu_ps(&positionX[i]), _mm_mul_ps(vx, deltaTime));
+            __m128 py = _mm_add_ps(_mm_loadu_ps(&positionY[i]), _mm_mul_ps(vy, deltaTime));
+            __m128 pz = _mm_add_ps(_mm_loadu_ps(&positionZ[i]), _mm_mul_ps(vz, deltaTime));
+
+            __m128 ox = _mm_add_ps(_mm_sub_ps(px, cameraX), radius);
+            __m128 oz = _mm_add_ps(_mm_sub_ps(pz, cameraZ), radius);
+            px = _mm_sub_ps(_mm_add_ps(cameraX, _mm_sub_ps(ox, _mm_mul_ps(floor4(_mm_mul_ps(ox, invSpan)), span))), radius);
+            pz = _mm_sub_ps(_mm_add_ps(cameraZ, _mm_sub_ps(oz, _mm_mul_ps(floor4(_mm_mul_ps(oz, invSpan)), span))), radius);
+            py = select4(_mm_cmpgt_ps(py, top), _mm_sub_ps(py, height), py);
+
+            // the height grid is gathered lane by lane
+            alignas(16) int32_t cellX[4];
+            alignas(16) int32_t cellZ[4];
+            _mm_store_si128((__m128i*)cellX, _mm_cvttps_epi32(floor4(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(px, originX), invCellSize), half))));
+            _mm_store_si128((__m128i*)cellZ, _mm_cvttps_epi32(floor4(_mm_add_ps(_mm_mul_ps(_mm_sub_ps(pz, originZ), invCellSize), half))));
+            alignas(16) float surfaces[4];
+            for (int lane = 0; lane < 4; lane++) {
+                surfaces[lane] = -FLT_MAX;
+                if (cellX[lane] >= 0 && cellZ[lane] >= 0 && cellX[lane] < occluderWidth && cellZ[lane] < occluderDepth) {
+                    surfaces[lane] = occluderHeights[(size_t)cellZ[lane] * occluderWidth + cellX[lane]];
+                }
+            }
+
+            __m128 dead = _mm_or_ps(_mm_cmplt_ps(py, _mm_load_ps(surfaces)), _mm_cmplt_ps(py, bottom));
+            if (_mm_movemask_ps(dead) != 0) {
+                __m128i state = _mm_loadu_si128((const __m128i*)&randomState[i]);
+                __m128i state1 = nextRandom4(state);
+                __m128i state2 = nextRandom4(state1);
+                __m128i state3 = nextRandom4(state2);
+                __m128 spawnX = _mm_add_ps(cameraX, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(randomUnit4(state1), two), one), radius));
+                __m128 spawnY = _mm_add_ps(cameraY, _mm_mul_ps(halfHeight, _mm_sub_ps(one, _mm_mul_ps(respawnBand, randomUnit4(state2)))));
+                __m128 spawnZ = _mm_add_ps(cameraZ, _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(randomUnit4(state3), two), one), radius));
+                px = select4(dead, spawnX, px);
+                py = select4(dead, spawnY, py);
+                pz = select4(dead, spawnZ, pz);
+                vx = select4(dead, windX, vx);
+                vy = select4(dead, _mm_sub_ps(_mm_setzero_ps(), fall), vy);
+                vz = select4(dead, windZ, vz);
+                __m128i deadBits = _mm_castps_si128(dead);
+                state = _mm_or_si128(_mm_and_si128(deadBits, state3), _mm_andnot_si128(deadBits, state));
+                _mm_storeu_si128((__m128i*)&randomState[i], state);
+            }
+
+            _mm_storeu_ps(&velocityX[i], vx);
+            _mm_storeu_ps(&velocityY[i], vy);
+            _mm_storeu_ps(&velocityZ[i], vz);
+            _mm_storeu_ps(&positionX[i], px);
+            _mm_storeu_ps(&positionY[i], py);
+            _mm_storeu_ps(&positionZ[i], pz);
+
+            // (x, y, z, size) per flake for the vertex buffer
+            __m128 sizes = _mm_loadu_ps(&size[i]);
+            _MM_TRANSPOSE4_PS(px, py, pz, sizes);
+            _mm_storeu_ps(&out[i].x, px);
+            _mm_storeu_ps(&out[i + 1].x, py);
+            _mm_storeu_ps(&out[i + 2].x, pz);
+            _mm_storeu_ps(&out[i + 3].x, sizes);
+        }
+        simulateScalar(frame, i, end, out);
+#else
+        simulateScalar(frame, begin, end, out);
+#endif
+    }
+
+#if defined(SNOW_AVX2)
+    static SNOW_AVX2_TARGET inline __m256 select8(__m256 mask, __m256 a, __m256 b) {
+        return _mm256_blendv_ps(b, a, mask);
+    }
+
+    static SNOW_AVX2_TARGET inline __m256i nextRandom8(__m256i state) {
+        state = _mm256_xor_si256(state, _mm256_slli_epi32(state, 13));
+        state = _mm256_xor_si256(state, _mm256_srli_epi32(state, 17));
+        return _mm256_xor_si256(state, _mm256_slli_epi32(state, 5));
+    }
+
+    static SNOW_AVX2_TARGET inline __m256 randomUnit8(__m256i state) {
+        return _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(state, 8)), _mm256_set1_ps(1.0f / 16777216.0f));
+    }
+
+    static bool cpuHasAvx2() {
+    #if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) {
+            return false;
+        }
+        __cpuid(info, 1);
+        // the OS must save the YMM registers (OSXSAVE, then XCR0 bits 1 and 2)
+        if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 6) != 6) {
+            return false;
+        }
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+    #else
+        return __builtin_cpu_supports("avx2");
+    #endif
+    }
+#endif
+
+    SnowKernel getBestSnowKernel() {
+#if defined(SNOW_AVX2)
+        static const bool avx2 = cpuHasAvx2();
+        if (avx2) {
+            return SNOW_KERNEL_AVX2;
+        }
+#endif
+#if defined(SNOW_SSE)
+        return SNOW_KERNEL_SSE;
+#else
+        return SNOW_KERNEL_SCALAR;
+#endif
+    }
+
+    // Same arithmetic as simulateSimd, eight flakes per step, the height grid
+    // read with a masked gather; the leftover flakes go through the SSE path
+#if defined(SNOW_AVX2)
+    SNOW_AVX2_TARGET
+#endif
+    void CpuSnow::simulateAvx2(const FrameConstants& frame, size_t begin, size_t end, glm::vec4* out) {
+#if defined(SNOW_AVX2)
+        const __m256 deltaTime = _mm256_set1_ps(frame.deltaTime);
+        const __m256 drag = _mm256_set1_ps(frame.drag);
+        const __m256 windX = _mm256_set1_ps(frame.windX);
+        const __m256 windZ = _mm256_set1_ps(frame.windZ);
+        const __m256 turbulence = _mm256_set1_ps(frame.turbulence);
+        const __m256 flutterCos = _mm256_set1_ps(frame.flutterCos);
+        const __m256 flutterSin = _mm256_set1_ps(frame.flutterSin);
+        const __m256 cameraX = _mm256_set1_ps(frame.cameraX);
+        const __m256 cameraY = _mm256_set1_ps(frame.cameraY);
+        const __m256 cameraZ = _mm256_set1_ps(frame.cameraZ);
+        const __m256 radius = _mm256_set1_ps(frame.radius);
+        const __m256 span = _mm256_set1_ps(2.0f * frame.radius);
+        const __m256 invSpan = _mm256_set1_ps(1.0f / (2.0f * frame.radius));
+        const __m256 top = _mm256_set1_ps(frame.cameraY + frame.halfHeight);
+        const __m256 bottom = _mm256_set1_ps(frame.cameraY - frame.halfHeight);
+        const __m256 height = _mm256_set1_ps(2.0f * frame.halfHeight);
+        const __m256 halfHeight = _mm256_set1_ps(frame.halfHeight);
+        const __m256 originX = _mm256_set1_ps(occluderOrigin.x);
+        const __m256 originZ = _mm256_set1_ps(occluderOrigin.y);
+        const __m256 invCellSize = _mm256_set1_ps(1.0f / occluderCellSize);
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 two = _mm256_set1_ps(2.0f);
+        const __m256 respawnBand = _mm256_set1_ps(0.2f);
+        const __m256 noSurface = _mm256_set1_ps(-FLT_MAX);
+        const __m256i width = _mm256_set1_epi32(occluderWidth);
+        const __m256i depth = _mm256_set1_epi32(occluderDepth);
+
+        size_t i = begin;
+        for (; i + 8 <= end; i += 8) {
+            __m256 fx0 = _mm256_loadu_ps(&flutterX[i]);
+            __m256 fz0 = _mm256_loadu_ps(&flutterZ[i]);
+            __m256 fx = _mm256_sub_ps(_mm256_mul_ps(fx0, flutterCos), _mm256_mul_ps(fz0, flutterSin));
+            __m256 fz = _mm256_add_ps(_mm256_mul_ps(fx0, flutterSin), _mm256_mul_ps(fz0, flutterCos));
+            _mm256_storeu_ps(&flutterX[i], fx);
+            _mm256_storeu_ps(&flutterZ[i], fz);
+
+            __m256 fall = _mm256_loadu_ps(&fallSpeed[i]);
+            __m256 vx = _mm256_loadu_ps(&velocityX[i]);
+            __m256 vy = _mm256_loadu_ps(&velocityY[i]);
+            __m256 vz = _mm256_loadu_ps(&velocityZ[i]);
+            vx = _mm256_add_ps(vx, _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(windX, _mm256_mul_ps(fx, turbulence)), vx), drag));
+            vy = _mm256_add_ps(vy, _mm256_mul_ps(_mm256_sub_ps(_mm256_sub_ps(_mm256_setzero_ps(), fall), vy), drag));
+            vz = _mm256_add_ps(vz, _mm256_mul_ps(_mm256_sub_ps(_mm256_add_ps(windZ, _mm256_mul_ps(fz, turbulence)), vz), drag));
+            __m256 px = _mm256_add_ps(_mm256_loadu_ps(&positionX[i]), _mm256_mul_ps(vx, deltaTime));
+            __m256 py = _mm256_add_ps(_mm256_loadu_ps(&positionY[i]), _mm256_mul_ps(vy, deltaTime));
+            __m256 pz = _mm256_add_ps(_mm256_loadu_ps(&positionZ[i]), _mm256_mul_ps(vz, deltaTime));
+
+            __m256 ox = _mm256_add_ps(_mm256_sub_ps(px, cameraX), radius);
+            __m256 oz = _mm256_add_ps(_mm256_sub_ps(pz, cameraZ), radius);
+            px = _mm256_sub_ps(_mm256_add_ps(cameraX, _mm256_sub_ps(ox, _mm256_mul_ps(_mm256_floor_ps(_mm256_mul_ps(ox, invSpan)), span))), radius);
+            pz = _mm256_sub_ps(_mm256_add_ps(cameraZ, _mm256_sub_ps(oz, _mm256_mul_ps(_mm256_floor_ps(_mm256_mul_ps(oz, invSpan)), span))), radius);
+            py = select8(_mm256_cmp_ps(py, top, _CMP_GT_OQ), _mm256_sub_ps(py, height), py);
+
+            __m256i cellX = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(px, originX), invCellSize), half)));
+            __m256i cellZ = _mm256_cvttps_epi32(_mm256_floor_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(pz, originZ), invCellSize), half)));
+            // 0 <= cell < size, per lane
+            __m256i inside = _mm256_and_si256(
+                _mm256_and_si256(_mm256_cmpgt_epi32(cellX, _mm256_set1_epi32(-1)), _mm256_cmpgt_epi32(width, cellX)),
+                _mm256_and_si256(_mm256_cmpgt_epi32(cellZ, _mm256_set1_epi32(-1)), _mm256_cmpgt_epi32(depth, cellZ)));
+            __m256i cell = _mm256_add_epi32(_mm256_mullo_epi32(cellZ, width), cellX);
+            cell = _mm256_and_si256(cell, inside);
+            __m256 surface = occluderHeights.empty() ? noSurface
+                : _mm256_mask_i32gather_ps(noSurface, occluderHeights.data(), cell, _mm256_castsi256_ps(inside), 4);
+
+            __m256 dead = _mm256_or_ps(_mm256_cmp_ps(py, surface, _CMP_LT_OQ), _mm256_cmp_ps(py, bottom, _CMP_LT_OQ));
+            if (_mm256_movemask_ps(dead) != 0) {
+                __m256i state = _mm256_loadu_si256((const __m256i*)&randomState[i]);
+                __m256i state1 = nextRandom8(state);
+                __m256i state2 = nextRandom8(state1);
+                __m256i state3 = nextRandom8(state2);
+                __m256 spawnX = _mm256_add_ps(cameraX, _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(randomUnit8(state1), two), one), radius));
+                __m256 spawnY = _mm256_add_ps(cameraY, _mm256_mul_ps(halfHeight, _mm256_sub_ps(one, _mm256_mul_ps(respawnBand, randomUnit8(state2)))));
+                __m256 spawnZ = _mm256_add_ps(cameraZ, _mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(randomUnit8(state3), two), one), radius));
+                px = select8(dead, spawnX, px);
+                py = select8(dead, spawnY, py);
+                pz = select8(dead, spawnZ, pz);
+                vx = select8(dead, windX, vx);
+                vy = select8(dead, _mm256_sub_ps(_mm256_setzero_ps(), fall), vy);
+                vz = select8(dead, windZ, vz);
+                state = _mm256_blendv_epi8(state, state3, _mm256_castps_si256(dead));
+                _mm256_storeu_si256((__m256i*)&randomState[i], state);
+            }
+
+            _mm256_storeu_ps(&velocityX[i], vx);
+            _mm256_storeu_ps(&velocityY[i], vy);
+            _mm256_storeu_ps(&velocityZ[i], vz);
+            _mm256_storeu_ps(&positionX[i], px);
+            _mm256_storeu_ps(&positionY[i], py);
+            _mm256_storeu_ps(&positionZ[i], pz);
+
+            // (x, y, z, size) per flake, the two halves transposed like the SSE path
+            __m256 sizes = _mm256_loadu_ps(&size[i]);
+            for (int halfIndex = 0; halfIndex < 2; halfIndex++) {
+                __m128 x4 = halfIndex == 0 ? _mm256_castps256_ps128(px) : _mm256_extractf128_ps(px, 1);
+                __m128 y4 = halfIndex == 0 ? _mm256_castps256_ps128(py) : _mm256_extractf128_ps(py, 1);
+                __m128 z4 = halfIndex == 0 ? _mm256_castps256_ps128(pz) : _mm256_extractf128_ps(pz, 1);
+                __m128 s4 = halfIndex == 0 ? _mm256_castps256_ps128(sizes) : _mm256_extractf128_ps(sizes, 1);
+                _MM_TRANSPOSE4_PS(x4, y4, z4, s4);
+                size_t first = i + 4 * halfIndex;
+                _mm_storeu_ps(&out[first].x, x4);
+                _mm_storeu_ps(&out[first + 1].x, y4);
+                _mm_storeu_ps(&out[first + 2].x, z4);
+                _mm_storeu_ps(&out[first + 3].x, s4);
+            }
+        }
+        simulateSimd(frame, i, end, out);
+#else
+        simulateSimd(frame, begin, end, out);
+#endif
+    }
+
+    void CpuSnow::simulate(float deltaTime, const glm::vec3& cameraPosition, glm::vec4* out, SnowKernel kernel) {
+        FrameConstants frame;
+        frame.deltaTime = deltaTime;
+        frame.drag = std::min(std::max(deltaTime * 2.0f, 0.0f), 1.0f);
+        frame.windX = settings.wind.x;
+        frame.windZ = settings.wind.z;
+        frame.turbulence = settings.turbulence;
+        frame.flutterCos = std::cos(FLUTTER_RATE * deltaTime);
+        frame.flutterSin = std::sin(FLUTTER_RATE * deltaTime);
+        frame.cameraX = cameraPosition.x;
+        frame.cameraY = cameraPosition.y;
+        frame.cameraZ = cameraPosition.z;
+        frame.radius = settings.radius;
+        frame.halfHeight = settings.halfHeight;
+
+        if (kernel == SNOW_KERNEL_AVX2 && getBestSnowKernel() != SNOW_KERNEL_AVX2) {
+            kernel = SNOW_KERNEL_SSE;
+        }
+        parallelFor(flakeCount, SNOW_GRAIN, [&](size_t begin, size_t end) {
+            if (kernel == SNOW_KERNEL_AVX2) {
+                simulateAvx2(frame, begin, end, out);
+            }
+            else if (kernel == SNOW_KERNEL_SSE) {
+                simulateSimd(frame, begin, end, out);
+            }
+            else {
+                simulateScalar(frame, begin, end, out);
+            }
+        });
+    }
+
+    void CpuSnow::initBuffers() {
+        glGenVertexArrays(2, vaos);
+        glGenBuffers(2, buffers);
+        for (int i = 0; i < 2; i++) {
+            glBindVertexArray(vaos[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, flakeCount * sizeof(glm::vec4), nullptr, GL_STREAM_DRAW);
+            // snow.vert reads the position from attribute 0 and the size from
+            // attribute 1's w; both point at the same (x, y, z, size)
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (GLvoid*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), (GLvoid*)0);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        renderShader.loadShader("shaders/snow.vert", "shaders/snow.frag");
+    }
+
+    void CpuSnow::update(float deltaTime, const glm::vec3& cameraPosition) {
+        if (flakeCount == 0) {
+            return;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+
+        // the buffer drawn last frame may still be in flight; write the other one
+        int next = 1 - current;
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[next]);
+        glm::vec4* mapped = (glm::vec4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, flakeCount * sizeof(glm::vec4),
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped) {
+            simulate(deltaTime, cameraPosition, mapped, getBestSnowKernel());
+            if (glUnmapBuffer(GL_ARRAY_BUFFER)) {
+                current = next;
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        auto stop = std::chrono::high_resolution_clock::now();
+        updateMs = std::chrono::duration<double, std::milli>(stop - start).count();
+    }
+
+    void CpuSnow::render(const glm::mat4& view, const glm::mat4& projection, float pointScale) {
+        if (flakeCount == 0) {
+            return;
+        }
+        drawSnowFlakes(renderShader, vaos[current], flakeCount, settings, view, projection, pointScale);
+    }
+
+    size_t CpuSnow::getFlakeCount() const {
+        return flakeCount;
+    }
+
+    double CpuSnow::getUpdateMs() const {
+        return updateMs;
+    }
+
+    void benchmarkSnow(size_t flakeCount, int frameCount) {
+        struct Run {
+            const char* name;
+            SnowKernel kernel;
+            unsigned int threads;
+        };
+        const Run runs[] = {
+            { "scalar", SNOW_KERNEL_SCALAR, 1 },
+#if defined(SNOW_SSE)
+            { "SSE   ", SNOW_KERNEL_SSE, 1 },
+            { "SSE   ", SNOW_KERNEL_SSE, 0 },
+#else
+            { "scalar", SNOW_KERNEL_SCALAR, 0 },
+#endif
+            { "AVX2  ", SNOW_KERNEL_AVX2, 1 },
+            { "AVX2  ", SNOW_KERNEL_AVX2, 0 },
+        };
+
+        std::vector<glm::vec4> vertices(flakeCount);
+        for (const Run& run : runs) {
+            if (run.kernel == SNOW_KERNEL_AVX2 && getBestSnowKernel() != SNOW_KERNEL_AVX2) {
+                std::cout << "Snow AVX2: not supported by this CPU" << std::endl;
+                break;
+            }
+            CpuSnow snow;
+            snow.init(flakeCount, glm::vec3(0.0f));
+            setThreadLimit(run.threads);
+
+            // the camera walks, so flakes wrap and respawn as in the viewer
+            glm::vec3 camera(0.0f);
+            const float deltaTime = 1.0f / 60.0f;
+            snow.simulate(deltaTime, camera, vertices.data(), run.kernel);
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int frame = 0; frame < frameCount; frame++) {
+                camera.x += 0.05f;
+                snow.simulate(deltaTime, camera, vertices.data(), run.kernel);
+            }
+            auto stop = std::chrono::high_resolution_clock::now();
+
+            double ms = std::chrono::duration<double, std::milli>(stop - start).count() / frameCount;
+            unsigned int threads = getThreadCount();
+            double flakesPerMs = flakeCount / ms;
+            std::cout << "Snow " << run.name << ", " << threads << " thread(s): " << ms << " ms per frame, "
+                << flakesPerMs << " flakes per ms, " << flakesPerMs / threads << " per ms per core" << std::endl;
+        }
+        setThreadLimit(0);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef CpuSnow_hpp
+#define CpuSnow_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "Heightfield.hpp"
+#include "GpuSnow.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    enum SnowKernel {
+        SNOW_KERNEL_SCALAR,
+        // four flakes per step
+        SNOW_KERNEL_SSE,
+        // eight flakes per step, on CPUs that report AVX2 at run time
+        SNOW_KERNEL_AVX2
+    };
+
+    // The fastest kernel this build and CPU can run
+    SnowKernel getBestSnowKernel();
+
+    // The snowfall of GpuSnow simulated on the CPU, for software renderers
+    // (llvmpipe) where vertex work is as slow as the CPU itself. Flakes are
+    // kept as structure of arrays and advanced eight (AVX2) or four (SSE) at a
+    // time on the worker pool; the kernel writes (position, size) straight
+    // into one of two vertex buffers mapped for the frame, which GpuSnow's
+    // point sprite shaders draw.
+    class CpuSnow {
+
+    public:
+        ~CpuSnow();
+
+        // Simulation state only, no GL calls
+        void init(size_t flakeCount, const glm::vec3& center);
+
+        void setOccluder(const Heightfield& heights);
+
+        // Advances every flake and writes (x, y, z, size) per flake into out;
+        // SNOW_KERNEL_SCALAR is the reference path, a kernel the CPU cannot
+        // run falls back to the next narrower one
+        void simulate(float deltaTime, const glm::vec3& cameraPosition, glm::vec4* out, SnowKernel kernel);
+
+        // Vertex buffers and shaders, after init
+        void initBuffers();
+
+        // simulate into the buffer not drawn last frame
+        void update(float deltaTime, const glm::vec3& cameraPosition);
+
+        void render(const glm::mat4& view, const glm::mat4& projection, float pointScale);
+
+        size_t getFlakeCount() const;
+
+        // CPU time of the last update, simulation and streaming included
+        double getUpdateMs() const;
+
+    private:
+        SnowSettings settings;
+        size_t flakeCount = 0;
+
+        std::vector<float> positionX, positionY, positionZ;
+        std::vector<float> velocityX, velocityY, velocityZ;
+        // unit flutter direction, rotated a little every frame
+        std::vector<float> flutterX, flutterZ;
+        std::vector<float> fallSpeed;
+        std::vector<float> size;
+        // per-flake xorshift state for respawns
+        std::vector<uint32_t> randomState;
+
+        // copy of the top surface heights, nearest cell
+        std::vector<float> occluderHeights;
+        glm::vec2 occluderOrigin = glm::vec2(0.0f);
+        float occluderCellSize = 1.0f;
+        int occluderWidth = 0;
+        int occluderDepth = 0;
+
+        GLuint vaos[2] = { 0, 0 };
+        GLuint buffers[2] = { 0, 0 };
+        // buffer written by the last update
+        int current = 0;
+        Shader renderShader;
+        double updateMs = 0.0;
+
+        struct FrameConstants;
+        void simulateScalar(const FrameConstants& frame, size_t begin, size_t end, glm::vec4* out);
+        void simulateSimd(const FrameConstants& frame, size_t begin, size_t end, glm::vec4* out);
+        void simulateAvx2(const FrameConstants& frame, size_t begin, size_t end, glm::vec4* out);
+    };
+
+    // Times simulate on flakeCount flakes over frameCount frames, scalar, SSE
+    // and AVX2 (when the CPU has it), on one thread and on all cores, without
+    // a GL context
+    void benchmarkSnow(size_t flakeCount, int frameCount);
+}
+
+#endif /* CpuSnow_hpp */
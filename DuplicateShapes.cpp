@@ -0,0 +1,185 @@
+#include "DuplicateShapes.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+
+namespace gps {
+
+    // radius bins per doubling of the radius, about 2% each; far coarser than
+    // the matching tolerance, and the neighbouring bins are searched too, so
+    // float noise in a copy cannot put it out of reach of its group
+    static const float RADIUS_BINS_PER_OCTAVE = 32.0f;
+
+    struct ShapePose {
+        glm::vec3 centroid;
+        float radius;
+        // mean vertex distance to the centroid, a cheap check before matches
+        float meanDistance;
+        int64_t radiusBin;
+    };
+
+    // Anchor vertices and their frame, taken from the first shape of a group
+    struct GroupReference {
+        size_t anchorA;
+        size_t anchorB;
+        glm::mat3 frame;
+        bool valid;
+    };
+
+    static ShapePose computePose(const std::vector<Vertex>& vertices) {
+        ShapePose pose;
+        pose.centroid = glm::vec3(0.0f);
+        for (const Vertex& vertex : vertices) {
+            pose.centroid += vertex.Position;
+        }
+        if (!vertices.empty()) {
+            pose.centroid /= (float)vertices.size();
+        }
+
+        pose.radius = 0.0f;
+        pose.meanDistance = 0.0f;
+        for (const Vertex& vertex : vertices) {
+            float distance = glm::length(vertex.Position - pose.centroid);
+            pose.radius = std::max(pose.radius, distance);
+            pose.meanDistance += distance;
+        }
+        if (!vertices.empty()) {
+            pose.meanDistance /= (float)vertices.size();
+        }
+        pose.radiusBin = (int64_t)std::floor(std::log2(pose.radius + 1e-4f) * RADIUS_BINS_PER_OCTAVE);
+        return pose;
+    }
+
+    // FNV-1a over what a copy shares exactly (count, material) and the radius bin
+    static uint64_t bucketKey(size_t vertexCount, int material, int64_t radiusBin) {
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](uint64_t value) {
+            hash ^= value;
+            hash *= 1099511628211ull;
+        };
+        mix(vertexCount);
+        mix((uint64_t)(int64_t)material);
+        mix((uint64_t)radiusBin);
+        return hash;
+    }
+
+    // Orthonormal frame from the anchor vertices; false when they are (nearly) collinear with the centroid
+    static bool buildFrame(const std::vector<Vertex>& vertices, const glm::vec3& centroid, size_t anchorA, size_t anchorB, glm::mat3& frame) {
+        glm::vec3 a = vertices[anchorA].Position - centroid;
+        glm::vec3 b = vertices[anchorB].Position - centroid;
+        glm::vec3 normal = glm::cross(a, b);
+        if (glm::length(a) < 1e-6f || glm::length(normal) < 1e-6f * glm::dot(a, a)) {
+            return false;
+        }
+        glm::vec3 x = glm::normalize(a);
+        glm::vec3 z = glm::normalize(normal);
+        frame = glm::mat3(x, glm::cross(z, x), z);
+        return true;
+    }
+
+    static GroupReference makeReference(const std::vector<Vertex>& vertices, const ShapePose& pose) {
+        GroupReference reference;
+        reference.anchorA = 0;
+        reference.anchorB = 0;
+        float farthest = -1.0f;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            float distance = glm::length(vertices[i].Position - pose.centroid);
+            if (distance > farthest) {
+                farthest = distance;
+                reference.anchorA = i;
+            }
+        }
+        glm::vec3 a = vertices.empty() ? glm::vec3(0.0f) : vertices[reference.anchorA].Position - pose.centroid;
+        float widest = -1.0f;
+        for (size_t i = 0; i < vertices.size(); i++) {
+            float area = glm::length(glm::cross(a, vertices[i].Position - pose.centroid));
+            if (area > widest) {
+                widest = area;
+                reference.anchorB = i;
+            }
+        }
+        reference.valid = !vertices.empty() && buildFrame(vertices, pose.centroid, reference.anchorA, reference.anchorB, reference.frame);
+        return reference;
+    }
+
+    static bool matches(const std::vector<Vertex>& reference, const glm::vec3& referenceCentroid,
+        const std::vector<Vertex>& candidate, const glm::vec3& candidateCentroid, const glm::mat3& rotation, float tolerance) {
+        for (size_t i = 0; i < reference.size(); i++) {
+            glm::vec3 position = rotation * (reference[i].Position - referenceCentroid) + candidateCentroid;
+            if (glm::length(position - candidate[i].Position) > tolerance) {
+                return false;
+            }
+            if (glm::length(rotation * reference[i].Normal - candidate[i].Normal) > 1e-3f * std::max(1.0f, glm::length(reference[i].Normal))) {
+                return false;
+            }
+            glm::vec2 texCoords = glm::abs(reference[i].TexCoords - candidate[i].TexCoords);
+            if (std::max(texCoords.x, texCoords.y) > 1e-5f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void groupDuplicateShapes(const std::vector<std::vector<Vertex>>& shapeVertices, const std::vector<int>& shapeMaterials,
+        std::vector<ShapeGroup>& groups) {
+        groups.clear();
+        std::vector<ShapePose> groupPoses;
+        std::vector<GroupReference> references;
+        std::unordered_map<uint64_t, std::vector<size_t>> buckets;
+
+        for (size_t s = 0; s < shapeVertices.size(); s++) {
+            const std::vector<Vertex>& vertices = shapeVertices[s];
+            ShapePose pose = computePose(vertices);
+
+            bool grouped = false;
+            for (int64_t bin = pose.radiusBin - 1; bin <= pose.radiusBin + 1 && !grouped; bin++) {
+                auto bucket = buckets.find(bucketKey(vertices.size(), shapeMaterials[s], bin));
+                if (bucket == buckets.end()) {
+                    continue;
+                }
+                for (size_t g : bucket->second) {
+                    const GroupReference& reference = references[g];
+                    const std::vector<Vertex>& referenceVertices = shapeVertices[groups[g].shapes[0]];
+                    if (!reference.valid || referenceVertices.size() != vertices.size() || shapeMaterials[groups[g].shapes[0]] != shapeMaterials[s]) {
+                        continue;
+                    }
+                    float tolerance = 1e-3f * groupPoses[g].radius + 1e-4f;
+                    if (std::abs(groupPoses[g].meanDistance - pose.meanDistance) > tolerance) {
+                        continue;
+                    }
+
+                    // the vertices come in the same order in every copy, so the anchors correspond by index
+                    glm::mat3 frame;
+                    if (!buildFrame(vertices, pose.centroid, reference.anchorA, reference.anchorB, frame)) {
+                        continue;
+                    }
+                    glm::mat3 rotation = frame * glm::transpose(reference.frame);
+                    if (!matches(referenceVertices, groupPoses[g].centroid, vertices, pose.centroid, rotation, tolerance)) {
+                        continue;
+                    }
+
+                    glm::mat4 transform = glm::mat4(rotation);
+                    transform[3] = glm::vec4(pose.centroid, 1.0f);
+                    groups[g].shapes.push_back(s);
+                    groups[g].transforms.push_back(transform);
+                    grouped = true;
+                    break;
+                }
+            }
+
+            if (!grouped) {
+                ShapeGroup group;
+                group.shapes.push_back(s);
+                group.transforms.push_back(glm::translate(glm::mat4(1.0f), pose.centroid));
+                buckets[bucketKey(vertices.size(), shapeMaterials[s], pose.radiusBin)].push_back(groups.size());
+                groups.push_back(group);
+                groupPoses.push_back(pose);
+                references.push_back(makeReference(vertices, pose));
+            }
+        }
+    }
+}
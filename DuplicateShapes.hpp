@@ -0,0 +1,33 @@
+#ifndef DuplicateShapes_hpp
+#define DuplicateShapes_hpp
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Shapes that are rigid copies of the first one in the group
+    struct ShapeGroup {
+        // in file order
+        std::vector<size_t> shapes;
+        // per shape: from the first shape, moved so its centroid is at the
+        // origin, to where the shape sits in the file
+        std::vector<glm::mat4> transforms;
+    };
+
+    // Groups shapes (one vertex per face corner, as Model3D reads them) that
+    // are the same geometry under a rotation and translation. Candidates are
+    // found by a hash of the vertex count, the material and a coarse bin of
+    // the radius around the centroid (the neighbouring bins too), which do
+    // not change with the pose; the transform is then solved from two anchor
+    // vertices and checked against every position, normal and texture
+    // coordinate. Every shape ends up in exactly one group, groups ordered by
+    // their first shape.
+    void groupDuplicateShapes(const std::vector<std::vector<Vertex>>& shapeVertices, const std::vector<int>& shapeMaterials,
+        std::vector<ShapeGroup>& groups);
+}
+
+#endif /* DuplicateShapes_hpp */
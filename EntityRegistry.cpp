@@ -0,0 +1,121 @@
+#include "EntityRegistry.hpp"
+#include "Parallel.hpp"
+#include "SceneNode.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <iostream>
+
+namespace gps {
+
+    Entity EntityRegistry::create() {
+        if (!freeEntities.empty()) {
+            Entity entity = freeEntities.back();
+            freeEntities.pop_back();
+            return entity;
+        }
+        return nextEntity++;
+    }
+
+    void EntityRegistry::destroy(Entity entity) {
+        transforms.remove(entity);
+        renderables.remove(entity);
+        rotators.remove(entity);
+        lights.remove(entity);
+        nodes.remove(entity);
+        freeEntities.push_back(entity);
+    }
+
+    size_t EntityRegistry::aliveCount() const {
+        return nextEntity - freeEntities.size();
+    }
+
+    static glm::mat4 getRotatorTransform(const RotatorComponent& rotator) {
+        glm::mat4 model = glm::translate(rotator.restTransform, rotator.pivot);
+        model = glm::rotate(model, glm::radians(rotator.angle), rotator.axis);
+        return glm::translate(model, -rotator.pivot);
+    }
+
+    void updateRotators(EntityRegistry& registry, float deltaTime) {
+        parallelFor(registry.rotators.size(), 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                RotatorComponent& rotator = registry.rotators.at(i);
+
+                rotator.angle += rotator.speed * deltaTime;
+                if (rotator.angle > 360.0f) {
+                    rotator.angle -= 360.0f;
+                }
+
+                Entity entity = registry.rotators.entityAt(i);
+                if (registry.nodes.has(entity)) {
+                    continue;
+                }
+
+                // entities are created with their transform first, so this walks
+                // the transform array in (mostly) the same order
+                TransformComponent& transform = registry.transforms.get(entity);
+                transform.model = getRotatorTransform(rotator);
+                transform.normalMatrix = computeNormalMatrix(transform.model, true);
+            }
+        });
+
+        // posing a node flags its parents dirty, so the nodes are posed on one thread
+        for (size_t i = 0; i < registry.nodes.size(); i++) {
+            Entity entity = registry.nodes.entityAt(i);
+            if (registry.rotators.has(entity)) {
+                registry.nodes.at(i).node->setLocalTransform(getRotatorTransform(registry.rotators.get(entity)));
+            }
+        }
+    }
+
+    void syncSceneNodes(EntityRegistry& registry) {
+        for (size_t i = 0; i < registry.nodes.size(); i++) {
+            const SceneNode& node = *registry.nodes.at(i).node;
+            TransformComponent& transform = registry.transforms.get(registry.nodes.entityAt(i));
+            transform.model = node.getWorldTransform();
+            transform.normalMatrix = node.getNormalMatrix();
+        }
+    }
+
+    void benchmarkRotators(size_t entityCount, int frameCount) {
+        EntityRegistry registry;
+        registry.transforms.reserve(entityCount);
+        registry.rotators.reserve(entityCount);
+
+        for (size_t i = 0; i < entityCount; i++) {
+            Entity entity = registry.create();
+            glm::vec3 position((float)(i % 1000), 0.0f, (float)(i / 1000));
+
+            TransformComponent transform;
+            transform.model = glm::translate(glm::mat4(1.0f), position);
+            transform.normalMatrix = glm::mat3(1.0f);
+            registry.transforms.add(entity, transform);
+
+            RotatorComponent rotator;
+            rotator.restTransform = transform.model;
+            rotator.pivot = glm::vec3(0.0f, 1.0f, 0.0f);
+            rotator.axis = glm::vec3(1.0f, 0.0f, 0.0f);
+            rotator.angle = (float)(i % 360);
+            rotator.speed = 30.0f;
+            registry.rotators.add(entity, rotator);
+        }
+
+        unsigned int limits[2] = { 1, 0 };
+        for (int run = 0; run < 2; run++) {
+            setThreadLimit(limits[run]);
+            updateRotators(registry, 1.0f / 60.0f);
+
+            auto start = std::chrono::high_resolution_clock::now();
+            for (int frame = 0; frame < frameCount; frame++) {
+                updateRotators(registry, 1.0f / 60.0f);
+            }
+            auto stop = std::chrono::high_resolution_clock::now();
+
+            double ms = std::chrono::duration<double, std::milli>(stop - start).count() / frameCount;
+            std::cout << entityCount << " rotating entities, " << getThreadCount() << " thread(s): "
+                << ms << " ms per frame" << std::endl;
+        }
+        setThreadLimit(0);
+    }
+}
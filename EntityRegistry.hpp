@@ -0,0 +1,170 @@
+#ifndef EntityRegistry_hpp
+#define EntityRegistry_hpp
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    class Model3D;
+    class SceneNode;
+
+    typedef uint32_t Entity;
+    const Entity NULL_ENTITY = 0xFFFFFFFFu;
+
+    struct TransformComponent {
+        glm::mat4 model;
+        // world-space normal matrix, see computeNormalMatrix
+        glm::mat3 normalMatrix;
+    };
+
+    struct RenderableComponent {
+        gps::Model3D* model;
+        bool castsShadow;
+        // false for anything that moves, so cached passes can skip it
+        bool isStatic;
+        // per mesh, rebuilt every frame by the visibility pass
+        std::vector<uint8_t> visibleMeshes;
+        // visibleMeshes minus the occluded ones; shadows still need those
+        std::vector<uint8_t> litMeshes;
+        std::vector<uint8_t> litLods;
+        std::vector<uint8_t> shadowLods;
+        // visibleMeshes minus those the impostors split into near and far
+        // copies; the shadow pass draws those copies on their own
+        std::vector<uint8_t> shadowWholeMeshes;
+    };
+
+    // Spins the entity around an axis through pivot, on top of its rest transform
+    struct RotatorComponent {
+        glm::mat4 restTransform;
+        glm::vec3 pivot;
+        glm::vec3 axis;
+        // degrees and degrees per second
+        float angle;
+        float speed;
+    };
+
+    // Hangs the entity off a scene graph node: syncSceneNodes copies the node's
+    // world transform into the entity's, and a rotator poses the node instead
+    struct SceneNodeComponent {
+        SceneNode* node;
+    };
+
+    // Point light at the entity's transform origin
+    struct LightComponent {
+        glm::vec3 color;
+        float constant;
+        float linear;
+        float quadratic;
+        bool castsShadow;
+    };
+
+    // Tightly packed component array: components live contiguously in insertion
+    // order, a sparse table maps entities to their slot
+    template<typename T>
+    class ComponentPool {
+
+    public:
+        T& add(Entity entity, const T& component) {
+            if (entity >= sparse.size()) {
+                sparse.resize(entity + 1, NULL_ENTITY);
+            }
+            if (sparse[entity] != NULL_ENTITY) {
+                dense[sparse[entity]] = component;
+                return dense[sparse[entity]];
+            }
+            sparse[entity] = (uint32_t)dense.size();
+            dense.push_back(component);
+            denseEntities.push_back(entity);
+            return dense.back();
+        }
+
+        // Swap-removes, so the last component takes the freed slot
+        void remove(Entity entity) {
+            if (!has(entity)) {
+                return;
+            }
+            uint32_t slot = sparse[entity];
+            Entity last = denseEntities.back();
+            dense[slot] = dense.back();
+            denseEntities[slot] = last;
+            sparse[last] = slot;
+            dense.pop_back();
+            denseEntities.pop_back();
+            sparse[entity] = NULL_ENTITY;
+        }
+
+        bool has(Entity entity) const {
+            return entity < sparse.size() && sparse[entity] != NULL_ENTITY;
+        }
+
+        T& get(Entity entity) {
+            return dense[sparse[entity]];
+        }
+
+        const T& get(Entity entity) const {
+            return dense[sparse[entity]];
+        }
+
+        size_t size() const {
+            return dense.size();
+        }
+
+        T& at(size_t slot) {
+            return dense[slot];
+        }
+
+        const T& at(size_t slot) const {
+            return dense[slot];
+        }
+
+        Entity entityAt(size_t slot) const {
+            return denseEntities[slot];
+        }
+
+        void reserve(size_t count) {
+            dense.reserve(count);
+            denseEntities.reserve(count);
+        }
+
+    private:
+        std::vector<T> dense;
+        std::vector<Entity> denseEntities;
+        std::vector<uint32_t> sparse;
+    };
+
+    class EntityRegistry {
+
+    public:
+        Entity create();
+        // Removes the entity's components and recycles its id
+        void destroy(Entity entity);
+        size_t aliveCount() const;
+
+        ComponentPool<TransformComponent> transforms;
+        ComponentPool<RenderableComponent> renderables;
+        ComponentPool<RotatorComponent> rotators;
+        ComponentPool<LightComponent> lights;
+        ComponentPool<SceneNodeComponent> nodes;
+
+    private:
+        Entity nextEntity = 0;
+        std::vector<Entity> freeEntities;
+    };
+
+    // Advances every rotator and rewrites its entity's transform; runs on the
+    // worker pool in contiguous chunks of the rotator array
+    void updateRotators(EntityRegistry& registry, float deltaTime);
+
+    // Copies the cached world and normal matrices of every entity's scene node
+    // into its transform; call after the root node's update()
+    void syncSceneNodes(EntityRegistry& registry);
+
+    // Times updateRotators over entityCount rotating entities and prints the
+    // per-frame cost, single-threaded and on all cores
+    void benchmarkRotators(size_t entityCount, int frameCount);
+}
+
+#endif /* EntityRegistry_hpp */
@@ -0,0 +1,239 @@
+#include "FarField.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    // GL cube map face order: +X -X +Y -Y +Z -Z, as in PointShadows.cpp
+    static const glm::vec3 faceDirections[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    static const glm::vec3 faceUps[6] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+    };
+
+    FarField::~FarField() {
+        if (fbo != 0) {
+            glDeleteTextures(2, cubeMaps);
+            glDeleteFramebuffers(1, &fbo);
+            glDeleteRenderbuffers(1, &depthBuffer);
+            glDeleteVertexArrays(1, &emptyVAO);
+        }
+    }
+
+    void FarField::init(const FarFieldSettings& farFieldSettings) {
+        settings = farFieldSettings;
+
+        glGenTextures(2, cubeMaps);
+        for (int i = 0; i < 2; i++) {
+            glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMaps[i]);
+            for (int face = 0; face < 6; face++) {
+                // lit colours, written and read through the sRGB conversion like the back buffer
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_SRGB8_ALPHA8, settings.faceSize, settings.faceSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        }
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, settings.faceSize, settings.faceSize);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        // the background triangle is generated from gl_VertexID
+        glGenVertexArrays(1, &emptyVAO);
+    }
+
+    const FarFieldSettings& FarField::getSettings() const {
+        return settings;
+    }
+
+    void FarField::update(const glm::vec3& cameraPosition, float lightAngle) {
+        facesRendered = 0;
+        // nothing to show yet, so the first panorama is rendered at once
+        faceBudget = ready ? settings.facesPerFrame : 6;
+
+        // restarting on every sun change would never finish while the sun
+        // keeps moving; the faces keep the refresh's sun, so there is no seam
+        if (nextFace >= 0) {
+            return;
+        }
+
+        if (!ready || invalidated || glm::length(cameraPosition - frontCenter) > settings.moveThreshold || lightAngle != frontLightAngle) {
+            backCenter = cameraPosition;
+            backLightAngle = lightAngle;
+            nextFace = 0;
+            backIncompleteFaces = 0;
+            invalidated = false;
+        }
+    }
+
+    void FarField::invalidate() {
+        invalidated = true;
+        nextFace = -1;
+    }
+
+    void FarField::invalidateBounds(const BoundingBox& bounds) {
+        float clipDistance = getClipDistance();
+        float clipDistanceSquared = clipDistance * clipDistance;
+        if (!ready || bounds.farthestDistanceSquared(frontCenter) >= clipDistanceSquared
+            || (nextFace >= 0 && bounds.farthestDistanceSquared(backCenter) >= clipDistanceSquared)) {
+            invalidate();
+        }
+    }
+
+    void FarField::faceCamera(const glm::vec3& center, int face, glm::mat4& faceView, glm::mat4& faceProjection, float farPlane) const {
+        faceView = glm::lookAt(center, center + faceDirections[face], faceUps[face]);
+        // a point past the clip distance lies at least that far / sqrt(3) along some face's axis
+        float nearPlane = std::max(getClipDistance() / std::sqrt(3.0f), 0.1f);
+        faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, farPlane);
+    }
+
+    bool FarField::beginFace(glm::mat4& faceView, glm::mat4& faceProjection, float farPlane) {
+        if (facesRendered >= faceBudget) {
+            return false;
+        }
+
+        int face = nextFace;
+        GLuint cubeMap = cubeMaps[1 - front];
+        glm::vec3 center = backCenter;
+        if (face < 0) {
+            // no refresh under way, so redraw a shown face in place; it is
+            // cleared and redrawn whole before the panorama is drawn
+            unsigned int due = redrawRequests & incompleteFaces;
+            if (due == 0) {
+                return false;
+            }
+            face = 0;
+            while (!(due & (1u << face))) {
+                face++;
+            }
+            redrawRequests &= ~(1u << face);
+            incompleteFaces &= ~(1u << face);
+            redrawFace = face;
+            cubeMap = cubeMaps[front];
+            center = frontCenter;
+        }
+
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, cubeMap, 0);
+        glViewport(0, 0, settings.faceSize, settings.faceSize);
+        // the clear colour is the fog colour, as behind the near geometry
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        faceCamera(center, face, faceView, faceProjection, farPlane);
+        return true;
+    }
+
+    float FarField::getFaceLightAngle() const {
+        return redrawFace >= 0 ? frontLightAngle : backLightAngle;
+    }
+
+    void FarField::markFaceIncomplete() {
+        if (redrawFace >= 0) {
+            incompleteFaces |= 1u << redrawFace;
+        } else if (nextFace >= 0) {
+            backIncompleteFaces |= 1u << nextFace;
+        }
+    }
+
+    void FarField::endFace() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+
+        facesRendered++;
+        if (redrawFace >= 0) {
+            redrawFace = -1;
+            return;
+        }
+        nextFace++;
+        if (nextFace == 6) {
+            front = 1 - front;
+            frontCenter = backCenter;
+            frontLightAngle = backLightAngle;
+            incompleteFaces = backIncompleteFaces;
+            backIncompleteFaces = 0;
+            redrawRequests = 0;
+            ready = true;
+            nextFace = -1;
+            refreshCount++;
+        }
+    }
+
+    bool FarField::isFaceIncomplete(int face) const {
+        return ready && (incompleteFaces & (1u << face)) != 0;
+    }
+
+    void FarField::getFaceCamera(int face, glm::mat4& faceView, glm::mat4& faceProjection, float farPlane) const {
+        faceCamera(frontCenter, face, faceView, faceProjection, farPlane);
+    }
+
+    void FarField::requestRedraw(int face) {
+        redrawRequests |= 1u << face;
+    }
+
+    float FarField::getClipDistance() const {
+        return std::max(settings.radius - settings.moveThreshold, 0.0f);
+    }
+
+    bool FarField::isReady() const {
+        return ready;
+    }
+
+    void FarField::draw(Shader& shader, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition) {
+        if (!ready) {
+            return;
+        }
+
+        shader.useShaderProgram();
+        GLuint program = shader.shaderProgram;
+        // directions only, the offset from the centre is handled by the proxy sphere
+        glm::mat4 inverseViewProjection = glm::inverse(projection * glm::mat4(glm::mat3(view)));
+        glm::vec3 cameraOffset = cameraPosition - frontCenter;
+        glUniformMatrix4fv(glGetUniformLocation(program, "inverseViewProjection"), 1, GL_FALSE, glm::value_ptr(inverseViewProjection));
+        glUniform3fv(glGetUniformLocation(program, "cameraOffset"), 1, glm::value_ptr(cameraOffset));
+        glUniform1f(glGetUniformLocation(program, "proxyRadius"), settings.radius);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, cubeMaps[front]);
+        glUniform1i(glGetUniformLocation(program, "panorama"), 0);
+
+        // at depth 1, so only the pixels nothing near was drawn to pass
+        glDepthFunc(GL_LEQUAL);
+        glDepthMask(GL_FALSE);
+        glBindVertexArray(emptyVAO);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glBindVertexArray(0);
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+
+        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+    }
+
+    int FarField::getFacesRendered() const {
+        return facesRendered;
+    }
+
+    int FarField::getRefreshCount() const {
+        return refreshCount;
+    }
+}
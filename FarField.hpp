@@ -0,0 +1,123 @@
+#ifndef FarField_hpp
+#define FarField_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "BoundingBox.hpp"
+#include "Shader.hpp"
+
+namespace gps {
+
+    struct FarFieldSettings {
+        // the lit pass draws up to here, the panorama holds what lies past it
+        float radius = 400.0f;
+        // the panorama is re-rendered once the camera strays this far from its centre
+        float moveThreshold = 25.0f;
+        // faces re-rendered per frame while a refresh is under way
+        int facesPerFrame = 1;
+        int faceSize = 1024;
+    };
+
+    // Everything past settings.radius, rendered into a cube map centred on
+    // the camera and drawn as the background. Two cube maps alternate: a
+    // refresh renders a few faces per frame into the hidden one, which is
+    // shown once all six are done, so a half-updated panorama never appears.
+    // The faces clip geometry closer than radius - moveThreshold to their
+    // centre (gl_ClipDistance[0]), which leaves no gap for any camera
+    // position that does not yet trigger a refresh.
+    class FarField {
+
+    public:
+        ~FarField();
+
+        void init(const FarFieldSettings& settings);
+
+        const FarFieldSettings& getSettings() const;
+
+        // Starts a refresh when the camera has moved past the threshold or the
+        // sun has moved since the shown panorama was rendered. A refresh under
+        // way always finishes; a sun that moved meanwhile starts the next one.
+        // Redraws requested before a refresh finishes are dropped with it.
+        void update(const glm::vec3& cameraPosition, float lightAngle);
+
+        // Forces a refresh, after the fog or the scene changes
+        void invalidate();
+        // Forces a refresh only when the box reaches past the clip distance
+        // from the centre of the shown panorama or the one being rendered
+        void invalidateBounds(const BoundingBox& bounds);
+
+        // Binds the next face due this frame and returns its camera, false
+        // when the frame's budget is spent or nothing is due. Faces of a
+        // refresh come first, then redraws requested for the shown panorama.
+        bool beginFace(glm::mat4& faceView, glm::mat4& faceProjection, float farPlane);
+        // The sun angle the bound face is lit with
+        float getFaceLightAngle() const;
+        // The bound face drew something still loading (a coarser stand-in)
+        void markFaceIncomplete();
+        // Unbinds the face, restoring the framebuffer and viewport
+        void endFace();
+
+        // Faces of the shown panorama marked incomplete, and their cameras,
+        // so the caller can keep what they wanted loading and ask for a
+        // redraw in place once it is there
+        bool isFaceIncomplete(int face) const;
+        void getFaceCamera(int face, glm::mat4& faceView, glm::mat4& faceProjection, float farPlane) const;
+        void requestRedraw(int face);
+
+        // Distance from the face camera below which geometry is clipped
+        float getClipDistance() const;
+
+        // False until the first panorama is complete
+        bool isReady() const;
+
+        // Fills the pixels left at the far plane (depth 1) with the panorama
+        void draw(Shader& shader, const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPosition);
+
+        int getFacesRendered() const;
+        int getRefreshCount() const;
+
+    private:
+        FarFieldSettings settings;
+        GLuint cubeMaps[2] = { 0, 0 };
+        GLuint fbo = 0;
+        GLuint depthBuffer = 0;
+        GLuint emptyVAO = 0;
+
+        // the cube map shown, the other one is refreshed
+        int front = 0;
+        bool ready = false;
+        glm::vec3 frontCenter = glm::vec3(0.0f);
+        float frontLightAngle = 0.0f;
+
+        // -1 while no refresh is under way
+        int nextFace = -1;
+        glm::vec3 backCenter = glm::vec3(0.0f);
+        float backLightAngle = 0.0f;
+        bool invalidated = false;
+
+        // bit per face: drawn incomplete in the shown and the refreshed cube
+        // map, and redraws of shown faces due
+        unsigned int incompleteFaces = 0;
+        unsigned int backIncompleteFaces = 0;
+        unsigned int redrawRequests = 0;
+        // the shown face being redrawn, -1 when the bound face is a refresh's
+        int redrawFace = -1;
+
+        int faceBudget = 0;
+        int facesRendered = 0;
+        int refreshCount = 0;
+        GLint previousViewport[4] = { 0, 0, 0, 0 };
+
+        void faceCamera(const glm::vec3& center, int face, glm::mat4& faceView, glm::mat4& faceProjection, float farPlane) const;
+    };
+}
+
+#endif /* FarField_hpp */
@@ -0,0 +1,158 @@
+#include "GpuSnow.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstddef>
+#include <random>
+#include <vector>
+
+namespace gps {
+
+    GpuSnow::~GpuSnow() {
+        if (buffers[0] != 0) {
+            glDeleteBuffers(2, buffers);
+            glDeleteVertexArrays(2, vaos);
+        }
+        if (occluderTexture != 0) {
+            glDeleteTextures(1, &occluderTexture);
+        }
+    }
+
+    void GpuSnow::init(size_t flakeCount, const glm::vec3& center) {
+        this->flakeCount = flakeCount;
+
+        // spread evenly through the box; from then on the GPU owns them
+        std::mt19937 generator(7);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        std::vector<SnowFlake> flakes(flakeCount);
+        for (SnowFlake& flake : flakes) {
+            glm::vec3 position = center + glm::vec3((unit(generator) * 2.0f - 1.0f) * settings.radius,
+                (unit(generator) * 2.0f - 1.0f) * settings.halfHeight,
+                (unit(generator) * 2.0f - 1.0f) * settings.radius);
+            flake.positionSeed = glm::vec4(position, unit(generator));
+            flake.velocitySize = glm::vec4(0.0f, -settings.fallSpeed, 0.0f, settings.flakeSize * (0.5f + unit(generator)));
+        }
+
+        glGenVertexArrays(2, vaos);
+        glGenBuffers(2, buffers);
+        for (int i = 0; i < 2; i++) {
+            glBindVertexArray(vaos[i]);
+            glBindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+            glBufferData(GL_ARRAY_BUFFER, flakes.size() * sizeof(SnowFlake), flakes.data(), GL_DYNAMIC_COPY);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(SnowFlake), (GLvoid*)offsetof(SnowFlake, positionSeed));
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(SnowFlake), (GLvoid*)offsetof(SnowFlake, velocitySize));
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        // nothing to land on until setOccluder
+        const float noSurface = -1e9f;
+        glGenTextures(1, &occluderTexture);
+        glBindTexture(GL_TEXTURE_2D, occluderTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, 1, 1, 0, GL_RED, GL_FLOAT, &noSurface);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        std::vector<const char*> varyings = { "tfPositionSeed", "tfVelocitySize" };
+        updateShader.loadFeedbackShader("shaders/snowUpdate.vert", varyings);
+        renderShader.loadShader("shaders/snow.vert", "shaders/snow.frag");
+    }
+
+    void GpuSnow::setOccluder(const Heightfield& heights) {
+        if (heights.getWidth() < 2 || heights.getDepth() < 2) {
+            return;
+        }
+
+        // texel centers sit on the samples, so the texture reaches half a cell past them
+        std::vector<float> texels(heights.getHeights());
+        for (float& height : texels) {
+            if (height == -FLT_MAX) {
+                height = -1e9f;
+            }
+        }
+        float cellSize = heights.getCellSize();
+        occluderOrigin = heights.getOrigin() - glm::vec2(cellSize * 0.5f);
+        occluderSize = glm::vec2((float)heights.getWidth(), (float)heights.getDepth()) * cellSize;
+
+        glBindTexture(GL_TEXTURE_2D, occluderTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, heights.getWidth(), heights.getDepth(), 0, GL_RED, GL_FLOAT, texels.data());
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void GpuSnow::update(float deltaTime, float time, const glm::vec3& cameraPosition) {
+        if (flakeCount == 0) {
+            return;
+        }
+
+        updateShader.useShaderProgram();
+        GLuint program = updateShader.shaderProgram;
+        glUniform1f(glGetUniformLocation(program, "deltaTime"), deltaTime);
+        glUniform1f(glGetUniformLocation(program, "time"), time);
+        glUniform1ui(glGetUniformLocation(program, "frame"), frame++);
+        glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+        glUniform3fv(glGetUniformLocation(program, "wind"), 1, glm::value_ptr(settings.wind));
+        glUniform1f(glGetUniformLocation(program, "turbulence"), settings.turbulence);
+        glUniform1f(glGetUniformLocation(program, "fallSpeed"), settings.fallSpeed);
+        glUniform3f(glGetUniformLocation(program, "volumeExtent"), settings.radius, settings.halfHeight, settings.radius);
+        glUniform2fv(glGetUniformLocation(program, "occluderOrigin"), 1, glm::value_ptr(occluderOrigin));
+        glUniform2fv(glGetUniformLocation(program, "occluderSize"), 1, glm::value_ptr(occluderSize));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, occluderTexture);
+        glUniform1i(glGetUniformLocation(program, "occluderHeights"), 0);
+
+        int next = 1 - current;
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(vaos[current]);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffers[next]);
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, (GLsizei)flakeCount);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glBindVertexArray(0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        current = next;
+    }
+
+    void drawSnowFlakes(Shader& shader, GLuint vao, size_t flakeCount, const SnowSettings& settings,
+        const glm::mat4& view, const glm::mat4& projection, float pointScale) {
+        shader.useShaderProgram();
+        GLuint program = shader.shaderProgram;
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform1f(glGetUniformLocation(program, "pointScale"), pointScale);
+        glUniform1f(glGetUniformLocation(program, "fadeDistance"), settings.fadeDistance);
+        glUniform3fv(glGetUniformLocation(program, "snowColor"), 1, glm::value_ptr(settings.color));
+
+        glEnable(GL_PROGRAM_POINT_SIZE);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        glDepthMask(GL_FALSE);
+
+        glBindVertexArray(vao);
+        glDrawArrays(GL_POINTS, 0, (GLsizei)flakeCount);
+        glBindVertexArray(0);
+
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+        glDisable(GL_PROGRAM_POINT_SIZE);
+    }
+
+    void GpuSnow::render(const glm::mat4& view, const glm::mat4& projection, float pointScale) {
+        if (flakeCount == 0) {
+            return;
+        }
+        drawSnowFlakes(renderShader, vaos[current], flakeCount, settings, view, projection, pointScale);
+    }
+
+    size_t GpuSnow::getFlakeCount() const {
+        return flakeCount;
+    }
+}
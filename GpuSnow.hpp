@@ -0,0 +1,87 @@
+#ifndef GpuSnow_hpp
+#define GpuSnow_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "Heightfield.hpp"
+
+#include <cstdint>
+
+namespace gps {
+
+    // One flake as stored in the particle buffers and read by shaders/snow.vert
+    struct SnowFlake {
+        // w: per-flake random value in [0, 1)
+        glm::vec4 positionSeed;
+        // w: diameter in world units
+        glm::vec4 velocitySize;
+    };
+
+    struct SnowSettings {
+        glm::vec3 wind = glm::vec3(1.5f, 0.0f, 0.5f);
+        float turbulence = 0.6f;
+        float fallSpeed = 1.2f;
+        // flakes live in a box around the camera, this far out horizontally
+        // and above / below it
+        float radius = 40.0f;
+        float halfHeight = 20.0f;
+        float flakeSize = 0.04f;
+        float fadeDistance = 40.0f;
+        glm::vec3 color = glm::vec3(0.95f, 0.97f, 1.0f);
+    };
+
+    // Snowfall simulated entirely on the GPU: every frame a vertex shader
+    // advances the flakes of one buffer and transform feedback writes them
+    // into the other (ping-pong), which is then drawn as point sprites.
+    // Flakes that land on the scene's top surfaces or fall out of the box
+    // respawn at its top.
+    class GpuSnow {
+
+    public:
+        ~GpuSnow();
+
+        void init(size_t flakeCount, const glm::vec3& center);
+
+        // Uploads the heights of the scene's topmost surfaces
+        void setOccluder(const Heightfield& heights);
+
+        void update(float deltaTime, float time, const glm::vec3& cameraPosition);
+
+        // Depth tested against the scene but not written; pointScale is the
+        // viewport height over 2 tan(fov / 2)
+        void render(const glm::mat4& view, const glm::mat4& projection, float pointScale);
+
+        size_t getFlakeCount() const;
+
+    private:
+        SnowSettings settings;
+        size_t flakeCount = 0;
+        GLuint vaos[2] = { 0, 0 };
+        GLuint buffers[2] = { 0, 0 };
+        // buffer holding the latest state
+        int current = 0;
+        uint32_t frame = 0;
+
+        GLuint occluderTexture = 0;
+        glm::vec2 occluderOrigin = glm::vec2(0.0f);
+        glm::vec2 occluderSize = glm::vec2(1.0f);
+
+        Shader updateShader;
+        Shader renderShader;
+    };
+
+    // Draws flakeCount points of vao with shaders/snow.vert and snow.frag
+    void drawSnowFlakes(Shader& shader, GLuint vao, size_t flakeCount, const SnowSettings& settings,
+        const glm::mat4& view, const glm::mat4& projection, float pointScale);
+}
+
+#endif /* GpuSnow_hpp */
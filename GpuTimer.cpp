@@ -0,0 +1,63 @@
+#include "GpuTimer.hpp"
+
+namespace gps {
+
+    void GpuTimer::init() {
+        glGenQueries(QUERY_COUNT, queries);
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            pending[i] = false;
+        }
+    }
+
+    void GpuTimer::begin() {
+        collect();
+        // all queries still in flight: skip this measurement rather than wait
+        if (pending[current]) {
+            return;
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+        running = true;
+    }
+
+    void GpuTimer::end() {
+        if (!running) {
+            return;
+        }
+        glEndQuery(GL_TIME_ELAPSED);
+        running = false;
+        pending[current] = true;
+        current = (current + 1) % QUERY_COUNT;
+    }
+
+    double GpuTimer::getAverageMs() {
+        collect();
+        return samples > 0 ? totalMs / samples : 0.0;
+    }
+
+    int GpuTimer::getSampleCount() {
+        return samples;
+    }
+
+    void GpuTimer::reset() {
+        collect();
+        totalMs = 0.0;
+        samples = 0;
+    }
+
+    void GpuTimer::collect() {
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            if (!pending[i]) {
+                continue;
+            }
+            GLint available = 0;
+            glGetQueryObjectiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 elapsedNs = 0;
+                glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &elapsedNs);
+                totalMs += elapsedNs / 1000000.0;
+                samples++;
+                pending[i] = false;
+            }
+        }
+    }
+}
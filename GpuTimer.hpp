@@ -0,0 +1,43 @@
+#ifndef GpuTimer_hpp
+#define GpuTimer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    // Measures GPU time between begin() and end() with GL_TIME_ELAPSED queries.
+    // Results are read a few frames later and only once available, so the
+    // timer never stalls the pipeline.
+    class GpuTimer {
+
+    public:
+        void init();
+        void begin();
+        void end();
+
+        // average over the samples collected since the last reset()
+        double getAverageMs();
+        int getSampleCount();
+        void reset();
+
+    private:
+        static const int QUERY_COUNT = 4;
+        GLuint queries[QUERY_COUNT];
+        bool pending[QUERY_COUNT];
+        int current = 0;
+        bool running = false;
+
+        double totalMs = 0.0;
+        int samples = 0;
+
+        void collect();
+    };
+}
+
+#endif /* GpuTimer_hpp */
@@ -0,0 +1,94 @@
+#include "Heightfield.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    void Heightfield::bake(const Bvh& bvh, const glm::mat4& model, float cellSize, int maxCells) {
+        heights.clear();
+        width = 0;
+        depth = 0;
+        if (bvh.isEmpty()) {
+            return;
+        }
+
+        BoundingBox worldBounds = bvh.getBounds().transformed(model);
+        glm::vec2 size(worldBounds.max.x - worldBounds.min.x, worldBounds.max.z - worldBounds.min.z);
+        this->cellSize = std::max(cellSize, std::max(size.x, size.y) / (maxCells - 1));
+        origin = glm::vec2(worldBounds.min.x, worldBounds.min.z);
+        width = (int)std::ceil(size.x / this->cellSize) + 1;
+        depth = (int)std::ceil(size.y / this->cellSize) + 1;
+        heights.assign((size_t)width * depth, -FLT_MAX);
+
+        // rays go down in model space; their parameter stays a world-space fraction
+        glm::mat4 worldToModel = glm::inverse(model);
+        float top = worldBounds.max.y + 1.0f;
+        float drop = worldBounds.max.y - worldBounds.min.y + 2.0f;
+        parallelFor(depth, 4, [&](size_t begin, size_t end) {
+            std::vector<Ray> rays(width);
+            std::vector<RayHit> hits(width);
+            for (size_t row = begin; row < end; row++) {
+                for (int column = 0; column < width; column++) {
+                    glm::vec3 start(origin.x + column * this->cellSize, top, origin.y + row * this->cellSize);
+                    rays[column].origin = glm::vec3(worldToModel * glm::vec4(start, 1.0f));
+                    rays[column].direction = glm::vec3(worldToModel * glm::vec4(0.0f, -drop, 0.0f, 0.0f));
+                    rays[column].maxDistance = 1.0f;
+                }
+                bvh.intersect(rays.data(), hits.data(), width);
+                for (int column = 0; column < width; column++) {
+                    if (hits[column].isHit()) {
+                        heights[row * width + column] = top - hits[column].distance * drop;
+                    }
+                }
+            }
+        });
+    }
+
+    bool Heightfield::sample(float x, float z, float& height) const {
+        if (heights.empty()) {
+            return false;
+        }
+        float gridX = (x - origin.x) / cellSize;
+        float gridZ = (z - origin.y) / cellSize;
+        if (gridX < 0.0f || gridZ < 0.0f || gridX > width - 1 || gridZ > depth - 1) {
+            return false;
+        }
+
+        int x0 = std::min((int)gridX, width - 2 < 0 ? 0 : width - 2);
+        int z0 = std::min((int)gridZ, depth - 2 < 0 ? 0 : depth - 2);
+        int x1 = std::min(x0 + 1, width - 1);
+        int z1 = std::min(z0 + 1, depth - 1);
+        float fx = gridX - x0;
+        float fz = gridZ - z0;
+
+        float h00 = heights[z0 * width + x0], h10 = heights[z0 * width + x1];
+        float h01 = heights[z1 * width + x0], h11 = heights[z1 * width + x1];
+        if (h00 == -FLT_MAX || h10 == -FLT_MAX || h01 == -FLT_MAX || h11 == -FLT_MAX) {
+            return false;
+        }
+        height = (h00 * (1.0f - fx) + h10 * fx) * (1.0f - fz) + (h01 * (1.0f - fx) + h11 * fx) * fz;
+        return true;
+    }
+
+    int Heightfield::getWidth() const {
+        return width;
+    }
+
+    int Heightfield::getDepth() const {
+        return depth;
+    }
+
+    glm::vec2 Heightfield::getOrigin() const {
+        return origin;
+    }
+
+    float Heightfield::getCellSize() const {
+        return cellSize;
+    }
+
+    const std::vector<float>& Heightfield::getHeights() const {
+        return heights;
+    }
+}
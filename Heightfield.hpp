@@ -0,0 +1,43 @@
+#ifndef Heightfield_hpp
+#define Heightfield_hpp
+
+#include <glm/glm.hpp>
+
+#include "Bvh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Height of the topmost surface over a regular XZ grid, baked by casting
+    // rays straight down through a BVH
+    class Heightfield {
+
+    public:
+        // Bakes over the world-space bounds of bvh placed by model, with cells
+        // of cellSize (grown so that neither side exceeds maxCells)
+        void bake(const Bvh& bvh, const glm::mat4& model, float cellSize, int maxCells);
+
+        // Bilinear height at a world XZ position; false outside the grid or
+        // where no surface was found below
+        bool sample(float x, float z, float& height) const;
+
+        int getWidth() const;
+        int getDepth() const;
+        // world XZ of the first sample
+        glm::vec2 getOrigin() const;
+        float getCellSize() const;
+        // row by row along X; -FLT_MAX where no surface was found
+        const std::vector<float>& getHeights() const;
+
+    private:
+        glm::vec2 origin;
+        float cellSize = 1.0f;
+        int width = 0;
+        int depth = 0;
+        // -FLT_MAX where the ray found nothing
+        std::vector<float> heights;
+    };
+}
+
+#endif /* Heightfield_hpp */
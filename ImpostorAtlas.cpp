@@ -0,0 +1,478 @@
+#include "ImpostorAtlas.hpp"
+#include "MeshSimplifier.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    static const char impostorMagic[4] = { 'I', 'M', 'P', '1' };
+
+    // Octahedral map of the sphere, +Y at the centre of the square;
+    // the same as octDecode in impostor.vert
+    static glm::vec3 octDecode(glm::vec2 e) {
+        glm::vec3 n(e.x, 1.0f - std::fabs(e.x) - std::fabs(e.y), e.y);
+        if (n.y < 0.0f) {
+            n.x = (1.0f - std::fabs(e.y)) * (e.x >= 0.0f ? 1.0f : -1.0f);
+            n.z = (1.0f - std::fabs(e.x)) * (e.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return glm::normalize(n);
+    }
+
+    // Up hint of the bake camera, which impostor.vert reproduces to orient a frame
+    static glm::vec3 frameUpHint(const glm::vec3& direction) {
+        return std::fabs(direction.y) > 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    ImpostorAtlas::~ImpostorAtlas() {
+        if (albedoTexture != 0) {
+            glDeleteTextures(1, &albedoTexture);
+            glDeleteTextures(1, &normalDepthTexture);
+        }
+        if (quadVAO != 0) {
+            glDeleteVertexArrays(1, &quadVAO);
+            glDeleteBuffers(1, &quadVBO);
+            glDeleteBuffers(1, &instanceVBO);
+        }
+        for (CopySplit& split : splits) {
+            if (split.nearBuffer != 0) {
+                glDeleteBuffers(1, &split.nearBuffer);
+            }
+            if (split.farBuffer != 0) {
+                glDeleteBuffers(1, &split.farBuffer);
+            }
+        }
+    }
+
+    void ImpostorAtlas::build(Model3D& source, const std::string& cacheFile) {
+        model = &source;
+        splits.resize(source.getMeshes().size());
+        selectMeshes(source);
+        initBuffers();
+        if (impostors.empty()) {
+            return;
+        }
+        createTextures();
+
+        const std::vector<Mesh>& meshes = source.getMeshes();
+        std::vector<uint64_t> hashes;
+        for (const Impostor& impostor : impostors) {
+            hashes.push_back(hashMeshData(meshes[impostor.mesh].vertices, meshes[impostor.mesh].indices));
+        }
+
+        if (load(cacheFile, hashes)) {
+            std::cout << "Impostor cache : " << cacheFile << std::endl;
+        }
+        else {
+            auto start = std::chrono::high_resolution_clock::now();
+            bake(source);
+            glFinish();
+            auto stop = std::chrono::high_resolution_clock::now();
+            std::cout << "Impostor bake  : " << impostors.size() << " meshes, "
+                << std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
+
+            if (!save(cacheFile, hashes)) {
+                std::cerr << "Could not write " << cacheFile << std::endl;
+            }
+        }
+
+        glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTexture);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void ImpostorAtlas::selectMeshes(const Model3D& source) {
+        const std::vector<Mesh>& meshes = source.getMeshes();
+        meshImpostors.assign(meshes.size(), -1);
+        impostors.clear();
+
+        std::vector<Impostor> candidates;
+        std::vector<size_t> savings;
+        for (size_t m = 0; m < meshes.size(); m++) {
+            const Mesh& mesh = meshes[m];
+            size_t triangles = mesh.indices.size() / 3;
+            if (triangles < MIN_TRIANGLES || mesh.vertices.empty()) {
+                continue;
+            }
+
+            // the vertices are one copy, also for instanced meshes
+            BoundingBox copyBounds;
+            for (const Vertex& vertex : mesh.vertices) {
+                copyBounds.expand(vertex.Position);
+            }
+            Impostor impostor;
+            impostor.mesh = m;
+            impostor.center = copyBounds.getCenter();
+            impostor.radius = 0.0f;
+            for (const Vertex& vertex : mesh.vertices) {
+                impostor.radius = std::max(impostor.radius, glm::length(vertex.Position - impostor.center));
+            }
+            if (impostor.radius <= 0.0f || impostor.radius > MAX_RADIUS) {
+                continue;
+            }
+            candidates.push_back(impostor);
+            savings.push_back(triangles * std::max(mesh.getInstanceCount(), (size_t)1));
+        }
+
+        std::vector<size_t> order(candidates.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [&savings](size_t a, size_t b) {
+            return savings[a] > savings[b];
+        });
+        order.resize(std::min(order.size(), (size_t)MAX_IMPOSTORS));
+        // layers in mesh order, so the cache does not depend on the sort
+        std::sort(order.begin(), order.end());
+
+        for (size_t i : order) {
+            meshImpostors[candidates[i].mesh] = (int)impostors.size();
+            impostors.push_back(candidates[i]);
+        }
+    }
+
+    void ImpostorAtlas::createTextures() {
+        GLsizei layers = (GLsizei)impostors.size();
+
+        glGenTextures(1, &albedoTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTexture);
+        // the model's textures are sRGB, so the baked colours are kept that way
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_SRGB8_ALPHA8, LAYER_SIZE, LAYER_SIZE, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // coarser levels would blend whole frames together
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 3);
+
+        // averaging normals and depths across silhouettes is meaningless, so no mipmaps
+        glGenTextures(1, &normalDepthTexture);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, normalDepthTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, LAYER_SIZE, LAYER_SIZE, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    }
+
+    void ImpostorAtlas::bake(Model3D& source) {
+        Shader bakeShader;
+        bakeShader.loadShader("shaders/impostorBake.vert", "shaders/impostorBake.frag");
+        bakeShader.useShaderProgram();
+        GLint viewProjectionLoc = glGetUniformLocation(bakeShader.shaderProgram, "viewProjection");
+
+        GLuint fbo;
+        GLuint depthBuffer;
+        glGenFramebuffers(1, &fbo);
+        glGenRenderbuffers(1, &depthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, LAYER_SIZE, LAYER_SIZE);
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+        GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+
+        GLint previousViewport[4];
+        GLfloat previousClearColor[4];
+        glGetIntegerv(GL_VIEWPORT, previousViewport);
+        glGetFloatv(GL_COLOR_CLEAR_VALUE, previousClearColor);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+        const std::vector<Mesh>& meshes = source.getMeshes();
+        for (size_t i = 0; i < impostors.size(); i++) {
+            const Impostor& impostor = impostors[i];
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, albedoTexture, 0, (GLint)i);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, normalDepthTexture, 0, (GLint)i);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "Impostor framebuffer incomplete" << std::endl;
+                break;
+            }
+            glViewport(0, 0, LAYER_SIZE, LAYER_SIZE);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+            // one copy, without the instance transforms
+            std::vector<GLsizei> counts(1, (GLsizei)meshes[impostor.mesh].indices.size());
+            std::vector<const GLvoid*> offsets(1, (const GLvoid*)0);
+
+            float r = impostor.radius;
+            glm::mat4 projection = glm::ortho(-r, r, -r, r, 0.0f, 2.0f * r);
+            for (int y = 0; y < FRAMES; y++) {
+                for (int x = 0; x < FRAMES; x++) {
+                    glm::vec2 cell = (glm::vec2((float)x, (float)y) + 0.5f) / (float)FRAMES;
+                    glm::vec3 direction = octDecode(cell * 2.0f - 1.0f);
+                    // the eye on the sphere, so depth 0..1 spans the diameter
+                    glm::mat4 view = glm::lookAt(impostor.center + direction * r, impostor.center, frameUpHint(direction));
+                    glm::mat4 viewProjection = projection * view;
+
+                    glViewport(x * FRAME_SIZE, y * FRAME_SIZE, FRAME_SIZE, FRAME_SIZE);
+                    bakeShader.useShaderProgram();
+                    glUniformMatrix4fv(viewProjectionLoc, 1, GL_FALSE, glm::value_ptr(viewProjection));
+                    source.DrawMeshRanges(bakeShader, impostor.mesh, counts, offsets);
+                }
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteFramebuffers(1, &fbo);
+        glDeleteRenderbuffers(1, &depthBuffer);
+        glDeleteProgram(bakeShader.shaderProgram);
+        glViewport(previousViewport[0], previousViewport[1], previousViewport[2], previousViewport[3]);
+        glClearColor(previousClearColor[0], previousClearColor[1], previousClearColor[2], previousClearColor[3]);
+    }
+
+    bool ImpostorAtlas::load(const std::string& fileName, const std::vector<uint64_t>& meshHashes) {
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        char magic[4];
+        uint32_t header[3] = { 0, 0, 0 };
+        file.read(magic, sizeof(magic));
+        file.read((char*)header, sizeof(header));
+        if (!file || std::memcmp(magic, impostorMagic, sizeof(magic)) != 0
+            || header[0] != FRAMES || header[1] != FRAME_SIZE || header[2] != impostors.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < impostors.size(); i++) {
+            uint32_t mesh = 0;
+            uint64_t hash = 0;
+            file.read((char*)&mesh, sizeof(mesh));
+            file.read((char*)&hash, sizeof(hash));
+            if (!file || mesh != impostors[i].mesh || hash != meshHashes[i]) {
+                return false;
+            }
+        }
+
+        std::vector<unsigned char> albedo((size_t)LAYER_SIZE * LAYER_SIZE * 4 * impostors.size());
+        std::vector<unsigned char> normalDepth(albedo.size());
+        file.read((char*)albedo.data(), albedo.size());
+        file.read((char*)normalDepth.data(), normalDepth.size());
+        if (!file) {
+            return false;
+        }
+
+        GLsizei layers = (GLsizei)impostors.size();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTexture);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, LAYER_SIZE, LAYER_SIZE, layers, GL_RGBA, GL_UNSIGNED_BYTE, albedo.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, normalDepthTexture);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, LAYER_SIZE, LAYER_SIZE, layers, GL_RGBA, GL_UNSIGNED_BYTE, normalDepth.data());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return true;
+    }
+
+    bool ImpostorAtlas::save(const std::string& fileName, const std::vector<uint64_t>& meshHashes) {
+        std::ofstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        uint32_t header[3] = { FRAMES, FRAME_SIZE, (uint32_t)impostors.size() };
+        file.write(impostorMagic, sizeof(impostorMagic));
+        file.write((const char*)header, sizeof(header));
+        for (size_t i = 0; i < impostors.size(); i++) {
+            uint32_t mesh = (uint32_t)impostors[i].mesh;
+            file.write((const char*)&mesh, sizeof(mesh));
+            file.write((const char*)&meshHashes[i], sizeof(uint64_t));
+        }
+
+        // every layer at once
+        std::vector<unsigned char> pixels((size_t)LAYER_SIZE * LAYER_SIZE * 4 * impostors.size());
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTexture);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        file.write((const char*)pixels.data(), pixels.size());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, normalDepthTexture);
+        glGetTexImage(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        file.write((const char*)pixels.data(), pixels.size());
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        return (bool)file;
+    }
+
+    void ImpostorAtlas::initBuffers() {
+        // triangle strip, corners of the quad in units of the radius
+        const float corners[8] = { -1.0f, -1.0f, 1.0f, -1.0f, -1.0f, 1.0f, 1.0f, 1.0f };
+
+        glGenVertexArrays(1, &quadVAO);
+        glGenBuffers(1, &quadVBO);
+        glGenBuffers(1, &instanceVBO);
+        glBindVertexArray(quadVAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 2 * sizeof(float), (GLvoid*)0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        for (GLuint column = 0; column < 6; column++) {
+            glEnableVertexAttribArray(1 + column);
+            glVertexAttribPointer(1 + column, 4, GL_FLOAT, GL_FALSE, sizeof(ImpostorInstance), (GLvoid*)(column * sizeof(glm::vec4)));
+            glVertexAttribDivisor(1 + column, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    const Model3D* ImpostorAtlas::getModel() const {
+        return model;
+    }
+
+    bool ImpostorAtlas::hasImpostor(size_t meshIndex) const {
+        return meshIndex < meshImpostors.size() && meshImpostors[meshIndex] >= 0;
+    }
+
+    void ImpostorAtlas::clearInstances() {
+        instances.clear();
+        for (CopySplit& split : splits) {
+            split.nearCopies.clear();
+            split.farCopies.clear();
+            split.nearHash = 0;
+        }
+    }
+
+    void ImpostorAtlas::splitCopies(size_t meshIndex, const glm::mat4& modelMatrix, const glm::vec3& cameraPosition, float distance) {
+        const Impostor& impostor = impostors[meshImpostors[meshIndex]];
+        const Mesh& mesh = model->getMeshes()[meshIndex];
+        CopySplit& split = splits[meshIndex];
+        split.nearCopies.clear();
+        split.farCopies.clear();
+        // FNV-1a over the indices of the near copies
+        split.nearHash = 14695981039346656037ull;
+
+        float scale = std::max(glm::length(glm::vec3(modelMatrix[0])),
+            std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+        auto place = [&](const glm::mat4& copy, uint64_t index) {
+            glm::vec3 center = glm::vec3(modelMatrix * copy * glm::vec4(impostor.center, 1.0f));
+            bool isFar = glm::length(center - cameraPosition) - impostor.radius * scale >= distance;
+            (isFar ? split.farCopies : split.nearCopies).push_back(copy);
+            if (!isFar) {
+                split.nearHash = (split.nearHash ^ index) * 1099511628211ull;
+            }
+        };
+        if (mesh.getInstanceCount() == 0) {
+            place(glm::mat4(1.0f), 0);
+            return;
+        }
+        const std::vector<glm::mat4>& copies = mesh.getInstanceTransforms();
+        for (size_t c = 0; c < copies.size(); c++) {
+            place(copies[c], c);
+        }
+        if (isSplit(meshIndex)) {
+            uploadCopies(split.nearBuffer, split.nearCapacity, split.nearCopies);
+            uploadCopies(split.farBuffer, split.farCapacity, split.farCopies);
+        }
+    }
+
+    void ImpostorAtlas::uploadCopies(GLuint& buffer, size_t& capacity, const std::vector<glm::mat4>& transforms) {
+        if (buffer == 0) {
+            glGenBuffers(1, &buffer);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        GLsizeiptr bytes = transforms.size() * sizeof(glm::mat4);
+        if (transforms.size() > capacity) {
+            glBufferData(GL_ARRAY_BUFFER, bytes, transforms.data(), GL_STREAM_DRAW);
+            capacity = transforms.size();
+        }
+        else {
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, transforms.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    size_t ImpostorAtlas::getNearCopyCount(size_t meshIndex) const {
+        return meshIndex < splits.size() ? splits[meshIndex].nearCopies.size() : 0;
+    }
+
+    size_t ImpostorAtlas::getFarCopyCount(size_t meshIndex) const {
+        return meshIndex < splits.size() ? splits[meshIndex].farCopies.size() : 0;
+    }
+
+    bool ImpostorAtlas::isSplit(size_t meshIndex) const {
+        return getNearCopyCount(meshIndex) > 0 && getFarCopyCount(meshIndex) > 0;
+    }
+
+    GLuint ImpostorAtlas::getNearCopyBuffer(size_t meshIndex) const {
+        return splits[meshIndex].nearBuffer;
+    }
+
+    GLuint ImpostorAtlas::getFarCopyBuffer(size_t meshIndex) const {
+        return splits[meshIndex].farBuffer;
+    }
+
+    uint64_t ImpostorAtlas::getSplitHash(size_t meshIndex) const {
+        return meshIndex < splits.size() ? splits[meshIndex].nearHash : 0;
+    }
+
+    void ImpostorAtlas::addInstances(size_t meshIndex, const glm::mat4& modelMatrix) {
+        const Impostor& impostor = impostors[meshImpostors[meshIndex]];
+        const Mesh& mesh = model->getMeshes()[meshIndex];
+        glm::mat4 centered = glm::translate(glm::mat4(1.0f), impostor.center);
+
+        ImpostorInstance instance;
+        instance.params = glm::vec4((float)meshImpostors[meshIndex], impostor.radius, 0.0f, 0.0f);
+        // the light the mesh's coarse levels are drawn with, see setAmbientSource in main.cpp
+        instance.bakedAmbient = glm::vec4(0.0f);
+        if (model->getLightmapTexture() != 0 && mesh.getInstanceCount() == 0) {
+            instance.bakedAmbient = glm::vec4(model->getLightmapAverage(meshIndex), 1.0f);
+        }
+        for (const glm::mat4& copy : splits[meshIndex].farCopies) {
+            instance.model = modelMatrix * copy * centered;
+            instances.push_back(instance);
+        }
+    }
+
+    void ImpostorAtlas::draw(Shader& shader, const glm::mat4& view, const glm::mat4& projection) {
+        if (instances.empty()) {
+            return;
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        GLsizeiptr bytes = instances.size() * sizeof(ImpostorInstance);
+        if (instances.size() > instanceCapacity) {
+            instanceCapacity = instances.size();
+            glBufferData(GL_ARRAY_BUFFER, bytes, instances.data(), GL_STREAM_DRAW);
+        }
+        else {
+            glBufferData(GL_ARRAY_BUFFER, instanceCapacity * sizeof(ImpostorInstance), NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, instances.data());
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        shader.useShaderProgram();
+        GLuint program = shader.shaderProgram;
+        glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+        glUniformMatrix4fv(glGetUniformLocation(program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+        glUniform1i(glGetUniformLocation(program, "frames"), FRAMES);
+
+        // units past the ones basic.frag uses
+        glActiveTexture(GL_TEXTURE10);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, albedoTexture);
+        glUniform1i(glGetUniformLocation(program, "impostorAlbedo"), 10);
+        glActiveTexture(GL_TEXTURE11);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, normalDepthTexture);
+        glUniform1i(glGetUniformLocation(program, "impostorNormalDepth"), 11);
+        glActiveTexture(GL_TEXTURE0);
+
+        glBindVertexArray(quadVAO);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)instances.size());
+        glBindVertexArray(0);
+    }
+
+    size_t ImpostorAtlas::getImpostorCount() const {
+        return impostors.size();
+    }
+
+    size_t ImpostorAtlas::getInstanceCount() const {
+        return instances.size();
+    }
+}
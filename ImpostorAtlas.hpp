@@ -0,0 +1,143 @@
+#ifndef ImpostorAtlas_hpp
+#define ImpostorAtlas_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+#include "Shader.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Octahedral impostors of a model's meshes. Each eligible mesh is
+    // rendered orthographically from FRAMES x FRAMES directions, the centres
+    // of the cells of an octahedral map of the sphere, into one layer of two
+    // texture arrays: albedo with coverage in alpha, and the model-space
+    // normal with the depth along the view direction in alpha.
+    // Far copies are then drawn as one camera-facing quad each, in a
+    // single instanced draw for the whole model. impostor.frag picks the
+    // frame closest to the view direction, rebuilds the surface point from
+    // the depth and lights it like basic.frag does.
+    class ImpostorAtlas {
+
+    public:
+        static const int FRAMES = 8;
+        static const int FRAME_SIZE = 32;
+        static const int LAYER_SIZE = FRAMES * FRAME_SIZE;
+        // simpler meshes cost little more than their quad
+        static const size_t MIN_TRIANGLES = 200;
+        // larger meshes (the ground, the hall) stay close to the camera somewhere
+        static constexpr float MAX_RADIUS = 30.0f;
+        // layers kept, the meshes with the most triangles in the scene first
+        static const size_t MAX_IMPOSTORS = 64;
+
+        ~ImpostorAtlas();
+
+        // Bakes impostors for model's eligible meshes, or reads them back from
+        // cacheFile when it was written for the same meshes. The model's
+        // textures must be loaded.
+        void build(Model3D& model, const std::string& cacheFile);
+
+        const Model3D* getModel() const;
+
+        bool hasImpostor(size_t meshIndex) const;
+
+        // Per frame: forget the last frame's splits and queued copies
+        void clearInstances();
+
+        // Per frame, for each mesh with an impostor: sorts its copies (the
+        // mesh itself when it is drawn once) into those nearer than distance
+        // to the camera and those past it, each by its own bounding sphere.
+        // A merged mesh spans the whole scene, so only per copy can part of
+        // it turn into impostors while the camera is among the rest.
+        void splitCopies(size_t meshIndex, const glm::mat4& modelMatrix, const glm::vec3& cameraPosition, float distance);
+
+        size_t getNearCopyCount(size_t meshIndex) const;
+        size_t getFarCopyCount(size_t meshIndex) const;
+
+        // True when an instanced mesh has copies on both sides; its model-space
+        // transforms on each side are then in these buffers, for Model3D::DrawMeshCopies
+        bool isSplit(size_t meshIndex) const;
+        GLuint getNearCopyBuffer(size_t meshIndex) const;
+        GLuint getFarCopyBuffer(size_t meshIndex) const;
+        // Hash of which copies are near, so a caller can tell when copies
+        // swapped sides even though the counts stayed the same
+        uint64_t getSplitHash(size_t meshIndex) const;
+
+        // Queues the far copies of a mesh as impostors, after splitCopies
+        void addInstances(size_t meshIndex, const glm::mat4& modelMatrix);
+
+        // Draws the queued copies with impostor.vert / impostor.frag; the
+        // lighting uniforms are the caller's
+        void draw(Shader& shader, const glm::mat4& view, const glm::mat4& projection);
+
+        size_t getImpostorCount() const;
+        size_t getInstanceCount() const;
+
+    private:
+        struct Impostor {
+            size_t mesh;
+            // model-space sphere around one copy of the mesh
+            glm::vec3 center;
+            float radius;
+        };
+
+        // per copy, attributes 1-6 of impostor.vert
+        struct ImpostorInstance {
+            // impostor space (centred on the sphere) to world
+            glm::mat4 model;
+            // x: layer, y: radius
+            glm::vec4 params;
+            // rgb: the mesh's mean lightmap light, a: 1 when it has one
+            glm::vec4 bakedAmbient;
+        };
+
+        // the copies of a mesh on either side of the impostor distance, as
+        // model-space transforms (identity for a mesh drawn once)
+        struct CopySplit {
+            std::vector<glm::mat4> nearCopies;
+            std::vector<glm::mat4> farCopies;
+            GLuint nearBuffer = 0;
+            GLuint farBuffer = 0;
+            size_t nearCapacity = 0;
+            size_t farCapacity = 0;
+            uint64_t nearHash = 0;
+        };
+
+        const Model3D* model = nullptr;
+        std::vector<Impostor> impostors;
+        // impostor of each mesh, -1 for none
+        std::vector<int> meshImpostors;
+        std::vector<ImpostorInstance> instances;
+        // per mesh
+        std::vector<CopySplit> splits;
+
+        GLuint albedoTexture = 0;
+        GLuint normalDepthTexture = 0;
+        GLuint quadVAO = 0;
+        GLuint quadVBO = 0;
+        GLuint instanceVBO = 0;
+        size_t instanceCapacity = 0;
+
+        void selectMeshes(const Model3D& model);
+        void createTextures();
+        void bake(Model3D& model);
+        bool load(const std::string& fileName, const std::vector<uint64_t>& meshHashes);
+        bool save(const std::string& fileName, const std::vector<uint64_t>& meshHashes);
+        void initBuffers();
+        void uploadCopies(GLuint& buffer, size_t& capacity, const std::vector<glm::mat4>& transforms);
+    };
+}
+
+#endif /* ImpostorAtlas_hpp */
@@ -0,0 +1,299 @@
+#include "InstanceScatter.hpp"
+#include "MeshClusters.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+
+namespace gps {
+
+    void scatterInstances(const Heightfield& ground, const ScatterRule& rule, std::vector<ScatterInstance>& instances) {
+        if (ground.getWidth() < 2 || ground.getDepth() < 2 || rule.density <= 0.0f) {
+            return;
+        }
+
+        float spacing = 1.0f / std::sqrt(rule.density);
+        glm::vec2 origin = ground.getOrigin();
+        glm::vec2 extent = glm::vec2((float)(ground.getWidth() - 1), (float)(ground.getDepth() - 1)) * ground.getCellSize();
+        int cellsX = (int)(extent.x / spacing);
+        int cellsZ = (int)(extent.y / spacing);
+        float maxRise = std::tan(glm::radians(rule.maxSlopeDegrees)) * rule.footprint;
+        const glm::vec2 footprintOffsets[4] = {
+            glm::vec2(rule.footprint, 0.0f), glm::vec2(-rule.footprint, 0.0f),
+            glm::vec2(0.0f, rule.footprint), glm::vec2(0.0f, -rule.footprint)
+        };
+
+        std::mt19937 generator(rule.seed);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        for (int z = 0; z < cellsZ; z++) {
+            for (int x = 0; x < cellsX; x++) {
+                // everything is drawn before the tests, so tightening a rule
+                // removes instances without moving the others
+                float px = origin.x + (x + unit(generator)) * spacing;
+                float pz = origin.y + (z + unit(generator)) * spacing;
+                float scale = rule.minScale + (rule.maxScale - rule.minScale) * unit(generator);
+                float yaw = unit(generator) * 6.2831853f;
+
+                float height;
+                if (!ground.sample(px, pz, height) || height < rule.minHeight || height > rule.maxHeight) {
+                    continue;
+                }
+
+                // the steepest rise across the footprint also rejects the edges of roofs and walls
+                bool flat = true;
+                for (const glm::vec2& offset : footprintOffsets) {
+                    float neighbour;
+                    if (!ground.sample(px + offset.x, pz + offset.y, neighbour) || std::fabs(neighbour - height) > maxRise) {
+                        flat = false;
+                        break;
+                    }
+                }
+                if (!flat) {
+                    continue;
+                }
+
+                ScatterInstance instance;
+                instance.positionScale = glm::vec4(px, height, pz, scale);
+                instance.rotation = glm::vec4(std::cos(yaw), std::sin(yaw), 0.0f, 0.0f);
+                instances.push_back(instance);
+            }
+        }
+    }
+
+    InstanceScatter::~InstanceScatter() {
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            if (prototype->sourceVAO != 0) {
+                glDeleteVertexArrays(1, &prototype->sourceVAO);
+                glDeleteBuffers(1, &prototype->sourceBuffer);
+                glDeleteBuffers(2, prototype->culledBuffers);
+                glDeleteQueries(2, prototype->queries);
+            }
+        }
+    }
+
+    bool InstanceScatter::addPrototype(const std::string& name, const std::string& modelFile, float cullDistance) {
+        if (!std::ifstream(modelFile)) {
+            std::cout << "Scatter: no model " << modelFile << " for " << name << std::endl;
+            return false;
+        }
+
+        std::unique_ptr<Prototype> prototype(new Prototype());
+        prototype->name = name;
+        prototype->cullDistance = cullDistance;
+        prototype->model.LoadModel(modelFile);
+        const BoundingBox& modelBounds = prototype->model.getBounds();
+        if (!modelBounds.isEmpty()) {
+            prototype->boundsCenter = modelBounds.getCenter();
+            prototype->boundsRadius = glm::length(modelBounds.getExtents());
+        }
+        prototypes.push_back(std::move(prototype));
+        return true;
+    }
+
+    int InstanceScatter::findPrototype(const std::string& name) const {
+        for (size_t i = 0; i < prototypes.size(); i++) {
+            if (prototypes[i]->name == name) {
+                return (int)i;
+            }
+        }
+        return -1;
+    }
+
+    void InstanceScatter::addInstances(int prototype, const std::vector<ScatterInstance>& instances) {
+        Prototype& target = *prototypes[prototype];
+        for (const ScatterInstance& instance : instances) {
+            glm::vec3 position(instance.positionScale);
+            float radius = (glm::length(target.boundsCenter) + target.boundsRadius) * instance.positionScale.w;
+            bounds.expand(position - glm::vec3(radius));
+            bounds.expand(position + glm::vec3(radius));
+        }
+        target.instances.insert(target.instances.end(), instances.begin(), instances.end());
+    }
+
+    bool InstanceScatter::loadPoints(const std::string& fileName) {
+        std::ifstream file(fileName);
+        if (!file) {
+            return false;
+        }
+
+        std::vector<std::vector<ScatterInstance>> placements(prototypes.size());
+        std::string line;
+        int lineNumber = 0;
+        while (std::getline(file, line)) {
+            lineNumber++;
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+
+            std::istringstream stream(line);
+            std::string name;
+            glm::vec3 position;
+            if (!(stream >> name >> position.x >> position.y >> position.z)) {
+                std::cout << fileName << ":" << lineNumber << ": expected prototype x y z" << std::endl;
+                continue;
+            }
+            float yawDegrees = 0.0f;
+            float scale = 1.0f;
+            stream >> yawDegrees >> scale;
+
+            int prototype = findPrototype(name);
+            if (prototype < 0) {
+                std::cout << fileName << ":" << lineNumber << ": unknown prototype " << name << std::endl;
+                continue;
+            }
+
+            float yaw = glm::radians(yawDegrees);
+            ScatterInstance instance;
+            instance.positionScale = glm::vec4(position, scale);
+            instance.rotation = glm::vec4(std::cos(yaw), std::sin(yaw), 0.0f, 0.0f);
+            placements[prototype].push_back(instance);
+        }
+
+        for (size_t i = 0; i < prototypes.size(); i++) {
+            addInstances((int)i, placements[i]);
+        }
+        return true;
+    }
+
+    void InstanceScatter::init() {
+        std::vector<const char*> varyings = { "tfPositionScale", "tfRotation" };
+        cullShader.loadFeedbackShader("shaders/instanceCull.vert", "shaders/instanceCull.geom", varyings);
+
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            GLsizeiptr bytes = prototype->instances.size() * sizeof(ScatterInstance);
+
+            glGenVertexArrays(1, &prototype->sourceVAO);
+            glGenBuffers(1, &prototype->sourceBuffer);
+            glBindVertexArray(prototype->sourceVAO);
+            glBindBuffer(GL_ARRAY_BUFFER, prototype->sourceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, bytes, prototype->instances.data(), GL_STATIC_DRAW);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance), (GLvoid*)0);
+            glEnableVertexAttribArray(1);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(ScatterInstance), (GLvoid*)sizeof(glm::vec4));
+            glBindVertexArray(0);
+
+            // every instance may survive the cull
+            glGenBuffers(2, prototype->culledBuffers);
+            for (int i = 0; i < 2; i++) {
+                glBindBuffer(GL_ARRAY_BUFFER, prototype->culledBuffers[i]);
+                glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_COPY);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            glGenQueries(2, prototype->queries);
+
+            std::cout << "Scatter: " << prototype->instances.size() << " instances of " << prototype->name << std::endl;
+        }
+    }
+
+    void InstanceScatter::cull(const glm::mat4& view, const glm::mat4& projection) {
+        if (prototypes.empty()) {
+            return;
+        }
+
+        glm::vec4 frustumPlanes[6];
+        extractFrustumPlanes(projection * view, frustumPlanes);
+        glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+        int target = latest == 0 ? 1 : 0;
+
+        cullShader.useShaderProgram();
+        GLuint program = cullShader.shaderProgram;
+        glUniform4fv(glGetUniformLocation(program, "frustumPlanes"), 6, glm::value_ptr(frustumPlanes[0]));
+        glUniform3fv(glGetUniformLocation(program, "cameraPosition"), 1, glm::value_ptr(cameraPosition));
+        GLint cullDistanceLoc = glGetUniformLocation(program, "cullDistance");
+        GLint boundsCenterLoc = glGetUniformLocation(program, "boundsCenter");
+        GLint boundsRadiusLoc = glGetUniformLocation(program, "boundsRadius");
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            if (prototype->instances.empty()) {
+                continue;
+            }
+            // the previous pass has had a whole frame to finish, so this rarely waits
+            if (latest >= 0) {
+                glGetQueryObjectuiv(prototype->queries[latest], GL_QUERY_RESULT, &prototype->visibleCount);
+            }
+
+            glUniform1f(cullDistanceLoc, prototype->cullDistance);
+            glUniform3fv(boundsCenterLoc, 1, glm::value_ptr(prototype->boundsCenter));
+            glUniform1f(boundsRadiusLoc, prototype->boundsRadius);
+
+            glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, prototype->culledBuffers[target]);
+            glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, prototype->queries[target]);
+            glBeginTransformFeedback(GL_POINTS);
+            glBindVertexArray(prototype->sourceVAO);
+            glDrawArrays(GL_POINTS, 0, (GLsizei)prototype->instances.size());
+            glEndTransformFeedback();
+            glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+        }
+        glBindVertexArray(0);
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+
+        drawn = latest;
+        latest = target;
+    }
+
+    void InstanceScatter::draw(Shader& shader, int lod) {
+        if (drawn < 0) {
+            return;
+        }
+
+        shader.useShaderProgram();
+        GLint instancedLoc = glGetUniformLocation(shader.shaderProgram, "instanced");
+        glUniform1i(instancedLoc, 1);
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            prototype->model.DrawInstanced(shader, lod, prototype->culledBuffers[drawn], (GLsizei)prototype->visibleCount);
+        }
+        glUniform1i(instancedLoc, 0);
+    }
+
+    void InstanceScatter::drawAll(Shader& shader, int lod, const glm::vec3& cameraPosition) {
+        shader.useShaderProgram();
+        GLint instancedLoc = glGetUniformLocation(shader.shaderProgram, "instanced");
+        GLint cullCenterLoc = glGetUniformLocation(shader.shaderProgram, "instanceCullCenter");
+        GLint cullDistanceLoc = glGetUniformLocation(shader.shaderProgram, "instanceCullDistance");
+        glUniform1i(instancedLoc, 1);
+        glUniform3fv(cullCenterLoc, 1, glm::value_ptr(cameraPosition));
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            glUniform1f(cullDistanceLoc, prototype->cullDistance);
+            prototype->model.DrawInstanced(shader, lod, prototype->sourceBuffer, (GLsizei)prototype->instances.size());
+        }
+        glUniform1f(cullDistanceLoc, 0.0f);
+        glUniform1i(instancedLoc, 0);
+    }
+
+    const BoundingBox& InstanceScatter::getBounds() const {
+        return bounds;
+    }
+
+    size_t InstanceScatter::getInstanceCount() const {
+        size_t count = 0;
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            count += prototype->instances.size();
+        }
+        return count;
+    }
+
+    size_t InstanceScatter::getVisibleInstanceCount() const {
+        size_t count = 0;
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            count += prototype->visibleCount;
+        }
+        return count;
+    }
+
+    size_t InstanceScatter::getVisibleTriangleCount() const {
+        size_t count = 0;
+        for (const std::unique_ptr<Prototype>& prototype : prototypes) {
+            for (const Mesh& mesh : prototype->model.getMeshes()) {
+                count += (size_t)prototype->visibleCount * mesh.getTriangleCount(0);
+            }
+        }
+        return count;
+    }
+}
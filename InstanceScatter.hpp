@@ -0,0 +1,131 @@
+#ifndef InstanceScatter_hpp
+#define InstanceScatter_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+#include "Shader.hpp"
+#include "Heightfield.hpp"
+#include "BoundingBox.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // One placed copy of a prototype, as stored in the instance buffers and
+    // read by attributes 4 and 5 of basic.vert and depthShader.vert
+    struct ScatterInstance {
+        // xyz: position of the model's origin, w: uniform scale
+        glm::vec4 positionScale;
+        // cos and sin of the rotation about +Y, then unused
+        glm::vec4 rotation;
+    };
+
+    // Procedural placement over the ground: a jittered grid of cells
+    // 1 / sqrt(density) apart, keeping the points whose ground is flat enough
+    // and inside the height band
+    struct ScatterRule {
+        // instances per square world unit
+        float density = 0.01f;
+        float minScale = 1.0f;
+        float maxScale = 1.0f;
+        // steepest ground allowed, measured across footprint
+        float maxSlopeDegrees = 30.0f;
+        float footprint = 1.0f;
+        float minHeight = -FLT_MAX;
+        float maxHeight = FLT_MAX;
+        uint32_t seed = 1;
+    };
+
+    void scatterInstances(const Heightfield& ground, const ScatterRule& rule, std::vector<ScatterInstance>& instances);
+
+    // Thousands of copies of a few prototype models (pines, rocks). Every
+    // frame a transform feedback pass frustum and distance culls each
+    // prototype's instances into a compacted buffer, and each of its meshes
+    // is drawn once with glDrawElementsInstanced from that buffer.
+    // GL 4.1 cannot source the instance count from the GPU, so it is read
+    // back from a query one frame later: the instances drawn are those that
+    // passed the previous frame's cull.
+    class InstanceScatter {
+
+    public:
+        ~InstanceScatter();
+
+        // Loads modelFile as the prototype called name; instances beyond
+        // cullDistance from the camera are dropped. False if the file is missing.
+        bool addPrototype(const std::string& name, const std::string& modelFile, float cullDistance);
+
+        // -1 if there is no such prototype
+        int findPrototype(const std::string& name) const;
+
+        void addInstances(int prototype, const std::vector<ScatterInstance>& instances);
+
+        // Placements written by hand or by an external tool, one per line:
+        //   prototype x y z [yawDegrees] [scale]
+        // Lines starting with # are skipped. False if the file is missing.
+        bool loadPoints(const std::string& fileName);
+
+        // Uploads the instance buffers and loads the cull shaders, after the
+        // prototypes and their instances are added
+        void init();
+
+        // Runs the cull pass with the current camera
+        void cull(const glm::mat4& view, const glm::mat4& projection);
+
+        // Draws the instances that passed the last cull at a level of detail.
+        // The shader's "instanced" uniform is set for the draws and cleared after.
+        void draw(Shader& shader, int lod);
+
+        // Draws every instance within its prototype's cull distance of
+        // cameraPosition, frustum or not, for the cached shadow cascades
+        // (depthShader.vert drops the rest). The placements never move, so
+        // unlike draw this does not wait on a cull.
+        void drawAll(Shader& shader, int lod, const glm::vec3& cameraPosition);
+
+        // World bounds of every instance, for fitting the shadow cascades
+        const BoundingBox& getBounds() const;
+
+        size_t getInstanceCount() const;
+        size_t getVisibleInstanceCount() const;
+        // triangles submitted by the last draw call of every mesh, one pass
+        size_t getVisibleTriangleCount() const;
+
+    private:
+        struct Prototype {
+            std::string name;
+            Model3D model;
+            float cullDistance = 0.0f;
+            // model space sphere around the model's bounds
+            glm::vec3 boundsCenter = glm::vec3(0.0f);
+            float boundsRadius = 0.0f;
+            std::vector<ScatterInstance> instances;
+
+            GLuint sourceVAO = 0;
+            GLuint sourceBuffer = 0;
+            GLuint culledBuffers[2] = { 0, 0 };
+            GLuint queries[2] = { 0, 0 };
+            GLuint visibleCount = 0;
+        };
+
+        std::vector<std::unique_ptr<Prototype>> prototypes;
+        BoundingBox bounds;
+        Shader cullShader;
+        // culled buffer written by the last cull pass, -1 before the first
+        int latest = -1;
+        // culled buffer drawn this frame
+        int drawn = -1;
+    };
+}
+
+#endif /* InstanceScatter_hpp */
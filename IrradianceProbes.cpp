@@ -0,0 +1,60 @@
+#include "IrradianceProbes.hpp"
+
+#include <iostream>
+#include <vector>
+
+namespace gps {
+
+    IrradianceProbes::~IrradianceProbes() {
+        if (texture != 0) {
+            glDeleteTextures(1, &texture);
+        }
+    }
+
+    bool IrradianceProbes::load(const std::string& fileName) {
+        if (!loadProbeGrid(fileName, grid)) {
+            grid = ProbeGrid();
+            return false;
+        }
+
+        // probe order is x, y, z with the channels interleaved; the texture wants
+        // every channel's whole grid in its own block
+        size_t probeCount = (size_t)grid.width * grid.height * grid.depth;
+        std::vector<glm::vec4> texels(probeCount * 3);
+        for (size_t channel = 0; channel < 3; channel++) {
+            for (size_t probe = 0; probe < probeCount; probe++) {
+                texels[channel * probeCount + probe] = grid.coefficients[probe * 3 + channel];
+            }
+        }
+
+        if (texture == 0) {
+            glGenTextures(1, &texture);
+        }
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, grid.width, grid.height, grid.depth * 3, 0, GL_RGBA, GL_FLOAT, texels.data());
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        std::cout << "Probe grid     : " << fileName << ", " << grid.width << " x " << grid.height << " x " << grid.depth
+            << " probes, " << grid.spacing << " apart" << std::endl;
+        return true;
+    }
+
+    bool IrradianceProbes::isLoaded() const {
+        return !grid.coefficients.empty();
+    }
+
+    void IrradianceProbes::bind(GLuint shaderProgram, GLint textureUnit) {
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glUniform1i(glGetUniformLocation(shaderProgram, "probeGrid"), textureUnit);
+        glUniform3f(glGetUniformLocation(shaderProgram, "probeGridOrigin"), grid.origin.x, grid.origin.y, grid.origin.z);
+        glUniform1f(glGetUniformLocation(shaderProgram, "probeGridSpacing"), grid.spacing);
+        glUniform3i(glGetUniformLocation(shaderProgram, "probeGridSize"), grid.width, grid.height, grid.depth);
+        glActiveTexture(GL_TEXTURE0);
+    }
+}
@@ -0,0 +1,41 @@
+#ifndef IrradianceProbes_hpp
+#define IrradianceProbes_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "ProbeGrid.hpp"
+
+#include <string>
+
+namespace gps {
+
+    // A baked ProbeGrid on the GPU, ambient light for objects without a
+    // lightmap. The three color channels are stacked along z in one RGBA16F 3D
+    // texture (blocks of depth texels), so basic.frag gets the trilinearly
+    // interpolated probe with one fetch per channel.
+    class IrradianceProbes {
+
+    public:
+        ~IrradianceProbes();
+
+        bool load(const std::string& fileName);
+
+        bool isLoaded() const;
+
+        void bind(GLuint shaderProgram, GLint textureUnit);
+
+    private:
+        ProbeGrid grid;
+        GLuint texture = 0;
+    };
+}
+
+#endif /* IrradianceProbes_hpp */
@@ -0,0 +1,227 @@
+#include "LightClusters.hpp"
+#include "Parallel.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define LIGHT_CLUSTERS_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    float computeLightRange(const PointLight& light, float threshold) {
+        // solve  max(color) / (c + l*d + q*d^2) = threshold  for d
+        float intensity = std::max(light.color.r, std::max(light.color.g, light.color.b));
+        float c = light.constant - intensity / threshold;
+        if (light.quadratic <= 0.0f) {
+            return light.linear > 0.0f ? -c / light.linear : 1e30f;
+        }
+        float discriminant = light.linear * light.linear - 4.0f * light.quadratic * c;
+        return (-light.linear + std::sqrt(std::max(discriminant, 0.0f))) / (2.0f * light.quadratic);
+    }
+
+    void LightClusters::setProjection(float fovy, float aspect, float nearPlane, float farPlane) {
+        this->farPlane = farPlane;
+        this->sliceScale = SLICES / std::log(farPlane / CLUSTER_NEAR);
+
+        clusterMin.resize(CLUSTER_COUNT);
+        clusterMax.resize(CLUSTER_COUNT);
+
+        float tanY = std::tan(fovy * 0.5f);
+        float tanX = tanY * aspect;
+
+        for (int slice = 0; slice < SLICES; slice++) {
+            float zNear = slice == 0 ? nearPlane : CLUSTER_NEAR * std::pow(farPlane / CLUSTER_NEAR, (float)slice / SLICES);
+            float zFar = CLUSTER_NEAR * std::pow(farPlane / CLUSTER_NEAR, (float)(slice + 1) / SLICES);
+
+            for (int y = 0; y < TILES_Y; y++) {
+                float ndcY0 = -1.0f + 2.0f * y / TILES_Y;
+                float ndcY1 = -1.0f + 2.0f * (y + 1) / TILES_Y;
+
+                for (int x = 0; x < TILES_X; x++) {
+                    float ndcX0 = -1.0f + 2.0f * x / TILES_X;
+                    float ndcX1 = -1.0f + 2.0f * (x + 1) / TILES_X;
+
+                    // the tile is a pyramid section; bound its corners at both depths
+                    glm::vec3 minCorner(1e30f), maxCorner(-1e30f);
+                    float depths[2] = { zNear, zFar };
+                    for (int d = 0; d < 2; d++) {
+                        float z = depths[d];
+                        glm::vec3 a(ndcX0 * tanX * z, ndcY0 * tanY * z, -z);
+                        glm::vec3 b(ndcX1 * tanX * z, ndcY1 * tanY * z, -z);
+                        minCorner = glm::min(minCorner, glm::min(a, b));
+                        maxCorner = glm::max(maxCorner, glm::max(a, b));
+                    }
+
+                    int cluster = x + TILES_X * (y + TILES_Y * slice);
+                    clusterMin[cluster] = minCorner;
+                    clusterMax[cluster] = maxCorner;
+                }
+            }
+        }
+    }
+
+    void LightClusters::assignLights(const glm::mat4& view, const std::vector<PointLight>& lights) {
+        size_t lightCount = lights.size();
+        lightRanges.resize(lightCount);
+
+        // view-space light spheres, structure of arrays
+        std::vector<float> lightX(lightCount), lightY(lightCount), lightZ(lightCount), lightR(lightCount);
+        for (size_t i = 0; i < lightCount; i++) {
+            glm::vec3 position = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            lightRanges[i] = computeLightRange(lights[i], LIGHT_RANGE_THRESHOLD);
+            lightX[i] = position.x;
+            lightY[i] = position.y;
+            lightZ[i] = position.z;
+            lightR[i] = lightRanges[i];
+        }
+
+        std::vector<std::vector<uint32_t>> sliceIndices(SLICES);
+        std::vector<uint32_t> counts(CLUSTER_COUNT, 0);
+
+        parallelFor(SLICES, 1, [&](size_t begin, size_t end) {
+            std::vector<float> cx, cy, cz, cr2;
+            std::vector<uint32_t> candidates;
+
+            for (size_t slice = begin; slice < end; slice++) {
+                int firstCluster = (int)slice * TILES_X * TILES_Y;
+                float sliceMinZ = clusterMin[firstCluster].z;
+                float sliceMaxZ = clusterMax[firstCluster].z;
+
+                // lights overlapping the slice depth range, padded to a multiple
+                // of 4 with spheres that never pass the test
+                cx.clear(); cy.clear(); cz.clear(); cr2.clear(); candidates.clear();
+                for (size_t i = 0; i < lightCount; i++) {
+                    if (lightZ[i] - lightR[i] <= sliceMaxZ && lightZ[i] + lightR[i] >= sliceMinZ) {
+                        cx.push_back(lightX[i]);
+                        cy.push_back(lightY[i]);
+                        cz.push_back(lightZ[i]);
+                        cr2.push_back(lightR[i] * lightR[i]);
+                        candidates.push_back((uint32_t)i);
+                    }
+                }
+                while (cx.size() % 4 != 0) {
+                    cx.push_back(0.0f); cy.push_back(0.0f); cz.push_back(0.0f); cr2.push_back(-1.0f);
+                }
+
+                std::vector<uint32_t>& output = sliceIndices[slice];
+                for (int tile = 0; tile < TILES_X * TILES_Y; tile++) {
+                    int cluster = firstCluster + tile;
+                    const glm::vec3& bmin = clusterMin[cluster];
+                    const glm::vec3& bmax = clusterMax[cluster];
+                    size_t before = output.size();
+
+#if defined(LIGHT_CLUSTERS_SSE)
+                    __m128 minX = _mm_set1_ps(bmin.x), minY = _mm_set1_ps(bmin.y), minZ = _mm_set1_ps(bmin.z);
+                    __m128 maxX = _mm_set1_ps(bmax.x), maxY = _mm_set1_ps(bmax.y), maxZ = _mm_set1_ps(bmax.z);
+                    __m128 zero = _mm_setzero_ps();
+                    for (size_t i = 0; i < cx.size(); i += 4) {
+                        __m128 x = _mm_loadu_ps(&cx[i]);
+                        __m128 y = _mm_loadu_ps(&cy[i]);
+                        __m128 z = _mm_loadu_ps(&cz[i]);
+                        // distance from the sphere centre to the box, per axis
+                        __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero), _mm_max_ps(_mm_sub_ps(x, maxX), zero));
+                        __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero), _mm_max_ps(_mm_sub_ps(y, maxY), zero));
+                        __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minZ, z), zero), _mm_max_ps(_mm_sub_ps(z, maxZ), zero));
+                        __m128 distance2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                        int mask = _mm_movemask_ps(_mm_cmple_ps(distance2, _mm_loadu_ps(&cr2[i])));
+                        while (mask != 0) {
+                            int lane = 0;
+                            while (((mask >> lane) & 1) == 0) {
+                                lane++;
+                            }
+                            mask &= mask - 1;
+                            output.push_back(candidates[i + lane]);
+                        }
+                    }
+#else
+                    for (size_t i = 0; i < candidates.size(); i++) {
+                        float dx = std::max(bmin.x - cx[i], 0.0f) + std::max(cx[i] - bmax.x, 0.0f);
+                        float dy = std::max(bmin.y - cy[i], 0.0f) + std::max(cy[i] - bmax.y, 0.0f);
+                        float dz = std::max(bmin.z - cz[i], 0.0f) + std::max(cz[i] - bmax.z, 0.0f);
+                        if (dx * dx + dy * dy + dz * dz <= cr2[i]) {
+                            output.push_back(candidates[i]);
+                        }
+                    }
+#endif
+                    counts[cluster] = (uint32_t)(output.size() - before);
+                }
+            }
+        });
+
+        clusterGrid.resize(2 * CLUSTER_COUNT);
+        clusterIndices.clear();
+        for (int slice = 0; slice < SLICES; slice++) {
+            uint32_t sliceOffset = (uint32_t)clusterIndices.size();
+            clusterIndices.insert(clusterIndices.end(), sliceIndices[slice].begin(), sliceIndices[slice].end());
+            for (int tile = 0; tile < TILES_X * TILES_Y; tile++) {
+                int cluster = slice * TILES_X * TILES_Y + tile;
+                clusterGrid[2 * cluster + 0] = sliceOffset;
+                clusterGrid[2 * cluster + 1] = counts[cluster];
+                sliceOffset += counts[cluster];
+            }
+        }
+    }
+
+    void LightClusters::initBuffers() {
+        glGenBuffers(1, &lightBuffer);
+        glGenBuffers(1, &gridBuffer);
+        glGenBuffers(1, &indexBuffer);
+        glGenTextures(1, &lightTexture);
+        glGenTextures(1, &gridTexture);
+        glGenTextures(1, &indexTexture);
+    }
+
+    void LightClusters::upload(const std::vector<PointLight>& lights) {
+        // three texels per light: (position, range) (color, constant) (linear, quadratic, shadow slot, -)
+        std::vector<glm::vec4> lightData(3 * std::max<size_t>(lights.size(), 1), glm::vec4(0.0f));
+        for (size_t i = 0; i < lights.size(); i++) {
+            lightData[3 * i + 0] = glm::vec4(lights[i].position, lightRanges[i]);
+            lightData[3 * i + 1] = glm::vec4(lights[i].color, lights[i].constant);
+            lightData[3 * i + 2] = glm::vec4(lights[i].linear, lights[i].quadratic, (float)lights[i].shadowSlot, 0.0f);
+        }
+        if (clusterIndices.empty()) {
+            clusterIndices.push_back(0);
+        }
+
+        glBindBuffer(GL_TEXTURE_BUFFER, lightBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(glm::vec4), lightData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, gridBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, clusterGrid.size() * sizeof(uint32_t), clusterGrid.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, indexBuffer);
+        glBufferData(GL_TEXTURE_BUFFER, clusterIndices.size() * sizeof(uint32_t), clusterIndices.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::bind(GLuint shaderProgram, GLint firstTextureUnit, float viewportWidth, float viewportHeight) {
+        glActiveTexture(GL_TEXTURE0 + firstTextureUnit);
+        glBindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+        glUniform1i(glGetUniformLocation(shaderProgram, "lightData"), firstTextureUnit);
+
+        glActiveTexture(GL_TEXTURE0 + firstTextureUnit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, gridTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gridBuffer);
+        glUniform1i(glGetUniformLocation(shaderProgram, "clusterGrid"), firstTextureUnit + 1);
+
+        glActiveTexture(GL_TEXTURE0 + firstTextureUnit + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+        glUniform1i(glGetUniformLocation(shaderProgram, "clusterIndices"), firstTextureUnit + 2);
+
+        glUniform3i(glGetUniformLocation(shaderProgram, "clusterDims"), TILES_X, TILES_Y, SLICES);
+        glUniform2f(glGetUniformLocation(shaderProgram, "clusterTileSize"), viewportWidth / TILES_X, viewportHeight / TILES_Y);
+        glUniform1f(glGetUniformLocation(shaderProgram, "clusterNear"), CLUSTER_NEAR);
+        glUniform1f(glGetUniformLocation(shaderProgram, "clusterSliceScale"), sliceScale);
+
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    size_t LightClusters::getIndexCount() const {
+        return clusterIndices.size();
+    }
+}
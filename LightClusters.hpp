@@ -0,0 +1,83 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    struct PointLight {
+        glm::vec3 position;
+        glm::vec3 color;
+        float constant;
+        float linear;
+        float quadratic;
+        bool castsShadow = false;
+        // layer group in the point shadow cube map array, -1 = unshadowed
+        int shadowSlot = -1;
+    };
+
+    // contribution below which a light is treated as out of range
+    const float LIGHT_RANGE_THRESHOLD = 1.0f / 256.0f;
+
+    // Distance at which the light's attenuated contribution drops below threshold
+    float computeLightRange(const PointLight& light, float threshold);
+
+    // Clustered light culling: the view frustum is split into a froxel grid
+    // (screen tiles x exponential depth slices) and every cluster gets the list
+    // of lights whose range sphere touches it. The lists are built on the CPU
+    // and handed to the shader through texture buffers.
+    class LightClusters {
+
+    public:
+        static const int TILES_X = 16;
+        static const int TILES_Y = 9;
+        static const int SLICES = 24;
+        static const int CLUSTER_COUNT = TILES_X * TILES_Y * SLICES;
+
+        // start of the exponential slicing; everything closer is slice 0
+        static constexpr float CLUSTER_NEAR = 5.0f;
+
+        // Rebuilds the view-space cluster bounds
+        void setProjection(float fovy, float aspect, float nearPlane, float farPlane);
+
+        // Assigns lights to clusters (multi-threaded, SIMD sphere tests)
+        void assignLights(const glm::mat4& view, const std::vector<PointLight>& lights);
+
+        // GL side
+        void initBuffers();
+        void upload(const std::vector<PointLight>& lights);
+        // binds the light, cluster and index buffers to three consecutive units
+        // and sets the shader's clustering uniforms
+        void bind(GLuint shaderProgram, GLint firstTextureUnit, float viewportWidth, float viewportHeight);
+
+        size_t getIndexCount() const;
+
+    private:
+        float farPlane = 1000.0f;
+        float sliceScale = 1.0f;
+        std::vector<glm::vec3> clusterMin;
+        std::vector<glm::vec3> clusterMax;
+        std::vector<float> lightRanges;
+
+        // per cluster (offset, count) into clusterIndices
+        std::vector<uint32_t> clusterGrid;
+        std::vector<uint32_t> clusterIndices;
+
+        GLuint lightBuffer = 0, lightTexture = 0;
+        GLuint gridBuffer = 0, gridTexture = 0;
+        GLuint indexBuffer = 0, indexTexture = 0;
+    };
+}
+
+#endif /* LightClusters_hpp */
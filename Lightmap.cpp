@@ -0,0 +1,286 @@
+#include "Lightmap.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <unordered_map>
+
+namespace gps {
+
+    // texels of empty border around every chart, keeps bilinear filtering and
+    // the dilation pass from bleeding neighbouring charts into each other
+    static const int CHART_PADDING = 2;
+
+    static const char lightmapMagic[4] = { 'L', 'M', 'P', '1' };
+
+    void encodeRgbm(const glm::vec3& color, uint8_t* texel) {
+        glm::vec3 scaled = glm::max(color / LIGHTMAP_RANGE, glm::vec3(0.0f));
+        float multiplier = std::min(std::max(std::max(scaled.x, scaled.y), std::max(scaled.z, 1e-6f)), 1.0f);
+        multiplier = std::ceil(multiplier * 255.0f) / 255.0f;
+        for (int c = 0; c < 3; c++) {
+            float value = std::min(scaled[c] / multiplier, 1.0f);
+            texel[c] = (uint8_t)(value * 255.0f + 0.5f);
+        }
+        texel[3] = (uint8_t)(multiplier * 255.0f + 0.5f);
+    }
+
+    glm::vec3 decodeRgbm(const uint8_t* texel) {
+        float multiplier = texel[3] / 255.0f * LIGHTMAP_RANGE;
+        return glm::vec3(texel[0], texel[1], texel[2]) / 255.0f * multiplier;
+    }
+
+    bool loadLightmap(const std::string& fileName, Lightmap& lightmap) {
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        char magic[4];
+        int32_t size[2] = { 0, 0 };
+        uint32_t meshCount = 0;
+        file.read(magic, sizeof(magic));
+        file.read((char*)size, sizeof(size));
+        file.read((char*)&meshCount, sizeof(meshCount));
+        if (!file || std::memcmp(magic, lightmapMagic, sizeof(magic)) != 0 || size[0] <= 0 || size[1] <= 0) {
+            return false;
+        }
+
+        lightmap.width = size[0];
+        lightmap.height = size[1];
+        lightmap.meshCoords.assign(meshCount, std::vector<glm::vec2>());
+        for (uint32_t m = 0; m < meshCount && file; m++) {
+            uint32_t vertexCount = 0;
+            file.read((char*)&vertexCount, sizeof(vertexCount));
+            lightmap.meshCoords[m].resize(vertexCount);
+            file.read((char*)lightmap.meshCoords[m].data(), vertexCount * sizeof(glm::vec2));
+        }
+        lightmap.texels.resize((size_t)lightmap.width * lightmap.height * 4);
+        file.read((char*)lightmap.texels.data(), lightmap.texels.size());
+        return (bool)file;
+    }
+
+    bool saveLightmap(const std::string& fileName, const Lightmap& lightmap) {
+        std::ofstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        int32_t size[2] = { lightmap.width, lightmap.height };
+        uint32_t meshCount = (uint32_t)lightmap.meshCoords.size();
+        file.write(lightmapMagic, sizeof(lightmapMagic));
+        file.write((const char*)size, sizeof(size));
+        file.write((const char*)&meshCount, sizeof(meshCount));
+        for (uint32_t m = 0; m < meshCount; m++) {
+            uint32_t vertexCount = (uint32_t)lightmap.meshCoords[m].size();
+            file.write((const char*)&vertexCount, sizeof(vertexCount));
+            file.write((const char*)lightmap.meshCoords[m].data(), vertexCount * sizeof(glm::vec2));
+        }
+        file.write((const char*)lightmap.texels.data(), lightmap.texels.size());
+        return (bool)file;
+    }
+
+    struct Chart {
+        size_t mesh;
+        std::vector<uint32_t> triangles;
+        int uAxis;
+        int vAxis;
+        glm::vec2 minCoords;
+        glm::vec2 maxCoords;
+        int x;
+        int y;
+        int width;
+        int height;
+    };
+
+    struct PositionKey {
+        uint32_t bits[3];
+        bool operator==(const PositionKey& other) const {
+            return bits[0] == other.bits[0] && bits[1] == other.bits[1] && bits[2] == other.bits[2];
+        }
+    };
+
+    struct PositionKeyHash {
+        size_t operator()(const PositionKey& key) const {
+            return (size_t)key.bits[0] * 73856093u ^ (size_t)key.bits[1] * 19349663u ^ (size_t)key.bits[2] * 83492791u;
+        }
+    };
+
+    // dominant axis and sign of the face normal, 0..5
+    static int normalBin(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        glm::vec3 magnitude = glm::abs(normal);
+        int axis = 0;
+        if (magnitude.y > magnitude[axis]) axis = 1;
+        if (magnitude.z > magnitude[axis]) axis = 2;
+        return axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+    }
+
+    static void buildCharts(size_t mesh, const std::vector<glm::vec3>& corners, std::vector<Chart>& charts) {
+        uint32_t triangleCount = (uint32_t)(corners.size() / 3);
+
+        // weld corners so faces that share an edge in the OBJ become neighbours
+        std::unordered_map<PositionKey, uint32_t, PositionKeyHash> welded;
+        std::vector<uint32_t> cornerIds(corners.size());
+        for (size_t i = 0; i < corners.size(); i++) {
+            PositionKey key;
+            std::memcpy(key.bits, &corners[i], sizeof(key.bits));
+            auto found = welded.emplace(key, (uint32_t)welded.size());
+            cornerIds[i] = found.first->second;
+        }
+
+        // (edge, triangle) pairs sorted by edge give every edge's faces
+        std::vector<std::pair<uint64_t, uint32_t>> edges;
+        edges.reserve(corners.size());
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            for (int e = 0; e < 3; e++) {
+                uint64_t a = cornerIds[t * 3 + e];
+                uint64_t b = cornerIds[t * 3 + (e + 1) % 3];
+                if (a != b) {
+                    edges.push_back(std::make_pair(std::min(a, b) << 32 | std::max(a, b), t));
+                }
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+
+        std::vector<std::vector<uint32_t>> neighbours(triangleCount);
+        for (size_t begin = 0; begin < edges.size();) {
+            size_t end = begin + 1;
+            while (end < edges.size() && edges[end].first == edges[begin].first) {
+                end++;
+            }
+            for (size_t i = begin; i < end; i++) {
+                for (size_t j = i + 1; j < end; j++) {
+                    neighbours[edges[i].second].push_back(edges[j].second);
+                    neighbours[edges[j].second].push_back(edges[i].second);
+                }
+            }
+            begin = end;
+        }
+
+        std::vector<int> bins(triangleCount);
+        for (uint32_t t = 0; t < triangleCount; t++) {
+            bins[t] = normalBin(corners[t * 3], corners[t * 3 + 1], corners[t * 3 + 2]);
+        }
+
+        std::vector<bool> visited(triangleCount, false);
+        std::vector<uint32_t> stack;
+        for (uint32_t seed = 0; seed < triangleCount; seed++) {
+            if (visited[seed]) {
+                continue;
+            }
+
+            Chart chart;
+            chart.mesh = mesh;
+            int axis = bins[seed] / 2;
+            chart.uAxis = (axis + 1) % 3;
+            chart.vAxis = (axis + 2) % 3;
+
+            visited[seed] = true;
+            stack.push_back(seed);
+            while (!stack.empty()) {
+                uint32_t t = stack.back();
+                stack.pop_back();
+                chart.triangles.push_back(t);
+                for (uint32_t n : neighbours[t]) {
+                    if (!visited[n] && bins[n] == bins[seed]) {
+                        visited[n] = true;
+                        stack.push_back(n);
+                    }
+                }
+            }
+
+            chart.minCoords = glm::vec2(FLT_MAX);
+            chart.maxCoords = glm::vec2(-FLT_MAX);
+            for (uint32_t t : chart.triangles) {
+                for (int c = 0; c < 3; c++) {
+                    const glm::vec3& p = corners[t * 3 + c];
+                    glm::vec2 coords(p[chart.uAxis], p[chart.vAxis]);
+                    chart.minCoords = glm::min(chart.minCoords, coords);
+                    chart.maxCoords = glm::max(chart.maxCoords, coords);
+                }
+            }
+            charts.push_back(chart);
+        }
+    }
+
+    // shelf packing, tallest charts first; false if they do not fit
+    static bool packCharts(std::vector<Chart>& charts, float texelsPerUnit, int maxSize, int& usedWidth, int& usedHeight) {
+        for (Chart& chart : charts) {
+            glm::vec2 extent = (chart.maxCoords - chart.minCoords) * texelsPerUnit;
+            chart.width = (int)std::ceil(extent.x) + 1 + 2 * CHART_PADDING;
+            chart.height = (int)std::ceil(extent.y) + 1 + 2 * CHART_PADDING;
+            if (chart.width > maxSize || chart.height > maxSize) {
+                return false;
+            }
+        }
+
+        std::vector<Chart*> order;
+        for (Chart& chart : charts) {
+            order.push_back(&chart);
+        }
+        std::sort(order.begin(), order.end(), [](const Chart* a, const Chart* b) {
+            return a->height > b->height;
+        });
+
+        int x = 0;
+        int y = 0;
+        int shelfHeight = 0;
+        usedWidth = 0;
+        for (Chart* chart : order) {
+            if (x + chart->width > maxSize) {
+                x = 0;
+                y += shelfHeight;
+                shelfHeight = 0;
+            }
+            if (y + chart->height > maxSize) {
+                return false;
+            }
+            chart->x = x;
+            chart->y = y;
+            x += chart->width;
+            shelfHeight = std::max(shelfHeight, chart->height);
+            usedWidth = std::max(usedWidth, x);
+        }
+        usedHeight = y + shelfHeight;
+        return true;
+    }
+
+    float unwrapLightmap(const std::vector<std::vector<glm::vec3>>& meshCorners, float texelsPerUnit, int maxSize, Lightmap& lightmap) {
+        std::vector<Chart> charts;
+        for (size_t m = 0; m < meshCorners.size(); m++) {
+            buildCharts(m, meshCorners[m], charts);
+        }
+
+        int usedWidth = 0;
+        int usedHeight = 0;
+        while (!packCharts(charts, texelsPerUnit, maxSize, usedWidth, usedHeight)) {
+            texelsPerUnit *= 0.85f;
+        }
+
+        // rows of 4 texels keep the upload aligned
+        lightmap.width = std::max((usedWidth + 3) / 4 * 4, 4);
+        lightmap.height = std::max((usedHeight + 3) / 4 * 4, 4);
+        lightmap.texels.assign((size_t)lightmap.width * lightmap.height * 4, 0);
+        lightmap.meshCoords.assign(meshCorners.size(), std::vector<glm::vec2>());
+        for (size_t m = 0; m < meshCorners.size(); m++) {
+            lightmap.meshCoords[m].resize(meshCorners[m].size());
+        }
+
+        glm::vec2 atlasSize((float)lightmap.width, (float)lightmap.height);
+        for (const Chart& chart : charts) {
+            const std::vector<glm::vec3>& corners = meshCorners[chart.mesh];
+            glm::vec2 origin(chart.x + CHART_PADDING + 0.5f, chart.y + CHART_PADDING + 0.5f);
+            for (uint32_t t : chart.triangles) {
+                for (int c = 0; c < 3; c++) {
+                    const glm::vec3& p = corners[t * 3 + c];
+                    glm::vec2 coords(p[chart.uAxis], p[chart.vAxis]);
+                    glm::vec2 texel = origin + (coords - chart.minCoords) * texelsPerUnit;
+                    lightmap.meshCoords[chart.mesh][t * 3 + c] = texel / atlasSize;
+                }
+            }
+        }
+        return texelsPerUnit;
+    }
+}
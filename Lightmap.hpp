@@ -0,0 +1,41 @@
+#ifndef Lightmap_hpp
+#define Lightmap_hpp
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Baked sky and bounce light of one model: lightmap coordinates for every
+    // vertex of every mesh (in Model3D's order, one vertex per OBJ face corner)
+    // and an RGBM atlas holding irradiance / pi, the same scale as lightColor
+    struct Lightmap {
+        int width = 0;
+        int height = 0;
+        std::vector<std::vector<glm::vec2>> meshCoords;
+        // RGBA8, rows from v = 0
+        std::vector<uint8_t> texels;
+    };
+
+    // largest value RGBM can hold: rgb * a * LIGHTMAP_RANGE
+    const float LIGHTMAP_RANGE = 8.0f;
+
+    void encodeRgbm(const glm::vec3& color, uint8_t* texel);
+    glm::vec3 decodeRgbm(const uint8_t* texel);
+
+    bool loadLightmap(const std::string& fileName, Lightmap& lightmap);
+    bool saveLightmap(const std::string& fileName, const Lightmap& lightmap);
+
+    // Generates lightmap coordinates: triangles are grouped into charts of
+    // connected faces sharing a dominant normal axis, each chart is projected
+    // along that axis and the charts are shelf-packed into an atlas at most
+    // maxSize wide and high, lowering texelsPerUnit until they fit.
+    // meshCorners[m] holds three positions per triangle of mesh m.
+    // Returns the texel density actually used.
+    float unwrapLightmap(const std::vector<std::vector<glm::vec3>>& meshCorners, float texelsPerUnit, int maxSize, Lightmap& lightmap);
+}
+
+#endif /* Lightmap_hpp */
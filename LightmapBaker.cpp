@@ -0,0 +1,663 @@
+// Offline lightmap baker, a separate console program from the viewer.
+//
+// Unwraps every mesh of an OBJ into a lightmap atlas and path traces the sky
+// light (which doubles as ambient occlusion) and the sun and sky light
+// bouncing off the scene into it, on all cores, against a Bvh. The same light
+// is baked into a grid of irradiance probes for the objects that move. The
+// direct sun term is left to the renderer, which moves the sun. Needs no GL
+// context, so it runs on a headless Linux box:
+//
+//   g++ -O2 -std=c++17 -pthread -msse2 -DGLM_ENABLE_EXPERIMENTAL LightmapBaker.cpp Lightmap.cpp ProbeGrid.cpp Bvh.cpp Parallel.cpp tiny_obj_loader.cpp stb_image.cpp -o LightmapBaker
+//   ./LightmapBaker models/scenaFinala/finalScene.obj
+//
+// writes models/scenaFinala/finalScene.lightmap, which Model3D::LoadLightmap
+// reads, and finalScene.probes for IrradianceProbes.
+
+#include "Lightmap.hpp"
+#include "ProbeGrid.hpp"
+#include "Bvh.hpp"
+#include "Parallel.hpp"
+
+#include "tiny_obj_loader.h"
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+struct BakeSettings {
+    std::string objFile;
+    std::string outputFile;
+    std::string probesFile;
+    float texelsPerUnit = 8.0f;
+    int maxSize = 1024;
+    int samples = 64;
+    // sun and sky light bounces after the first hit; 0 bakes only sky occlusion
+    int bounces = 2;
+    unsigned int threads = 0;
+    // towards the sun, the renderer's sun position at lightAngle 0
+    glm::vec3 sunDirection = glm::vec3(30.0f, 10.0f, 0.0f);
+    glm::vec3 sunColor = glm::vec3(1.0f);
+    // radiance of the open sky; 0.2 matches basic.frag's flat ambientStrength
+    glm::vec3 skyColor = glm::vec3(0.2f);
+    // 0 skips the probe grid
+    float probeSpacing = 2.0f;
+    int probeSamples = 256;
+};
+
+const int MAX_PROBES_PER_AXIS = 64;
+// probes seeing more back faces than this are inside geometry
+const float PROBE_MAX_BACKFACE_RATIO = 0.3f;
+
+// The scene as Model3D::ReadOBJ lays it out: one mesh per OBJ shape, three
+// vertices per triangle
+struct BakeScene {
+    std::vector<std::vector<glm::vec3>> meshCorners;
+    std::vector<std::vector<glm::vec3>> meshNormals;
+    std::vector<uint32_t> meshFirstTriangles;
+    // per triangle of the whole scene, in Bvh order
+    std::vector<glm::vec3> faceNormals;
+    std::vector<glm::vec3> albedos;
+    gps::Bvh bvh;
+    // pushes ray origins off the surface they leave
+    float bias = 1e-4f;
+};
+
+struct TexelSample {
+    uint32_t texel;
+    glm::vec3 position;
+    glm::vec3 normal;
+    glm::vec3 faceNormal;
+};
+
+struct Random {
+    uint32_t state;
+
+    explicit Random(uint32_t seed) : state(seed * 747796405u + 2891336453u) {
+        if (state == 0) {
+            state = 1;
+        }
+    }
+
+    // xorshift32, uniform in [0, 1)
+    float next() {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    }
+};
+
+static glm::vec3 sampleCosineHemisphere(const glm::vec3& normal, Random& random) {
+    glm::vec3 tangent = std::fabs(normal.x) > 0.9f ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    tangent = glm::normalize(glm::cross(tangent, normal));
+    glm::vec3 bitangent = glm::cross(normal, tangent);
+
+    float angle = 6.2831853f * random.next();
+    float radiusSquared = random.next();
+    float radius = std::sqrt(radiusSquared);
+    return tangent * (radius * std::cos(angle)) + bitangent * (radius * std::sin(angle)) + normal * std::sqrt(1.0f - radiusSquared);
+}
+
+// Average color of a diffuse texture, in linear space like the renderer's
+// GL_SRGB textures; white when the image cannot be read
+static glm::vec3 averageTextureColor(const std::string& path) {
+    int width, height, channels;
+    unsigned char* image = stbi_load(path.c_str(), &width, &height, &channels, 3);
+    if (!image) {
+        std::cerr << "Could not load " << path << std::endl;
+        return glm::vec3(1.0f);
+    }
+
+    float linear[256];
+    for (int i = 0; i < 256; i++) {
+        linear[i] = std::pow(i / 255.0f, 2.2f);
+    }
+
+    glm::dvec3 sum(0.0);
+    size_t pixelCount = (size_t)width * height;
+    for (size_t i = 0; i < pixelCount; i++) {
+        sum += glm::dvec3(linear[image[i * 3]], linear[image[i * 3 + 1]], linear[image[i * 3 + 2]]);
+    }
+    stbi_image_free(image);
+    return glm::vec3(sum / (double)std::max(pixelCount, (size_t)1));
+}
+
+static bool loadScene(const std::string& fileName, BakeScene& scene) {
+    std::string basePath;
+    size_t slash = fileName.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        basePath = fileName.substr(0, slash + 1);
+    }
+
+    tinyobj::attrib_t attrib;
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string err;
+    bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true);
+    if (!err.empty()) {
+        std::cerr << err << std::endl;
+    }
+    if (!ret) {
+        return false;
+    }
+
+    // the renderer shades with the diffuse texture alone, so that is the albedo
+    std::map<std::string, glm::vec3> textureColors;
+    std::vector<glm::vec3> positions;
+    for (size_t s = 0; s < shapes.size(); s++) {
+        const tinyobj::mesh_t& mesh = shapes[s].mesh;
+
+        glm::vec3 albedo(1.0f);
+        if (!mesh.material_ids.empty() && mesh.material_ids[0] >= 0 && mesh.material_ids[0] < (int)materials.size()) {
+            const tinyobj::material_t& material = materials[mesh.material_ids[0]];
+            if (!material.diffuse_texname.empty()) {
+                auto found = textureColors.find(material.diffuse_texname);
+                if (found == textureColors.end()) {
+                    found = textureColors.emplace(material.diffuse_texname, averageTextureColor(basePath + material.diffuse_texname)).first;
+                }
+                albedo = found->second;
+            }
+            else {
+                albedo = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+            }
+        }
+
+        std::vector<glm::vec3> corners;
+        std::vector<glm::vec3> normals;
+        for (size_t i = 0; i < mesh.indices.size(); i++) {
+            tinyobj::index_t idx = mesh.indices[i];
+            corners.push_back(glm::vec3(attrib.vertices[3 * idx.vertex_index + 0],
+                attrib.vertices[3 * idx.vertex_index + 1], attrib.vertices[3 * idx.vertex_index + 2]));
+            if (idx.normal_index >= 0) {
+                normals.push_back(glm::vec3(attrib.normals[3 * idx.normal_index + 0],
+                    attrib.normals[3 * idx.normal_index + 1], attrib.normals[3 * idx.normal_index + 2]));
+            }
+            else {
+                normals.push_back(glm::vec3(0.0f));
+            }
+        }
+
+        scene.meshFirstTriangles.push_back((uint32_t)(positions.size() / 3));
+        for (size_t t = 0; t + 2 < corners.size(); t += 3) {
+            glm::vec3 normal = glm::cross(corners[t + 1] - corners[t], corners[t + 2] - corners[t]);
+            float length = glm::length(normal);
+            scene.faceNormals.push_back(length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f));
+            scene.albedos.push_back(albedo);
+        }
+        positions.insert(positions.end(), corners.begin(), corners.end());
+        scene.meshCorners.push_back(corners);
+        scene.meshNormals.push_back(normals);
+    }
+
+    std::vector<uint32_t> indices(positions.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+        indices[i] = (uint32_t)i;
+    }
+    scene.bvh.build(positions, indices);
+
+    glm::vec3 extent = scene.bvh.getBounds().max - scene.bvh.getBounds().min;
+    scene.bias = std::max(glm::length(extent) * 1e-5f, 1e-4f);
+    std::cout << "Scene          : " << shapes.size() << " meshes, " << scene.bvh.getTriangleCount() << " triangles, "
+        << textureColors.size() << " textures" << std::endl;
+    return true;
+}
+
+// Texel centers covered by the meshes' lightmap triangles
+static void rasterizeTexels(const BakeScene& scene, const gps::Lightmap& lightmap, std::vector<TexelSample>& samples) {
+    std::vector<int> texelSamples((size_t)lightmap.width * lightmap.height, -1);
+    glm::vec2 atlasSize((float)lightmap.width, (float)lightmap.height);
+
+    for (size_t m = 0; m < scene.meshCorners.size(); m++) {
+        const std::vector<glm::vec3>& corners = scene.meshCorners[m];
+        const std::vector<glm::vec3>& normals = scene.meshNormals[m];
+        const std::vector<glm::vec2>& coords = lightmap.meshCoords[m];
+
+        for (size_t t = 0; t + 2 < corners.size(); t += 3) {
+            glm::vec2 a = coords[t] * atlasSize;
+            glm::vec2 b = coords[t + 1] * atlasSize;
+            glm::vec2 c = coords[t + 2] * atlasSize;
+            float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+            if (std::fabs(area) < 1e-8f) {
+                continue;
+            }
+
+            glm::vec3 faceNormal = scene.faceNormals[scene.meshFirstTriangles[m] + t / 3];
+            int minX = std::max((int)std::floor(std::min(a.x, std::min(b.x, c.x))), 0);
+            int minY = std::max((int)std::floor(std::min(a.y, std::min(b.y, c.y))), 0);
+            int maxX = std::min((int)std::ceil(std::max(a.x, std::max(b.x, c.x))), lightmap.width - 1);
+            int maxY = std::min((int)std::ceil(std::max(a.y, std::max(b.y, c.y))), lightmap.height - 1);
+            for (int y = minY; y <= maxY; y++) {
+                for (int x = minX; x <= maxX; x++) {
+                    glm::vec2 p(x + 0.5f, y + 0.5f);
+                    float w0 = ((b.x - p.x) * (c.y - p.y) - (b.y - p.y) * (c.x - p.x)) / area;
+                    float w1 = ((c.x - p.x) * (a.y - p.y) - (c.y - p.y) * (a.x - p.x)) / area;
+                    float w2 = 1.0f - w0 - w1;
+                    if (w0 < -1e-4f || w1 < -1e-4f || w2 < -1e-4f) {
+                        continue;
+                    }
+
+                    TexelSample sample;
+                    sample.texel = (uint32_t)(y * lightmap.width + x);
+                    sample.position = corners[t] * w0 + corners[t + 1] * w1 + corners[t + 2] * w2;
+                    glm::vec3 normal = normals[t] * w0 + normals[t + 1] * w1 + normals[t + 2] * w2;
+                    float length = glm::length(normal);
+                    sample.normal = length > 0.0f ? normal / length : faceNormal;
+                    // the side of the face the shading normal looks out of
+                    sample.faceNormal = glm::dot(faceNormal, sample.normal) < 0.0f ? -faceNormal : faceNormal;
+
+                    int& slot = texelSamples[sample.texel];
+                    if (slot < 0) {
+                        slot = (int)samples.size();
+                        samples.push_back(sample);
+                    }
+                    else {
+                        samples[slot] = sample;
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Light leaving a hit point towards the ray's origin
+static glm::vec3 shadeHit(const BakeScene& scene, const BakeSettings& settings, const gps::Ray& ray, const gps::RayHit& hit,
+    Random& random, int bouncesLeft) {
+    glm::vec3 normal = scene.faceNormals[hit.triangle];
+    if (glm::dot(normal, ray.direction) > 0.0f) {
+        normal = -normal;
+    }
+    glm::vec3 position = ray.origin + ray.direction * hit.distance + normal * scene.bias;
+
+    glm::vec3 light(0.0f);
+    float sunCos = glm::dot(normal, settings.sunDirection);
+    if (sunCos > 0.0f) {
+        gps::Ray shadowRay;
+        shadowRay.origin = position;
+        shadowRay.direction = settings.sunDirection;
+        if (!scene.bvh.occluded(shadowRay)) {
+            light += settings.sunColor * sunCos;
+        }
+    }
+
+    if (bouncesLeft > 0) {
+        gps::Ray bounce;
+        bounce.origin = position;
+        bounce.direction = sampleCosineHemisphere(normal, random);
+        gps::RayHit bounceHit;
+        if (scene.bvh.intersect(bounce, bounceHit)) {
+            light += shadeHit(scene, settings, bounce, bounceHit, random, bouncesLeft - 1);
+        }
+        else {
+            light += settings.skyColor;
+        }
+    }
+    return scene.albedos[hit.triangle] * light;
+}
+
+// Mean incoming radiance over the cosine-weighted hemisphere, i.e. irradiance
+// / pi, which the renderer multiplies by the albedo like its lightColor terms
+static glm::vec3 bakeTexel(const BakeScene& scene, const BakeSettings& settings, const TexelSample& sample,
+    std::vector<gps::Ray>& rays, std::vector<gps::RayHit>& hits) {
+    Random random(sample.texel * 9781u + 1u);
+    glm::vec3 origin = sample.position + sample.faceNormal * scene.bias;
+
+    // the first bounce leaves one point, so its rays stay coherent enough for packets
+    for (int s = 0; s < settings.samples; s++) {
+        rays[s].origin = origin;
+        rays[s].direction = sampleCosineHemisphere(sample.normal, random);
+        rays[s].maxDistance = FLT_MAX;
+        hits[s] = gps::RayHit();
+    }
+    scene.bvh.intersect(rays.data(), hits.data(), settings.samples);
+
+    glm::vec3 sum(0.0f);
+    for (int s = 0; s < settings.samples; s++) {
+        if (!hits[s].isHit()) {
+            sum += settings.skyColor;
+        }
+        else if (settings.bounces > 0) {
+            sum += shadeHit(scene, settings, rays[s], hits[s], random, settings.bounces - 1);
+        }
+    }
+    return sum / (float)settings.samples;
+}
+
+// Spreads the baked texels into the empty ones around them, so bilinear
+// filtering at chart borders does not pull in black
+static void dilate(int width, int height, std::vector<glm::vec3>& texels, std::vector<uint8_t>& covered, int passes) {
+    for (int pass = 0; pass < passes; pass++) {
+        std::vector<glm::vec3> source = texels;
+        std::vector<uint8_t> sourceCovered = covered;
+        for (int y = 0; y < height; y++) {
+            for (int x = 0; x < width; x++) {
+                size_t index = (size_t)y * width + x;
+                if (sourceCovered[index]) {
+                    continue;
+                }
+                glm::vec3 sum(0.0f);
+                int count = 0;
+                for (int dy = -1; dy <= 1; dy++) {
+                    for (int dx = -1; dx <= 1; dx++) {
+                        int nx = x + dx;
+                        int ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= width || ny >= height) {
+                            continue;
+                        }
+                        size_t neighbour = (size_t)ny * width + nx;
+                        if (sourceCovered[neighbour]) {
+                            sum += source[neighbour];
+                            count++;
+                        }
+                    }
+                }
+                if (count > 0) {
+                    texels[index] = sum / (float)count;
+                    covered[index] = 1;
+                }
+            }
+        }
+    }
+}
+
+// Directions spread evenly over the sphere (Fibonacci spiral)
+static void sphereDirections(int count, std::vector<glm::vec3>& directions) {
+    const float goldenAngle = 2.3999632f;
+    directions.resize(count);
+    for (int i = 0; i < count; i++) {
+        float y = 1.0f - (i + 0.5f) * 2.0f / count;
+        float radius = std::sqrt(std::max(1.0f - y * y, 0.0f));
+        float angle = goldenAngle * i;
+        directions[i] = glm::vec3(radius * std::cos(angle), y, radius * std::sin(angle));
+    }
+}
+
+// Projects the light arriving at every probe onto L1 spherical harmonics and
+// convolves it with the cosine lobe. Probes that end up inside geometry take
+// the average of their valid neighbours.
+static void bakeProbes(const BakeScene& scene, const BakeSettings& settings, gps::ProbeGrid& grid) {
+    const gps::BoundingBox& bounds = scene.bvh.getBounds();
+    glm::vec3 extent = bounds.max - bounds.min;
+    float largest = std::max(extent.x, std::max(extent.y, extent.z));
+    grid.spacing = std::max(settings.probeSpacing, largest / (MAX_PROBES_PER_AXIS - 1));
+    grid.width = std::max((int)std::ceil(extent.x / grid.spacing), 1);
+    grid.height = std::max((int)std::ceil(extent.y / grid.spacing), 1);
+    grid.depth = std::max((int)std::ceil(extent.z / grid.spacing), 1);
+    // centered, so no probe sits right on the bounds' outer faces
+    glm::vec3 gridExtent = glm::vec3((float)(grid.width - 1), (float)(grid.height - 1), (float)(grid.depth - 1)) * grid.spacing;
+    grid.origin = (bounds.min + bounds.max) * 0.5f - gridExtent * 0.5f;
+
+    size_t probeCount = (size_t)grid.width * grid.height * grid.depth;
+    grid.coefficients.assign(probeCount * 3, glm::vec4(0.0f));
+    std::vector<uint8_t> valid(probeCount, 0);
+
+    std::vector<glm::vec3> directions;
+    sphereDirections(settings.probeSamples, directions);
+    const float Y0 = 0.282095f;
+    const float Y1 = 0.488603f;
+    const float weight = 4.0f * 3.14159265f / settings.probeSamples;
+
+    gps::parallelFor(probeCount, 4, [&](size_t begin, size_t end) {
+        std::vector<gps::Ray> rays(settings.probeSamples);
+        std::vector<gps::RayHit> hits(settings.probeSamples);
+        for (size_t p = begin; p < end; p++) {
+            int x = (int)(p % grid.width);
+            int y = (int)(p / grid.width % grid.height);
+            int z = (int)(p / ((size_t)grid.width * grid.height));
+            glm::vec3 position = grid.origin + glm::vec3((float)x, (float)y, (float)z) * grid.spacing;
+
+            Random random((uint32_t)p * 7919u + 17u);
+            for (int s = 0; s < settings.probeSamples; s++) {
+                rays[s].origin = position;
+                rays[s].direction = directions[s];
+                rays[s].maxDistance = FLT_MAX;
+                hits[s] = gps::RayHit();
+            }
+            scene.bvh.intersect(rays.data(), hits.data(), settings.probeSamples);
+
+            glm::vec3 c0(0.0f);
+            glm::vec3 c1[3] = { glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f) };
+            int backfaces = 0;
+            for (int s = 0; s < settings.probeSamples; s++) {
+                glm::vec3 radiance(0.0f);
+                if (!hits[s].isHit()) {
+                    radiance = settings.skyColor;
+                }
+                else {
+                    if (glm::dot(scene.faceNormals[hits[s].triangle], directions[s]) > 0.0f) {
+                        backfaces++;
+                    }
+                    if (settings.bounces > 0) {
+                        radiance = shadeHit(scene, settings, rays[s], hits[s], random, settings.bounces - 1);
+                    }
+                }
+                c0 += radiance * Y0;
+                for (int axis = 0; axis < 3; axis++) {
+                    c1[axis] += radiance * (Y1 * directions[s][axis]);
+                }
+            }
+
+            // cosine lobe convolution (pi, 2 pi / 3) and the division by pi
+            for (int channel = 0; channel < 3; channel++) {
+                grid.coefficients[p * 3 + channel] = glm::vec4(c0[channel] * weight * Y0,
+                    c1[0][channel] * weight * Y1 * (2.0f / 3.0f),
+                    c1[1][channel] * weight * Y1 * (2.0f / 3.0f),
+                    c1[2][channel] * weight * Y1 * (2.0f / 3.0f));
+            }
+            valid[p] = backfaces <= PROBE_MAX_BACKFACE_RATIO * settings.probeSamples;
+        }
+    });
+
+    size_t validCount = 0;
+    for (uint8_t v : valid) {
+        validCount += v;
+    }
+    std::cout << "Probes         : " << grid.width << " x " << grid.height << " x " << grid.depth << ", " << grid.spacing
+        << " apart, " << probeCount - validCount << " inside geometry" << std::endl;
+    if (validCount == 0) {
+        return;
+    }
+
+    // flood the invalid probes from their valid neighbours
+    const int offsets[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    while (validCount < probeCount) {
+        std::vector<uint8_t> sourceValid = valid;
+        for (size_t p = 0; p < probeCount; p++) {
+            if (sourceValid[p]) {
+                continue;
+            }
+            int x = (int)(p % grid.width);
+            int y = (int)(p / grid.width % grid.height);
+            int z = (int)(p / ((size_t)grid.width * grid.height));
+            glm::vec4 sum[3] = { glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f) };
+            int count = 0;
+            for (int n = 0; n < 6; n++) {
+                int nx = x + offsets[n][0];
+                int ny = y + offsets[n][1];
+                int nz = z + offsets[n][2];
+                if (nx < 0 || ny < 0 || nz < 0 || nx >= grid.width || ny >= grid.height || nz >= grid.depth) {
+                    continue;
+                }
+                size_t neighbour = grid.probeIndex(nx, ny, nz);
+                if (sourceValid[neighbour]) {
+                    for (int channel = 0; channel < 3; channel++) {
+                        sum[channel] += grid.coefficients[neighbour * 3 + channel];
+                    }
+                    count++;
+                }
+            }
+            if (count > 0) {
+                for (int channel = 0; channel < 3; channel++) {
+                    grid.coefficients[p * 3 + channel] = sum[channel] / (float)count;
+                }
+                valid[p] = 1;
+                validCount++;
+            }
+        }
+    }
+}
+
+static void printUsage() {
+    std::cout << "Usage: LightmapBaker <model.obj> [options]\n"
+        << "  --out <file>              output, default <model>.lightmap\n"
+        << "  --texels-per-unit <n>     lightmap density, lowered until the atlas fits (8)\n"
+        << "  --size <n>                largest atlas width and height (1024)\n"
+        << "  --samples <n>             hemisphere rays per texel (64)\n"
+        << "  --bounces <n>             light bounces after the first hit, 0 for sky occlusion only (2)\n"
+        << "  --sun <x> <y> <z>         direction towards the sun (30 10 0)\n"
+        << "  --sun-color <r> <g> <b>   (1 1 1)\n"
+        << "  --sky <r> <g> <b>         open sky radiance (0.2 0.2 0.2)\n"
+        << "  --probes <file>           probe grid output, default <model>.probes\n"
+        << "  --probe-spacing <n>       distance between irradiance probes, 0 to skip them (2)\n"
+        << "  --probe-samples <n>       rays per probe (256)\n"
+        << "  --threads <n>             worker threads, 0 for all cores (0)" << std::endl;
+}
+
+static bool parseArguments(int argc, char** argv, BakeSettings& settings) {
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        int left = argc - i - 1;
+        if (arg == "--out" && left >= 1) {
+            settings.outputFile = argv[++i];
+        }
+        else if (arg == "--texels-per-unit" && left >= 1) {
+            settings.texelsPerUnit = (float)std::atof(argv[++i]);
+        }
+        else if (arg == "--size" && left >= 1) {
+            settings.maxSize = std::atoi(argv[++i]);
+        }
+        else if (arg == "--samples" && left >= 1) {
+            settings.samples = std::atoi(argv[++i]);
+        }
+        else if (arg == "--bounces" && left >= 1) {
+            settings.bounces = std::atoi(argv[++i]);
+        }
+        else if (arg == "--probes" && left >= 1) {
+            settings.probesFile = argv[++i];
+        }
+        else if (arg == "--probe-spacing" && left >= 1) {
+            settings.probeSpacing = (float)std::atof(argv[++i]);
+        }
+        else if (arg == "--probe-samples" && left >= 1) {
+            settings.probeSamples = std::atoi(argv[++i]);
+        }
+        else if (arg == "--threads" && left >= 1) {
+            settings.threads = (unsigned int)std::atoi(argv[++i]);
+        }
+        else if ((arg == "--sun" || arg == "--sun-color" || arg == "--sky") && left >= 3) {
+            glm::vec3 value((float)std::atof(argv[i + 1]), (float)std::atof(argv[i + 2]), (float)std::atof(argv[i + 3]));
+            i += 3;
+            if (arg == "--sun") {
+                settings.sunDirection = value;
+            }
+            else if (arg == "--sun-color") {
+                settings.sunColor = value;
+            }
+            else {
+                settings.skyColor = value;
+            }
+        }
+        else if (arg[0] != '-' && settings.objFile.empty()) {
+            settings.objFile = arg;
+        }
+        else {
+            std::cerr << "Unknown or incomplete option " << arg << std::endl;
+            return false;
+        }
+    }
+
+    if (settings.objFile.empty() || settings.samples < 1 || settings.probeSamples < 1 || settings.maxSize < 16 || settings.texelsPerUnit <= 0.0f
+        || glm::length(settings.sunDirection) == 0.0f) {
+        return false;
+    }
+    settings.sunDirection = glm::normalize(settings.sunDirection);
+    std::string base = settings.objFile;
+    if (base.size() > 4 && base.substr(base.size() - 4) == ".obj") {
+        base = base.substr(0, base.size() - 4);
+    }
+    if (settings.outputFile.empty()) {
+        settings.outputFile = base + ".lightmap";
+    }
+    if (settings.probesFile.empty()) {
+        settings.probesFile = base + ".probes";
+    }
+    return true;
+}
+
+int main(int argc, char** argv) {
+    BakeSettings settings;
+    if (!parseArguments(argc, argv, settings)) {
+        printUsage();
+        return 1;
+    }
+    gps::setThreadLimit(settings.threads);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    BakeScene scene;
+    std::cout << "Loading : " << settings.objFile << std::endl;
+    if (!loadScene(settings.objFile, scene)) {
+        return 1;
+    }
+
+    gps::Lightmap lightmap;
+    float texelsPerUnit = gps::unwrapLightmap(scene.meshCorners, settings.texelsPerUnit, settings.maxSize, lightmap);
+    std::vector<TexelSample> samples;
+    rasterizeTexels(scene, lightmap, samples);
+    std::cout << "Atlas          : " << lightmap.width << " x " << lightmap.height << ", " << texelsPerUnit
+        << " texels per unit, " << samples.size() << " texels to bake" << std::endl;
+
+    std::vector<glm::vec3> texels((size_t)lightmap.width * lightmap.height, glm::vec3(0.0f));
+    std::vector<uint8_t> covered(texels.size(), 0);
+
+    // in slices, to report progress between them
+    auto bakeStart = std::chrono::high_resolution_clock::now();
+    const size_t SLICES = 10;
+    for (size_t slice = 0; slice < SLICES; slice++) {
+        size_t sliceBegin = samples.size() * slice / SLICES;
+        size_t sliceEnd = samples.size() * (slice + 1) / SLICES;
+        gps::parallelFor(sliceEnd - sliceBegin, 64, [&](size_t begin, size_t end) {
+            std::vector<gps::Ray> rays(settings.samples);
+            std::vector<gps::RayHit> hits(settings.samples);
+            for (size_t i = sliceBegin + begin; i < sliceBegin + end; i++) {
+                texels[samples[i].texel] = bakeTexel(scene, settings, samples[i], rays, hits);
+                covered[samples[i].texel] = 1;
+            }
+        });
+
+        auto now = std::chrono::high_resolution_clock::now();
+        std::cout << "Baking         : " << (slice + 1) * 100 / SLICES << "% after "
+            << std::chrono::duration<double>(now - bakeStart).count() << " s" << std::endl;
+    }
+
+    dilate(lightmap.width, lightmap.height, texels, covered, 3);
+    for (size_t i = 0; i < texels.size(); i++) {
+        gps::encodeRgbm(texels[i], &lightmap.texels[i * 4]);
+    }
+
+    if (!gps::saveLightmap(settings.outputFile, lightmap)) {
+        std::cerr << "Could not write " << settings.outputFile << std::endl;
+        return 1;
+    }
+
+    if (settings.probeSpacing > 0.0f) {
+        auto probeStart = std::chrono::high_resolution_clock::now();
+        gps::ProbeGrid grid;
+        bakeProbes(scene, settings, grid);
+        auto probeStop = std::chrono::high_resolution_clock::now();
+        std::cout << "Probe bake     : " << std::chrono::duration<double>(probeStop - probeStart).count() << " s" << std::endl;
+        if (!gps::saveProbeGrid(settings.probesFile, grid)) {
+            std::cerr << "Could not write " << settings.probesFile << std::endl;
+            return 1;
+        }
+    }
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::cout << "Wrote " << settings.outputFile << " in " << std::chrono::duration<double>(stop - start).count()
+        << " s on " << gps::getThreadCount() << " threads" << std::endl;
+    return 0;
+}
@@ -1,4 +1,9 @@
 #include "Mesh.hpp"
+#include "AssetManager.hpp"
+#include "MeshSimplifier.hpp"
+
+#include <algorithm>
+
 namespace gps {
 
 	/* Mesh Constructor */
@@ -8,7 +13,69 @@ namespace gps {
 		this->indices = indices;
 		this->textures = textures;
 
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			this->bounds.expand(this->vertices[i].Position);
+		}
+
+		if (this->indices.size() / 3 >= CLUSTERED_MIN_TRIANGLES) {
+			std::vector<glm::vec3> positions;
+			for (size_t i = 0; i < this->vertices.size(); i++) {
+				positions.push_back(this->vertices[i].Position);
+			}
+			// reorders the triangles so that every cluster is one index range
+			buildClusters(positions, this->indices, this->clusters);
+		}
+		this->contentHash = hashMeshData(this->vertices, this->indices);
+
+		MeshLod fullDetail = { (GLsizei)this->indices.size(), 0, 0.0f };
+		this->lods.push_back(fullDetail);
+		this->buffers = Buffers();
+		this->lodBuffers = Buffers();
+		this->lodBytes = 0;
+		this->lodHash = 0;
+		this->bufferHandle = 0;
+		this->lodBufferHandle = 0;
+		this->lightmapVBO = 0;
+		this->instanceVBO = 0;
+
+		for (size_t i = 0; i < this->vertices.size(); i++) {
+			this->occluderPositions.push_back(this->vertices[i].Position);
+		}
+		this->occluderIndices = this->indices;
+	}
+
+	void Mesh::upload() {
+
+		if (isUploaded()) {
+			return;
+		}
 		this->setupMesh();
+		if (!this->pendingLodIndices.empty()) {
+			setupBuffers(this->lodBuffers, this->lodHash, this->pendingLodVertices, this->pendingLodIndices, this->lodBufferHandle);
+			std::vector<Vertex>().swap(this->pendingLodVertices);
+			std::vector<GLuint>().swap(this->pendingLodIndices);
+		}
+		if (!this->instanceTransforms.empty()) {
+			uploadInstances();
+		}
+	}
+
+	bool Mesh::isUploaded() const {
+		return this->buffers.VAO != 0;
+	}
+
+	void Mesh::release() {
+
+		releaseBuffers(this->buffers, this->bufferHandle);
+		releaseBuffers(this->lodBuffers, this->lodBufferHandle);
+		if (this->lightmapVBO != 0) {
+			glDeleteBuffers(1, &this->lightmapVBO);
+			this->lightmapVBO = 0;
+		}
+		if (this->instanceVBO != 0) {
+			glDeleteBuffers(1, &this->instanceVBO);
+			this->instanceVBO = 0;
+		}
 	}
 
 	Buffers Mesh::getBuffers() {
@@ -18,6 +85,94 @@ namespace gps {
 	/* Mesh drawing function - also applies associated textures */
 	void Mesh::Draw(gps::Shader shader)	{
 
+		Draw(shader, 0);
+	}
+
+	void Mesh::Draw(gps::Shader shader, int lod) {
+
+		bindTextures(shader);
+
+		const MeshLod& level = this->lods[lod];
+		glBindVertexArray(lod == 0 ? this->buffers.VAO : this->lodBuffers.VAO);
+		if (this->instanceTransforms.empty()) {
+			glDrawElements(GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT, (GLvoid*)(level.firstIndex * sizeof(GLuint)));
+		}
+		else {
+			GLint instancedLoc = glGetUniformLocation(shader.shaderProgram, "instancedMesh");
+			glUniform1i(instancedLoc, 1);
+			glDrawElementsInstanced(GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT, (GLvoid*)(level.firstIndex * sizeof(GLuint)), (GLsizei)this->instanceTransforms.size());
+			glUniform1i(instancedLoc, 0);
+		}
+		glBindVertexArray(0);
+
+		unbindTextures();
+	}
+
+	void Mesh::DrawInstanced(gps::Shader shader, int lod, GLuint instanceBuffer, GLsizei instanceCount) {
+
+		if (instanceCount == 0) {
+			return;
+		}
+
+		bindTextures(shader);
+
+		const MeshLod& level = this->lods[lod];
+		glBindVertexArray(lod == 0 ? this->buffers.VAO : this->lodBuffers.VAO);
+		// the culled buffer alternates between frames, so the pointers are set per draw
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		glEnableVertexAttribArray(4);
+		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (GLvoid*)0);
+		glVertexAttribDivisor(4, 1);
+		glEnableVertexAttribArray(5);
+		glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, 2 * sizeof(glm::vec4), (GLvoid*)sizeof(glm::vec4));
+		glVertexAttribDivisor(5, 1);
+		glDrawElementsInstanced(GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT, (GLvoid*)(level.firstIndex * sizeof(GLuint)), instanceCount);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		unbindTextures();
+	}
+
+	void Mesh::DrawCopies(gps::Shader shader, int lod, GLuint copyBuffer, GLsizei copyCount) {
+
+		if (copyCount == 0) {
+			return;
+		}
+
+		bindTextures(shader);
+
+		const MeshLod& level = this->lods[lod];
+		glBindVertexArray(lod == 0 ? this->buffers.VAO : this->lodBuffers.VAO);
+		setInstancePointers(copyBuffer);
+		GLint instancedLoc = glGetUniformLocation(shader.shaderProgram, "instancedMesh");
+		glUniform1i(instancedLoc, 1);
+		glDrawElementsInstanced(GL_TRIANGLES, level.indexCount, GL_UNSIGNED_INT, (GLvoid*)(level.firstIndex * sizeof(GLuint)), copyCount);
+		glUniform1i(instancedLoc, 0);
+		// back to the mesh's own copies for Draw
+		setInstancePointers(this->instanceVBO);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		unbindTextures();
+	}
+
+	void Mesh::DrawRanges(gps::Shader shader, const std::vector<GLsizei>& counts, const std::vector<const GLvoid*>& offsets) {
+
+		if (counts.empty()) {
+			return;
+		}
+
+		bindTextures(shader);
+
+		glBindVertexArray(this->buffers.VAO);
+		glMultiDrawElements(GL_TRIANGLES, counts.data(), GL_UNSIGNED_INT, offsets.data(), (GLsizei)counts.size());
+		glBindVertexArray(0);
+
+		unbindTextures();
+	}
+
+	void Mesh::bindTextures(gps::Shader shader) {
+
 		shader.useShaderProgram();
 
 		//set textures
@@ -27,34 +182,233 @@ namespace gps {
 			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
 		}
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	void Mesh::unbindTextures() {
 
         for(GLuint i = 0; i < this->textures.size(); i++) {
 
             glActiveTexture(GL_TEXTURE0 + i);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
-
     }
 
+	void Mesh::setLods(const std::vector<Vertex>& lodVertices, const std::vector<std::vector<GLuint>>& lodIndices, const std::vector<float>& lodErrors) {
+
+		this->lods.resize(1);
+		if (lodIndices.empty()) {
+			return;
+		}
+
+		// all levels back to back in one index buffer
+		std::vector<GLuint> allIndices;
+		for (size_t level = 0; level < lodIndices.size(); level++) {
+			MeshLod lod = { (GLsizei)lodIndices[level].size(), allIndices.size(), lodErrors[level] };
+			this->lods.push_back(lod);
+			allIndices.insert(allIndices.end(), lodIndices[level].begin(), lodIndices[level].end());
+		}
+
+		this->lodBytes = lodVertices.size() * sizeof(Vertex) + allIndices.size() * sizeof(GLuint);
+		if (isUploaded()) {
+			releaseBuffers(this->lodBuffers, this->lodBufferHandle);
+			this->lodHash = hashMeshData(lodVertices, allIndices);
+			setupBuffers(this->lodBuffers, this->lodHash, lodVertices, allIndices, this->lodBufferHandle);
+			if (!this->instanceTransforms.empty()) {
+				bindInstanceAttributes(this->lodBuffers.VAO);
+			}
+		}
+		else {
+			this->lodHash = hashMeshData(lodVertices, allIndices);
+			this->pendingLodVertices = lodVertices;
+			this->pendingLodIndices.swap(allIndices);
+		}
+
+		int occluderLevel = -1;
+		for (size_t level = 0; level < lodIndices.size(); level++) {
+			if (lodErrors[level] <= OCCLUDER_MAX_ERROR) {
+				occluderLevel = (int)level;
+			}
+		}
+		if (occluderLevel >= 0) {
+			this->occluderPositions.clear();
+			for (size_t i = 0; i < lodVertices.size(); i++) {
+				this->occluderPositions.push_back(lodVertices[i].Position);
+			}
+			this->occluderIndices = lodIndices[occluderLevel];
+			replicateOccluders();
+		}
+	}
+
+	int Mesh::getLodCount() const {
+		return (int)this->lods.size();
+	}
+
+	int Mesh::selectLod(float maxError) const {
+
+		int lod = 0;
+		while (lod + 1 < (int)this->lods.size() && this->lods[lod + 1].error <= maxError) {
+			lod++;
+		}
+		return lod;
+	}
+
+	GLsizei Mesh::getTriangleCount(int lod) const {
+		return this->lods[lod].indexCount / 3 * (GLsizei)std::max(this->instanceTransforms.size(), (size_t)1);
+	}
+
+	const std::vector<MeshCluster>& Mesh::getClusters() const {
+		return this->clusters;
+	}
+
+	const std::vector<glm::vec3>& Mesh::getOccluderPositions() const {
+		return this->occluderPositions;
+	}
+
+	const std::vector<GLuint>& Mesh::getOccluderIndices() const {
+		return this->occluderIndices;
+	}
+
+	void Mesh::setLightmapCoords(const std::vector<glm::vec2>& coords) {
+
+		if (this->lightmapVBO == 0) {
+			glGenBuffers(1, &this->lightmapVBO);
+		}
+
+		glBindVertexArray(this->buffers.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, this->lightmapVBO);
+		glBufferData(GL_ARRAY_BUFFER, coords.size() * sizeof(glm::vec2), coords.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(3);
+		glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (GLvoid*)0);
+		glBindVertexArray(0);
+	}
+
+	GLuint Mesh::getLightmapBuffer() const {
+		return this->lightmapVBO;
+	}
+
+	void Mesh::setInstances(const std::vector<glm::mat4>& transforms) {
+
+		this->instanceTransforms = transforms;
+		this->clusters.clear();
+
+		BoundingBox localBounds = this->bounds;
+		this->bounds = BoundingBox();
+		for (size_t i = 0; i < transforms.size(); i++) {
+			this->bounds.expand(localBounds.transformed(transforms[i]));
+		}
+
+		if (isUploaded()) {
+			uploadInstances();
+		}
+		replicateOccluders();
+	}
+
+	size_t Mesh::getInstanceCount() const {
+		return this->instanceTransforms.size();
+	}
+
+	const std::vector<glm::mat4>& Mesh::getInstanceTransforms() const {
+		return this->instanceTransforms;
+	}
+
+	GLuint Mesh::getInstanceBuffer() const {
+		return this->instanceVBO;
+	}
+
+	uint64_t Mesh::getContentHash() const {
+		return this->contentHash;
+	}
+
+	size_t Mesh::getMemoryBytes() const {
+
+		size_t vertexBytes = this->vertices.size() * sizeof(Vertex) + this->indices.size() * sizeof(GLuint);
+		size_t instanceBytes = this->instanceTransforms.size() * sizeof(glm::mat4);
+		// CPU copies, then the GPU buffers
+		size_t bytes = vertexBytes + instanceBytes
+			+ this->occluderPositions.size() * sizeof(glm::vec3) + this->occluderIndices.size() * sizeof(GLuint)
+			+ this->clusters.size() * sizeof(MeshCluster);
+		bytes += vertexBytes + instanceBytes + this->lodBytes;
+		if (this->lightmapVBO != 0) {
+			bytes += this->vertices.size() * sizeof(glm::vec2);
+		}
+		return bytes;
+	}
+
+	void Mesh::uploadInstances() {
+
+		if (this->instanceVBO == 0) {
+			glGenBuffers(1, &this->instanceVBO);
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, this->instanceVBO);
+		glBufferData(GL_ARRAY_BUFFER, this->instanceTransforms.size() * sizeof(glm::mat4), this->instanceTransforms.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+		bindInstanceAttributes(this->buffers.VAO);
+		if (this->lodBuffers.VAO != 0) {
+			bindInstanceAttributes(this->lodBuffers.VAO);
+		}
+	}
+
+	void Mesh::bindInstanceAttributes(GLuint vao) {
+
+		glBindVertexArray(vao);
+		setInstancePointers(this->instanceVBO);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+
+	// a mat4 attribute takes four locations, one column each
+	void Mesh::setInstancePointers(GLuint instanceBuffer) {
+
+		glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+		for (GLuint column = 0; column < 4; column++) {
+			glEnableVertexAttribArray(6 + column);
+			glVertexAttribPointer(6 + column, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4), (GLvoid*)(column * sizeof(glm::vec4)));
+			glVertexAttribDivisor(6 + column, 1);
+		}
+	}
+
+	// the occlusion buffer rasterizes every copy with the entity's transform
+	void Mesh::replicateOccluders() {
+
+		if (this->instanceTransforms.empty()) {
+			return;
+		}
+
+		std::vector<glm::vec3> localPositions;
+		localPositions.swap(this->occluderPositions);
+		std::vector<GLuint> localIndices;
+		localIndices.swap(this->occluderIndices);
+		for (size_t i = 0; i < this->instanceTransforms.size(); i++) {
+			GLuint firstVertex = (GLuint)this->occluderPositions.size();
+			for (size_t v = 0; v < localPositions.size(); v++) {
+				this->occluderPositions.push_back(glm::vec3(this->instanceTransforms[i] * glm::vec4(localPositions[v], 1.0f)));
+			}
+			for (size_t k = 0; k < localIndices.size(); k++) {
+				this->occluderIndices.push_back(firstVertex + localIndices[k]);
+			}
+		}
+	}
+
 	// Initializes all the buffer objects/arrays
 	void Mesh::setupMesh() {
 
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		setupBuffers(this->buffers, this->contentHash, this->vertices, this->indices, this->bufferHandle);
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+	// The vertex and index buffers come from the asset manager, shared with
+	// every mesh holding the same data; the VAO is the mesh's own, as the
+	// lightmap and instance attributes differ per mesh
+	void Mesh::setupBuffers(Buffers& target, uint64_t hash, const std::vector<Vertex>& bufferVertices, const std::vector<GLuint>& bufferIndices, uint32_t& handle) {
+
+		handle = getAssetManager().acquireMeshBuffers(hash, bufferVertices, bufferIndices, target.VBO, target.EBO);
+
+		// Create buffers/arrays
+		glGenVertexArrays(1, &target.VAO);
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+		glBindVertexArray(target.VAO);
+		glBindBuffer(GL_ARRAY_BUFFER, target.VBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, target.EBO);
 
 		// Set the vertex attribute pointers
 		// Vertex Positions
@@ -69,4 +423,13 @@ namespace gps {
 
 		glBindVertexArray(0);
 	}
+
+	void Mesh::releaseBuffers(Buffers& target, uint32_t handle) {
+
+		if (target.VAO != 0) {
+			glDeleteVertexArrays(1, &target.VAO);
+			getAssetManager().releaseMeshBuffers(handle);
+			target = Buffers();
+		}
+	}
 }
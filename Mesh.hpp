@@ -12,7 +12,10 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "BoundingBox.hpp"
+#include "MeshClusters.hpp"
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -47,26 +50,137 @@ namespace gps {
         GLuint EBO;
     };
 
+    // One level of detail: a range of the level's index buffer
+    struct MeshLod {
+        GLsizei indexCount;
+        size_t firstIndex;
+        // object-space geometric error against the full mesh
+        float error;
+    };
+
     class Mesh {
 
     public:
         std::vector<Vertex> vertices;
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
+        // object-space bounds of the vertices, over every instance for
+        // meshes drawn instanced
+        BoundingBox bounds;
 
+	    // CPU side only, safe off the GL thread; upload creates the GL objects
 	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
+	    // Creates the buffers of the mesh and of what setLods and setInstances
+	    // were given before it; they upload directly afterwards
+	    void upload();
+
+	    bool isUploaded() const;
+
+	    // Deletes every GL object of the mesh
+	    void release();
+
 	    Buffers getBuffers();
 
 	    void Draw(gps::Shader shader);
 
+	    void Draw(gps::Shader shader, int lod);
+
+	    // Draws instanceCount copies, reading one ScatterInstance per copy
+	    // (two vec4s) from instanceBuffer into attributes 4 and 5
+	    void DrawInstanced(gps::Shader shader, int lod, GLuint instanceBuffer, GLsizei instanceCount);
+
+	    // The simplified levels; they share one welded vertex buffer
+	    void setLods(const std::vector<Vertex>& lodVertices, const std::vector<std::vector<GLuint>>& lodIndices, const std::vector<float>& lodErrors);
+
+	    int getLodCount() const;
+
+	    // Coarsest level whose error stays within maxError
+	    int selectLod(float maxError) const;
+
+	    // over every instance
+	    GLsizei getTriangleCount(int lod) const;
+
+	    // Clusters of the full detail level; empty for meshes under CLUSTERED_MIN_TRIANGLES
+	    const std::vector<MeshCluster>& getClusters() const;
+
+	    // Draws ranges of the full detail index buffer in one glMultiDrawElements
+	    void DrawRanges(gps::Shader shader, const std::vector<GLsizei>& counts, const std::vector<const GLvoid*>& offsets);
+
+	    static const size_t CLUSTERED_MIN_TRIANGLES = 4 * CLUSTER_TRIANGLES;
+
+	    // Proxy geometry for the software occlusion buffer: the coarsest level
+	    // within OCCLUDER_MAX_ERROR of the full mesh
+	    const std::vector<glm::vec3>& getOccluderPositions() const;
+	    const std::vector<GLuint>& getOccluderIndices() const;
+
+	    static constexpr float OCCLUDER_MAX_ERROR = 0.1f;
+
+	    // Lightmap coordinates per vertex, fed to attribute 3 of the full detail level
+	    void setLightmapCoords(const std::vector<glm::vec2>& coords);
+
+	    GLuint getLightmapBuffer() const;
+
+	    // Turns the mesh into copies of itself, one per model-space transform,
+	    // drawn by Draw with one glDrawElementsInstanced (attributes 6-9 and the
+	    // shader's "instancedMesh" uniform). Drops the clusters, which are only
+	    // culled with the entity's transform; occluders are replicated.
+	    void setInstances(const std::vector<glm::mat4>& transforms);
+
+	    // 0 for a mesh drawn once
+	    size_t getInstanceCount() const;
+
+	    const std::vector<glm::mat4>& getInstanceTransforms() const;
+
+	    GLuint getInstanceBuffer() const;
+
+	    // Draws copyCount copies of an instanced mesh whose model-space
+	    // transforms are read from copyBuffer instead of the mesh's own
+	    void DrawCopies(gps::Shader shader, int lod, GLuint copyBuffer, GLsizei copyCount);
+
+	    // hashMeshData of the full detail level, the key of its shared buffers
+	    uint64_t getContentHash() const;
+
+	    // Approximate memory held by the mesh, its CPU copies and GPU buffers
+	    size_t getMemoryBytes() const;
+
     private:
         /*  Render data  */
         Buffers buffers;
+        uint64_t contentHash;
+        // the asset manager's handles (AssetHandle) on buffers and lodBuffers
+        uint32_t bufferHandle;
+        // level 0 draws from buffers, the others from lodBuffers
+        std::vector<MeshLod> lods;
+        Buffers lodBuffers;
+        uint64_t lodHash;
+        uint32_t lodBufferHandle;
+        // kept for upload when setLods comes first
+        std::vector<Vertex> pendingLodVertices;
+        std::vector<GLuint> pendingLodIndices;
+        size_t lodBytes;
+        GLuint lightmapVBO;
+        std::vector<glm::mat4> instanceTransforms;
+        GLuint instanceVBO;
+        std::vector<MeshCluster> clusters;
+
+        std::vector<glm::vec3> occluderPositions;
+        std::vector<GLuint> occluderIndices;
 
 	    // Initializes all the buffer objects/arrays
 	    void setupMesh();
 
+	    void bindTextures(gps::Shader shader);
+	    void unbindTextures();
+
+	    void setupBuffers(Buffers& target, uint64_t hash, const std::vector<Vertex>& bufferVertices, const std::vector<GLuint>& bufferIndices, uint32_t& handle);
+	    void releaseBuffers(Buffers& target, uint32_t handle);
+
+	    void uploadInstances();
+	    void bindInstanceAttributes(GLuint vao);
+	    void setInstancePointers(GLuint instanceBuffer);
+	    void replicateOccluders();
+
     };
 
 }
@@ -0,0 +1,210 @@
+#include "MeshClusters.hpp"
+#include "OcclusionBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace gps {
+
+    // spreads the low 10 bits of value to every third bit
+    static uint32_t spreadBits(uint32_t value) {
+        value &= 0x3ff;
+        value = (value | (value << 16)) & 0x030000ff;
+        value = (value | (value << 8)) & 0x0300f00f;
+        value = (value | (value << 4)) & 0x030c30c3;
+        value = (value | (value << 2)) & 0x09249249;
+        return value;
+    }
+
+    static glm::vec3 triangleNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+        glm::vec3 normal = glm::cross(b - a, c - a);
+        float length = glm::length(normal);
+        return length > 0.0f ? normal / length : glm::vec3(0.0f);
+    }
+
+    static void finishCluster(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, MeshCluster& cluster) {
+        glm::vec3 normalSum(0.0f);
+        for (size_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.indexCount; i += 3) {
+            const glm::vec3& a = positions[indices[i]];
+            const glm::vec3& b = positions[indices[i + 1]];
+            const glm::vec3& c = positions[indices[i + 2]];
+            cluster.bounds.expand(a);
+            cluster.bounds.expand(b);
+            cluster.bounds.expand(c);
+            normalSum += triangleNormal(a, b, c);
+        }
+
+        cluster.center = cluster.bounds.getCenter();
+        cluster.radius = 0.0f;
+        for (size_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.indexCount; i++) {
+            cluster.radius = std::max(cluster.radius, glm::length(positions[indices[i]] - cluster.center));
+        }
+
+        cluster.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        cluster.coneCos = -1.0f;
+        cluster.coneSin = 0.0f;
+        float axisLength = glm::length(normalSum);
+        if (axisLength < 1e-6f) {
+            return;
+        }
+        cluster.coneAxis = normalSum / axisLength;
+
+        float minDot = 1.0f;
+        for (size_t i = cluster.firstIndex; i < cluster.firstIndex + cluster.indexCount; i += 3) {
+            glm::vec3 normal = triangleNormal(positions[indices[i]], positions[indices[i + 1]], positions[indices[i + 2]]);
+            // degenerate triangles are never rasterized, they do not widen the cone
+            if (normal != glm::vec3(0.0f)) {
+                minDot = std::min(minDot, glm::dot(normal, cluster.coneAxis));
+            }
+        }
+        cluster.coneCos = minDot;
+        cluster.coneSin = std::sqrt(std::max(1.0f - minDot * minDot, 0.0f));
+    }
+
+    void buildClusters(const std::vector<glm::vec3>& positions, std::vector<GLuint>& indices, std::vector<MeshCluster>& clusters) {
+        clusters.clear();
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        BoundingBox bounds;
+        for (const glm::vec3& position : positions) {
+            bounds.expand(position);
+        }
+        glm::vec3 size = glm::max(bounds.max - bounds.min, glm::vec3(1e-6f));
+
+        // key: dominant normal direction (6 bins), then the centroid's Morton code,
+        // so that a cluster is compact and its normals stay within a narrow cone
+        std::vector<std::pair<uint64_t, uint32_t>> keys(triangleCount);
+        for (size_t t = 0; t < triangleCount; t++) {
+            const glm::vec3& a = positions[indices[3 * t]];
+            const glm::vec3& b = positions[indices[3 * t + 1]];
+            const glm::vec3& c = positions[indices[3 * t + 2]];
+
+            glm::vec3 normal = triangleNormal(a, b, c);
+            glm::vec3 magnitude = glm::abs(normal);
+            int axis = magnitude.x >= magnitude.y && magnitude.x >= magnitude.z ? 0 : (magnitude.y >= magnitude.z ? 1 : 2);
+            uint64_t direction = axis * 2 + (normal[axis] < 0.0f ? 1 : 0);
+
+            glm::vec3 cell = glm::clamp(((a + b + c) / 3.0f - bounds.min) / size, 0.0f, 1.0f) * 1023.0f;
+            uint64_t morton = spreadBits((uint32_t)cell.x) | (spreadBits((uint32_t)cell.y) << 1) | (spreadBits((uint32_t)cell.z) << 2);
+
+            keys[t] = std::make_pair((direction << 32) | morton, (uint32_t)t);
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<GLuint> sorted(indices.size());
+        for (size_t t = 0; t < triangleCount; t++) {
+            uint32_t source = keys[t].second;
+            sorted[3 * t] = indices[3 * source];
+            sorted[3 * t + 1] = indices[3 * source + 1];
+            sorted[3 * t + 2] = indices[3 * source + 2];
+        }
+        indices.swap(sorted);
+
+        // a cluster never spans two normal bins
+        size_t begin = 0;
+        while (begin < triangleCount) {
+            uint64_t direction = keys[begin].first >> 32;
+            size_t end = begin;
+            while (end < triangleCount && end - begin < CLUSTER_TRIANGLES && (keys[end].first >> 32) == direction) {
+                end++;
+            }
+
+            MeshCluster cluster;
+            cluster.firstIndex = begin * 3;
+            cluster.indexCount = (GLsizei)((end - begin) * 3);
+            finishCluster(positions, indices, cluster);
+            clusters.push_back(cluster);
+            begin = end;
+        }
+    }
+
+    void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+        glm::vec4 row[4];
+        for (int i = 0; i < 4; i++) {
+            row[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+        planes[0] = row[3] + row[0];
+        planes[1] = row[3] - row[0];
+        planes[2] = row[3] + row[1];
+        planes[3] = row[3] - row[1];
+        planes[4] = row[3] + row[2];
+        planes[5] = row[3] - row[2];
+        for (int i = 0; i < 6; i++) {
+            planes[i] /= glm::length(glm::vec3(planes[i]));
+        }
+    }
+
+    static bool boxOutsideFrustum(const BoundingBox& box, const glm::vec4 planes[6]) {
+        glm::vec3 center = box.getCenter();
+        glm::vec3 extents = box.getExtents();
+        for (int i = 0; i < 6; i++) {
+            glm::vec3 normal(planes[i]);
+            float reach = glm::dot(glm::abs(normal), extents);
+            if (glm::dot(normal, center) + planes[i].w < -reach) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // True when every triangle of the cluster faces away from the camera,
+    // wherever it lies in the bounding sphere
+    static bool coneBackfacing(const glm::vec3& center, float radius, const glm::vec3& axis, float coneCos, float coneSin, const glm::vec3& cameraPosition) {
+        if (coneCos <= 0.0f) {
+            return false;
+        }
+        glm::vec3 toCluster = center - cameraPosition;
+        float along = glm::dot(toCluster, axis);
+        float across = std::sqrt(std::max(glm::dot(toCluster, toCluster) - along * along, 0.0f));
+        // smallest dot(normal, toCluster) over the cone, minus what the sphere can add
+        return along * coneCos - across * coneSin > radius;
+    }
+
+    void cullClusters(const std::vector<MeshCluster>& clusters, const glm::mat4& model, const ClusterView& view,
+        std::vector<GLsizei>& counts, std::vector<const GLvoid*>& offsets, ClusterCullStats& stats) {
+
+        glm::mat3 linear(model);
+        float scale = std::max(glm::length(linear[0]), std::max(glm::length(linear[1]), glm::length(linear[2])));
+        // the cone test needs the normals' directions, so only rotations and uniform scales keep it valid
+        bool conformal = std::fabs(glm::length(linear[0]) - scale) < 1e-3f * scale
+            && std::fabs(glm::length(linear[1]) - scale) < 1e-3f * scale
+            && std::fabs(glm::length(linear[2]) - scale) < 1e-3f * scale
+            && glm::determinant(linear) > 0.0f;
+
+        size_t rangeEnd = (size_t)-1;
+        for (const MeshCluster& cluster : clusters) {
+            stats.total++;
+
+            if (conformal) {
+                glm::vec3 center = glm::vec3(model * glm::vec4(cluster.center, 1.0f));
+                glm::vec3 axis = glm::normalize(linear * cluster.coneAxis);
+                if (coneBackfacing(center, cluster.radius * scale, axis, cluster.coneCos, cluster.coneSin, view.cameraPosition)) {
+                    stats.backfacing++;
+                    continue;
+                }
+            }
+
+            BoundingBox worldBox = cluster.bounds.transformed(model);
+            if (boxOutsideFrustum(worldBox, view.frustumPlanes)) {
+                stats.outsideFrustum++;
+                continue;
+            }
+            if (view.occlusion != nullptr && !view.occlusion->isVisible(worldBox)) {
+                stats.occluded++;
+                continue;
+            }
+
+            if (cluster.firstIndex == rangeEnd) {
+                counts.back() += cluster.indexCount;
+            } else {
+                counts.push_back(cluster.indexCount);
+                offsets.push_back((const GLvoid*)(cluster.firstIndex * sizeof(GLuint)));
+            }
+            rangeEnd = cluster.firstIndex + cluster.indexCount;
+        }
+    }
+}
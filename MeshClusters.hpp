@@ -0,0 +1,66 @@
+#ifndef MeshClusters_hpp
+#define MeshClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "BoundingBox.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    class OcclusionBuffer;
+
+    // A run of about CLUSTER_TRIANGLES triangles of a mesh's index buffer
+    struct MeshCluster {
+        size_t firstIndex;
+        GLsizei indexCount;
+        BoundingBox bounds;
+        glm::vec3 center;
+        float radius;
+        // every triangle normal lies within coneAngle of coneAxis;
+        // coneCos <= 0 means the normals spread too far to ever cull
+        glm::vec3 coneAxis;
+        float coneCos;
+        float coneSin;
+    };
+
+    const size_t CLUSTER_TRIANGLES = 128;
+
+    // Reorders the triangles of indices into spatially coherent clusters with
+    // similar normals (dominant normal axis, then Morton order of the centroids)
+    void buildClusters(const std::vector<glm::vec3>& positions, std::vector<GLuint>& indices, std::vector<MeshCluster>& clusters);
+
+    struct ClusterCullStats {
+        size_t total;
+        size_t backfacing;
+        size_t outsideFrustum;
+        size_t occluded;
+    };
+
+    // World-space view state for cullClusters
+    struct ClusterView {
+        glm::vec3 cameraPosition;
+        glm::vec4 frustumPlanes[6];
+        // optional; clusters hidden in it are rejected
+        const OcclusionBuffer* occlusion;
+    };
+
+    // Frustum planes (normals pointing inwards) from a view projection matrix
+    void extractFrustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]);
+
+    // Appends the index ranges of the clusters surviving back-face cone, frustum
+    // and occlusion tests, merging neighbouring ranges into one draw
+    void cullClusters(const std::vector<MeshCluster>& clusters, const glm::mat4& model, const ClusterView& view,
+        std::vector<GLsizei>& counts, std::vector<const GLvoid*>& offsets, ClusterCullStats& stats);
+}
+
+#endif /* MeshClusters_hpp */
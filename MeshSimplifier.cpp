@@ -0,0 +1,488 @@
+#include "MeshSimplifier.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+
+namespace gps {
+
+    namespace {
+
+        // symmetric 4x4 plane quadric: xx xy xz xw yy yz yw zz zw ww
+        struct Quadric {
+            double q[10];
+
+            Quadric() {
+                std::fill(q, q + 10, 0.0);
+            }
+
+            void addPlane(double a, double b, double c, double d) {
+                q[0] += a * a; q[1] += a * b; q[2] += a * c; q[3] += a * d;
+                q[4] += b * b; q[5] += b * c; q[6] += b * d;
+                q[7] += c * c; q[8] += c * d;
+                q[9] += d * d;
+            }
+
+            void add(const Quadric& other) {
+                for (int i = 0; i < 10; i++) {
+                    q[i] += other.q[i];
+                }
+            }
+
+            double evaluate(const glm::vec3& p) const {
+                double x = p.x, y = p.y, z = p.z;
+                return q[0] * x * x + 2.0 * q[1] * x * y + 2.0 * q[2] * x * z + 2.0 * q[3] * x
+                    + q[4] * y * y + 2.0 * q[5] * y * z + 2.0 * q[6] * y
+                    + q[7] * z * z + 2.0 * q[8] * z
+                    + q[9];
+            }
+        };
+
+        struct Collapse {
+            double cost;
+            GLuint from;
+            GLuint to;
+            uint32_t fromVersion;
+            uint32_t toVersion;
+
+            bool operator>(const Collapse& other) const {
+                return cost > other.cost;
+            }
+        };
+
+        struct WeldKey {
+            float values[5];
+
+            bool operator==(const WeldKey& other) const {
+                return std::memcmp(values, other.values, sizeof(values)) == 0;
+            }
+        };
+
+        struct WeldKeyHash {
+            size_t operator()(const WeldKey& key) const {
+                uint32_t bits[5];
+                std::memcpy(bits, key.values, sizeof(bits));
+                size_t hash = 0;
+                for (int i = 0; i < 5; i++) {
+                    hash = hash * 31 + std::hash<uint32_t>()(bits[i]);
+                }
+                return hash;
+            }
+        };
+
+        WeldKey makeKey(const glm::vec3& position, const glm::vec2& texCoords) {
+            // +0.0f so that -0.0f and 0.0f weld
+            WeldKey key = { { position.x + 0.0f, position.y + 0.0f, position.z + 0.0f, texCoords.x + 0.0f, texCoords.y + 0.0f } };
+            return key;
+        }
+
+        uint64_t edgeKey(GLuint a, GLuint b) {
+            return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+        }
+    }
+
+    void weldVertices(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        std::vector<Vertex>& weldedVertices, std::vector<GLuint>& weldedIndices) {
+
+        std::unordered_map<WeldKey, GLuint, WeldKeyHash> lookup;
+        std::vector<glm::vec3> normalSums;
+
+        weldedVertices.clear();
+        weldedIndices.resize(indices.size());
+        for (size_t i = 0; i < indices.size(); i++) {
+            const Vertex& vertex = vertices[indices[i]];
+            WeldKey key = makeKey(vertex.Position, vertex.TexCoords);
+
+            auto found = lookup.find(key);
+            if (found == lookup.end()) {
+                found = lookup.insert(std::make_pair(key, (GLuint)weldedVertices.size())).first;
+                weldedVertices.push_back(vertex);
+                normalSums.push_back(glm::vec3(0.0f));
+            }
+            normalSums[found->second] += vertex.Normal;
+            weldedIndices[i] = found->second;
+        }
+
+        for (size_t v = 0; v < weldedVertices.size(); v++) {
+            if (glm::dot(normalSums[v], normalSums[v]) > 0.0f) {
+                weldedVertices[v].Normal = glm::normalize(normalSums[v]);
+            }
+        }
+    }
+
+    void simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        const std::vector<size_t>& triangleTargets,
+        std::vector<std::vector<GLuint>>& levels, std::vector<float>& errors) {
+
+        levels.clear();
+        errors.clear();
+
+        size_t vertexCount = vertices.size();
+
+        // drop triangles that are degenerate after welding
+        std::vector<GLuint> triangles;
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            GLuint a = indices[i], b = indices[i + 1], c = indices[i + 2];
+            if (a != b && b != c && a != c) {
+                triangles.push_back(a);
+                triangles.push_back(b);
+                triangles.push_back(c);
+            }
+        }
+        size_t triangleCount = triangles.size() / 3;
+        std::vector<uint8_t> triangleAlive(triangleCount, 1);
+
+        // vertices sharing a position with different texture coordinates sit on a UV seam
+        std::unordered_map<WeldKey, GLuint, WeldKeyHash> positionLookup;
+        std::vector<GLuint> positionClass(vertexCount);
+        std::vector<int> classSize;
+        for (size_t v = 0; v < vertexCount; v++) {
+            WeldKey key = makeKey(vertices[v].Position, glm::vec2(0.0f));
+            auto found = positionLookup.find(key);
+            if (found == positionLookup.end()) {
+                found = positionLookup.insert(std::make_pair(key, (GLuint)classSize.size())).first;
+                classSize.push_back(0);
+            }
+            positionClass[v] = found->second;
+            classSize[found->second]++;
+        }
+
+        // edges (by position) used by one triangle are borders, by more than two non-manifold
+        std::unordered_map<uint64_t, int> edgeUse;
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                GLuint a = positionClass[triangles[3 * t + k]];
+                GLuint b = positionClass[triangles[3 * t + (k + 1) % 3]];
+                edgeUse[edgeKey(a, b)]++;
+            }
+        }
+        std::vector<uint8_t> classLocked(classSize.size(), 0);
+        for (size_t c = 0; c < classSize.size(); c++) {
+            classLocked[c] = classSize[c] > 1;
+        }
+        for (const auto& edge : edgeUse) {
+            if (edge.second != 2) {
+                classLocked[(GLuint)(edge.first >> 32)] = 1;
+                classLocked[(GLuint)(edge.first & 0xFFFFFFFFu)] = 1;
+            }
+        }
+        std::vector<uint8_t> locked(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            locked[v] = classLocked[positionClass[v]];
+        }
+
+        std::vector<Quadric> quadrics(vertexCount);
+        std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+        for (size_t t = 0; t < triangleCount; t++) {
+            const glm::vec3& p0 = vertices[triangles[3 * t]].Position;
+            const glm::vec3& p1 = vertices[triangles[3 * t + 1]].Position;
+            const glm::vec3& p2 = vertices[triangles[3 * t + 2]].Position;
+            glm::vec3 normal = glm::cross(p1 - p0, p2 - p0);
+            float length = glm::length(normal);
+            if (length > 0.0f) {
+                normal /= length;
+                Quadric plane;
+                plane.addPlane(normal.x, normal.y, normal.z, -glm::dot(normal, p0));
+                for (int k = 0; k < 3; k++) {
+                    quadrics[triangles[3 * t + k]].add(plane);
+                }
+            }
+            for (int k = 0; k < 3; k++) {
+                vertexTriangles[triangles[3 * t + k]].push_back((uint32_t)t);
+            }
+        }
+
+        std::vector<uint32_t> version(vertexCount, 0);
+        std::vector<uint8_t> removed(vertexCount, 0);
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap;
+
+        auto pushCollapse = [&](GLuint from, GLuint to) {
+            if (locked[from]) {
+                return;
+            }
+            Quadric sum = quadrics[from];
+            sum.add(quadrics[to]);
+            Collapse collapse = { std::max(sum.evaluate(vertices[to].Position), 0.0), from, to, version[from], version[to] };
+            heap.push(collapse);
+        };
+
+        std::vector<GLuint> neighborsFrom, neighborsTo;
+        auto collectNeighbors = [&](GLuint v, std::vector<GLuint>& out) {
+            out.clear();
+            for (uint32_t t : vertexTriangles[v]) {
+                if (triangleAlive[t]) {
+                    for (int k = 0; k < 3; k++) {
+                        if (triangles[3 * t + k] != v) {
+                            out.push_back(triangles[3 * t + k]);
+                        }
+                    }
+                }
+            }
+            std::sort(out.begin(), out.end());
+            out.erase(std::unique(out.begin(), out.end()), out.end());
+        };
+
+        for (size_t v = 0; v < vertexCount; v++) {
+            collectNeighbors((GLuint)v, neighborsFrom);
+            for (GLuint w : neighborsFrom) {
+                pushCollapse((GLuint)v, w);
+            }
+        }
+
+        auto recordLevel = [&](double maxCost) {
+            std::vector<GLuint> level;
+            level.reserve(triangleCount * 3);
+            for (size_t t = 0; t < triangleAlive.size(); t++) {
+                if (triangleAlive[t]) {
+                    level.insert(level.end(), triangles.begin() + 3 * t, triangles.begin() + 3 * t + 3);
+                }
+            }
+            levels.push_back(level);
+            errors.push_back((float)std::sqrt(maxCost));
+        };
+
+        double maxCost = 0.0;
+        size_t target = 0;
+        size_t lastRecorded = triangleCount;
+        while (target < triangleTargets.size() && !heap.empty()) {
+            if (triangleCount <= triangleTargets[target]) {
+                recordLevel(maxCost);
+                lastRecorded = triangleCount;
+                target++;
+                continue;
+            }
+
+            Collapse collapse = heap.top();
+            heap.pop();
+            GLuint from = collapse.from;
+            GLuint to = collapse.to;
+            if (removed[from] || removed[to] || version[from] != collapse.fromVersion || version[to] != collapse.toVersion) {
+                continue;
+            }
+
+            // link condition: the two vertices may only share the neighbours opposite the edge,
+            // otherwise the collapse pinches the surface
+            collectNeighbors(from, neighborsFrom);
+            collectNeighbors(to, neighborsTo);
+            size_t sharedNeighbors = 0;
+            for (GLuint w : neighborsFrom) {
+                sharedNeighbors += std::binary_search(neighborsTo.begin(), neighborsTo.end(), w) ? 1 : 0;
+            }
+            size_t sharedTriangles = 0;
+            bool flips = false;
+            const glm::vec3& targetPosition = vertices[to].Position;
+            for (uint32_t t : vertexTriangles[from]) {
+                if (!triangleAlive[t]) {
+                    continue;
+                }
+                GLuint* corners = &triangles[3 * t];
+                if (corners[0] == to || corners[1] == to || corners[2] == to) {
+                    sharedTriangles++;
+                    continue;
+                }
+
+                // the remaining triangles must not turn over
+                glm::vec3 before[3], after[3];
+                for (int k = 0; k < 3; k++) {
+                    before[k] = vertices[corners[k]].Position;
+                    after[k] = corners[k] == from ? targetPosition : before[k];
+                }
+                glm::vec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+                glm::vec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+                float lengthBefore = glm::length(normalBefore);
+                float lengthAfter = glm::length(normalAfter);
+                if (lengthBefore > 0.0f && (lengthAfter <= 0.0f || glm::dot(normalBefore, normalAfter) < 0.25f * lengthBefore * lengthAfter)) {
+                    flips = true;
+                    break;
+                }
+            }
+            if (flips || sharedTriangles == 0 || sharedNeighbors != sharedTriangles) {
+                continue;
+            }
+
+            for (uint32_t t : vertexTriangles[from]) {
+                if (!triangleAlive[t]) {
+                    continue;
+                }
+                GLuint* corners = &triangles[3 * t];
+                if (corners[0] == to || corners[1] == to || corners[2] == to) {
+                    triangleAlive[t] = 0;
+                    triangleCount--;
+                    continue;
+                }
+                for (int k = 0; k < 3; k++) {
+                    if (corners[k] == from) {
+                        corners[k] = to;
+                    }
+                }
+                vertexTriangles[to].push_back(t);
+            }
+            vertexTriangles[from].clear();
+            removed[from] = 1;
+            quadrics[to].add(quadrics[from]);
+            version[to]++;
+            maxCost = std::max(maxCost, collapse.cost);
+
+            std::vector<uint32_t>& toTriangles = vertexTriangles[to];
+            toTriangles.erase(std::remove_if(toTriangles.begin(), toTriangles.end(),
+                [&](uint32_t t) { return !triangleAlive[t]; }), toTriangles.end());
+
+            collectNeighbors(to, neighborsTo);
+            for (GLuint w : neighborsTo) {
+                pushCollapse(w, to);
+                pushCollapse(to, w);
+            }
+        }
+
+        // out of collapses: keep what was reached if it is a real step down
+        if (target < triangleTargets.size() && triangleCount < lastRecorded * 9 / 10) {
+            recordLevel(maxCost);
+        }
+    }
+
+    void buildLodChain(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        int levelCount, LodChain& chain) {
+
+        chain.vertices.clear();
+        chain.levels.clear();
+        chain.errors.clear();
+
+        // too small to be worth extra draw data
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount < 64) {
+            return;
+        }
+
+        std::vector<GLuint> weldedIndices;
+        weldVertices(vertices, indices, chain.vertices, weldedIndices);
+
+        std::vector<size_t> targets;
+        for (int level = 1; level <= levelCount; level++) {
+            targets.push_back(std::max<size_t>(triangleCount >> level, 16));
+        }
+        simplifyMesh(chain.vertices, weldedIndices, targets, chain.levels, chain.errors);
+    }
+
+    uint64_t hashMeshData(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices) {
+        // FNV-1a
+        uint64_t hash = 14695981039346656037ull;
+        auto mix = [&hash](const void* data, size_t size) {
+            const unsigned char* bytes = (const unsigned char*)data;
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ull;
+            }
+        };
+        // the lengths first, so data split differently between the two cannot collide
+        uint64_t vertexCount = vertices.size();
+        uint64_t indexCount = indices.size();
+        mix(&vertexCount, sizeof(vertexCount));
+        mix(&indexCount, sizeof(indexCount));
+        mix(vertices.data(), vertices.size() * sizeof(Vertex));
+        mix(indices.data(), indices.size() * sizeof(GLuint));
+        return hash;
+    }
+
+    static const char lodCacheMagic[4] = { 'L', 'O', 'D', '1' };
+
+    bool loadLodChains(const std::string& fileName, const std::vector<LodSource>& sources, std::vector<LodChain>& chains) {
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file) {
+            return false;
+        }
+        // every count is checked against what is left before anything is allocated
+        uint64_t remaining = (uint64_t)file.tellg();
+        file.seekg(0);
+        auto take = [&remaining](uint64_t bytes) {
+            if (bytes > remaining) {
+                return false;
+            }
+            remaining -= bytes;
+            return true;
+        };
+
+        char magic[4];
+        uint32_t meshCount = 0;
+        file.read(magic, sizeof(magic));
+        file.read((char*)&meshCount, sizeof(meshCount));
+        if (!file || !take(sizeof(magic) + sizeof(meshCount)) || std::memcmp(magic, lodCacheMagic, sizeof(magic)) != 0 || meshCount != sources.size()) {
+            return false;
+        }
+
+        chains.assign(meshCount, LodChain());
+        for (uint32_t m = 0; m < meshCount; m++) {
+            uint64_t hash = 0;
+            uint32_t vertexCount = 0;
+            file.read((char*)&hash, sizeof(hash));
+            file.read((char*)&vertexCount, sizeof(vertexCount));
+            // welding only ever removes vertices
+            if (!file || !take(sizeof(hash) + sizeof(vertexCount)) || hash != sources[m].hash
+                || vertexCount > sources[m].vertexCount || !take((uint64_t)vertexCount * sizeof(Vertex))) {
+                return false;
+            }
+            chains[m].vertices.resize(vertexCount);
+            file.read((char*)chains[m].vertices.data(), vertexCount * sizeof(Vertex));
+
+            uint32_t levelCount = 0;
+            file.read((char*)&levelCount, sizeof(levelCount));
+            // each level takes at least its error and its count
+            if (!file || !take(sizeof(levelCount)) || levelCount > remaining / (sizeof(float) + sizeof(uint32_t))) {
+                return false;
+            }
+            chains[m].levels.resize(levelCount);
+            chains[m].errors.resize(levelCount);
+            for (uint32_t level = 0; level < levelCount; level++) {
+                uint32_t indexCount = 0;
+                file.read((char*)&chains[m].errors[level], sizeof(float));
+                file.read((char*)&indexCount, sizeof(indexCount));
+                // simplifying only ever removes triangles
+                if (!file || !take(sizeof(float) + sizeof(indexCount)) || indexCount > sources[m].indexCount
+                    || !take((uint64_t)indexCount * sizeof(GLuint))) {
+                    return false;
+                }
+                std::vector<GLuint>& indices = chains[m].levels[level];
+                indices.resize(indexCount);
+                file.read((char*)indices.data(), indexCount * sizeof(GLuint));
+                if (!file) {
+                    return false;
+                }
+                for (GLuint index : indices) {
+                    if (index >= vertexCount) {
+                        return false;
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+    bool saveLodChains(const std::string& fileName, const std::vector<uint64_t>& meshHashes, const std::vector<LodChain>& chains) {
+        std::ofstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        uint32_t meshCount = (uint32_t)chains.size();
+        file.write(lodCacheMagic, sizeof(lodCacheMagic));
+        file.write((const char*)&meshCount, sizeof(meshCount));
+        for (uint32_t m = 0; m < meshCount; m++) {
+            uint32_t vertexCount = (uint32_t)chains[m].vertices.size();
+            file.write((const char*)&meshHashes[m], sizeof(uint64_t));
+            file.write((const char*)&vertexCount, sizeof(vertexCount));
+            file.write((const char*)chains[m].vertices.data(), vertexCount * sizeof(Vertex));
+
+            uint32_t levelCount = (uint32_t)chains[m].levels.size();
+            file.write((const char*)&levelCount, sizeof(levelCount));
+            for (uint32_t level = 0; level < levelCount; level++) {
+                uint32_t indexCount = (uint32_t)chains[m].levels[level].size();
+                file.write((const char*)&chains[m].errors[level], sizeof(float));
+                file.write((const char*)&indexCount, sizeof(indexCount));
+                file.write((const char*)chains[m].levels[level].data(), indexCount * sizeof(GLuint));
+            }
+        }
+        return (bool)file;
+    }
+}
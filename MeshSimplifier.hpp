@@ -0,0 +1,56 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Coarser versions of one mesh. All levels index the same welded vertices.
+    struct LodChain {
+        std::vector<Vertex> vertices;
+        // index lists, finest first
+        std::vector<std::vector<GLuint>> levels;
+        // object-space geometric error of each level
+        std::vector<float> errors;
+    };
+
+    // Merges corners with the same position and texture coordinates; the
+    // normals of merged corners are averaged
+    void weldVertices(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        std::vector<Vertex>& weldedVertices, std::vector<GLuint>& weldedIndices);
+
+    // Quadric error metric simplification by half-edge collapses. Vertices on
+    // open borders and UV seams are locked, so both survive every level.
+    // One level is recorded per triangle target (descending); stops early once
+    // no collapse is left.
+    void simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        const std::vector<size_t>& triangleTargets,
+        std::vector<std::vector<GLuint>>& levels, std::vector<float>& errors);
+
+    // Welds the mesh and simplifies it to up to levelCount levels, each
+    // about half the triangles of the previous one
+    void buildLodChain(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+        int levelCount, LodChain& chain);
+
+    // Identifies the source data of a chain in the LOD cache
+    uint64_t hashMeshData(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices);
+
+    // The full mesh a cached chain was built from
+    struct LodSource {
+        uint64_t hash;
+        size_t vertexCount;
+        size_t indexCount;
+    };
+
+    // LOD cache file; loading fails unless every mesh hash matches and every
+    // chain is no bigger than its source, fits the file and indexes only its
+    // own vertices, so a stale or truncated file is rebuilt
+    bool loadLodChains(const std::string& fileName, const std::vector<LodSource>& sources, std::vector<LodChain>& chains);
+    bool saveLodChains(const std::string& fileName, const std::vector<uint64_t>& meshHashes, const std::vector<LodChain>& chains);
+}
+
+#endif /* MeshSimplifier_hpp */
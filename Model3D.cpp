@@ -1,27 +1,243 @@
 #include "Model3D.hpp"
+#include "Parallel.hpp"
+#include "DuplicateShapes.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
 
 namespace gps {
 
+	void Model3D::setAutoInstancing(bool enabled) {
+
+		autoInstancing = enabled;
+	}
+
 	void Model3D::LoadModel(std::string fileName) {
 
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+		LoadModel(fileName, basePath);
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)	{
 
-		ReadOBJ(fileName, basePath);
+		if (!ReadModel(fileName, basePath)) {
+
+			exit(1);
+		}
+		Upload(SIZE_MAX);
+	}
+
+	bool Model3D::ReadModel(std::string fileName, std::string basePath) {
+
+		std::string key = normalizePath(fileName) + (autoInstancing ? "|instanced" : "");
+		std::shared_ptr<SharedData> shared = shareData(key, nullptr);
+		if (shared) {
+			std::cout << "Loading : " << fileName << " (shared)" << std::endl;
+			data = shared;
+			return true;
+		}
+
+		data = std::make_shared<SharedData>();
+		if (!ReadOBJ(fileName, basePath)) {
+			return false;
+		}
+		GenerateLods(fileName);
+		BuildBvh();
+		// another thread may have read the same file meanwhile, its copy wins
+		data = shareData(key, data);
+		return true;
+	}
+
+	bool Model3D::Upload(size_t byteBudget) {
+
+		size_t uploaded = 0;
+		gps::AssetManager& assets = getAssetManager();
+		while (data->uploadedTextures < data->loadedTextures.size() && uploaded < byteBudget) {
+			// textures shared with a model uploaded before come back with their id
+			data->loadedTextures[data->uploadedTextures].id = assets.uploadTexture(data->textureHandles[data->uploadedTextures], uploaded);
+			data->uploadedTextures++;
+		}
+		if (data->uploadedTextures < data->loadedTextures.size()) {
+			return false;
+		}
+
+		while (data->uploadedMeshes < data->meshes.size() && uploaded < byteBudget) {
+			gps::Mesh& mesh = data->meshes[data->uploadedMeshes];
+			// the meshes were given their textures before these had ids
+			for (gps::Texture& texture : mesh.textures) {
+				texture.id = data->loadedTextures[data->textureIndices.at(texture.path)].id;
+			}
+			mesh.upload();
+			uploaded += mesh.vertices.size() * sizeof(gps::Vertex) + mesh.indices.size() * sizeof(GLuint);
+			data->uploadedMeshes++;
+		}
+		return data->uploadedMeshes == data->meshes.size();
+	}
+
+	size_t Model3D::getMemoryBytes() const {
+
+		size_t bytes = data->textureBytes;
+		for (const gps::Mesh& mesh : data->meshes) {
+			bytes += mesh.getMemoryBytes();
+		}
+		// triangles and nodes of the BVH, roughly
+		bytes += (size_t)data->bvh.getTriangleCount() * 64;
+		return bytes;
 	}
 
 	// Draw each mesh from the model
 	void Model3D::Draw(gps::Shader shaderProgram) {
 
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+		for (int i = 0; i < data->meshes.size(); i++)
+			data->meshes[i].Draw(shaderProgram);
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const std::vector<uint8_t>& visibleMeshes) {
+
+		for (size_t i = 0; i < data->meshes.size() && i < visibleMeshes.size(); i++)
+			if (visibleMeshes[i])
+				data->meshes[i].Draw(shaderProgram);
+	}
+
+	void Model3D::Draw(gps::Shader shaderProgram, const std::vector<uint8_t>& visibleMeshes, const std::vector<uint8_t>& meshLods) {
+
+		for (size_t i = 0; i < data->meshes.size() && i < visibleMeshes.size() && i < meshLods.size(); i++)
+			if (visibleMeshes[i])
+				data->meshes[i].Draw(shaderProgram, meshLods[i]);
+	}
+
+	void Model3D::DrawMesh(gps::Shader shaderProgram, size_t meshIndex, int lod) {
+
+		data->meshes[meshIndex].Draw(shaderProgram, lod);
+	}
+
+	void Model3D::DrawInstanced(gps::Shader shaderProgram, int lod, GLuint instanceBuffer, GLsizei instanceCount) {
+
+		for (size_t i = 0; i < data->meshes.size(); i++)
+			data->meshes[i].DrawInstanced(shaderProgram, std::min(lod, data->meshes[i].getLodCount() - 1), instanceBuffer, instanceCount);
+	}
+
+	void Model3D::DrawMeshCopies(gps::Shader shaderProgram, size_t meshIndex, int lod, GLuint copyBuffer, GLsizei copyCount) {
+
+		data->meshes[meshIndex].DrawCopies(shaderProgram, lod, copyBuffer, copyCount);
+	}
+
+	void Model3D::DrawMeshRanges(gps::Shader shaderProgram, size_t meshIndex, const std::vector<GLsizei>& counts, const std::vector<const GLvoid*>& offsets) {
+
+		data->meshes[meshIndex].DrawRanges(shaderProgram, counts, offsets);
+	}
+
+	const std::vector<gps::Mesh>& Model3D::getMeshes() const {
+
+		return data->meshes;
+	}
+
+	const gps::BoundingBox& Model3D::getBounds() const {
+
+		return data->bounds;
+	}
+
+	const gps::Bvh& Model3D::getBvh() const {
+
+		return data->bvh;
+	}
+
+	size_t Model3D::getMeshOfTriangle(uint32_t triangle) const {
+
+		return std::upper_bound(data->meshFirstTriangles.begin(), data->meshFirstTriangles.end(), triangle) - data->meshFirstTriangles.begin() - 1;
+	}
+
+	bool Model3D::LoadLightmap(std::string fileName) {
+
+		// the baker unwraps every shape of the file, instanced or not
+		gps::Lightmap lightmap;
+		if (!gps::loadLightmap(fileName, lightmap) || lightmap.meshCoords.size() != data->shapeCount) {
+			return false;
+		}
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			if (lightmap.meshCoords[data->meshShapes[m]].size() != data->meshes[m].vertices.size()) {
+				return false;
+			}
+		}
+
+		// instanced meshes share one set of coordinates, so they take the probes instead
+		data->lightmapAverages.assign(data->meshes.size(), glm::vec3(0.0f));
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			if (data->meshes[m].getInstanceCount() > 0) {
+				continue;
+			}
+			data->meshes[m].setLightmapCoords(lightmap.meshCoords[data->meshShapes[m]]);
+
+			const std::vector<glm::vec2>& coords = lightmap.meshCoords[data->meshShapes[m]];
+			for (size_t i = 0; i < coords.size(); i++) {
+				int x = std::min(std::max((int)(coords[i].x * lightmap.width), 0), lightmap.width - 1);
+				int y = std::min(std::max((int)(coords[i].y * lightmap.height), 0), lightmap.height - 1);
+				data->lightmapAverages[m] += gps::decodeRgbm(&lightmap.texels[((size_t)y * lightmap.width + x) * 4]);
+			}
+			if (!coords.empty()) {
+				data->lightmapAverages[m] /= (float)coords.size();
+			}
+		}
+
+		// RGBM is decoded in the shader, so the texels stay linear and unmipmapped
+		if (data->lightmapTexture == 0) {
+			glGenTextures(1, &data->lightmapTexture);
+		}
+		glBindTexture(GL_TEXTURE_2D, data->lightmapTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, lightmap.width, lightmap.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, lightmap.texels.data());
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		std::cout << "Lightmap       : " << fileName << ", " << lightmap.width << " x " << lightmap.height << std::endl;
+		return true;
+	}
+
+	GLuint Model3D::getLightmapTexture() const {
+
+		return data->lightmapTexture;
+	}
+
+	glm::vec3 Model3D::getLightmapAverage(size_t meshIndex) const {
+
+		return meshIndex < data->lightmapAverages.size() ? data->lightmapAverages[meshIndex] : glm::vec3(0.0f);
+	}
+
+	void Model3D::BuildBvh() {
+
+		std::vector<glm::vec3> positions;
+		std::vector<uint32_t> indices;
+		data->meshFirstTriangles.clear();
+		for (size_t m = 0; m < data->meshes.size(); m++) {
+			data->meshFirstTriangles.push_back((uint32_t)(indices.size() / 3));
+			// every copy of an instanced mesh is traced, all reported as that mesh
+			std::vector<glm::mat4> transforms = data->meshes[m].getInstanceTransforms();
+			if (transforms.empty()) {
+				transforms.push_back(glm::mat4(1.0f));
+			}
+			for (const glm::mat4& transform : transforms) {
+				uint32_t firstVertex = (uint32_t)positions.size();
+				for (size_t i = 0; i < data->meshes[m].vertices.size(); i++) {
+					positions.push_back(glm::vec3(transform * glm::vec4(data->meshes[m].vertices[i].Position, 1.0f)));
+				}
+				for (size_t i = 0; i < data->meshes[m].indices.size(); i++) {
+					indices.push_back(firstVertex + data->meshes[m].indices[i]);
+				}
+			}
+		}
+
+		auto start = std::chrono::high_resolution_clock::now();
+		data->bvh.build(positions, indices);
+		auto stop = std::chrono::high_resolution_clock::now();
+		std::cout << "BVH build      : " << data->bvh.getTriangleCount() << " triangles, "
+			<< std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath) {
+	bool Model3D::ReadOBJ(std::string fileName, std::string basePath) {
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
@@ -40,18 +256,23 @@ namespace gps {
 
 		if (!ret) {
 
-			exit(1);
+			return false;
 		}
 
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		std::vector<std::vector<gps::Vertex>> shapeVertices(shapes.size());
+		std::vector<std::vector<GLuint>> shapeIndices(shapes.size());
+		std::vector<std::vector<gps::Texture>> shapeTextures(shapes.size());
+		std::vector<int> shapeMaterials(shapes.size(), -1);
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			std::vector<gps::Vertex>& vertices = shapeVertices[s];
+			std::vector<GLuint>& indices = shapeIndices[s];
+			std::vector<gps::Texture>& textures = shapeTextures[s];
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -107,6 +328,7 @@ namespace gps {
 			if (a > 0 && materials.size()>0) {
 
 				materialId = shapes[s].mesh.material_ids[0];
+				shapeMaterials[s] = materialId;
 				if (materialId != -1) {
 
 					gps::Material currentMaterial;
@@ -146,111 +368,170 @@ namespace gps {
 				}
 			}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
 		}
-	}
 
-	// Retrieves a texture associated with the object - by its name and type
-	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
+		data->shapeCount = shapes.size();
+		data->meshShapes.clear();
+		if (!autoInstancing) {
+			for (size_t s = 0; s < shapes.size(); s++) {
+				data->meshes.push_back(gps::Mesh(shapeVertices[s], shapeIndices[s], shapeTextures[s]));
+				data->meshShapes.push_back(s);
+				data->bounds.expand(data->meshes.back().bounds);
+			}
+			return true;
+		}
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
+		auto start = std::chrono::high_resolution_clock::now();
+		std::vector<gps::ShapeGroup> groups;
+		gps::groupDuplicateShapes(shapeVertices, shapeMaterials, groups);
 
-				if (loadedTextures[i].path == path)	{
+		// small groups keep one mesh per shape, and with it their lightmap
+		std::vector<int> groupOfShape(shapes.size(), -1);
+		for (size_t g = 0; g < groups.size(); g++) {
+			if (groups[g].shapes.size() >= AUTO_INSTANCE_MIN_COPIES) {
+				for (size_t s : groups[g].shapes) {
+					groupOfShape[s] = (int)g;
+				}
+			}
+		}
 
-					//already loaded texture
-					return loadedTextures[i];
+		size_t instancedMeshes = 0;
+		size_t instancedShapes = 0;
+		for (size_t s = 0; s < shapes.size(); s++) {
+			int g = groupOfShape[s];
+			if (g < 0) {
+				data->meshes.push_back(gps::Mesh(shapeVertices[s], shapeIndices[s], shapeTextures[s]));
+			}
+			else if (groups[g].shapes[0] == s) {
+				// the first copy, moved to its centroid, is the shared geometry
+				std::vector<gps::Vertex> local = shapeVertices[s];
+				glm::vec3 centroid = glm::vec3(groups[g].transforms[0][3]);
+				for (size_t i = 0; i < local.size(); i++) {
+					local[i].Position -= centroid;
 				}
+				data->meshes.push_back(gps::Mesh(local, shapeIndices[s], shapeTextures[s]));
+				data->meshes.back().setInstances(groups[g].transforms);
+				instancedMeshes++;
+				instancedShapes += groups[g].shapes.size();
+			}
+			else {
+				continue;
 			}
+			data->meshShapes.push_back(s);
+			data->bounds.expand(data->meshes.back().bounds);
+		}
+		auto stop = std::chrono::high_resolution_clock::now();
 
-			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
-			currentTexture.type = std::string(type);
-			currentTexture.path = path;
+		std::cout << "Instancing     : " << instancedShapes << " shapes drawn as " << instancedMeshes << " instanced meshes, "
+			<< data->meshes.size() << " meshes in all, " << std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
+		return true;
+	}
 
-			loadedTextures.push_back(currentTexture);
 
-			return currentTexture;
+	void Model3D::GenerateLods(std::string fileName) {
+
+		std::string cacheName = fileName + ".lod";
+
+		std::vector<uint64_t> hashes(data->meshes.size());
+		std::vector<gps::LodSource> sources(data->meshes.size());
+		for (size_t i = 0; i < data->meshes.size(); i++) {
+			hashes[i] = data->meshes[i].getContentHash();
+			sources[i].hash = hashes[i];
+			sources[i].vertexCount = data->meshes[i].vertices.size();
+			sources[i].indexCount = data->meshes[i].indices.size();
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+		// the cache is only used when it was built from exactly these meshes
+		std::vector<gps::LodChain> chains;
+		if (gps::loadLodChains(cacheName, sources, chains)) {
+			std::cout << "LOD cache      : " << cacheName << std::endl;
+		}
+		else {
+			auto start = std::chrono::high_resolution_clock::now();
 
-		int x, y, n;
-		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+			chains.assign(data->meshes.size(), gps::LodChain());
+			gps::parallelFor(data->meshes.size(), 1, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					gps::buildLodChain(data->meshes[i].vertices, data->meshes[i].indices, LOD_LEVELS, chains[i]);
+				}
+			});
 
-		if (!image_data) {
-			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+			auto stop = std::chrono::high_resolution_clock::now();
+			std::cout << "LOD generation : " << std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
+
+			if (!gps::saveLodChains(cacheName, hashes, chains)) {
+				std::cerr << "Could not write " << cacheName << std::endl;
+			}
 		}
-		// NPOT check
-		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
-			fprintf(
-				stderr, "WARNING: texture %s is not power-of-2 dimensions\n", file_name
-			);
+
+		for (size_t i = 0; i < data->meshes.size(); i++) {
+			data->meshes[i].setLods(chains[i].vertices, chains[i].levels, chains[i].errors);
 		}
+	}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
+	// Retrieves a texture associated with the object - by its name and type
+	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
-		for (int row = 0; row < half_height; row++) {
+			auto loaded = data->textureIndices.find(path);
+			if (loaded != data->textureIndices.end()) {
 
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
+				//already loaded texture
+				gps::Texture currentTexture = data->loadedTextures[loaded->second];
+				currentTexture.type = type;
+				return currentTexture;
+			}
 
-			for (int col = 0; col < width_in_bytes; col++) {
+			gps::Texture currentTexture;
+			// Upload gives it an id
+			currentTexture.id = 0;
+			currentTexture.type = std::string(type);
+			currentTexture.path = path;
 
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
-		}
+			// decoded once for every model that uses the same image
+			gps::AssetManager& assets = getAssetManager();
+			AssetHandle handle = assets.acquireTexture(path);
+			data->textureBytes += assets.getTextureBytes(handle);
 
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
-
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+			data->textureIndices[path] = data->loadedTextures.size();
+			data->loadedTextures.push_back(currentTexture);
+			data->textureHandles.push_back(handle);
 
-		return textureID;
-	}
+			return currentTexture;
+		}
 
-	Model3D::~Model3D() {
+	Model3D::SharedData::~SharedData() {
 
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
+        for (size_t i = 0; i < textureHandles.size(); i++) {
 
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            getAssetManager().releaseTexture(textureHandles.at(i));
         }
 
         for (size_t i = 0; i < meshes.size(); i++) {
 
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
+            meshes.at(i).release();
         }
+
+        if (lightmapTexture != 0) {
+            glDeleteTextures(1, &lightmapTexture);
+        }
+	}
+
+	std::shared_ptr<Model3D::SharedData> Model3D::shareData(const std::string& key, const std::shared_ptr<SharedData>& candidate) {
+
+		// weak, so a file is read again once every model using it is gone
+		static std::mutex mutex;
+		static std::unordered_map<std::string, std::weak_ptr<SharedData>> loaded;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		auto found = loaded.find(key);
+		if (found != loaded.end()) {
+			if (std::shared_ptr<SharedData> shared = found->second.lock()) {
+				return shared;
+			}
+		}
+		if (candidate) {
+			loaded[key] = candidate;
+		}
+		return candidate;
 	}
 }
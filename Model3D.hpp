@@ -2,12 +2,19 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "MeshSimplifier.hpp"
+#include "Bvh.hpp"
+#include "Lightmap.hpp"
+#include "AssetManager.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <cstdint>
 #include <iostream>
+#include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
@@ -15,28 +22,128 @@ namespace gps {
     class Model3D {
 
     public:
-        ~Model3D();
+        // simplified levels generated per mesh, on top of the full mesh
+        static const int LOD_LEVELS = 3;
 
+        // shapes with fewer copies than this keep a mesh each
+        static const size_t AUTO_INSTANCE_MIN_COPIES = 3;
+
+		// Before LoadModel: merge shapes that are rigid copies of each other
+		// (an OBJ exported flat repeats every prop in world space) into one
+		// mesh drawn instanced per group, see groupDuplicateShapes
+		void setAutoInstancing(bool enabled);
+
+		// ReadModel then Upload, exiting when the file cannot be read
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
+		// Reads the OBJ, decodes its textures and builds the levels of detail
+		// and the BVH without touching GL, so it may run on a loader thread;
+		// false when the file cannot be read. A file another model still
+		// holds is not read again, the two share everything.
+		bool ReadModel(std::string fileName, std::string basePath);
+
+		// On the GL thread, after ReadModel: creates the textures, then the
+		// mesh buffers, one at a time until byteBudget bytes were uploaded in
+		// this call; true once everything is uploaded
+		bool Upload(size_t byteBudget);
+
+		// Approximate memory held by the model, its CPU copies and GPU objects
+		size_t getMemoryBytes() const;
+
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws only the meshes whose entry in visibleMeshes is non-zero
+		void Draw(gps::Shader shaderProgram, const std::vector<uint8_t>& visibleMeshes);
+
+		// Same, with a level of detail per mesh
+		void Draw(gps::Shader shaderProgram, const std::vector<uint8_t>& visibleMeshes, const std::vector<uint8_t>& meshLods);
+
+		// Draws a single mesh
+		void DrawMesh(gps::Shader shaderProgram, size_t meshIndex, int lod);
+
+		// Draws instanceCount copies of every mesh at one level of detail,
+		// placed by the instance buffer (see Mesh::DrawInstanced)
+		void DrawInstanced(gps::Shader shaderProgram, int lod, GLuint instanceBuffer, GLsizei instanceCount);
+
+		// Draws copyCount copies of an instanced mesh from another transform buffer (see Mesh::DrawCopies)
+		void DrawMeshCopies(gps::Shader shaderProgram, size_t meshIndex, int lod, GLuint copyBuffer, GLsizei copyCount);
+
+		// Draws index ranges of a mesh's full detail level (its surviving clusters)
+		void DrawMeshRanges(gps::Shader shaderProgram, size_t meshIndex, const std::vector<GLsizei>& counts, const std::vector<const GLvoid*>& offsets);
+
+		const std::vector<gps::Mesh>& getMeshes() const;
+
+		// Union of the mesh bounds, in model space
+		const gps::BoundingBox& getBounds() const;
+
+		// Ray queries against every mesh's full detail triangles, in model space
+		const gps::Bvh& getBvh() const;
+
+		// Mesh owning a triangle reported by the BVH
+		size_t getMeshOfTriangle(uint32_t triangle) const;
+
+		// Reads a lightmap written by LightmapBaker for this model; false when it
+		// is missing or was baked from a different version of the model
+		bool LoadLightmap(std::string fileName);
+
+		// 0 until a lightmap is loaded
+		GLuint getLightmapTexture() const;
+
+		// Mean baked light over a mesh's vertices, for levels of detail that
+		// have no lightmap coordinates
+		glm::vec3 getLightmapAverage(size_t meshIndex) const;
+
     private:
-		// Component meshes - group of objects
-        std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// What is read from the file and uploaded from it, shared by every
+		// model loaded from the same path (with the same auto instancing):
+		// the file is parsed, simplified and its BVH built once, and the
+		// copies draw from the same GL objects, lightmap included
+		struct SharedData {
+			// Component meshes - group of objects
+			std::vector<gps::Mesh> meshes;
+			gps::BoundingBox bounds;
+			gps::Bvh bvh;
+			// first BVH triangle of each mesh
+			std::vector<uint32_t> meshFirstTriangles;
+			// Associated textures
+			std::vector<gps::Texture> loadedTextures;
+			// OBJ shape each mesh was read from (the first copy for instanced meshes)
+			std::vector<size_t> meshShapes;
+			size_t shapeCount = 0;
+			GLuint lightmapTexture = 0;
+			std::vector<glm::vec3> lightmapAverages;
+
+			// the asset manager's reference on each of loadedTextures
+			std::vector<AssetHandle> textureHandles;
+			// path to its index in loadedTextures
+			std::unordered_map<std::string, size_t> textureIndices;
+			size_t uploadedTextures = 0;
+			size_t uploadedMeshes = 0;
+			size_t textureBytes = 0;
+
+			~SharedData();
+		};
+
+		std::shared_ptr<SharedData> data = std::make_shared<SharedData>();
+		bool autoInstancing = false;
+
+		// The data already read under key, else candidate, which is kept
+		// for the next model asking (unless it is null)
+		static std::shared_ptr<SharedData> shareData(const std::string& key, const std::shared_ptr<SharedData>& candidate);
 
 		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		bool ReadOBJ(std::string fileName, std::string basePath);
+
+		// Simplifies every mesh into LOD_LEVELS levels, or reads them back from fileName.lod
+		void GenerateLods(std::string fileName);
+
+		// Builds the BVH over the meshes' triangles
+		void BuildBvh();
 
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
-
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
     };
 }
 
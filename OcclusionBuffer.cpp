@@ -0,0 +1,221 @@
+#include "OcclusionBuffer.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define OCCLUSION_BUFFER_SSE
+    #include <emmintrin.h>
+#endif
+
+namespace gps {
+
+    // rows rasterized per worker job
+    static const int BAND_HEIGHT = 8;
+    // pyramid stops at 8x4
+    static const int LEVEL_COUNT = 6;
+
+    void OcclusionBuffer::begin(const glm::mat4& viewProjection) {
+        this->viewProjection = viewProjection;
+        screenTriangles.clear();
+
+        if (levels.empty()) {
+            levels.resize(LEVEL_COUNT);
+            for (int level = 0; level < LEVEL_COUNT; level++) {
+                levels[level].resize((WIDTH >> level) * (HEIGHT >> level));
+            }
+        }
+        std::fill(levels[0].begin(), levels[0].end(), 1.0f);
+    }
+
+    void OcclusionBuffer::addOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, const glm::mat4& model) {
+        glm::mat4 modelViewProjection = viewProjection * model;
+
+        std::vector<glm::vec4> clip(positions.size());
+        for (size_t i = 0; i < positions.size(); i++) {
+            clip[i] = modelViewProjection * glm::vec4(positions[i], 1.0f);
+        }
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+            glm::vec3 screen[3];
+            bool clipped = false;
+            for (int k = 0; k < 3; k++) {
+                const glm::vec4& p = clip[indices[i + k]];
+                // no near plane clipping: triangles reaching behind the camera are simply not occluders
+                if (p.w < 1e-3f) {
+                    clipped = true;
+                    break;
+                }
+                screen[k] = glm::vec3((p.x / p.w * 0.5f + 0.5f) * WIDTH, (p.y / p.w * 0.5f + 0.5f) * HEIGHT, p.z / p.w * 0.5f + 0.5f);
+            }
+            if (clipped) {
+                continue;
+            }
+
+            // the lit pass culls back faces, so they must not occlude either
+            float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) - (screen[1].y - screen[0].y) * (screen[2].x - screen[0].x);
+            if (area <= 0.0f) {
+                continue;
+            }
+
+            float minX = std::min(screen[0].x, std::min(screen[1].x, screen[2].x));
+            float maxX = std::max(screen[0].x, std::max(screen[1].x, screen[2].x));
+            float minY = std::min(screen[0].y, std::min(screen[1].y, screen[2].y));
+            float maxY = std::max(screen[0].y, std::max(screen[1].y, screen[2].y));
+            if (maxX < 0.0f || minX > WIDTH || maxY < 0.0f || minY > HEIGHT) {
+                continue;
+            }
+
+            screenTriangles.push_back(screen[0]);
+            screenTriangles.push_back(screen[1]);
+            screenTriangles.push_back(screen[2]);
+        }
+    }
+
+    void OcclusionBuffer::rasterize() {
+        // bands own disjoint rows, so the workers never touch the same pixels
+        int bandCount = (HEIGHT + BAND_HEIGHT - 1) / BAND_HEIGHT;
+        parallelFor(bandCount, 1, [this](size_t begin, size_t end) {
+            for (size_t band = begin; band < end; band++) {
+                rasterizeRows((int)band * BAND_HEIGHT, std::min((int)(band + 1) * BAND_HEIGHT, HEIGHT));
+            }
+        });
+
+        buildPyramid();
+    }
+
+    void OcclusionBuffer::rasterizeRows(int rowBegin, int rowEnd) {
+        std::vector<float>& depth = levels[0];
+
+        for (size_t t = 0; t < screenTriangles.size(); t += 3) {
+            const glm::vec3& v0 = screenTriangles[t];
+            const glm::vec3& v1 = screenTriangles[t + 1];
+            const glm::vec3& v2 = screenTriangles[t + 2];
+
+            int minY = std::max((int)std::floor(std::min(v0.y, std::min(v1.y, v2.y))), rowBegin);
+            int maxY = std::min((int)std::ceil(std::max(v0.y, std::max(v1.y, v2.y))), rowEnd - 1);
+            if (minY > maxY) {
+                continue;
+            }
+            // whole groups of four pixels; WIDTH is a multiple of 4
+            int minX = std::max((int)std::floor(std::min(v0.x, std::min(v1.x, v2.x))), 0) & ~3;
+            int maxX = std::min((int)std::ceil(std::max(v0.x, std::max(v1.x, v2.x))), WIDTH - 1);
+
+            // edge functions e = a*x + b*y + c, non-negative inside (counter-clockwise)
+            float a0 = v0.y - v1.y, b0 = v1.x - v0.x, c0 = -(a0 * v0.x + b0 * v0.y);
+            float a1 = v1.y - v2.y, b1 = v2.x - v1.x, c1 = -(a1 * v1.x + b1 * v1.y);
+            float a2 = v2.y - v0.y, b2 = v0.x - v2.x, c2 = -(a2 * v2.x + b2 * v2.y);
+
+            // depth is affine in screen space: z = za*x + zb*y + zc
+            float area = a0 * v2.x + b0 * v2.y + c0;
+            float za = (a1 * v0.z + a2 * v1.z + a0 * v2.z) / area;
+            float zb = (b1 * v0.z + b2 * v1.z + b0 * v2.z) / area;
+            float zc = (c1 * v0.z + c2 * v1.z + c0 * v2.z) / area;
+
+            for (int y = minY; y <= maxY; y++) {
+                float py = y + 0.5f;
+                float* row = &depth[y * WIDTH];
+
+#if defined(OCCLUSION_BUFFER_SSE)
+                __m128 laneX = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+                __m128 zero = _mm_setzero_ps();
+                for (int x = minX; x <= maxX; x += 4) {
+                    __m128 px = _mm_add_ps(_mm_set1_ps((float)x), laneX);
+                    __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), px), _mm_set1_ps(b0 * py + c0));
+                    __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), px), _mm_set1_ps(b1 * py + c1));
+                    __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), px), _mm_set1_ps(b2 * py + c2));
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                    if (_mm_movemask_ps(inside) == 0) {
+                        continue;
+                    }
+
+                    __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), px), _mm_set1_ps(zb * py + zc));
+                    __m128 old = _mm_loadu_ps(row + x);
+                    __m128 nearest = _mm_min_ps(old, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, old)));
+                }
+#else
+                for (int x = minX; x <= maxX; x++) {
+                    float px = x + 0.5f;
+                    if (a0 * px + b0 * py + c0 >= 0.0f && a1 * px + b1 * py + c1 >= 0.0f && a2 * px + b2 * py + c2 >= 0.0f) {
+                        float z = za * px + zb * py + zc;
+                        row[x] = std::min(row[x], z);
+                    }
+                }
+#endif
+            }
+        }
+    }
+
+    void OcclusionBuffer::buildPyramid() {
+        for (int level = 1; level < LEVEL_COUNT; level++) {
+            const std::vector<float>& below = levels[level - 1];
+            std::vector<float>& current = levels[level];
+            int width = WIDTH >> level;
+            int height = HEIGHT >> level;
+            int belowWidth = width * 2;
+
+            for (int y = 0; y < height; y++) {
+                for (int x = 0; x < width; x++) {
+                    const float* texels = &below[(2 * y) * belowWidth + 2 * x];
+                    current[y * width + x] = std::max(std::max(texels[0], texels[1]), std::max(texels[belowWidth], texels[belowWidth + 1]));
+                }
+            }
+        }
+    }
+
+    bool OcclusionBuffer::isVisible(const BoundingBox& worldBox) const {
+        glm::vec3 minNdc(1e30f), maxNdc(-1e30f);
+        int cornersBehind = 0;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec3 position((corner & 1) ? worldBox.max.x : worldBox.min.x,
+                (corner & 2) ? worldBox.max.y : worldBox.min.y,
+                (corner & 4) ? worldBox.max.z : worldBox.min.z);
+            glm::vec4 clip = viewProjection * glm::vec4(position, 1.0f);
+            if (clip.w < 1e-3f) {
+                cornersBehind++;
+                continue;
+            }
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            minNdc = glm::min(minNdc, ndc);
+            maxNdc = glm::max(maxNdc, ndc);
+        }
+
+        // entirely behind the camera, or reaching the near plane where the test cannot decide
+        if (cornersBehind > 0) {
+            return cornersBehind < 8;
+        }
+
+        if (maxNdc.x < -1.0f || minNdc.x > 1.0f || maxNdc.y < -1.0f || minNdc.y > 1.0f || minNdc.z > 1.0f) {
+            return false;
+        }
+
+        int x0 = std::max((int)((minNdc.x * 0.5f + 0.5f) * WIDTH), 0);
+        int x1 = std::min((int)((maxNdc.x * 0.5f + 0.5f) * WIDTH), WIDTH - 1);
+        int y0 = std::max((int)((minNdc.y * 0.5f + 0.5f) * HEIGHT), 0);
+        int y1 = std::min((int)((maxNdc.y * 0.5f + 0.5f) * HEIGHT), HEIGHT - 1);
+        float nearestDepth = minNdc.z * 0.5f + 0.5f;
+
+        // coarsest level at which the box covers at most 4x4 texels
+        int level = 0;
+        while (level + 1 < LEVEL_COUNT && ((x1 >> level) - (x0 >> level) > 3 || (y1 >> level) - (y0 >> level) > 3)) {
+            level++;
+        }
+
+        const std::vector<float>& depth = levels[level];
+        int width = WIDTH >> level;
+        for (int y = y0 >> level; y <= y1 >> level; y++) {
+            for (int x = x0 >> level; x <= x1 >> level; x++) {
+                if (depth[y * width + x] >= nearestDepth) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    size_t OcclusionBuffer::getOccluderTriangleCount() const {
+        return screenTriangles.size() / 3;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef OcclusionBuffer_hpp
+#define OcclusionBuffer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "BoundingBox.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Low resolution depth buffer rasterized on the CPU from a few large
+    // occluders, with a max-depth pyramid to test bounding boxes against.
+    // Usage per frame: begin(), addOccluder()..., rasterize(), then isVisible()
+    // from any thread.
+    class OcclusionBuffer {
+
+    public:
+        static const int WIDTH = 256;
+        static const int HEIGHT = 128;
+
+        // clears the buffer and the occluder list
+        void begin(const glm::mat4& viewProjection);
+
+        // queues the front-facing triangles of an occluder
+        void addOccluder(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices, const glm::mat4& model);
+
+        // rasterizes the queued triangles (row bands across the worker threads)
+        // and builds the depth pyramid
+        void rasterize();
+
+        // false when the box is hidden behind the occluders or outside the view
+        bool isVisible(const BoundingBox& worldBox) const;
+
+        size_t getOccluderTriangleCount() const;
+
+    private:
+        glm::mat4 viewProjection;
+
+        // screen space (x, y in pixels, z = depth in [0, 1]), three per triangle
+        std::vector<glm::vec3> screenTriangles;
+
+        // level 0 is the rasterized buffer (nearest depth per pixel), each next
+        // level keeps the farthest depth of 2x2 texels below it
+        std::vector<std::vector<float>> levels;
+
+        void rasterizeRows(int rowBegin, int rowEnd);
+        void buildPyramid();
+    };
+}
+
+#endif /* OcclusionBuffer_hpp */
@@ -0,0 +1,172 @@
+#include "OcclusionQueries.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace gps {
+
+    void OcclusionQueries::init() {
+        // unit cube, scaled onto each box
+        const GLfloat corners[] = {
+            -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,   1.0f, 1.0f, -1.0f,   -1.0f, 1.0f, -1.0f,
+            -1.0f, -1.0f, 1.0f,    1.0f, -1.0f, 1.0f,    1.0f, 1.0f, 1.0f,    -1.0f, 1.0f, 1.0f
+        };
+        const GLuint faces[] = {
+            0, 2, 1, 0, 3, 2,   4, 5, 6, 4, 6, 7,
+            0, 1, 5, 0, 5, 4,   3, 6, 2, 3, 7, 6,
+            0, 4, 7, 0, 7, 3,   1, 2, 6, 1, 6, 5
+        };
+
+        glGenVertexArrays(1, &boxVAO);
+        glGenBuffers(1, &boxVBO);
+        glGenBuffers(1, &boxEBO);
+        glBindVertexArray(boxVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(faces), faces, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        glBindVertexArray(0);
+
+        boxShader.loadShader(
+            "shaders/occlusionBox.vert",
+            "shaders/occlusionBox.frag");
+        boxTransformLoc = glGetUniformLocation(boxShader.shaderProgram, "boxTransform");
+    }
+
+    void OcclusionQueries::collect() {
+        drawnCount = 0;
+        occludedCount = 0;
+        inFlightCount = 0;
+
+        for (size_t i = 0; i < queries.size(); i++) {
+            std::vector<MeshQuery>& meshQueries = queries.at(i);
+            for (MeshQuery& meshQuery : meshQueries) {
+                if (!meshQuery.pending) {
+                    continue;
+                }
+                GLint available = 0;
+                glGetQueryObjectiv(meshQuery.query, GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint anySamples = 0;
+                    glGetQueryObjectuiv(meshQuery.query, GL_QUERY_RESULT, &anySamples);
+                    meshQuery.visible = anySamples != 0;
+                    meshQuery.pending = false;
+                }
+            }
+        }
+    }
+
+    bool OcclusionQueries::beginDraw(Entity entity, size_t meshIndex) {
+        if (!queries.has(entity) || meshIndex >= queries.get(entity).size()) {
+            drawnCount++;
+            return false;
+        }
+
+        const MeshQuery& meshQuery = queries.get(entity)[meshIndex];
+        if (!meshQuery.issued || meshQuery.visible) {
+            drawnCount++;
+            return false;
+        }
+
+        // a pending query was issued again after its hidden result was
+        // collected, and GL_QUERY_NO_WAIT draws while that one is in flight
+        if (meshQuery.pending) {
+            inFlightCount++;
+        }
+        else {
+            occludedCount++;
+        }
+        glBeginConditionalRender(meshQuery.query, GL_QUERY_NO_WAIT);
+        return true;
+    }
+
+    void OcclusionQueries::endDraw(bool conditional) {
+        if (conditional) {
+            glEndConditionalRender();
+        }
+    }
+
+    void OcclusionQueries::beginQueries(const glm::mat4& viewProjection, const glm::vec3& cameraPosition) {
+        this->viewProjection = viewProjection;
+        this->cameraPosition = cameraPosition;
+
+        glGetIntegerv(GL_POLYGON_MODE, savedPolygonMode);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        // the camera may look at the box from inside its far faces
+        glDisable(GL_CULL_FACE);
+
+        boxShader.useShaderProgram();
+        glBindVertexArray(boxVAO);
+    }
+
+    void OcclusionQueries::query(Entity entity, size_t meshIndex, size_t meshCount, const BoundingBox& worldBox) {
+        if (!queries.has(entity)) {
+            queries.add(entity, std::vector<MeshQuery>());
+        }
+        std::vector<MeshQuery>& meshQueries = queries.get(entity);
+        while (meshQueries.size() < meshCount) {
+            MeshQuery meshQuery = { 0, false, false, true };
+            glGenQueries(1, &meshQuery.query);
+            meshQueries.push_back(meshQuery);
+        }
+
+        MeshQuery& meshQuery = meshQueries[meshIndex];
+        // the previous result is still on its way; keep waiting for it
+        if (meshQuery.pending) {
+            return;
+        }
+
+        // slightly inflated so the box never z-fights with the mesh's own surface
+        glm::vec3 center = worldBox.getCenter();
+        glm::vec3 extents = worldBox.getExtents() * 1.01f + glm::vec3(0.05f);
+        BoundingBox inflated(center - extents, center + extents);
+        if (inflated.distanceSquared(cameraPosition) == 0.0f) {
+            // box around the camera: visible, and a query would be clipped by the near plane
+            meshQuery.visible = true;
+            return;
+        }
+
+        glm::mat4 boxTransform = viewProjection * glm::scale(glm::translate(glm::mat4(1.0f), center), extents);
+        glUniformMatrix4fv(boxTransformLoc, 1, GL_FALSE, glm::value_ptr(boxTransform));
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, meshQuery.query);
+        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        meshQuery.issued = true;
+        meshQuery.pending = true;
+    }
+
+    void OcclusionQueries::release(Entity entity) {
+        if (!queries.has(entity)) {
+            return;
+        }
+        for (MeshQuery& meshQuery : queries.get(entity)) {
+            glDeleteQueries(1, &meshQuery.query);
+        }
+        queries.remove(entity);
+    }
+
+    void OcclusionQueries::endQueries() {
+        glBindVertexArray(0);
+        glEnable(GL_CULL_FACE);
+        glDepthMask(GL_TRUE);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glPolygonMode(GL_FRONT_AND_BACK, savedPolygonMode[0]);
+    }
+
+    int OcclusionQueries::getDrawnCount() const {
+        return drawnCount;
+    }
+
+    int OcclusionQueries::getOccludedCount() const {
+        return occludedCount;
+    }
+
+    int OcclusionQueries::getInFlightCount() const {
+        return inFlightCount;
+    }
+}
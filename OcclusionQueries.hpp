@@ -0,0 +1,79 @@
+#ifndef OcclusionQueries_hpp
+#define OcclusionQueries_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "BoundingBox.hpp"
+#include "EntityRegistry.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Hardware occlusion culling with one GL_ANY_SAMPLES_PASSED query per mesh.
+    // After the lit pass every mesh's bounding box is tested against the depth
+    // buffer; the next frames draw the mesh under conditional rendering on that
+    // query. Results are only read once available, never waited for: a mesh
+    // last seen visible is drawn directly, one last seen hidden is left to the
+    // GPU (GL_QUERY_NO_WAIT draws it if the result is still in flight).
+    class OcclusionQueries {
+
+    public:
+        void init();
+
+        // Reads the results that are ready and resets the frame counters
+        void collect();
+
+        // Wrap a mesh draw of the lit pass; beginDraw returns whether it started conditional rendering
+        bool beginDraw(Entity entity, size_t meshIndex);
+        void endDraw(bool conditional);
+
+        // Box pass, after the lit pass: depth test on, colour and depth writes off
+        void beginQueries(const glm::mat4& viewProjection, const glm::vec3& cameraPosition);
+        void query(Entity entity, size_t meshIndex, size_t meshCount, const BoundingBox& worldBox);
+        void endQueries();
+
+        // Deletes an entity's queries, before it is destroyed and its id reused
+        void release(Entity entity);
+
+        // meshes drawn directly this frame
+        int getDrawnCount() const;
+        // meshes under conditional rendering whose last result is known
+        // hidden, which the GPU skips...
+        int getOccludedCount() const;
+        // ...and those whose result is still in flight, which it draws
+        int getInFlightCount() const;
+
+    private:
+        struct MeshQuery {
+            GLuint query;
+            bool issued;
+            bool pending;
+            bool visible;
+        };
+
+        ComponentPool<std::vector<MeshQuery>> queries;
+
+        Shader boxShader;
+        GLuint boxVAO = 0, boxVBO = 0, boxEBO = 0;
+        GLint boxTransformLoc = -1;
+        glm::mat4 viewProjection;
+        glm::vec3 cameraPosition;
+        GLint savedPolygonMode[2];
+
+        int drawnCount = 0;
+        int occludedCount = 0;
+        int inFlightCount = 0;
+    };
+}
+
+#endif /* OcclusionQueries_hpp */
@@ -0,0 +1,174 @@
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    namespace {
+
+        // set by setSerialThread
+        thread_local bool serialThread = false;
+
+        class WorkerPool {
+
+        public:
+            WorkerPool() {
+                unsigned int hardwareThreads = std::max(1u, std::thread::hardware_concurrency());
+                stopping = false;
+                generation = 0;
+                activeWorkers = 0;
+                limit = hardwareThreads;
+                for (unsigned int i = 1; i < hardwareThreads; i++) {
+                    workers.push_back(std::thread(&WorkerPool::workerLoop, this));
+                }
+            }
+
+            ~WorkerPool() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    stopping = true;
+                }
+                wake.notify_all();
+                for (size_t i = 0; i < workers.size(); i++) {
+                    workers[i].join();
+                }
+            }
+
+            unsigned int threadCount() {
+                return std::min(limit.load(), (unsigned int)workers.size() + 1);
+            }
+
+            void setLimit(unsigned int threads) {
+                limit = threads == 0 ? (unsigned int)workers.size() + 1 : threads;
+            }
+
+            void run(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body) {
+                size_t chunks = (count + grainSize - 1) / grainSize;
+                unsigned int helpers = std::min((unsigned int)chunks, threadCount()) - 1;
+
+                if (insideWorker || serialThread || helpers == 0) {
+                    body(0, count);
+                    return;
+                }
+                std::unique_lock<std::mutex> owner(runMutex, std::try_to_lock);
+                if (!owner.owns_lock()) {
+                    body(0, count);
+                    return;
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    job = &body;
+                    jobCount = count;
+                    jobGrain = grainSize;
+                    nextChunk = 0;
+                    pendingChunks = chunks;
+                    activeWorkers = helpers;
+                    generation++;
+                }
+                wake.notify_all();
+
+                executeChunks();
+
+                std::unique_lock<std::mutex> lock(mutex);
+                done.wait(lock, [this]() { return pendingChunks == 0 && workersInJob == 0; });
+                // workers that did not wake up in time must not join a finished job
+                activeWorkers = 0;
+                job = nullptr;
+            }
+
+        private:
+            std::vector<std::thread> workers;
+            std::mutex runMutex;
+            std::mutex mutex;
+            std::condition_variable wake;
+            std::condition_variable done;
+            bool stopping;
+            unsigned long long generation;
+            unsigned int activeWorkers;
+            unsigned int workersInJob = 0;
+            std::atomic<unsigned int> limit;
+
+            const std::function<void(size_t, size_t)>* job = nullptr;
+            size_t jobCount = 0;
+            size_t jobGrain = 1;
+            std::atomic<size_t> nextChunk{ 0 };
+            std::atomic<size_t> pendingChunks{ 0 };
+
+            static thread_local bool insideWorker;
+
+            void executeChunks() {
+                size_t chunks = (jobCount + jobGrain - 1) / jobGrain;
+                for (;;) {
+                    size_t chunk = nextChunk.fetch_add(1);
+                    if (chunk >= chunks) {
+                        break;
+                    }
+                    size_t begin = chunk * jobGrain;
+                    size_t end = std::min(begin + jobGrain, jobCount);
+                    (*job)(begin, end);
+                    if (pendingChunks.fetch_sub(1) == 1) {
+                        std::lock_guard<std::mutex> lock(mutex);
+                        done.notify_all();
+                    }
+                }
+            }
+
+            void workerLoop() {
+                insideWorker = true;
+                unsigned long long seenGeneration = 0;
+                for (;;) {
+                    {
+                        std::unique_lock<std::mutex> lock(mutex);
+                        wake.wait(lock, [&]() { return stopping || (generation != seenGeneration && activeWorkers > 0); });
+                        if (stopping) {
+                            return;
+                        }
+                        seenGeneration = generation;
+                        activeWorkers--;
+                        workersInJob++;
+                    }
+
+                    executeChunks();
+
+                    std::lock_guard<std::mutex> lock(mutex);
+                    workersInJob--;
+                    if (workersInJob == 0) {
+                        done.notify_all();
+                    }
+                }
+            }
+        };
+
+        thread_local bool WorkerPool::insideWorker = false;
+
+        WorkerPool& getPool() {
+            static WorkerPool pool;
+            return pool;
+        }
+    }
+
+    unsigned int getThreadCount() {
+        return getPool().threadCount();
+    }
+
+    void setThreadLimit(unsigned int limit) {
+        getPool().setLimit(limit);
+    }
+
+    void setSerialThread() {
+        serialThread = true;
+    }
+
+    void parallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body) {
+        if (count == 0) {
+            return;
+        }
+        getPool().run(count, std::max<size_t>(grainSize, 1), body);
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef Parallel_hpp
+#define Parallel_hpp
+
+#include <cstddef>
+#include <functional>
+
+namespace gps {
+
+    // Number of threads parallelFor may use, including the calling thread
+    unsigned int getThreadCount();
+
+    // Caps the threads used by parallelFor (1 = run serially, 0 = all cores)
+    void setThreadLimit(unsigned int limit);
+
+    // Makes parallelFor on the calling thread run serially from now on; for
+    // background threads, whose jobs would otherwise hold the pool while a
+    // frame's parallelFor falls back to one thread
+    void setSerialThread();
+
+    // Splits [0, count) into chunks of grainSize and runs body(begin, end) on
+    // the worker pool; returns once every chunk is done. Nested calls, and
+    // calls made while another thread owns the pool, run serially.
+    void parallelFor(size_t count, size_t grainSize, const std::function<void(size_t, size_t)>& body);
+}
+
+#endif /* Parallel_hpp */
@@ -0,0 +1,292 @@
+#include "PointShadows.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <utility>
+
+namespace gps {
+
+    // GL cube map face order: +X -X +Y -Y +Z -Z
+    static const glm::vec3 faceDirections[6] = {
+        glm::vec3(1.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
+        glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f)
+    };
+    static const glm::vec3 faceUps[6] = {
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+        glm::vec3(0.0f, 0.0f, 1.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+        glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)
+    };
+
+    static int countFaces(uint8_t mask) {
+        int count = 0;
+        for (int face = 0; face < 6; face++) {
+            count += (mask >> face) & 1;
+        }
+        return count;
+    }
+
+    void PointShadows::init(size_t vramBudgetBytes) {
+        // 16-bit depth, six faces per slot
+        size_t slotBytes = (size_t)FACE_SIZE * FACE_SIZE * 6 * 2;
+        GLint maxLayers = 0;
+        glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+        size_t slotCount = std::min(vramBudgetBytes / slotBytes, (size_t)maxLayers / 6);
+        slotCount = std::max<size_t>(slotCount, 1);
+
+        Slot freeSlot = {};
+        freeSlot.used = false;
+        slots.assign(slotCount, freeSlot);
+
+        glGenTextures(1, &cubeMapArray);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubeMapArray);
+        glTexImage3D(GL_TEXTURE_CUBE_MAP_ARRAY, 0, GL_DEPTH_COMPONENT16, FACE_SIZE, FACE_SIZE,
+            (GLsizei)(6 * slotCount), 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP_ARRAY, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMapArray, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        depthShader.loadShader(
+            "shaders/pointShadow.vert",
+            "shaders/pointShadow.geom",
+            "shaders/pointShadow.frag");
+
+        std::cout << "Point shadows: " << slotCount << " cube map slot(s) of " << FACE_SIZE << "x" << FACE_SIZE
+            << " (" << slotCount * slotBytes / (1024 * 1024) << " MB)" << std::endl;
+    }
+
+    void PointShadows::update(const std::vector<uint32_t>& lightIds, std::vector<PointLight>& lights,
+        const glm::vec3& cameraPosition, const std::vector<BoundingBox>& movedCasters,
+        const DrawCasters& drawCasters) {
+
+        facesRendered = 0;
+        facesPending = 0;
+
+        // rank lights by how close their range gets to the camera
+        std::vector<std::pair<float, size_t>> ranked;
+        std::vector<float> ranges(lights.size());
+        for (size_t i = 0; i < lights.size(); i++) {
+            lights[i].shadowSlot = -1;
+            ranges[i] = computeLightRange(lights[i], LIGHT_RANGE_THRESHOLD);
+            if (!lights[i].castsShadow || ranges[i] <= NEAR_PLANE) {
+                continue;
+            }
+            float distance = std::max(glm::length(lights[i].position - cameraPosition) - ranges[i], 0.0f);
+            ranked.push_back(std::make_pair(distance, i));
+        }
+        size_t shadowedCount = std::min(ranked.size(), slots.size());
+        std::partial_sort(ranked.begin(), ranked.begin() + shadowedCount, ranked.end());
+
+        // lights keeping their slot keep their cached faces
+        std::vector<bool> claimed(slots.size(), false);
+        std::vector<size_t> unassigned;
+        for (size_t k = 0; k < shadowedCount; k++) {
+            size_t i = ranked[k].second;
+            size_t s = 0;
+            while (s < slots.size() && !(slots[s].used && slots[s].lightId == lightIds[i])) {
+                s++;
+            }
+            if (s == slots.size()) {
+                unassigned.push_back(k);
+                continue;
+            }
+
+            Slot& slot = slots[s];
+            if (slot.position != lights[i].position || slot.range != ranges[i]) {
+                slot.position = lights[i].position;
+                slot.range = ranges[i];
+                slot.validFaces = 0;
+            }
+            slot.priority = ranked[k].first;
+            claimed[s] = true;
+        }
+        for (size_t s = 0; s < slots.size(); s++) {
+            if (!claimed[s]) {
+                slots[s].used = false;
+            }
+        }
+        for (size_t k : unassigned) {
+            size_t i = ranked[k].second;
+            size_t s = 0;
+            while (slots[s].used) {
+                s++;
+            }
+
+            Slot& slot = slots[s];
+            slot.lightId = lightIds[i];
+            slot.used = true;
+            slot.position = lights[i].position;
+            slot.range = ranges[i];
+            slot.validFaces = 0;
+            slot.ready = false;
+            slot.priority = ranked[k].first;
+        }
+
+        // faces seeing a moved caster are stale
+        for (Slot& slot : slots) {
+            if (!slot.used || slot.validFaces == 0) {
+                continue;
+            }
+            for (const BoundingBox& box : movedCasters) {
+                if (box.intersectsSphere(slot.position, slot.range)) {
+                    slot.validFaces &= ~facesTouched(box, slot.position);
+                }
+            }
+        }
+
+        // refresh the closest lights first, within the face budget
+        std::vector<std::pair<float, int>> order;
+        for (size_t s = 0; s < slots.size(); s++) {
+            if (slots[s].used && slots[s].validFaces != ALL_FACES) {
+                order.push_back(std::make_pair(slots[s].priority, (int)s));
+            }
+        }
+        std::sort(order.begin(), order.end());
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, FACE_SIZE, FACE_SIZE);
+
+        int budget = faceBudget;
+        for (size_t k = 0; k < order.size(); k++) {
+            Slot& slot = slots[order[k].second];
+            uint8_t missing = ALL_FACES & ~slot.validFaces;
+            uint8_t mask = 0;
+            for (int face = 0; face < 6 && budget > 0; face++) {
+                if (missing & (1 << face)) {
+                    mask |= (uint8_t)(1 << face);
+                    budget--;
+                }
+            }
+
+            if (mask != 0) {
+                renderFaces(order[k].second, mask, drawCasters);
+                slot.validFaces |= mask;
+                facesRendered += countFaces(mask);
+            }
+            facesPending += countFaces(ALL_FACES & ~slot.validFaces);
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+
+        // a slot still holding faces of its previous owner stays unused by the shader
+        for (size_t k = 0; k < shadowedCount; k++) {
+            size_t i = ranked[k].second;
+            for (size_t s = 0; s < slots.size(); s++) {
+                if (slots[s].used && slots[s].lightId == lightIds[i]) {
+                    slots[s].ready = slots[s].ready || slots[s].validFaces == ALL_FACES;
+                    lights[i].shadowSlot = slots[s].ready ? (int)s : -1;
+                    break;
+                }
+            }
+        }
+    }
+
+    void PointShadows::renderFaces(int slotIndex, uint8_t faceMask, const DrawCasters& drawCasters) {
+        const Slot& slot = slots[slotIndex];
+        GLint firstLayer = slotIndex * 6;
+
+        // a layered attachment would clear all slots, so clear face by face
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        for (int face = 0; face < 6; face++) {
+            if (faceMask & (1 << face)) {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMapArray, 0, firstLayer + face);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+        }
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, cubeMapArray, 0);
+
+        glm::mat4 faceProjection = glm::perspective(glm::radians(90.0f), 1.0f, NEAR_PLANE, slot.range);
+        glm::mat4 faceMatrices[6];
+        for (int face = 0; face < 6; face++) {
+            faceMatrices[face] = faceProjection * glm::lookAt(slot.position, slot.position + faceDirections[face], faceUps[face]);
+        }
+
+        depthShader.useShaderProgram();
+        GLuint program = depthShader.shaderProgram;
+        glUniformMatrix4fv(glGetUniformLocation(program, "faceMatrices"), 6, GL_FALSE, glm::value_ptr(faceMatrices[0]));
+        glUniform1i(glGetUniformLocation(program, "faceMask"), faceMask);
+        glUniform1i(glGetUniformLocation(program, "firstLayer"), firstLayer);
+        glUniform3fv(glGetUniformLocation(program, "lightPosition"), 1, glm::value_ptr(slot.position));
+        glUniform1f(glGetUniformLocation(program, "lightRange"), slot.range);
+
+        drawCasters(depthShader, slot.position, slot.range);
+    }
+
+    uint8_t PointShadows::facesTouched(const BoundingBox& box, const glm::vec3& lightPosition) const {
+        glm::vec3 low = box.min - lightPosition;
+        glm::vec3 high = box.max - lightPosition;
+
+        // a face sees the points whose coordinate along its axis dominates the other two;
+        // compare the box's furthest reach along the axis with its closest approach to it
+        glm::vec3 closest;
+        for (int axis = 0; axis < 3; axis++) {
+            closest[axis] = (low[axis] <= 0.0f && high[axis] >= 0.0f) ? 0.0f : std::min(std::abs(low[axis]), std::abs(high[axis]));
+        }
+
+        uint8_t mask = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            float otherA = closest[(axis + 1) % 3];
+            float otherB = closest[(axis + 2) % 3];
+            float reachPositive = high[axis];
+            float reachNegative = -low[axis];
+            if (reachPositive > 0.0f && reachPositive >= otherA && reachPositive >= otherB) {
+                mask |= (uint8_t)(1 << (2 * axis));
+            }
+            if (reachNegative > 0.0f && reachNegative >= otherA && reachNegative >= otherB) {
+                mask |= (uint8_t)(1 << (2 * axis + 1));
+            }
+        }
+        return mask;
+    }
+
+    void PointShadows::bind(GLuint shaderProgram, GLint textureUnit) {
+        glActiveTexture(GL_TEXTURE0 + textureUnit);
+        glBindTexture(GL_TEXTURE_CUBE_MAP_ARRAY, cubeMapArray);
+        glUniform1i(glGetUniformLocation(shaderProgram, "pointShadowMaps"), textureUnit);
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void PointShadows::invalidate() {
+        for (Slot& slot : slots) {
+            slot.validFaces = 0;
+        }
+    }
+
+    int PointShadows::getSlotCount() const {
+        return (int)slots.size();
+    }
+
+    int PointShadows::getFaceBudget() const {
+        return faceBudget;
+    }
+
+    void PointShadows::setFaceBudget(int faces) {
+        faceBudget = std::max(faces, 1);
+    }
+
+    int PointShadows::getFacesRendered() const {
+        return facesRendered;
+    }
+
+    int PointShadows::getFacesPending() const {
+        return facesPending;
+    }
+}
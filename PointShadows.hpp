@@ -0,0 +1,88 @@
+#ifndef PointShadows_hpp
+#define PointShadows_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "BoundingBox.hpp"
+#include "LightClusters.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace gps {
+
+    // Omnidirectional shadows for point lights. All shadowed lights share one
+    // cube map array sized from a fixed VRAM budget; a light owns a slot (six
+    // layers) while it is among the closest lights to the camera. The six faces
+    // are drawn in one layered pass (geometry shader instancing) and cached:
+    // a face is only redrawn when its light moves or a dynamic caster moves
+    // inside it, and at most faceBudget faces are redrawn per frame.
+    class PointShadows {
+
+    public:
+        static const int FACE_SIZE = 512;
+        static constexpr float NEAR_PLANE = 0.1f;
+
+        // Draws the casters overlapping the sphere with the bound depth shader
+        typedef std::function<void(Shader& shader, const glm::vec3& center, float radius)> DrawCasters;
+
+        void init(size_t vramBudgetBytes);
+
+        // lightIds identify lights across frames; movedCasters are the world bounds
+        // (before and after) of dynamic casters that moved since the last update.
+        // Writes the assigned slot, or -1, into every light's shadowSlot.
+        void update(const std::vector<uint32_t>& lightIds, std::vector<PointLight>& lights,
+            const glm::vec3& cameraPosition, const std::vector<BoundingBox>& movedCasters,
+            const DrawCasters& drawCasters);
+
+        void bind(GLuint shaderProgram, GLint textureUnit);
+
+        // drops every cached face, e.g. after the static scene changed
+        void invalidate();
+
+        int getSlotCount() const;
+        int getFaceBudget() const;
+        void setFaceBudget(int faces);
+        // faces redrawn by the last update / still waiting for the budget
+        int getFacesRendered() const;
+        int getFacesPending() const;
+
+    private:
+        static const uint8_t ALL_FACES = 0x3F;
+
+        struct Slot {
+            uint32_t lightId;
+            bool used;
+            glm::vec3 position;
+            float range;
+            uint8_t validFaces;
+            // all six faces drawn at least once since the slot was assigned
+            bool ready;
+            float priority;
+        };
+
+        std::vector<Slot> slots;
+        int faceBudget = 6;
+        int facesRendered = 0;
+        int facesPending = 0;
+
+        GLuint cubeMapArray = 0;
+        GLuint framebuffer = 0;
+        Shader depthShader;
+
+        uint8_t facesTouched(const BoundingBox& box, const glm::vec3& lightPosition) const;
+        void renderFaces(int slotIndex, uint8_t faceMask, const DrawCasters& drawCasters);
+    };
+}
+
+#endif /* PointShadows_hpp */
@@ -0,0 +1,49 @@
+#include "ProbeGrid.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+
+namespace gps {
+
+    static const char probeGridMagic[4] = { 'P', 'R', 'B', '1' };
+
+    bool loadProbeGrid(const std::string& fileName, ProbeGrid& grid) {
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        char magic[4];
+        int32_t size[3] = { 0, 0, 0 };
+        file.read(magic, sizeof(magic));
+        file.read((char*)size, sizeof(size));
+        file.read((char*)&grid.origin, sizeof(grid.origin));
+        file.read((char*)&grid.spacing, sizeof(grid.spacing));
+        if (!file || std::memcmp(magic, probeGridMagic, sizeof(magic)) != 0 || size[0] <= 0 || size[1] <= 0 || size[2] <= 0) {
+            return false;
+        }
+
+        grid.width = size[0];
+        grid.height = size[1];
+        grid.depth = size[2];
+        grid.coefficients.resize((size_t)grid.width * grid.height * grid.depth * 3);
+        file.read((char*)grid.coefficients.data(), grid.coefficients.size() * sizeof(glm::vec4));
+        return (bool)file;
+    }
+
+    bool saveProbeGrid(const std::string& fileName, const ProbeGrid& grid) {
+        std::ofstream file(fileName, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+
+        int32_t size[3] = { grid.width, grid.height, grid.depth };
+        file.write(probeGridMagic, sizeof(probeGridMagic));
+        file.write((const char*)size, sizeof(size));
+        file.write((const char*)&grid.origin, sizeof(grid.origin));
+        file.write((const char*)&grid.spacing, sizeof(grid.spacing));
+        file.write((const char*)grid.coefficients.data(), grid.coefficients.size() * sizeof(glm::vec4));
+        return (bool)file;
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef ProbeGrid_hpp
+#define ProbeGrid_hpp
+
+#include <glm/glm.hpp>
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Regular grid of L1 spherical harmonic irradiance probes, baked by
+    // LightmapBaker. Every probe holds one vec4 per color channel, already
+    // convolved with the cosine lobe, so for a unit normal n
+    //     irradiance / pi = c.x + dot(c.yzw, n)
+    // which is the scale the renderer multiplies by the albedo.
+    struct ProbeGrid {
+        int width = 0;
+        int height = 0;
+        int depth = 0;
+        // world position of probe (0, 0, 0)
+        glm::vec3 origin = glm::vec3(0.0f);
+        float spacing = 1.0f;
+        // 3 per probe (red, green, blue), x fastest, then y, then z
+        std::vector<glm::vec4> coefficients;
+
+        size_t probeIndex(int x, int y, int z) const {
+            return ((size_t)z * height + y) * width + x;
+        }
+    };
+
+    bool loadProbeGrid(const std::string& fileName, ProbeGrid& grid);
+    bool saveProbeGrid(const std::string& fileName, const ProbeGrid& grid);
+}
+
+#endif /* ProbeGrid_hpp */
@@ -0,0 +1,114 @@
+#include "SceneNode.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+
+namespace gps {
+
+    glm::mat3 computeNormalMatrix(const glm::mat4& modelMatrix, bool rigid) {
+        if (rigid) {
+            // the inverse of a rotation is its transpose
+            return glm::mat3(modelMatrix);
+        }
+        return glm::inverseTranspose(glm::mat3(modelMatrix));
+    }
+
+    SceneNode::SceneNode() {
+        this->model = nullptr;
+        this->parent = nullptr;
+        this->localTransform = glm::mat4(1.0f);
+        this->worldTransform = glm::mat4(1.0f);
+        this->normalMatrix = glm::mat3(1.0f);
+        this->localRigid = true;
+        this->worldRigid = true;
+        this->dirty = true;
+        this->childDirty = false;
+    }
+
+    void SceneNode::addChild(SceneNode* child) {
+        if (child->parent != nullptr) {
+            child->parent->removeChild(child);
+        }
+        child->parent = this;
+        children.push_back(child);
+        child->markDirty();
+    }
+
+    void SceneNode::removeChild(SceneNode* child) {
+        auto it = std::find(children.begin(), children.end(), child);
+        if (it != children.end()) {
+            children.erase(it);
+            child->parent = nullptr;
+            child->markDirty();
+        }
+    }
+
+    const std::vector<SceneNode*>& SceneNode::getChildren() const {
+        return children;
+    }
+
+    const SceneNode* SceneNode::getParent() const {
+        return parent;
+    }
+
+    void SceneNode::setLocalTransform(const glm::mat4& localTransform, bool rigid) {
+        this->localTransform = localTransform;
+        this->localRigid = rigid;
+        markDirty();
+    }
+
+    const glm::mat4& SceneNode::getLocalTransform() const {
+        return localTransform;
+    }
+
+    const glm::mat4& SceneNode::getWorldTransform() const {
+        return worldTransform;
+    }
+
+    const glm::mat3& SceneNode::getNormalMatrix() const {
+        return normalMatrix;
+    }
+
+    glm::vec3 SceneNode::getWorldPosition() const {
+        return glm::vec3(worldTransform[3]);
+    }
+
+    void SceneNode::update() {
+        updateSubtree(false);
+    }
+
+    void SceneNode::markDirty() {
+        dirty = true;
+        // flag the path to the root so update() can skip clean subtrees
+        for (SceneNode* node = parent; node != nullptr && !node->childDirty; node = node->parent) {
+            node->childDirty = true;
+        }
+    }
+
+    void SceneNode::updateSubtree(bool parentChanged) {
+        bool changed = dirty || parentChanged;
+
+        if (!changed && !childDirty) {
+            return;
+        }
+
+        if (changed) {
+            if (parent != nullptr) {
+                worldTransform = parent->worldTransform * localTransform;
+                worldRigid = parent->worldRigid && localRigid;
+            }
+            else {
+                worldTransform = localTransform;
+                worldRigid = localRigid;
+            }
+            normalMatrix = computeNormalMatrix(worldTransform, worldRigid);
+            dirty = false;
+        }
+
+        for (size_t i = 0; i < children.size(); i++) {
+            children[i]->updateSubtree(changed);
+        }
+        childDirty = false;
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef SceneNode_hpp
+#define SceneNode_hpp
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    class Model3D;
+
+    // Returns the world-space normal matrix of a model matrix; rigid transforms
+    // (rotation + translation only) skip the inverse-transpose
+    glm::mat3 computeNormalMatrix(const glm::mat4& modelMatrix, bool rigid);
+
+    class SceneNode {
+
+    public:
+        SceneNode();
+
+        void addChild(SceneNode* child);
+        void removeChild(SceneNode* child);
+        const std::vector<SceneNode*>& getChildren() const;
+        // nullptr for a root
+        const SceneNode* getParent() const;
+
+        // rigid = the local transform contains no scale or shear
+        void setLocalTransform(const glm::mat4& localTransform, bool rigid = true);
+        const glm::mat4& getLocalTransform() const;
+
+        // Cached values, valid after update()
+        const glm::mat4& getWorldTransform() const;
+        const glm::mat3& getNormalMatrix() const;
+        glm::vec3 getWorldPosition() const;
+
+        // Recomputes world and normal matrices of the dirty subtrees only
+        void update();
+
+        // Optional attachment drawn with this node's transform
+        gps::Model3D* model;
+
+    private:
+        SceneNode* parent;
+        std::vector<SceneNode*> children;
+
+        glm::mat4 localTransform;
+        glm::mat4 worldTransform;
+        glm::mat3 normalMatrix;
+
+        bool localRigid;
+        bool worldRigid;
+        // this node must be recomputed
+        bool dirty;
+        // some node below this one must be recomputed
+        bool childDirty;
+
+        void markDirty();
+        void updateSubtree(bool parentChanged);
+    };
+}
+
+#endif /* SceneNode_hpp */
@@ -0,0 +1,151 @@
+//
+//  Shader.cpp
+//  Lab3
+//
+//  Created by CGIS on 05/10/2016.
+//  Copyright © 2016 CGIS. All rights reserved.
+//
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    std::string Shader::readShaderFile(std::string fileName) {
+
+        std::ifstream shaderFile;
+        std::string shaderString;
+
+        //open shader file
+        shaderFile.open(fileName);
+
+        std::stringstream shaderStringStream;
+
+        //read shader content into stream
+        shaderStringStream << shaderFile.rdbuf();
+
+        //close shader file
+        shaderFile.close();
+
+        //convert stream into GLchar array
+        shaderString = shaderStringStream.str();
+        return shaderString;
+    }
+
+    void Shader::shaderCompileLog(GLuint shaderId) {
+
+        GLint success;
+        GLchar infoLog[512];
+
+        //check compilation info
+        glGetShaderiv(shaderId, GL_COMPILE_STATUS, &success);
+        if(!success) {
+
+            glGetShaderInfoLog(shaderId, 512, NULL, infoLog);
+            std::cout << "Shader compilation error\n" << infoLog << std::endl;
+        }
+    }
+
+    void Shader::shaderLinkLog(GLuint shaderProgramId) {
+
+        GLint success;
+        GLchar infoLog[512];
+
+        //check linking info
+        glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &success);
+        if(!success) {
+
+            glGetProgramInfoLog(shaderProgramId, 512, NULL, infoLog);
+            std::cout << "Shader linking error\n" << infoLog << std::endl;
+        }
+    }
+
+    GLuint Shader::compileShader(std::string fileName, GLenum shaderType) {
+
+        //read, parse and compile the shader
+        std::string shaderString = readShaderFile(fileName);
+        const GLchar* shaderSource = shaderString.c_str();
+
+        GLuint shader = glCreateShader(shaderType);
+        glShaderSource(shader, 1, &shaderSource, NULL);
+        glCompileShader(shader);
+
+        //check compilation status
+        shaderCompileLog(shader);
+
+        return shader;
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
+
+        GLuint vertexShader = compileShader(vertexShaderFileName, GL_VERTEX_SHADER);
+        GLuint fragmentShader = compileShader(fragmentShaderFileName, GL_FRAGMENT_SHADER);
+
+        //attach and link the shader programs
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        glAttachShader(this->shaderProgram, fragmentShader);
+        glLinkProgram(this->shaderProgram);
+        glDeleteShader(vertexShader);
+        glDeleteShader(fragmentShader);
+
+        //check linking info
+        shaderLinkLog(this->shaderProgram);
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName) {
+
+        GLuint vertexShader = compileShader(vertexShaderFileName, GL_VERTEX_SHADER);
+        GLuint geometryShader = compileShader(geometryShaderFileName, GL_GEOMETRY_SHADER);
+        GLuint fragmentShader = compileShader(fragmentShaderFileName, GL_FRAGMENT_SHADER);
+
+        //attach and link the shader programs
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        glAttachShader(this->shaderProgram, geometryShader);
+        glAttachShader(this->shaderProgram, fragmentShader);
+        glLinkProgram(this->shaderProgram);
+        glDeleteShader(vertexShader);
+        glDeleteShader(geometryShader);
+        glDeleteShader(fragmentShader);
+
+        //check linking info
+        shaderLinkLog(this->shaderProgram);
+    }
+
+    void Shader::loadFeedbackShader(std::string vertexShaderFileName, const std::vector<const char*>& varyings) {
+
+        GLuint vertexShader = compileShader(vertexShaderFileName, GL_VERTEX_SHADER);
+
+        //the captured outputs have to be named before linking
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        glTransformFeedbackVaryings(this->shaderProgram, (GLsizei)varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(this->shaderProgram);
+        glDeleteShader(vertexShader);
+
+        //check linking info
+        shaderLinkLog(this->shaderProgram);
+    }
+
+    void Shader::loadFeedbackShader(std::string vertexShaderFileName, std::string geometryShaderFileName, const std::vector<const char*>& varyings) {
+
+        GLuint vertexShader = compileShader(vertexShaderFileName, GL_VERTEX_SHADER);
+        GLuint geometryShader = compileShader(geometryShaderFileName, GL_GEOMETRY_SHADER);
+
+        this->shaderProgram = glCreateProgram();
+        glAttachShader(this->shaderProgram, vertexShader);
+        glAttachShader(this->shaderProgram, geometryShader);
+        glTransformFeedbackVaryings(this->shaderProgram, (GLsizei)varyings.size(), varyings.data(), GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(this->shaderProgram);
+        glDeleteShader(vertexShader);
+        glDeleteShader(geometryShader);
+
+        //check linking info
+        shaderLinkLog(this->shaderProgram);
+    }
+
+    void Shader::useShaderProgram() {
+
+        glUseProgram(this->shaderProgram);
+    }
+}
@@ -20,6 +20,7 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
 
 
 namespace gps {
@@ -29,10 +30,16 @@ namespace gps {
     public:
         GLuint shaderProgram;
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+        void loadShader(std::string vertexShaderFileName, std::string geometryShaderFileName, std::string fragmentShaderFileName);
+        // Vertex shader only, its outputs captured interleaved by transform feedback
+        void loadFeedbackShader(std::string vertexShaderFileName, const std::vector<const char*>& varyings);
+        // Same, with a geometry shader deciding which primitives are captured
+        void loadFeedbackShader(std::string vertexShaderFileName, std::string geometryShaderFileName, const std::vector<const char*>& varyings);
         void useShaderProgram();
     
     private:
         std::string readShaderFile(std::string fileName);
+        GLuint compileShader(std::string fileName, GLenum shaderType);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
     };
@@ -0,0 +1,111 @@
+#include "ShadowCascades.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    void computeShadowCascades(const glm::mat4& view, float fovy, float aspect,
+        float nearPlane, float farPlane, const glm::vec3& lightDirection,
+        const std::vector<BoundingBox>& casterBounds, const BoundingBox& sceneBounds, const CascadeSettings& settings,
+        std::vector<ShadowCascade>& cascades) {
+
+        int cascadeCount = std::max(1, std::min(settings.cascadeCount, MAX_SHADOW_CASCADES));
+        cascades.resize(cascadeCount);
+
+        glm::mat4 inverseView = glm::inverse(view);
+        glm::vec3 cameraPosition = glm::vec3(inverseView[3]);
+        glm::vec3 cameraForward = -glm::normalize(glm::vec3(inverseView[2]));
+
+        // the light view only depends on the light direction, so snapping in
+        // light space is stable while the camera moves
+        glm::vec3 up = std::abs(lightDirection.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+
+        std::vector<BoundingBox> lightSpaceBounds(casterBounds.size());
+        for (size_t i = 0; i < casterBounds.size(); i++) {
+            lightSpaceBounds[i] = casterBounds[i].transformed(lightView);
+        }
+        // the window is clamped to bounds the camera does not change, or the
+        // window size (and with it the texel size) would follow the view
+        BoundingBox sceneLightBounds = sceneBounds.isEmpty() ? BoundingBox() : sceneBounds.transformed(lightView);
+
+        float tanHalfFov = std::tan(fovy * 0.5f);
+        // squared half-diagonal of the frustum cross-section at distance 1
+        float k = tanHalfFov * tanHalfFov * (1.0f + aspect * aspect);
+
+        float splitNear = nearPlane;
+        for (int c = 0; c < cascadeCount; c++) {
+            float p = (float)(c + 1) / (float)cascadeCount;
+            float logSplit = nearPlane * std::pow(farPlane / nearPlane, p);
+            float uniformSplit = nearPlane + (farPlane - nearPlane) * p;
+            float splitFar = settings.splitLambda * logSplit + (1.0f - settings.splitLambda) * uniformSplit;
+
+            // smallest sphere around the frustum slice; its radius does not
+            // change when the camera rotates
+            float centerDistance = 0.5f * (splitFar + splitNear) * (1.0f + k);
+            float radius;
+            if (centerDistance >= splitFar) {
+                centerDistance = splitFar;
+                radius = splitFar * std::sqrt(k);
+            }
+            else {
+                radius = std::sqrt((splitFar - centerDistance) * (splitFar - centerDistance) + k * splitFar * splitFar);
+            }
+
+            glm::vec3 center = glm::vec3(lightView * glm::vec4(cameraPosition + cameraForward * centerDistance, 1.0f));
+
+            // do not spend texels outside the scene
+            float windowRadius = radius;
+            if (!sceneLightBounds.isEmpty()) {
+                glm::vec3 sceneExtents = sceneLightBounds.getExtents();
+                windowRadius = std::min(radius, std::max(sceneExtents.x, sceneExtents.y));
+                for (int axis = 0; axis < 2; axis++) {
+                    if (sceneExtents[axis] > windowRadius) {
+                        center[axis] = glm::clamp(center[axis], sceneLightBounds.min[axis] + windowRadius, sceneLightBounds.max[axis] - windowRadius);
+                    }
+                    else {
+                        center[axis] = sceneLightBounds.getCenter()[axis];
+                    }
+                }
+            }
+
+            float texelSize = 2.0f * windowRadius / (float)settings.resolution;
+            center.x = std::floor(center.x / texelSize) * texelSize;
+            center.y = std::floor(center.y / texelSize) * texelSize;
+
+            BoundingBox window(
+                glm::vec3(center.x - windowRadius, center.y - windowRadius, -FLT_MAX),
+                glm::vec3(center.x + windowRadius, center.y + windowRadius, FLT_MAX));
+
+            // depth range: every caster overlapping the window
+            float minZ = center.z - radius;
+            float maxZ = center.z + radius;
+            bool foundCaster = false;
+            for (size_t i = 0; i < lightSpaceBounds.size(); i++) {
+                if (!lightSpaceBounds[i].isEmpty() && lightSpaceBounds[i].intersects(window)) {
+                    if (!foundCaster) {
+                        minZ = lightSpaceBounds[i].min.z;
+                        maxZ = lightSpaceBounds[i].max.z;
+                        foundCaster = true;
+                    }
+                    minZ = std::min(minZ, lightSpaceBounds[i].min.z);
+                    maxZ = std::max(maxZ, lightSpaceBounds[i].max.z);
+                }
+            }
+
+            // the light looks down -z, so near/far are the negated z range
+            float zPadding = 0.5f;
+            glm::mat4 lightProjection = glm::ortho(
+                center.x - windowRadius, center.x + windowRadius,
+                center.y - windowRadius, center.y + windowRadius,
+                -maxZ - zPadding, -minZ + zPadding);
+
+            cascades[c].lightSpaceTrMatrix = lightProjection * lightView;
+            cascades[c].splitFar = splitFar;
+            splitNear = splitFar;
+        }
+    }
+}
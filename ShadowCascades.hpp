@@ -0,0 +1,39 @@
+#ifndef ShadowCascades_hpp
+#define ShadowCascades_hpp
+
+#include "BoundingBox.hpp"
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+namespace gps {
+
+    const int MAX_SHADOW_CASCADES = 4;
+
+    struct ShadowCascade {
+        glm::mat4 lightSpaceTrMatrix;
+        // view-space distance where this cascade ends
+        float splitFar;
+    };
+
+    struct CascadeSettings {
+        int cascadeCount;
+        // 0 = uniform splits, 1 = logarithmic splits
+        float splitLambda;
+        int resolution;
+    };
+
+    // Splits the view frustum between nearPlane and farPlane into cascades and
+    // fits an orthographic light projection to each one. The window size of a
+    // cascade only depends on the split and on the scene bounds, and its origin
+    // is snapped to whole texels, so shadows do not shimmer as the camera moves.
+    // casterBounds (this frame's casters) fit the depth range; sceneBounds,
+    // every caster wherever the camera is, keeps the window inside the scene.
+    void computeShadowCascades(const glm::mat4& view, float fovy, float aspect,
+        float nearPlane, float farPlane, const glm::vec3& lightDirection,
+        const std::vector<BoundingBox>& casterBounds, const BoundingBox& sceneBounds, const CascadeSettings& settings,
+        std::vector<ShadowCascade>& cascades);
+}
+
+#endif /* ShadowCascades_hpp */
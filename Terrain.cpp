@@ -0,0 +1,571 @@
+#include "Terrain.hpp"
+
+#include "stb_image.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    static const float SAMPLE_SCALE = 1.0f / 65535.0f;
+
+    static bool boxOutsideFrustum(const BoundingBox& box, const glm::vec4 planes[6]) {
+        glm::vec3 center = box.getCenter();
+        glm::vec3 extents = box.getExtents();
+        for (int i = 0; i < 6; i++) {
+            glm::vec3 normal(planes[i]);
+            float reach = glm::dot(glm::abs(normal), extents);
+            if (glm::dot(normal, center) + planes[i].w < -reach) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Calls fn(x, z) for the nodes of a level whose samples include (x, z):
+    // one, or up to four for a sample on their shared edges
+    template <typename Fn>
+    static void forNodesContaining(int span, int count, int x, int z, Fn fn) {
+        for (int nodeZ = z / span - 1; nodeZ <= z / span; nodeZ++) {
+            for (int nodeX = x / span - 1; nodeX <= x / span; nodeX++) {
+                if (nodeX < 0 || nodeZ < 0 || nodeX >= count || nodeZ >= count || x > (nodeX + 1) * span || z > (nodeZ + 1) * span) {
+                    continue;
+                }
+                fn(nodeX, nodeZ);
+            }
+        }
+    }
+
+    Terrain::~Terrain() {
+        shutdown();
+    }
+
+    void Terrain::shutdown() {
+        if (loader.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(loaderMutex);
+                stopping = true;
+            }
+            loaderWake.notify_all();
+            loader.join();
+        }
+        for (auto& entry : resident) {
+            glDeleteVertexArrays(1, &entry.second.VAO);
+            glDeleteBuffers(1, &entry.second.VBO);
+        }
+        resident.clear();
+        if (indexBuffer != 0) {
+            glDeleteBuffers(1, &indexBuffer);
+            glDeleteTextures(1, &diffuseTexture);
+            glDeleteTextures(1, &specularTexture);
+            indexBuffer = 0;
+            diffuseTexture = 0;
+            specularTexture = 0;
+        }
+        // no longer loaded, so update and select do nothing
+        nodes.clear();
+        queue.clear();
+        busy.clear();
+        finished.clear();
+        wanted.clear();
+    }
+
+    bool Terrain::load(const std::string& fileName, const std::string& textureFile, const TerrainSettings& terrainSettings) {
+        std::ifstream file(fileName, std::ios::binary | std::ios::ate);
+        if (!file) {
+            std::cout << "No terrain heightmap at " << fileName << std::endl;
+            return false;
+        }
+        uint64_t bytes = (uint64_t)file.tellg();
+        int side = (int)std::llround(std::sqrt((double)(bytes / 2)));
+        int leaves = (side - 1) / CHUNK_QUADS;
+        if ((uint64_t)side * side * 2 != bytes || side < CHUNK_SIDE || (side - 1) % CHUNK_QUADS != 0 || (leaves & (leaves - 1)) != 0) {
+            std::cerr << "Terrain heightmap " << fileName << " must be square with 2^n * " << CHUNK_QUADS << " + 1 samples a side" << std::endl;
+            return false;
+        }
+
+        heightmapFile = fileName;
+        settings = terrainSettings;
+        samples = side;
+        spacing = settings.size / (float)(side - 1);
+        levelCount = 1;
+        while ((leaves >> (levelCount - 1)) > 1) {
+            levelCount++;
+        }
+        levelOffsets.clear();
+        uint32_t nodeCount = 0;
+        for (int level = 0; level < levelCount; level++) {
+            levelOffsets.push_back(nodeCount);
+            nodeCount += (uint32_t)(nodesPerSide(level) * nodesPerSide(level));
+        }
+        nodes.assign(nodeCount, Node{ FLT_MAX, -FLT_MAX, 0.0f });
+
+        file.seekg(0);
+        scanHeightmap(file);
+
+        // ranges and errors up the tree; a node's error adds the worst of its children's
+        for (int level = 1; level < levelCount; level++) {
+            for (int z = 0; z < nodesPerSide(level); z++) {
+                for (int x = 0; x < nodesPerSide(level); x++) {
+                    Node& node = nodes[nodeIndex(level, x, z)];
+                    float childError = 0.0f;
+                    for (int child = 0; child < 4; child++) {
+                        const Node& childNode = nodes[nodeIndex(level - 1, 2 * x + (child & 1), 2 * z + (child >> 1))];
+                        node.minHeight = std::min(node.minHeight, childNode.minHeight);
+                        node.maxHeight = std::max(node.maxHeight, childNode.maxHeight);
+                        childError = std::max(childError, childNode.error);
+                    }
+                    node.error += childError;
+                }
+            }
+        }
+        bounds = nodeBounds(levelCount - 1, 0, 0);
+
+        createIndexBuffer();
+        createTextures(textureFile);
+
+        // the root is always resident, so every frame has something to draw
+        ChunkData root;
+        root.node = nodeIndex(levelCount - 1, 0, 0);
+        file.clear();
+        buildChunk(file, root.node, root.vertices);
+        uploadChunk(root);
+
+        loader = std::thread(&Terrain::loaderLoop, this);
+
+        std::cout << "Terrain: " << side << "x" << side << " samples, " << spacing << " units apart, "
+            << levelCount << " levels, root error " << nodes[root.node].error << std::endl;
+        return true;
+    }
+
+    bool Terrain::isLoaded() const {
+        return !nodes.empty();
+    }
+
+    // One pass over the rows. The leaves get their height ranges. Every
+    // coarser level compares its surface with the next finer one's at the
+    // samples that only the finer grid has: the in-between samples of its
+    // own rows against the line through their neighbours, and the rows
+    // halfway between its rows against the bilinear surface of the rows
+    // around them, kept from earlier in the pass.
+    void Terrain::scanHeightmap(std::ifstream& file) {
+        std::vector<unsigned char> raw((size_t)samples * 2);
+        std::vector<float> row(samples);
+        std::vector<std::vector<float>> gridRows(levelCount);
+        std::vector<std::vector<float>> halfwayRows(levelCount);
+
+        auto addError = [this](int level, int x, int z, float error) {
+            forNodesContaining(CHUNK_QUADS << level, nodesPerSide(level), x, z, [&](int nodeX, int nodeZ) {
+                Node& node = nodes[nodeIndex(level, nodeX, nodeZ)];
+                node.error = std::max(node.error, error);
+            });
+        };
+
+        for (int z = 0; z < samples; z++) {
+            file.read((char*)raw.data(), raw.size());
+            for (int x = 0; x < samples; x++) {
+                row[x] = toHeight((uint16_t)(raw[2 * x] | (raw[2 * x + 1] << 8)));
+            }
+
+            for (int x = 0; x < samples; x++) {
+                forNodesContaining(CHUNK_QUADS, nodesPerSide(0), x, z, [&](int nodeX, int nodeZ) {
+                    Node& node = nodes[nodeIndex(0, nodeX, nodeZ)];
+                    node.minHeight = std::min(node.minHeight, row[x]);
+                    node.maxHeight = std::max(node.maxHeight, row[x]);
+                });
+            }
+
+            for (int level = 1; level < levelCount; level++) {
+                int stride = 1 << level;
+                int half = stride / 2;
+                if (z % half != 0) {
+                    continue;
+                }
+                if (z % stride == half) {
+                    halfwayRows[level] = row;
+                    continue;
+                }
+
+                for (int x = half; x < samples; x += stride) {
+                    addError(level, x, z, std::abs(row[x] - (row[x - half] + row[x + half]) * 0.5f));
+                }
+                if (z > 0) {
+                    const std::vector<float>& above = gridRows[level];
+                    const std::vector<float>& halfway = halfwayRows[level];
+                    for (int x = 0; x < samples; x += half) {
+                        float expected = x % stride == 0 ? (above[x] + row[x]) * 0.5f
+                            : (above[x - half] + above[x + half] + row[x - half] + row[x + half]) * 0.25f;
+                        addError(level, x, z - half, std::abs(halfway[x] - expected));
+                    }
+                }
+                gridRows[level] = row;
+            }
+        }
+    }
+
+    void Terrain::loaderLoop() {
+        std::ifstream file(heightmapFile, std::ios::binary);
+        while (true) {
+            uint32_t node;
+            {
+                std::unique_lock<std::mutex> lock(loaderMutex);
+                loaderWake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) {
+                    return;
+                }
+                node = queue.back().second;
+                queue.pop_back();
+                busy.insert(node);
+            }
+
+            ChunkData data;
+            data.node = node;
+            buildChunk(file, node, data.vertices);
+
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            finished.push_back(std::move(data));
+        }
+    }
+
+    // Reads the rows of the node's grid, plus one around it for the normals,
+    // and lays out the grid and skirt vertices in world space
+    void Terrain::buildChunk(std::ifstream& file, uint32_t node, std::vector<Vertex>& vertices) const {
+        int level, nodeX, nodeZ;
+        decodeNode(node, level, nodeX, nodeZ);
+        int stride = 1 << level;
+        int firstX = nodeX * CHUNK_QUADS * stride;
+        int firstZ = nodeZ * CHUNK_QUADS * stride;
+
+        const int border = CHUNK_SIDE + 2;
+        std::vector<float> heights(border * border);
+        int spanBegin = std::max(firstX - stride, 0);
+        int spanEnd = std::min(firstX + CHUNK_SIDE * stride, samples - 1);
+        std::vector<unsigned char> raw((size_t)(spanEnd - spanBegin + 1) * 2);
+        for (int j = -1; j <= CHUNK_SIDE; j++) {
+            int sampleZ = std::min(std::max(firstZ + j * stride, 0), samples - 1);
+            file.seekg((std::streamoff)(((uint64_t)sampleZ * samples + spanBegin) * 2));
+            file.read((char*)raw.data(), raw.size());
+            for (int i = -1; i <= CHUNK_SIDE; i++) {
+                int offset = std::min(std::max(firstX + i * stride, 0), samples - 1) - spanBegin;
+                heights[(j + 1) * border + i + 1] = toHeight((uint16_t)(raw[2 * offset] | (raw[2 * offset + 1] << 8)));
+            }
+        }
+        auto height = [&](int i, int j) {
+            return heights[(j + 1) * border + i + 1];
+        };
+
+        vertices.resize(CHUNK_VERTICES);
+        float step = stride * spacing;
+        for (int j = 0; j < CHUNK_SIDE; j++) {
+            for (int i = 0; i < CHUNK_SIDE; i++) {
+                Vertex& vertex = vertices[j * CHUNK_SIDE + i];
+                vertex.Position = glm::vec3(settings.origin.x + (firstX + i * stride) * spacing, height(i, j),
+                    settings.origin.y + (firstZ + j * stride) * spacing);
+                float slopeX = (height(i + 1, j) - height(i - 1, j)) / (2.0f * step);
+                float slopeZ = (height(i, j + 1) - height(i, j - 1)) / (2.0f * step);
+                vertex.Normal = glm::normalize(glm::vec3(-slopeX, 1.0f, -slopeZ));
+                vertex.TexCoords = glm::vec2(vertex.Position.x, vertex.Position.z) * settings.textureScale;
+            }
+        }
+
+        // the gap to a neighbour is at most both chunks' errors, each skirt covers twice its own
+        float skirtDepth = 2.0f * nodes[node].error + spacing;
+        int skirt = CHUNK_SIDE * CHUNK_SIDE;
+        for (int k = 0; k < CHUNK_SIDE; k++) {
+            int edges[4] = { k, CHUNK_QUADS * CHUNK_SIDE + k, k * CHUNK_SIDE, k * CHUNK_SIDE + CHUNK_QUADS };
+            for (int edge = 0; edge < 4; edge++) {
+                Vertex vertex = vertices[edges[edge]];
+                vertex.Position.y -= skirtDepth;
+                vertices[skirt + edge * CHUNK_SIDE + k] = vertex;
+            }
+        }
+    }
+
+    void Terrain::uploadChunk(const ChunkData& data) {
+        Chunk chunk;
+        chunk.lastUsed = frame;
+        glGenVertexArrays(1, &chunk.VAO);
+        glGenBuffers(1, &chunk.VBO);
+
+        glBindVertexArray(chunk.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, chunk.VBO);
+        glBufferData(GL_ARRAY_BUFFER, data.vertices.size() * sizeof(Vertex), data.vertices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        resident[data.node] = chunk;
+    }
+
+    // Counter-clockwise seen from above, the skirts facing outwards
+    void Terrain::createIndexBuffer() {
+        std::vector<GLushort> indices;
+        indices.reserve(CHUNK_TRIANGLES * 3);
+        auto triangle = [&indices](int a, int b, int c) {
+            indices.push_back((GLushort)a);
+            indices.push_back((GLushort)b);
+            indices.push_back((GLushort)c);
+        };
+
+        for (int j = 0; j < CHUNK_QUADS; j++) {
+            for (int i = 0; i < CHUNK_QUADS; i++) {
+                int corner = j * CHUNK_SIDE + i;
+                triangle(corner, corner + CHUNK_SIDE, corner + 1);
+                triangle(corner + 1, corner + CHUNK_SIDE, corner + CHUNK_SIDE + 1);
+            }
+        }
+
+        int skirt = CHUNK_SIDE * CHUNK_SIDE;
+        for (int k = 0; k < CHUNK_QUADS; k++) {
+            // -Z edge
+            int top = k;
+            int bottom = skirt + k;
+            triangle(top, top + 1, bottom);
+            triangle(top + 1, bottom + 1, bottom);
+            // +Z edge
+            top = CHUNK_QUADS * CHUNK_SIDE + k;
+            bottom = skirt + CHUNK_SIDE + k;
+            triangle(top, bottom, top + 1);
+            triangle(top + 1, bottom, bottom + 1);
+            // -X edge
+            top = k * CHUNK_SIDE;
+            bottom = skirt + 2 * CHUNK_SIDE + k;
+            triangle(top, bottom, top + CHUNK_SIDE);
+            triangle(top + CHUNK_SIDE, bottom, bottom + 1);
+            // +X edge
+            top = k * CHUNK_SIDE + CHUNK_QUADS;
+            bottom = skirt + 3 * CHUNK_SIDE + k;
+            triangle(top, top + CHUNK_SIDE, bottom);
+            triangle(top + CHUNK_SIDE, bottom + 1, bottom);
+        }
+
+        glGenBuffers(1, &indexBuffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    void Terrain::createTextures(const std::string& textureFile) {
+        int width = 1;
+        int height = 1;
+        int channels;
+        unsigned char white[4] = { 255, 255, 255, 255 };
+        unsigned char* image = textureFile.empty() ? nullptr : stbi_load(textureFile.c_str(), &width, &height, &channels, 4);
+        if (!image && !textureFile.empty()) {
+            std::cerr << "Could not load " << textureFile << std::endl;
+        }
+
+        glGenTextures(1, &diffuseTexture);
+        glBindTexture(GL_TEXTURE_2D, diffuseTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, image ? width : 1, image ? height : 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, image ? image : white);
+        glGenerateMipmap(GL_TEXTURE_2D);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (image) {
+            stbi_image_free(image);
+        }
+
+        // snow barely shines
+        unsigned char specular[4] = { 24, 24, 24, 255 };
+        glGenTextures(1, &specularTexture);
+        glBindTexture(GL_TEXTURE_2D, specularTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, specular);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    void Terrain::update() {
+        if (!isLoaded()) {
+            return;
+        }
+        frame++;
+
+        std::vector<ChunkData> uploads;
+        {
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            // the queue only holds what the last frame still wanted
+            queue.clear();
+            std::unordered_set<uint32_t> queued;
+            for (const std::pair<float, uint32_t>& request : wanted) {
+                if (!resident.count(request.second) && !busy.count(request.second) && queued.insert(request.second).second) {
+                    queue.push_back(request);
+                }
+            }
+            std::sort(queue.begin(), queue.end());
+
+            size_t count = std::min(finished.size(), (size_t)std::max(settings.uploadsPerFrame, 0));
+            for (size_t i = 0; i < count; i++) {
+                busy.erase(finished[i].node);
+                uploads.push_back(std::move(finished[i]));
+            }
+            finished.erase(finished.begin(), finished.begin() + count);
+        }
+        wanted.clear();
+        loaderWake.notify_one();
+
+        for (const ChunkData& data : uploads) {
+            uploadChunk(data);
+        }
+
+        // chunks drawn in the last frame stay, so no selection loses its stand-ins
+        uint32_t root = nodeIndex(levelCount - 1, 0, 0);
+        while (getResidentBytes() > settings.budgetBytes) {
+            auto oldest = resident.end();
+            for (auto it = resident.begin(); it != resident.end(); ++it) {
+                if (it->first != root && it->second.lastUsed + 1 < frame && (oldest == resident.end() || it->second.lastUsed < oldest->second.lastUsed)) {
+                    oldest = it;
+                }
+            }
+            if (oldest == resident.end()) {
+                break;
+            }
+            glDeleteVertexArrays(1, &oldest->second.VAO);
+            glDeleteBuffers(1, &oldest->second.VBO);
+            resident.erase(oldest);
+        }
+    }
+
+    bool Terrain::select(const TerrainView& view, std::vector<uint32_t>& chunks) {
+        if (!isLoaded()) {
+            return true;
+        }
+        return selectNode(view, levelCount - 1, 0, 0, chunks);
+    }
+
+    // Only reached through resident ancestors whose children were all
+    // resident, so the node itself is
+    bool Terrain::selectNode(const TerrainView& view, int level, int x, int z, std::vector<uint32_t>& chunks) {
+        BoundingBox box = nodeBounds(level, x, z);
+        float distanceSquared = box.distanceSquared(view.position);
+        if (distanceSquared > view.maxDistance * view.maxDistance
+            || box.farthestDistanceSquared(view.position) < view.minDistance * view.minDistance
+            || (view.useFrustum && boxOutsideFrustum(box, view.frustumPlanes))) {
+            return true;
+        }
+
+        uint32_t node = nodeIndex(level, x, z);
+        auto chunk = resident.find(node);
+        if (chunk != resident.end()) {
+            chunk->second.lastUsed = frame;
+        }
+        float distance = std::max(std::sqrt(distanceSquared), 1.0f);
+        if (level == 0 || nodes[node].error * view.pixelsPerUnit / distance <= view.maxPixelError) {
+            chunks.push_back(node);
+            return true;
+        }
+
+        bool childrenResident = true;
+        for (int child = 0; child < 4; child++) {
+            uint32_t childNode = nodeIndex(level - 1, 2 * x + (child & 1), 2 * z + (child >> 1));
+            if (!resident.count(childNode)) {
+                childrenResident = false;
+                // the further past the pixel budget, the sooner
+                wanted.push_back(std::make_pair(nodes[childNode].error * view.pixelsPerUnit / distance, childNode));
+            }
+        }
+        if (!childrenResident) {
+            chunks.push_back(node);
+            return false;
+        }
+        bool complete = true;
+        for (int child = 0; child < 4; child++) {
+            complete = selectNode(view, level - 1, 2 * x + (child & 1), 2 * z + (child >> 1), chunks) && complete;
+        }
+        return complete;
+    }
+
+    void Terrain::draw(Shader& shader, const std::vector<uint32_t>& chunks) {
+        GLuint program = shader.shaderProgram;
+        glm::mat4 identity(1.0f);
+        glUniformMatrix4fv(glGetUniformLocation(program, "model"), 1, GL_FALSE, glm::value_ptr(identity));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, diffuseTexture);
+        glUniform1i(glGetUniformLocation(program, "diffuseTexture"), 0);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, specularTexture);
+        glUniform1i(glGetUniformLocation(program, "specularTexture"), 1);
+
+        for (uint32_t node : chunks) {
+            auto it = resident.find(node);
+            if (it == resident.end()) {
+                continue;
+            }
+            glBindVertexArray(it->second.VAO);
+            glDrawElements(GL_TRIANGLES, CHUNK_TRIANGLES * 3, GL_UNSIGNED_SHORT, 0);
+        }
+        glBindVertexArray(0);
+
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    const BoundingBox& Terrain::getBounds() const {
+        return bounds;
+    }
+
+    BoundingBox Terrain::getChunkBounds(uint32_t chunk) const {
+        int level, x, z;
+        decodeNode(chunk, level, x, z);
+        return nodeBounds(level, x, z);
+    }
+
+    size_t Terrain::getResidentCount() const {
+        return resident.size();
+    }
+
+    size_t Terrain::getResidentBytes() const {
+        return resident.size() * CHUNK_VERTICES * sizeof(Vertex);
+    }
+
+    size_t Terrain::getQueuedCount() const {
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        return queue.size() + busy.size();
+    }
+
+    uint32_t Terrain::nodeIndex(int level, int x, int z) const {
+        return levelOffsets[level] + (uint32_t)(z * nodesPerSide(level) + x);
+    }
+
+    int Terrain::nodesPerSide(int level) const {
+        return ((samples - 1) / CHUNK_QUADS) >> level;
+    }
+
+    // Skirts hang below the range, so it is not part of the bounds
+    BoundingBox Terrain::nodeBounds(int level, int x, int z) const {
+        const Node& node = nodes[nodeIndex(level, x, z)];
+        float span = (float)(CHUNK_QUADS << level) * spacing;
+        return BoundingBox(glm::vec3(settings.origin.x + x * span, node.minHeight, settings.origin.y + z * span),
+            glm::vec3(settings.origin.x + (x + 1) * span, node.maxHeight, settings.origin.y + (z + 1) * span));
+    }
+
+    void Terrain::decodeNode(uint32_t node, int& level, int& x, int& z) const {
+        level = levelCount - 1;
+        while (node < levelOffsets[level]) {
+            level--;
+        }
+        int local = (int)(node - levelOffsets[level]);
+        x = local % nodesPerSide(level);
+        z = local / nodesPerSide(level);
+    }
+
+    float Terrain::toHeight(uint16_t sample) const {
+        return settings.minHeight + (settings.maxHeight - settings.minHeight) * (sample * SAMPLE_SCALE);
+    }
+}
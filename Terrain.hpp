@@ -0,0 +1,178 @@
+#ifndef Terrain_hpp
+#define Terrain_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Mesh.hpp"
+#include "Shader.hpp"
+#include "BoundingBox.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    struct TerrainSettings {
+        // world XZ of the heightmap's first sample, and the side of the square it covers
+        glm::vec2 origin = glm::vec2(-8192.0f, -8192.0f);
+        float size = 16384.0f;
+        // heights of the sample values 0 and 65535
+        float minHeight = -60.0f;
+        float maxHeight = 940.0f;
+        // GPU memory the resident chunks may use
+        size_t budgetBytes = 64 * 1024 * 1024;
+        // finished chunks uploaded per frame, so streaming never stalls a frame
+        int uploadsPerFrame = 8;
+        // texture repeats per world unit
+        float textureScale = 0.125f;
+    };
+
+    // A camera to select chunks for
+    struct TerrainView {
+        glm::vec3 position;
+        // inward planes (extractFrustumPlanes); every chunk passes when useFrustum is false
+        glm::vec4 frustumPlanes[6];
+        bool useFrustum;
+        // pixels covered by one unit at distance 1
+        float pixelsPerUnit;
+        float maxPixelError;
+        // chunks entirely closer than minDistance or farther than maxDistance are skipped
+        float minDistance;
+        float maxDistance;
+    };
+
+    // Heightfield terrain streamed from a raw 16-bit heightmap (.r16, little
+    // endian, square, 2^n * CHUNK_QUADS + 1 samples a side) that is never
+    // held in memory. A quadtree of chunks covers it: every chunk is a
+    // CHUNK_QUADS^2 grid sampling the map at its level's stride, so all
+    // chunks share one index buffer, and skirts hanging from their edges
+    // hide the cracks between levels. One sequential pass over the file at
+    // load gives each node its height range and geometric error; each frame
+    // the coarsest chunks whose error projects below a pixel budget are
+    // drawn. A loader thread reads and builds the missing chunks, the
+    // closest to the error budget first, while their parents stand in.
+    class Terrain {
+
+    public:
+        static const int CHUNK_QUADS = 32;
+        static const int CHUNK_SIDE = CHUNK_QUADS + 1;
+        // grid plus one skirt vertex per edge vertex
+        static const int CHUNK_VERTICES = CHUNK_SIDE * CHUNK_SIDE + 4 * CHUNK_SIDE;
+        static const int CHUNK_TRIANGLES = 2 * CHUNK_QUADS * CHUNK_QUADS + 4 * 2 * CHUNK_QUADS;
+
+        ~Terrain();
+
+        // Scans the heightmap, loads the root chunk and starts the loader
+        // thread; false if the file is missing or not a valid size. Without
+        // textureFile the terrain is plain white.
+        bool load(const std::string& heightmapFile, const std::string& textureFile, const TerrainSettings& settings);
+
+        bool isLoaded() const;
+
+        // Stops the loader thread and deletes the chunks, buffers and
+        // textures; on the GL thread while the context is still up
+        void shutdown();
+
+        // Once per frame, before selecting: uploads chunks the loader has
+        // finished, evicts the least recently used ones over the budget and
+        // queues the chunks the last frame's selections were missing
+        void update();
+
+        // Appends the chunks to draw for a view; false when a parent stands
+        // in for children that are not resident yet
+        bool select(const TerrainView& view, std::vector<uint32_t>& chunks);
+
+        // Draws chunks from select; the shader's model is set to identity,
+        // its normal matrix is the caller's
+        void draw(Shader& shader, const std::vector<uint32_t>& chunks);
+
+        // World bounds of the whole terrain
+        const BoundingBox& getBounds() const;
+        BoundingBox getChunkBounds(uint32_t chunk) const;
+
+        size_t getResidentCount() const;
+        size_t getResidentBytes() const;
+        size_t getQueuedCount() const;
+
+    private:
+        struct Node {
+            float minHeight;
+            float maxHeight;
+            // largest height difference to the full resolution surface
+            float error;
+        };
+
+        struct Chunk {
+            GLuint VAO;
+            GLuint VBO;
+            uint64_t lastUsed;
+        };
+
+        struct ChunkData {
+            uint32_t node;
+            std::vector<Vertex> vertices;
+        };
+
+        std::string heightmapFile;
+        TerrainSettings settings;
+        // samples per side
+        int samples = 0;
+        float spacing = 1.0f;
+        int levelCount = 0;
+        // first node of each level, level 0 being the finest
+        std::vector<uint32_t> levelOffsets;
+        std::vector<Node> nodes;
+        BoundingBox bounds;
+
+        GLuint indexBuffer = 0;
+        GLuint diffuseTexture = 0;
+        GLuint specularTexture = 0;
+        std::unordered_map<uint32_t, Chunk> resident;
+        uint64_t frame = 0;
+
+        // chunks the selections wanted this frame, with their priority
+        std::vector<std::pair<float, uint32_t>> wanted;
+
+        // shared with the loader thread
+        std::thread loader;
+        mutable std::mutex loaderMutex;
+        std::condition_variable loaderWake;
+        bool stopping = false;
+        // ascending priority, the loader takes from the back
+        std::vector<std::pair<float, uint32_t>> queue;
+        // being built, or built and not yet uploaded
+        std::unordered_set<uint32_t> busy;
+        std::vector<ChunkData> finished;
+
+        void scanHeightmap(std::ifstream& file);
+        void loaderLoop();
+        void buildChunk(std::ifstream& file, uint32_t node, std::vector<Vertex>& vertices) const;
+        void uploadChunk(const ChunkData& data);
+        void createIndexBuffer();
+        void createTextures(const std::string& textureFile);
+        bool selectNode(const TerrainView& view, int level, int x, int z, std::vector<uint32_t>& chunks);
+
+        uint32_t nodeIndex(int level, int x, int z) const;
+        int nodesPerSide(int level) const;
+        BoundingBox nodeBounds(int level, int x, int z) const;
+        void decodeNode(uint32_t node, int& level, int& x, int& z) const;
+        float toHeight(uint16_t sample) const;
+    };
+}
+
+#endif /* Terrain_hpp */
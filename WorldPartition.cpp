@@ -0,0 +1,319 @@
+#include "WorldPartition.hpp"
+#include "Parallel.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace gps {
+
+    WorldPartition::~WorldPartition() {
+        stopLoader();
+    }
+
+    void WorldPartition::stopLoader() {
+        if (loader.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(loaderMutex);
+                stopping = true;
+            }
+            loaderWake.notify_all();
+            loader.join();
+        }
+    }
+
+    void WorldPartition::shutdown() {
+        stopLoader();
+
+        // the loader is gone, so the read but unreceived models are ours to delete
+        finished.clear();
+        queue.clear();
+        busy.clear();
+        for (Cell& cell : cells) {
+            if (cell.state == CELL_RESIDENT || cell.state == CELL_UPLOADING) {
+                unload(cell);
+            }
+        }
+        cells.clear();
+    }
+
+    bool WorldPartition::init(const std::string& manifestFile, const WorldPartitionSettings& partitionSettings,
+        std::function<void(Model3D&)> loadedCallback, std::function<void(Model3D&)> unloadingCallback) {
+        std::ifstream manifest(manifestFile);
+        if (!manifest) {
+            std::cout << "No world partition manifest at " << manifestFile << std::endl;
+            return false;
+        }
+
+        std::string basePath;
+        size_t slash = manifestFile.find_last_of("/\\");
+        if (slash != std::string::npos) {
+            basePath = manifestFile.substr(0, slash + 1);
+        }
+
+        std::string line;
+        while (std::getline(manifest, line)) {
+            std::istringstream words(line);
+            std::string keyword;
+            if (!(words >> keyword) || keyword[0] == '#') {
+                continue;
+            }
+            if (keyword == "cellSize") {
+                words >> cellSize;
+            }
+            else if (keyword == "cell") {
+                Cell cell;
+                std::string file;
+                if (!(words >> cell.x >> cell.z >> file)) {
+                    std::cerr << "Bad line in " << manifestFile << ": " << line << std::endl;
+                    continue;
+                }
+                cell.file = basePath + file;
+                cell.state = CELL_UNLOADED;
+                cell.bytes = 0;
+                cell.failed = false;
+                cell.distance = 0.0f;
+                cell.rank = 0.0f;
+                cells.push_back(std::move(cell));
+            }
+        }
+        if (cellSize <= 0.0f || cells.empty()) {
+            std::cerr << manifestFile << " has no cellSize or no cells" << std::endl;
+            cells.clear();
+            return false;
+        }
+
+        settings = partitionSettings;
+        onLoaded = loadedCallback;
+        onUnloading = unloadingCallback;
+        loader = std::thread(&WorldPartition::loaderLoop, this);
+
+        std::cout << "World partition: " << cells.size() << " cells of " << cellSize << " units" << std::endl;
+        return true;
+    }
+
+    bool WorldPartition::isLoaded() const {
+        return !cells.empty();
+    }
+
+    void WorldPartition::setRadii(float loadRadius, float unloadRadius) {
+        settings.loadRadius = loadRadius;
+        settings.unloadRadius = std::max(unloadRadius, loadRadius);
+    }
+
+    void WorldPartition::loaderLoop() {
+        // the LODs and BVH of a cell are built here, never on the pool the frame needs
+        setSerialThread();
+        while (true) {
+            size_t index;
+            std::string file;
+            {
+                std::unique_lock<std::mutex> lock(loaderMutex);
+                loaderWake.wait(lock, [this] { return stopping || !queue.empty(); });
+                if (stopping) {
+                    return;
+                }
+                index = queue.back().second;
+                queue.pop_back();
+                busy.insert(index);
+                file = cells[index].file;
+            }
+
+            // read without GL; a model that cannot be read is handed back all
+            // the same, as deleting it releases shared assets, which is GL work
+            LoadedCell loaded;
+            loaded.cell = index;
+            loaded.model.reset(new Model3D());
+            loaded.model->setAutoInstancing(true);
+            std::string basePath = file.substr(0, file.find_last_of("/\\") + 1);
+            loaded.read = loaded.model->ReadModel(file, basePath);
+            if (!loaded.read) {
+                std::cerr << "Could not read world cell " << file << std::endl;
+            }
+
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            finished.push_back(std::move(loaded));
+        }
+    }
+
+    void WorldPartition::update(const glm::vec3& cameraPosition, const glm::vec3& cameraForward) {
+        if (!isLoaded()) {
+            return;
+        }
+
+        glm::vec2 camera(cameraPosition.x, cameraPosition.z);
+        glm::vec2 forward(cameraForward.x, cameraForward.z);
+        if (glm::dot(forward, forward) > 0.0f) {
+            forward = glm::normalize(forward);
+        }
+        for (Cell& cell : cells) {
+            glm::vec2 cellMin = glm::vec2((float)cell.x, (float)cell.z) * cellSize;
+            glm::vec2 closest = glm::clamp(camera, cellMin, cellMin + glm::vec2(cellSize));
+            cell.distance = glm::length(closest - camera);
+
+            // the direction to the centre decides how much the cell is in view
+            glm::vec2 toCenter = cellMin + glm::vec2(cellSize * 0.5f) - camera;
+            float facing = glm::dot(toCenter, toCenter) > 0.0f ? std::max(glm::dot(glm::normalize(toCenter), forward), 0.0f) : 1.0f;
+            cell.rank = cell.distance * (1.0f - settings.viewWeight * facing);
+
+            if (cell.distance > settings.unloadRadius && (cell.state == CELL_RESIDENT || cell.state == CELL_UPLOADING)) {
+                unload(cell);
+            }
+        }
+
+        receiveFinished();
+        uploadNext();
+        requestCells();
+    }
+
+    void WorldPartition::receiveFinished() {
+        std::vector<LoadedCell> received;
+        {
+            std::lock_guard<std::mutex> lock(loaderMutex);
+            received.swap(finished);
+            for (const LoadedCell& entry : received) {
+                busy.erase(entry.cell);
+            }
+        }
+
+        // GL objects are only created and deleted on this thread, so the
+        // models dropped here are deleted here too
+        for (LoadedCell& entry : received) {
+            Cell& cell = cells[entry.cell];
+            cell.state = CELL_UNLOADED;
+            if (!entry.read) {
+                cell.failed = true;
+                continue;
+            }
+            cell.bytes = entry.model->getMemoryBytes();
+            if (cell.distance > settings.unloadRadius || !makeRoom(cell.bytes, cell.rank)) {
+                continue;
+            }
+            cell.model = std::move(entry.model);
+            cell.state = CELL_UPLOADING;
+            residentBytes += cell.bytes;
+        }
+    }
+
+    // One cell at a time, the best ranked first
+    void WorldPartition::uploadNext() {
+        Cell* next = nullptr;
+        for (Cell& cell : cells) {
+            if (cell.state == CELL_UPLOADING && (!next || cell.rank < next->rank)) {
+                next = &cell;
+            }
+        }
+        if (next && next->model->Upload(settings.uploadBytesPerFrame)) {
+            next->state = CELL_RESIDENT;
+            if (onLoaded) {
+                onLoaded(*next->model);
+            }
+        }
+    }
+
+    // Cells whose size is known are only requested when they would fit;
+    // the others are checked against the budget once read
+    void WorldPartition::requestCells() {
+        std::vector<size_t> candidates;
+        size_t committed = residentBytes;
+        for (size_t i = 0; i < cells.size(); i++) {
+            Cell& cell = cells[i];
+            if (cell.state == CELL_REQUESTED) {
+                if (cell.distance < settings.loadRadius) {
+                    committed += cell.bytes;
+                }
+                else {
+                    cell.state = CELL_UNLOADED;
+                }
+            }
+            else if (cell.state == CELL_UNLOADED && !cell.failed && cell.distance < settings.loadRadius) {
+                candidates.push_back(i);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end(), [this](size_t a, size_t b) {
+            return cells[a].rank < cells[b].rank;
+        });
+
+        for (size_t i : candidates) {
+            Cell& cell = cells[i];
+            if (committed + cell.bytes > settings.budgetBytes) {
+                size_t lowerRanked = 0;
+                for (const Cell& other : cells) {
+                    if ((other.state == CELL_RESIDENT || other.state == CELL_UPLOADING) && other.rank > cell.rank) {
+                        lowerRanked += other.bytes;
+                    }
+                }
+                if (committed + cell.bytes > settings.budgetBytes + lowerRanked) {
+                    break;
+                }
+            }
+            cell.state = CELL_REQUESTED;
+            committed += cell.bytes;
+        }
+
+        std::lock_guard<std::mutex> lock(loaderMutex);
+        queue.clear();
+        for (size_t i = 0; i < cells.size(); i++) {
+            if (cells[i].state == CELL_REQUESTED && !busy.count(i)) {
+                queue.push_back(std::make_pair(cells[i].rank, i));
+            }
+        }
+        std::sort(queue.begin(), queue.end(), [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+            return a.first > b.first;
+        });
+        if (!queue.empty()) {
+            loaderWake.notify_one();
+        }
+    }
+
+    bool WorldPartition::makeRoom(size_t bytes, float rank) {
+        while (residentBytes + bytes > settings.budgetBytes) {
+            Cell* worst = nullptr;
+            for (Cell& cell : cells) {
+                if ((cell.state == CELL_RESIDENT || cell.state == CELL_UPLOADING) && cell.rank > rank && (!worst || cell.rank > worst->rank)) {
+                    worst = &cell;
+                }
+            }
+            if (!worst) {
+                return false;
+            }
+            unload(*worst);
+        }
+        return true;
+    }
+
+    void WorldPartition::unload(Cell& cell) {
+        if (cell.state == CELL_RESIDENT && onUnloading) {
+            onUnloading(*cell.model);
+        }
+        cell.model.reset();
+        residentBytes -= cell.bytes;
+        cell.state = CELL_UNLOADED;
+    }
+
+    size_t WorldPartition::getCellCount() const {
+        return cells.size();
+    }
+
+    size_t WorldPartition::getResidentCount() const {
+        size_t count = 0;
+        for (const Cell& cell : cells) {
+            count += cell.state == CELL_RESIDENT;
+        }
+        return count;
+    }
+
+    size_t WorldPartition::getResidentBytes() const {
+        return residentBytes;
+    }
+
+    size_t WorldPartition::getPendingCount() const {
+        size_t count = 0;
+        for (const Cell& cell : cells) {
+            count += cell.state == CELL_REQUESTED || cell.state == CELL_UPLOADING;
+        }
+        return count;
+    }
+}
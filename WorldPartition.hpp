@@ -0,0 +1,131 @@
+#ifndef WorldPartition_hpp
+#define WorldPartition_hpp
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    struct WorldPartitionSettings {
+        // cells closer than this to the camera are loaded...
+        float loadRadius = 750.0f;
+        // ...and kept until they are farther than this, so a camera moving
+        // along a cell border does not load and drop the same cells
+        float unloadRadius = 830.0f;
+        // Model3D::getMemoryBytes of the resident cells never exceeds this
+        size_t budgetBytes = 512 * 1024 * 1024;
+        // GPU uploads per frame, so a large cell arrives over a few frames
+        size_t uploadBytesPerFrame = 4 * 1024 * 1024;
+        // a cell straight ahead ranks as if this fraction closer
+        float viewWeight = 0.5f;
+    };
+
+    // The world split into a grid of cells, each its own OBJ (exported in
+    // world space), listed by a manifest:
+    //     cellSize 256
+    //     cell 0 0 cell_0_0.obj
+    //     cell 1 0 cell_1_0.obj
+    // with paths relative to the manifest. Cells near the camera are read by
+    // a loader thread (Model3D::ReadModel), nearest and most in view first,
+    // then uploaded a few megabytes per frame. A cell only becomes resident
+    // when it fits the budget, after dropping the resident cells that rank
+    // below it; cells past the unload radius are dropped.
+    class WorldPartition {
+
+    public:
+        ~WorldPartition();
+
+        // Reads the manifest and starts the loader thread; false when it is
+        // missing. onLoaded runs once a cell is uploaded, onUnloading just
+        // before its model is deleted, both on the thread calling update.
+        bool init(const std::string& manifestFile, const WorldPartitionSettings& settings,
+            std::function<void(Model3D&)> onLoaded, std::function<void(Model3D&)> onUnloading);
+
+        bool isLoaded() const;
+
+        // Changes settings.loadRadius and settings.unloadRadius, as when the
+        // view distance does; cells past the new unload radius go next update
+        void setRadii(float loadRadius, float unloadRadius);
+
+        // Once per frame on the GL thread
+        void update(const glm::vec3& cameraPosition, const glm::vec3& cameraForward);
+
+        // Stops the loader thread, after the cell it is reading if any, and
+        // unloads every cell; on the GL thread while the context is still up
+        void shutdown();
+
+        size_t getCellCount() const;
+        size_t getResidentCount() const;
+        size_t getResidentBytes() const;
+        // requested, being read or uploading
+        size_t getPendingCount() const;
+
+    private:
+        enum CellState {
+            CELL_UNLOADED,
+            CELL_REQUESTED,
+            CELL_UPLOADING,
+            CELL_RESIDENT
+        };
+
+        struct Cell {
+            int x;
+            int z;
+            std::string file;
+            CellState state;
+            std::unique_ptr<Model3D> model;
+            // known after the first load, 0 until then
+            size_t bytes;
+            bool failed;
+            // this frame's distance and rank, lower first
+            float distance;
+            float rank;
+        };
+
+        WorldPartitionSettings settings;
+        float cellSize = 0.0f;
+        std::vector<Cell> cells;
+        size_t residentBytes = 0;
+        std::function<void(Model3D&)> onLoaded;
+        std::function<void(Model3D&)> onUnloading;
+
+        // shared with the loader thread
+        std::thread loader;
+        mutable std::mutex loaderMutex;
+        std::condition_variable loaderWake;
+        bool stopping = false;
+        // descending rank, the loader takes from the back
+        std::vector<std::pair<float, size_t>> queue;
+        // being read, or read and not yet taken by update
+        std::unordered_set<size_t> busy;
+        struct LoadedCell {
+            size_t cell;
+            std::unique_ptr<Model3D> model;
+            // false when the file could not be read
+            bool read;
+        };
+        std::vector<LoadedCell> finished;
+
+        void stopLoader();
+        void loaderLoop();
+        void receiveFinished();
+        void uploadNext();
+        void requestCells();
+        // Drops resident cells ranked after rank, worst first, until bytes fit; false if they cannot
+        bool makeRoom(size_t bytes, float rank);
+        void unload(Cell& cell);
+    };
+}
+
+#endif /* WorldPartition_hpp */
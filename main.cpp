@@ -16,8 +16,33 @@
 #include "Shader.hpp"
 #include "Camera.hpp"
 #include "Model3D.hpp"
-
+#include "AssetManager.hpp"
+#include "SceneNode.hpp"
+#include "EntityRegistry.hpp"
+#include "ShadowCascades.hpp"
+#include "GpuTimer.hpp"
+#include "LightClusters.hpp"
+#include "PointShadows.hpp"
+#include "OcclusionBuffer.hpp"
+#include "OcclusionQueries.hpp"
+#include "Parallel.hpp"
+#include "Bvh.hpp"
+#include "Heightfield.hpp"
+#include "IrradianceProbes.hpp"
+#include "GpuSnow.hpp"
+#include "CpuSnow.hpp"
+#include "InstanceScatter.hpp"
+#include "ImpostorAtlas.hpp"
+#include "FarField.hpp"
+#include "Terrain.hpp"
+#include "WorldPartition.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
 #include <iostream>
+#include <random>
+#include <unordered_map>
 
 gps::Window myWindow;
 
@@ -63,17 +88,52 @@ GLboolean mouseControlEnabled = GL_TRUE;
 static float yaw = -90.0f;
 static float pitch = 0.0f;
 
-glm::vec3 wheelPivotPoint(54.69f, 19.73f, -55.22f);
-GLfloat wheelRotationAngle = 0.0f; 
+// scene objects
+gps::EntityRegistry registry;
+gps::Entity pointLightEntity;
 
-glm::mat4 sceneModelMatrix = glm::mat4(1.0f);
+// scene graph; the entities hung off its nodes take their transforms from it
+gps::SceneNode sceneRoot;
+gps::SceneNode scenaFinalaNode;
+gps::SceneNode doarMoriscaNode;
+gps::SceneNode sunNode;
+gps::SceneNode pointLightNode;
 
-const unsigned int SHADOW_WIDTH = 1024;
-const unsigned int SHADOW_HEIGHT = 1024;
+const unsigned int SHADOW_WIDTH = 2048;
+const unsigned int SHADOW_HEIGHT = 2048;
 
 GLuint shadowMapFBO;
+// one layer per cascade
 GLuint depthMapTexture;
 
+// depth of the static casters only, copied under the dynamic casters each frame
+GLuint staticShadowMapFBO;
+GLuint staticDepthMapTexture;
+glm::mat4 staticCascadeMatrices[gps::MAX_SHADOW_CASCADES];
+bool staticCascadeValid[gps::MAX_SHADOW_CASCADES] = {};
+
+// shadow filtering tiers: taps of the hardware 2x2 PCF lookup
+enum ShadowQuality {
+    SHADOW_1_TAP,
+    SHADOW_POISSON_4,
+    SHADOW_POISSON_8,
+    SHADOW_POISSON_16,
+    SHADOW_QUALITY_COUNT
+};
+
+const int shadowQualityTaps[SHADOW_QUALITY_COUNT] = { 1, 4, 8, 16 };
+ShadowQuality shadowQuality = SHADOW_POISSON_4;
+GLboolean shadowDepth16 = GL_FALSE;
+// lit pass GPU time, per tier
+gps::GpuTimer shadowQualityTimers[SHADOW_QUALITY_COUNT];
+
+gps::CascadeSettings cascadeSettings = { 3, 0.75f, SHADOW_WIDTH };
+std::vector<gps::ShadowCascade> shadowCascades;
+GLboolean showCascades = GL_FALSE;
+
+const float fieldOfView = 45.0f;
+const float nearPlane = 0.1f;
+
 
 // Point light properties
 glm::vec3 pointLightPos(-30.35f, 16.25f, 64.9f);
@@ -84,12 +144,160 @@ float pointLightConstant = 1.0f;
 float pointLightLinear = 0.09f;   
 float pointLightQuadratic = 0.032f; 
 
-static float lightAngle = 0.0f; 
+gps::LightClusters lightClusters;
+std::vector<gps::PointLight> pointLights;
+
+// cube map shadows of the point lights, cached until a dynamic caster moves
+gps::PointShadows pointShadows;
+const size_t pointShadowBudgetBytes = 48 * 1024 * 1024;
+// last transform the point shadows saw for each dynamic caster
+gps::ComponentPool<glm::mat4> casterTransforms;
+double lightCullingMs = 0.0;
+
+// --bench-lights: frame time against the number of point lights
+struct LightBenchmark {
+    bool active;
+    int step;
+    int frame;
+    double frameMs;
+    double cullingMs;
+    std::vector<gps::Entity> torches;
+};
+
+LightBenchmark lightBenchmark = {};
+const int lightBenchmarkCounts[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024 };
+const int lightBenchmarkSteps = sizeof(lightBenchmarkCounts) / sizeof(lightBenchmarkCounts[0]);
+const int lightBenchmarkWarmupFrames = 20;
+const int lightBenchmarkFrames = 120;
+gps::GpuTimer litPassTimer;
+
+static float lightAngle = 0.0f;
+static float sunNodeAngle = -1.0f;
 float lightRadius = 30.0f;
-glm::vec3 lightPos; 
+glm::vec3 lightPos;
 
 float fogStart = 100.0f;
 float fogEnd = 700.0f;
+glm::vec3 fogColor(0.7f, 0.7f, 0.7f); // Grey fog color, also the clear colour
+
+// visibility (shadow LOD + 1, 0 = culled) of the static casters the cached cascade layers were drawn with
+std::vector<uint8_t> staticCasterVisibility;
+
+// level of detail: the coarsest level whose error projects below this many pixels;
+// shadows tolerate more
+float litLodErrorPixels = 1.0f;
+float shadowLodErrorPixels = 4.0f;
+
+// triangles of the last frame, as drawn and as they would be at full detail
+struct TriangleStats {
+    size_t lit;
+    size_t litFull;
+    size_t shadow;
+    size_t shadowFull;
+};
+TriangleStats triangleStats = {};
+
+// occlusion culling of the lit pass
+enum CullingMode {
+    CULLING_NONE,
+    CULLING_SOFTWARE,
+    CULLING_GPU_QUERIES,
+    CULLING_MODE_COUNT
+};
+const char* cullingModeNames[CULLING_MODE_COUNT] = { "off", "software occlusion buffer", "GPU occlusion queries" };
+CullingMode cullingMode = CULLING_SOFTWARE;
+gps::OcclusionBuffer occlusionBuffer;
+gps::OcclusionQueries occlusionQueries;
+// static meshes covering at least this many occlusion buffer rows become occluders
+const float occluderMinPixels = 16.0f;
+size_t occludedMeshCount = 0;
+
+// large meshes drawn at full detail only submit their clusters that pass
+// the back-face cone, frustum and (software) occlusion tests
+bool clusterCulling = true;
+gps::ClusterView clusterView;
+gps::ClusterCullStats clusterStats = {};
+size_t clusterTrianglesDrawn = 0;
+
+// walk mode: the eye stays walkEyeHeight above the ground baked from the scene,
+// and a sphere around the body stops it at walls
+bool walkMode = false;
+gps::Heightfield groundHeights;
+const float walkEyeHeight = 2.0f;
+const float walkStepHeight = 0.6f;
+const float walkRadius = 0.5f;
+// gap kept between the body and a wall
+const float walkSkin = 0.01f;
+// farthest the ground below the eye is searched for off the heightfield
+const float walkMaxDrop = 1000.0f;
+const float groundCellSize = 0.5f;
+double walkQueryUs = 0.0;
+
+// ambient light baked by LightmapBaker replaces the flat ambient term of
+// models that have a lightmap; basic.frag's AMBIENT_* sources
+enum AmbientSource {
+    AMBIENT_FLAT,
+    AMBIENT_LIGHTMAP,
+    AMBIENT_BAKED_CONSTANT,
+    AMBIENT_PROBES
+};
+
+bool bakedLighting = true;
+const GLint LIGHTMAP_TEXTURE_UNIT = 8;
+// models without a lightmap (the windmill) take their ambient from the probes
+gps::IrradianceProbes irradianceProbes;
+const GLint PROBE_TEXTURE_UNIT = 9;
+
+// falling snow around the camera, simulated on the GPU or, under software
+// renderers (llvmpipe) and with --cpu-snow, on the CPU
+enum SnowMode {
+    SNOW_OFF,
+    SNOW_GPU,
+    SNOW_CPU
+};
+
+const char* snowModeNames[] = { "off", "GPU", "CPU" };
+SnowMode snowMode = SNOW_GPU;
+gps::GpuSnow snow;
+const size_t SNOW_FLAKES = 1 << 20;
+gps::CpuSnow cpuSnow;
+const size_t CPU_SNOW_FLAKES = 1 << 18;
+gps::GpuTimer snowTimer;
+
+// pines and rocks over the ground, culled on the GPU and drawn instanced
+gps::InstanceScatter scatter;
+
+// far meshes of the scene drawn as octahedral impostors in the lit pass
+gps::ImpostorAtlas sceneImpostors;
+gps::Shader impostorShader;
+bool impostorsEnabled = true;
+float impostorDistance = 250.0f;
+
+// static geometry past the far field radius, rendered into a panorama around
+// the camera that is only refreshed after large moves or when the sun moves
+gps::FarField farField;
+gps::Shader farFieldShader;
+bool farFieldEnabled = true;
+
+// heightfield terrain around the village, streamed in chunks and lit like the scene
+gps::Terrain terrain;
+std::vector<uint32_t> terrainLitChunks;
+// all around the camera, at the shadow pass's error
+std::vector<uint32_t> terrainShadowChunks;
+
+// grid cells of the wider world, streamed in and out around the camera,
+// each a static entity while resident
+gps::WorldPartition worldPartition;
+std::unordered_map<const gps::Model3D*, gps::Entity> worldCellEntities;
+// bounds of the cells that came or went since the point shadows were last updated
+std::vector<gps::BoundingBox> worldCellChanges;
+// cells load this far past fogEnd, the farthest anything is seen (the
+// panorama shows them out to there), so they are in before they come into
+// view, and stay until a little farther still
+const float worldLoadMargin = 50.0f;
+const float worldUnloadMargin = 130.0f;
+GLint ambientSourceLoc;
+GLint bakedAmbientLoc;
 
 enum RenderMode {
     SOLID,
@@ -226,6 +434,16 @@ void windowResizeCallback(GLFWwindow* window, int width, int height) {
     fprintf(stdout, "Window resized! New width: %d , and height: %d\n", width, height);
 }
 
+void recreateShadowMaps();
+void updateProjection();
+float getDrawDistance();
+
+void printAssetStats() {
+    gps::AssetManager& assets = gps::getAssetManager();
+    std::cout << "Assets: " << assets.getTextureCount() << " textures, " << assets.getMeshBufferCount() << " mesh buffers, "
+        << assets.getSharedCount() << " loads shared, " << assets.getSavedBytes() / (1024 * 1024) << " MB saved" << std::endl;
+}
+
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode) {
     if (key == GLFW_KEY_P && action == GLFW_PRESS) {
         mouseControlEnabled = !mouseControlEnabled;
@@ -286,13 +504,204 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
         pitch = 0.0f;
     }
 
+    if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+        showCascades = !showCascades;
+        std::cout << "Cascade debug view: " << (showCascades ? "on" : "off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        gps::GpuTimer& timer = shadowQualityTimers[shadowQuality];
+        std::cout << "Shadow tier " << shadowQualityTaps[shadowQuality] << " tap(s): lit pass "
+            << timer.getAverageMs() << " ms (" << timer.getSampleCount() << " frames)" << std::endl;
+
+        shadowQuality = (ShadowQuality)((shadowQuality + 1) % SHADOW_QUALITY_COUNT);
+        shadowQualityTimers[shadowQuality].reset();
+        std::cout << "Shadow tier: " << shadowQualityTaps[shadowQuality] << " tap(s)" << std::endl;
+    }
+
+    if (key == GLFW_KEY_Y && action == GLFW_PRESS) {
+        shadowDepth16 = !shadowDepth16;
+        recreateShadowMaps();
+        shadowQualityTimers[shadowQuality].reset();
+        std::cout << "Shadow depth format: " << (shadowDepth16 ? "16" : "32") << " bit" << std::endl;
+    }
+
+    if ((key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET) && action == GLFW_PRESS) {
+        int step = key == GLFW_KEY_RIGHT_BRACKET ? 1 : -1;
+        pointShadows.setFaceBudget(pointShadows.getFaceBudget() + step);
+        std::cout << "Point shadow faces per frame: " << pointShadows.getFaceBudget()
+            << " (last frame rendered " << pointShadows.getFacesRendered()
+            << ", pending " << pointShadows.getFacesPending() << ")" << std::endl;
+    }
+
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        std::cout << "Triangles  lit pass: " << triangleStats.lit << " with LOD, " << triangleStats.litFull << " without" << std::endl;
+        std::cout << "Triangles  shadow pass: " << triangleStats.shadow << " with LOD, " << triangleStats.shadowFull << " without" << std::endl;
+        if (cullingMode == CULLING_GPU_QUERIES) {
+            std::cout << "Occlusion (" << cullingModeNames[cullingMode] << "): " << occlusionQueries.getDrawnCount() << " mesh(es) drawn, "
+                << occludedMeshCount << " occluded, " << occlusionQueries.getInFlightCount() << " drawn while their query is in flight" << std::endl;
+        }
+        else {
+            std::cout << "Occlusion (" << cullingModeNames[cullingMode] << "): " << occludedMeshCount << " mesh(es) culled, "
+                << occlusionBuffer.getOccluderTriangleCount() << " occluder triangles" << std::endl;
+        }
+        std::cout << "Clusters (" << (clusterCulling ? "on" : "off") << "): " << clusterStats.total << " tested, "
+            << clusterStats.backfacing << " back-facing, " << clusterStats.outsideFrustum << " outside the frustum, "
+            << clusterStats.occluded << " occluded; " << clusterTrianglesDrawn << " triangles drawn from clusters" << std::endl;
+        if (scatter.getInstanceCount() > 0) {
+            std::cout << "Scatter: " << scatter.getVisibleInstanceCount() << " of " << scatter.getInstanceCount() << " instances drawn, "
+                << scatter.getVisibleTriangleCount() << " triangles in the lit pass" << std::endl;
+        }
+        if (sceneImpostors.getImpostorCount() > 0) {
+            std::cout << "Impostors (" << (impostorsEnabled ? "on" : "off") << "): " << sceneImpostors.getInstanceCount() << " drawn past "
+                << impostorDistance << " units, " << sceneImpostors.getImpostorCount() << " meshes baked" << std::endl;
+        }
+        printAssetStats();
+        if (worldPartition.isLoaded()) {
+            std::cout << "World: " << worldPartition.getResidentCount() << " of " << worldPartition.getCellCount() << " cells resident ("
+                << worldPartition.getResidentBytes() / (1024 * 1024) << " MB), " << worldPartition.getPendingCount() << " loading" << std::endl;
+        }
+        if (terrain.isLoaded()) {
+            std::cout << "Terrain: " << terrainLitChunks.size() << " chunks lit, " << terrainShadowChunks.size() << " casting shadows, "
+                << terrain.getResidentCount() << " resident (" << terrain.getResidentBytes() / (1024 * 1024) << " MB), "
+                << terrain.getQueuedCount() << " loading" << std::endl;
+        }
+        if (farFieldEnabled) {
+            std::cout << "Far field: past " << getDrawDistance() << " units, " << farField.getRefreshCount() << " refreshes, "
+                << farField.getFacesRendered() << " face(s) rendered last frame" << std::endl;
+        }
+        if (walkMode) {
+            std::cout << "Walk queries: " << walkQueryUs << " us last frame" << std::endl;
+        }
+        if (snowMode == SNOW_GPU) {
+            std::cout << "Snow: " << snow.getFlakeCount() << " flakes, " << snowTimer.getAverageMs() << " ms GPU (update + draw)" << std::endl;
+            snowTimer.reset();
+        }
+        else if (snowMode == SNOW_CPU) {
+            std::cout << "Snow: " << cpuSnow.getFlakeCount() << " flakes, " << cpuSnow.getUpdateMs() << " ms CPU update on "
+                << gps::getThreadCount() << " thread(s), " << snowTimer.getAverageMs() << " ms GPU draw" << std::endl;
+            snowTimer.reset();
+        }
+    }
+
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        walkMode = !walkMode;
+        std::cout << "Walk mode: " << (walkMode ? "on" : "off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_N && action == GLFW_PRESS) {
+        snowMode = (SnowMode)((snowMode + 1) % 3);
+        std::cout << "Snow: " << snowModeNames[snowMode] << std::endl;
+    }
+
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        bakedLighting = !bakedLighting;
+        std::cout << "Baked lighting: " << (bakedLighting ? "on" : "off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_M && action == GLFW_PRESS) {
+        clusterCulling = !clusterCulling;
+        std::cout << "Cluster culling: " << (clusterCulling ? "on" : "off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        impostorsEnabled = !impostorsEnabled;
+        std::cout << "Impostors: " << (impostorsEnabled ? "on" : "off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        cullingMode = (CullingMode)((cullingMode + 1) % CULLING_MODE_COUNT);
+        std::cout << "Occlusion culling: " << cullingModeNames[cullingMode] << std::endl;
+    }
+
+    if (key == GLFW_KEY_F && action == GLFW_PRESS) {
+        farFieldEnabled = !farFieldEnabled;
+        farField.invalidate();
+        updateProjection();
+        std::cout << "Far field panorama: " << (farFieldEnabled ? "on" : "off") << std::endl;
+    }
+
     if (key == GLFW_KEY_KP_ADD && action == GLFW_PRESS) {
         fogEnd += 50.0f;
+        farField.invalidate();
+        updateProjection();
     }
 
     if (key == GLFW_KEY_KP_SUBTRACT && action == GLFW_PRESS) {
         fogEnd -= 50.0f; 
         if (fogEnd <= fogStart) fogEnd = fogStart + 1.0f;
+        farField.invalidate();
+        updateProjection();
+    }
+}
+
+// Closest hit of a world-space ray against every renderable's BVH
+struct SceneHit {
+    gps::Entity entity;
+    size_t mesh;
+    float distance;
+    glm::vec3 position;
+};
+
+bool raycastScene(const gps::Ray& ray, SceneHit& sceneHit) {
+    bool found = false;
+    sceneHit.distance = ray.maxDistance;
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::Bvh& bvh = registry.renderables.at(i).model->getBvh();
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+
+        // the direction is not renormalized, so distances carry over unchanged
+        glm::mat4 worldToModel = glm::inverse(transform.model);
+        gps::Ray modelRay;
+        modelRay.origin = glm::vec3(worldToModel * glm::vec4(ray.origin, 1.0f));
+        modelRay.direction = glm::vec3(worldToModel * glm::vec4(ray.direction, 0.0f));
+        modelRay.maxDistance = sceneHit.distance;
+
+        gps::RayHit hit;
+        if (bvh.intersect(modelRay, hit)) {
+            found = true;
+            sceneHit.entity = registry.renderables.entityAt(i);
+            sceneHit.mesh = registry.renderables.at(i).model->getMeshOfTriangle(hit.triangle);
+            sceneHit.distance = hit.distance;
+        }
+    }
+    sceneHit.position = ray.origin + ray.direction * sceneHit.distance;
+    return found;
+}
+
+// Picks what lies under the cursor, or under the crosshair while the mouse steers the camera
+void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
+    if (button != GLFW_MOUSE_BUTTON_LEFT || action != GLFW_PRESS) {
+        return;
+    }
+
+    glm::vec2 ndc(0.0f);
+    if (!mouseControlEnabled) {
+        double cursorX, cursorY;
+        glfwGetCursorPos(window, &cursorX, &cursorY);
+        ndc.x = (float)(cursorX / myWindow.getWindowDimensions().width) * 2.0f - 1.0f;
+        ndc.y = 1.0f - (float)(cursorY / myWindow.getWindowDimensions().height) * 2.0f;
+    }
+
+    glm::mat4 clipToWorld = glm::inverse(projection * view);
+    glm::vec4 nearPoint = clipToWorld * glm::vec4(ndc.x, ndc.y, -1.0f, 1.0f);
+    glm::vec4 farPoint = clipToWorld * glm::vec4(ndc.x, ndc.y, 1.0f, 1.0f);
+    gps::Ray ray;
+    ray.origin = glm::vec3(nearPoint) / nearPoint.w;
+    ray.direction = glm::normalize(glm::vec3(farPoint) / farPoint.w - ray.origin);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    SceneHit sceneHit;
+    bool found = raycastScene(ray, sceneHit);
+    auto stop = std::chrono::high_resolution_clock::now();
+    double us = std::chrono::duration<double, std::micro>(stop - start).count();
+
+    if (found) {
+        std::cout << "Picked entity " << sceneHit.entity << ", mesh " << sceneHit.mesh << " at " << glm::to_string(sceneHit.position)
+            << ", distance " << sceneHit.distance << " (" << us << " us)" << std::endl;
+    }
+    else {
+        std::cout << "Picked nothing (" << us << " us)" << std::endl;
     }
 }
 
@@ -339,42 +748,166 @@ void mouseCallback(GLFWwindow* window, double xpos, double ypos) {
 }
 
 
-void processMovement() {
+// Sweeps a sphere along the ray against every renderable's BVH
+bool sweepScene(const gps::Ray& ray, float radius, gps::SweepHit& sceneHit) {
+    bool found = false;
+    sceneHit = gps::SweepHit();
+    sceneHit.distance = ray.maxDistance;
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::Bvh& bvh = registry.renderables.at(i).model->getBvh();
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+
+        // rigid transforms with a uniform scale keep the sphere a sphere
+        glm::mat4 worldToModel = glm::inverse(transform.model);
+        float scale = glm::length(glm::vec3(transform.model[0]));
+        gps::Ray modelRay;
+        modelRay.origin = glm::vec3(worldToModel * glm::vec4(ray.origin, 1.0f));
+        modelRay.direction = glm::vec3(worldToModel * glm::vec4(ray.direction, 0.0f));
+        modelRay.maxDistance = sceneHit.distance;
+
+        gps::SweepHit hit;
+        if (bvh.sweepSphere(modelRay, radius / scale, hit)) {
+            found = true;
+            sceneHit = hit;
+            sceneHit.normal = glm::normalize(transform.normalMatrix * hit.normal);
+        }
+    }
+    return found;
+}
+
+// Moves the body sphere, sliding along the walls it runs into
+glm::vec3 slideSphere(glm::vec3 center, glm::vec3 displacement) {
+    for (int iteration = 0; iteration < 3 && glm::dot(displacement, displacement) > 1e-8f; iteration++) {
+        gps::Ray ray;
+        ray.origin = center;
+        ray.direction = displacement;
+        ray.maxDistance = 1.0f;
+
+        gps::SweepHit hit;
+        if (!sweepScene(ray, walkRadius, hit)) {
+            center += displacement;
+            break;
+        }
+
+        // stop a little short of the contact, then follow the wall horizontally
+        float travel = std::max(hit.distance - walkSkin / glm::length(displacement), 0.0f);
+        center += displacement * travel;
+        displacement *= 1.0f - travel;
+
+        glm::vec3 normal(hit.normal.x, 0.0f, hit.normal.z);
+        if (glm::dot(normal, normal) < 1e-6f) {
+            break;
+        }
+        normal = glm::normalize(normal);
+        displacement -= normal * glm::dot(displacement, normal);
+    }
+    return center;
+}
+
+// Ground under the eye: the baked heightfield, or a ray down through the
+// scene where the heightfield's topmost surface is above the eye (roofs, arches)
+bool findGround(const glm::vec3& eye, float& ground) {
+    if (groundHeights.sample(eye.x, eye.z, ground) && ground <= eye.y) {
+        return true;
+    }
+
+    gps::Ray ray;
+    ray.origin = eye;
+    ray.direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    ray.maxDistance = walkMaxDrop;
+    SceneHit sceneHit;
+    if (raycastScene(ray, sceneHit)) {
+        ground = sceneHit.position.y;
+        return true;
+    }
+    return false;
+}
+
+void walkCamera() {
+    glm::vec3 front = myCamera.getFrontDirection();
+    glm::vec3 right = myCamera.getRightDirection();
+    front = glm::length(glm::vec2(front.x, front.z)) > 0.0f ? glm::normalize(glm::vec3(front.x, 0.0f, front.z)) : glm::vec3(0.0f);
+    right = glm::length(glm::vec2(right.x, right.z)) > 0.0f ? glm::normalize(glm::vec3(right.x, 0.0f, right.z)) : glm::vec3(0.0f);
+
+    glm::vec3 displacement(0.0f);
     if (pressedKeys[GLFW_KEY_W]) {
-        myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        displacement += front;
     }
     if (pressedKeys[GLFW_KEY_S]) {
-        myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        displacement -= front;
+    }
+    if (pressedKeys[GLFW_KEY_D]) {
+        displacement += right;
     }
     if (pressedKeys[GLFW_KEY_A]) {
-        myCamera.move(gps::MOVE_LEFT, cameraSpeed);
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        displacement -= right;
     }
-    if (pressedKeys[GLFW_KEY_D]) {
-        myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    if (glm::dot(displacement, displacement) > 0.0f) {
+        displacement = glm::normalize(displacement) * cameraSpeed;
     }
-    if (pressedKeys[GLFW_KEY_UP]) { 
-        myCamera.move(gps::MOVE_UP, cameraSpeed);
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+
+    auto start = std::chrono::high_resolution_clock::now();
+
+    // the body sphere floats walkStepHeight above the feet, so small steps pass under it
+    glm::vec3 eye = myCamera.getPosition();
+    glm::vec3 bodyOffset(0.0f, walkEyeHeight - walkStepHeight - walkRadius, 0.0f);
+    eye = slideSphere(eye - bodyOffset, displacement) + bodyOffset;
+
+    float ground;
+    if (findGround(eye, ground)) {
+        eye.y = ground + walkEyeHeight;
     }
-    if (pressedKeys[GLFW_KEY_DOWN]) {
-        myCamera.move(gps::MOVE_DOWN, cameraSpeed);
-        view = myCamera.getViewMatrix();
-        myBasicShader.useShaderProgram();
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+
+    auto stop = std::chrono::high_resolution_clock::now();
+    walkQueryUs = std::chrono::duration<double, std::micro>(stop - start).count();
+
+    myCamera.setPosition(eye);
+    view = myCamera.getViewMatrix();
+    myBasicShader.useShaderProgram();
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+}
+
+void processMovement() {
+    if (walkMode) {
+        walkCamera();
+    }
+    else {
+        if (pressedKeys[GLFW_KEY_W]) {
+            myCamera.move(gps::MOVE_FORWARD, cameraSpeed);
+            view = myCamera.getViewMatrix();
+            myBasicShader.useShaderProgram();
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        }
+        if (pressedKeys[GLFW_KEY_S]) {
+            myCamera.move(gps::MOVE_BACKWARD, cameraSpeed);
+            view = myCamera.getViewMatrix();
+            myBasicShader.useShaderProgram();
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        }
+        if (pressedKeys[GLFW_KEY_A]) {
+            myCamera.move(gps::MOVE_LEFT, cameraSpeed);
+            view = myCamera.getViewMatrix();
+            myBasicShader.useShaderProgram();
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        }
+        if (pressedKeys[GLFW_KEY_D]) {
+            myCamera.move(gps::MOVE_RIGHT, cameraSpeed);
+            view = myCamera.getViewMatrix();
+            myBasicShader.useShaderProgram();
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        }
+        if (pressedKeys[GLFW_KEY_UP]) { 
+            myCamera.move(gps::MOVE_UP, cameraSpeed);
+            view = myCamera.getViewMatrix();
+            myBasicShader.useShaderProgram();
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        }
+        if (pressedKeys[GLFW_KEY_DOWN]) {
+            myCamera.move(gps::MOVE_DOWN, cameraSpeed);
+            view = myCamera.getViewMatrix();
+            myBasicShader.useShaderProgram();
+            glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        }
     }
     if (pressedKeys[GLFW_KEY_Q]) {
         yaw -= 1.0f; 
@@ -403,10 +936,6 @@ void processMovement() {
             lightAngle -= 360.0f;
         }
     }
-
-    float lx = lightRadius * cos(glm::radians(lightAngle));
-    float lz = lightRadius * sin(glm::radians(lightAngle));
-    lightPos = glm::vec3(lx, 10.0f, lz); 
 }
 
 
@@ -418,10 +947,11 @@ void setWindowCallbacks() {
     glfwSetWindowSizeCallback(myWindow.getWindow(), windowResizeCallback);
     glfwSetKeyCallback(myWindow.getWindow(), keyboardCallback);
     glfwSetCursorPosCallback(myWindow.getWindow(), mouseCallback);
+    glfwSetMouseButtonCallback(myWindow.getWindow(), mouseButtonCallback);
 }
 
 void initOpenGLState() {
-    glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
+    glClearColor(fogColor.r, fogColor.g, fogColor.b, 1.0f);
     glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
     glEnable(GL_FRAMEBUFFER_SRGB);
     glEnable(GL_DEPTH_TEST); 
@@ -436,8 +966,103 @@ void initOpenGLState() {
 }
 
 void initModels() {
+    // the scene was exported flat, every fence post and barrel a shape of its own
+    scenaFinala.setAutoInstancing(true);
     scenaFinala.LoadModel("models/scenaFinala/finalScene.obj");
     doarMorisca.LoadModel("models/doarMorisca/scenaMorisca.obj");
+
+    if (!scenaFinala.LoadLightmap("models/scenaFinala/finalScene.lightmap")) {
+        std::cout << "No lightmap for finalScene.obj, run LightmapBaker to bake one" << std::endl;
+    }
+    if (!irradianceProbes.load("models/scenaFinala/finalScene.probes")) {
+        std::cout << "No irradiance probes for finalScene.obj, run LightmapBaker to bake them" << std::endl;
+    }
+
+    sceneImpostors.build(scenaFinala, "models/scenaFinala/finalScene.impostors");
+    printAssetStats();
+}
+
+gps::Entity createModelEntity(gps::Model3D* model, bool isStatic) {
+    gps::Entity entity = registry.create();
+
+    gps::TransformComponent transform;
+    transform.model = glm::mat4(1.0f);
+    transform.normalMatrix = glm::mat3(1.0f);
+    registry.transforms.add(entity, transform);
+
+    gps::RenderableComponent renderable;
+    renderable.model = model;
+    renderable.castsShadow = true;
+    renderable.isStatic = isStatic;
+    registry.renderables.add(entity, renderable);
+
+    return entity;
+}
+
+void initEntities() {
+    gps::Entity scene = createModelEntity(&scenaFinala, true);
+    registry.nodes.add(scene, gps::SceneNodeComponent{ &scenaFinalaNode });
+
+    auto start = std::chrono::high_resolution_clock::now();
+    groundHeights.bake(scenaFinala.getBvh(), registry.transforms.get(scene).model, groundCellSize, 2048);
+    auto stop = std::chrono::high_resolution_clock::now();
+    std::cout << "Ground heightfield: " << groundHeights.getWidth() << "x" << groundHeights.getDepth() << ", "
+        << std::chrono::duration<double, std::milli>(stop - start).count() << " ms" << std::endl;
+
+    // windmill wheel
+    gps::Entity wheel = createModelEntity(&doarMorisca, false);
+    gps::RotatorComponent rotator;
+    rotator.restTransform = glm::mat4(1.0f);
+    rotator.pivot = glm::vec3(54.69f, 19.73f, -55.22f);
+    rotator.axis = glm::vec3(1.0f, 0.0f, 0.0f);
+    rotator.angle = 0.0f;
+    rotator.speed = 30.0f;
+    registry.rotators.add(wheel, rotator);
+    registry.nodes.add(wheel, gps::SceneNodeComponent{ &doarMoriscaNode });
+
+    pointLightEntity = registry.create();
+    gps::TransformComponent lightTransform;
+    lightTransform.model = glm::translate(glm::mat4(1.0f), pointLightPos);
+    lightTransform.normalMatrix = glm::mat3(1.0f);
+    registry.transforms.add(pointLightEntity, lightTransform);
+    registry.nodes.add(pointLightEntity, gps::SceneNodeComponent{ &pointLightNode });
+
+    gps::LightComponent light;
+    light.color = pointLightColor;
+    light.constant = pointLightConstant;
+    light.linear = pointLightLinear;
+    light.quadratic = pointLightQuadratic;
+    light.castsShadow = true;
+    registry.lights.add(pointLightEntity, light);
+}
+
+void initSceneGraph() {
+    // the wheel turns on the windmill, so it moves with the scene
+    sceneRoot.addChild(&scenaFinalaNode);
+    scenaFinalaNode.addChild(&doarMoriscaNode);
+    sceneRoot.addChild(&sunNode);
+    sceneRoot.addChild(&pointLightNode);
+
+    pointLightNode.setLocalTransform(glm::translate(glm::mat4(1.0f), pointLightPos));
+}
+
+// the sun orbits at lightRadius, 10 units above the ground
+glm::mat4 getSunTransform(float angle) {
+    glm::mat4 sunModel = glm::rotate(glm::mat4(1.0f), glm::radians(-angle), glm::vec3(0.0f, 1.0f, 0.0f));
+    return glm::translate(sunModel, glm::vec3(lightRadius, 10.0f, 0.0f));
+}
+
+void updateSceneGraph() {
+    if (lightAngle != sunNodeAngle) {
+        sunNode.setLocalTransform(getSunTransform(lightAngle));
+        sunNodeAngle = lightAngle;
+    }
+
+    sceneRoot.update();
+    gps::syncSceneNodes(registry);
+
+    lightPos = sunNode.getWorldPosition();
+    pointLightPos = pointLightNode.getWorldPosition();
 }
 
 void initShaders() {
@@ -448,14 +1073,22 @@ void initShaders() {
     depthShader.loadShader(
         "shaders/depthShader.vert",
         "shaders/depthShader.frag");
+
+    impostorShader.loadShader(
+        "shaders/impostor.vert",
+        "shaders/impostor.frag");
+
+    farFieldShader.loadShader(
+        "shaders/farField.vert",
+        "shaders/farField.frag");
 }
 
 void initUniforms() {
     myBasicShader.useShaderProgram();
 
-    GLint loc = glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix");
+    GLint loc = glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrices");
     if (loc == -1) {
-        std::cout << "Uniform 'lightSpaceTrMatrix' not found in myCustomShader!" << std::endl;
+        std::cout << "Uniform 'lightSpaceTrMatrices' not found in myCustomShader!" << std::endl;
     }
 
     model = glm::rotate(glm::mat4(1.0f), glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -468,11 +1101,11 @@ void initUniforms() {
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
     normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
 
-    projection = glm::perspective(glm::radians(45.0f),
-        (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
-        0.1f, 1000.0f);
+    lightClusters.initBuffers();
+
     projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    updateProjection();
+    myBasicShader.useShaderProgram();
 
     lightDir = glm::vec3(0.0f, 1.0f, 1.0f);
     lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
@@ -483,198 +1116,1106 @@ void initUniforms() {
     glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 }
 
+// Distance to which static geometry is drawn in the lit pass: fogEnd, past
+// which everything is pure fog colour, or the far field radius while the
+// panorama covers the rest. Dynamic entities are not in the panorama, so
+// they are drawn to fogEnd either way, which is the lit pass's far plane.
+float getDrawDistance() {
+    return farFieldEnabled ? std::min(farField.getSettings().radius, fogEnd) : fogEnd;
+}
 
-void renderScenaFinala(gps::Shader shader) {
-    shader.useShaderProgram();
+void updateProjection() {
+    float aspect = (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height;
+    projection = glm::perspective(glm::radians(fieldOfView), aspect, nearPlane, fogEnd);
+    // the clusters span the lit pass's whole depth, dynamic entities are lit out to fogEnd
+    lightClusters.setProjection(glm::radians(fieldOfView), aspect, nearPlane, fogEnd);
+    worldPartition.setRadii(fogEnd + worldLoadMargin, fogEnd + worldUnloadMargin);
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+    myBasicShader.useShaderProgram();
+    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+}
 
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(sceneModelMatrix));
+// Distance culling: a mesh whose bounds lie entirely past the draw distance is
+// fogged to the clear colour or left to the far field panorama, so it is
+// skipped in the lit and sun shadow passes.
+// Visible meshes get a level of detail from their projected error.
+void updateVisibility() {
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    float drawDistance = getDrawDistance();
+    float drawDistanceSquared = drawDistance * drawDistance;
+    // pixels covered by one unit at distance 1
+    float pixelsPerUnit = myWindow.getWindowDimensions().height / (2.0f * std::tan(glm::radians(fieldOfView) * 0.5f));
+
+    std::vector<uint8_t> staticVisibility;
+    sceneImpostors.clearInstances();
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        gps::RenderableComponent& renderable = registry.renderables.at(i);
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+        const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+
+        renderable.visibleMeshes.assign(meshes.size(), 0);
+        renderable.litLods.assign(meshes.size(), 0);
+        renderable.shadowLods.assign(meshes.size(), 0);
+        renderable.shadowWholeMeshes.assign(meshes.size(), 0);
+
+        float scale = std::max(glm::length(glm::vec3(transform.model[0])),
+            std::max(glm::length(glm::vec3(transform.model[1])), glm::length(glm::vec3(transform.model[2]))));
+
+        float limitSquared = renderable.isStatic ? drawDistanceSquared : fogEnd * fogEnd;
+        if (renderable.model->getBounds().transformed(transform.model).distanceSquared(cameraPosition) <= limitSquared) {
+            for (size_t m = 0; m < meshes.size(); m++) {
+                float distanceSquared = meshes[m].bounds.transformed(transform.model).distanceSquared(cameraPosition);
+                if (distanceSquared > limitSquared) {
+                    continue;
+                }
+                renderable.visibleMeshes[m] = 1;
+
+                // object-space error allowed for a given pixel error at this distance
+                float distance = std::max(std::sqrt(distanceSquared), nearPlane);
+                float errorPerPixel = distance / (pixelsPerUnit * scale);
+                renderable.litLods[m] = (uint8_t)meshes[m].selectLod(litLodErrorPixels * errorPerPixel);
+                renderable.shadowLods[m] = (uint8_t)meshes[m].selectLod(shadowLodErrorPixels * errorPerPixel);
+
+                if (impostorsEnabled && renderable.model == sceneImpostors.getModel() && sceneImpostors.hasImpostor(m)) {
+                    sceneImpostors.splitCopies(m, transform.model, cameraPosition, impostorDistance);
+                    if (sceneImpostors.getNearCopyCount(m) == 0) {
+                        // an impostor in the lit pass, so the coarsest level is plenty for its shadow
+                        renderable.shadowLods[m] = (uint8_t)(meshes[m].getLodCount() - 1);
+                    }
+                }
+                renderable.shadowWholeMeshes[m] = renderable.model != sceneImpostors.getModel() || !sceneImpostors.isSplit(m);
+            }
+        }
 
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
+        if (renderable.castsShadow && renderable.isStatic) {
+            for (size_t m = 0; m < meshes.size(); m++) {
+                staticVisibility.push_back(renderable.visibleMeshes[m] ? renderable.shadowLods[m] + 1 : 0);
+                // split meshes cast near and far copies at different levels,
+                // so the layers depend on which copies are on each side
+                if (renderable.visibleMeshes[m] && !renderable.shadowWholeMeshes[m]) {
+                    uint64_t splitHash = sceneImpostors.getSplitHash(m);
+                    for (int byte = 0; byte < 8; byte++) {
+                        staticVisibility.push_back((uint8_t)(splitHash >> (8 * byte)));
+                    }
+                }
+            }
+        }
+    }
+
+    terrainLitChunks.clear();
+    terrainShadowChunks.clear();
+    if (terrain.isLoaded()) {
+        gps::TerrainView terrainView;
+        terrainView.position = cameraPosition;
+        gps::extractFrustumPlanes(projection * view, terrainView.frustumPlanes);
+        terrainView.useFrustum = true;
+        terrainView.pixelsPerUnit = pixelsPerUnit;
+        terrainView.maxPixelError = litLodErrorPixels;
+        terrainView.minDistance = 0.0f;
+        terrainView.maxDistance = drawDistance;
+        terrain.select(terrainView, terrainLitChunks);
+
+        terrainView.useFrustum = false;
+        terrainView.maxPixelError = shadowLodErrorPixels;
+        terrain.select(terrainView, terrainShadowChunks);
+        // the terrain's chunks are static casters too
+        for (uint32_t chunk : terrainShadowChunks) {
+            for (int byte = 0; byte < 4; byte++) {
+                staticVisibility.push_back((uint8_t)(chunk >> (8 * byte)));
+            }
+        }
+    }
 
-    scenaFinala.Draw(shader);
+    // the cached static cascade layers are only valid for the caster set they were drawn with
+    if (staticVisibility != staticCasterVisibility) {
+        staticCasterVisibility.swap(staticVisibility);
+        for (int c = 0; c < gps::MAX_SHADOW_CASCADES; c++) {
+            staticCascadeValid[c] = false;
+        }
+    }
 }
 
+// Software occlusion culling of the lit pass: the large static meshes near the
+// camera are rasterized into a small CPU depth buffer, then every visible mesh's
+// box is tested against its depth pyramid on the worker threads
+void updateOcclusion() {
+    occludedMeshCount = 0;
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        gps::RenderableComponent& renderable = registry.renderables.at(i);
+        renderable.litMeshes = renderable.visibleMeshes;
+    }
+    if (cullingMode == CULLING_GPU_QUERIES) {
+        occlusionQueries.collect();
+    }
+    if (cullingMode != CULLING_SOFTWARE) {
+        return;
+    }
 
-glm::mat4 wheelModelMatrix;
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    float occluderPixelsPerUnit = gps::OcclusionBuffer::HEIGHT / (2.0f * std::tan(glm::radians(fieldOfView) * 0.5f));
 
-void renderDoarMorisca(gps::Shader shader) {
-    shader.useShaderProgram();
+    occlusionBuffer.begin(projection * view);
+
+    // (renderable, mesh) pairs to test
+    std::vector<std::pair<uint32_t, uint32_t>> tests;
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+        const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+
+        for (size_t m = 0; m < meshes.size(); m++) {
+            if (!renderable.visibleMeshes[m]) {
+                continue;
+            }
+            tests.push_back(std::make_pair((uint32_t)i, (uint32_t)m));
+
+            if (!renderable.isStatic) {
+                continue;
+            }
+            gps::BoundingBox bounds = meshes[m].bounds.transformed(transform.model);
+            float size = glm::length(bounds.max - bounds.min);
+            float distance = std::max(std::sqrt(bounds.distanceSquared(cameraPosition)), nearPlane);
+            if (size * occluderPixelsPerUnit / distance >= occluderMinPixels) {
+                occlusionBuffer.addOccluder(meshes[m].getOccluderPositions(), meshes[m].getOccluderIndices(), transform.model);
+            }
+        }
+    }
 
-    wheelModelMatrix = glm::mat4(1.0f);
-    wheelModelMatrix = glm::translate(wheelModelMatrix, wheelPivotPoint);
-    wheelModelMatrix = glm::rotate(wheelModelMatrix, glm::radians(wheelRotationAngle), glm::vec3(1.0f, 0.0f, 0.0f));
-    wheelModelMatrix = glm::translate(wheelModelMatrix, -wheelPivotPoint);
+    occlusionBuffer.rasterize();
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(wheelModelMatrix));
-    doarMorisca.Draw(shader);
+    std::vector<uint8_t> results(tests.size());
+    gps::parallelFor(tests.size(), 64, [&](size_t begin, size_t end) {
+        for (size_t k = begin; k < end; k++) {
+            const gps::RenderableComponent& renderable = registry.renderables.at(tests[k].first);
+            const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(tests[k].first));
+            const gps::Mesh& mesh = renderable.model->getMeshes()[tests[k].second];
+            results[k] = occlusionBuffer.isVisible(mesh.bounds.transformed(transform.model));
+        }
+    });
+
+    for (size_t k = 0; k < tests.size(); k++) {
+        if (!results[k]) {
+            registry.renderables.at(tests[k].first).litMeshes[tests[k].second] = 0;
+            occludedMeshCount++;
+        }
+    }
 }
 
+// Copies of meshes with an impostor that lie past impostorDistance (split
+// off in updateVisibility) leave the lit pass and are queued on the atlas;
+// a mesh keeps drawing whatever copies are still near.
+void updateImpostors() {
+    if (!impostorsEnabled) {
+        return;
+    }
 
-glm::mat4 computeLightSpaceTrMatrix() {
-    glm::mat4 lightView = glm::lookAt(lightPos, glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::mat4 lightProjection = glm::ortho(-20.0f, 20.0f, -20.0f, 20.0f, 1.0f, 50.0f);
-    return lightProjection * lightView;
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        gps::RenderableComponent& renderable = registry.renderables.at(i);
+        if (renderable.model != sceneImpostors.getModel()) {
+            continue;
+        }
+
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+        for (size_t m = 0; m < renderable.litMeshes.size(); m++) {
+            if (!renderable.litMeshes[m] || sceneImpostors.getFarCopyCount(m) == 0) {
+                continue;
+            }
+            sceneImpostors.addInstances(m, transform.model);
+            if (sceneImpostors.getNearCopyCount(m) == 0) {
+                renderable.litMeshes[m] = 0;
+            }
+        }
+    }
 }
 
-void renderScenaDepth(gps::Shader& depthShader, const glm::mat4& modelMat) {
-    depthShader.useShaderProgram();
+// Tests every mesh's box against this frame's depth buffer; the results drive
+// the conditional draws of the following frames
+void issueOcclusionQueries() {
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    occlusionQueries.beginQueries(projection * view, cameraPosition);
+
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        gps::Entity entity = registry.renderables.entityAt(i);
+        const gps::TransformComponent& transform = registry.transforms.get(entity);
+        const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+
+        for (size_t m = 0; m < meshes.size(); m++) {
+            if (renderable.visibleMeshes[m]) {
+                occlusionQueries.query(entity, m, meshes.size(), meshes[m].bounds.transformed(transform.model));
+            }
+        }
+    }
 
-    GLint modelLocDepth = glGetUniformLocation(depthShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLocDepth, 1, GL_FALSE, glm::value_ptr(modelMat));
+    occlusionQueries.endQueries();
+}
 
-    scenaFinala.Draw(depthShader);
+// World-space box holding the model-space box at any angle of the entity's
+// rotator; a rotator on a scene node turns it inside its parent's space
+gps::BoundingBox getSweptBounds(gps::Entity entity, const gps::BoundingBox& bounds) {
+    const gps::RotatorComponent& rotator = registry.rotators.get(entity);
+    float radius = glm::length(glm::max(glm::abs(bounds.min - rotator.pivot), glm::abs(bounds.max - rotator.pivot)));
+    gps::BoundingBox swept(rotator.pivot - glm::vec3(radius), rotator.pivot + glm::vec3(radius));
+
+    glm::mat4 parentTransform(1.0f);
+    if (registry.nodes.has(entity) && registry.nodes.get(entity).node->getParent() != nullptr) {
+        parentTransform = registry.nodes.get(entity).node->getParent()->getWorldTransform();
+    }
+    return swept.transformed(parentTransform * rotator.restTransform);
 }
 
-void renderDoarMoriscaDepth(gps::Shader& depthShader, const glm::mat4& modelMat) {
-    depthShader.useShaderProgram();
+void updateShadowCascades() {
+    std::vector<gps::BoundingBox> casterBounds;
+    // every caster, visible or not, so the cascade windows do not change with the camera
+    gps::BoundingBox sceneBounds;
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        if (!renderable.castsShadow) {
+            continue;
+        }
+
+        gps::Entity entity = registry.renderables.entityAt(i);
+        const gps::TransformComponent& transform = registry.transforms.get(entity);
+        const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+        for (size_t m = 0; m < meshes.size(); m++) {
+            if (registry.rotators.has(entity)) {
+                // every mesh, over the whole turn: the box of a spinning part
+                // changes each frame and would refit the cascades (and
+                // re-render the static layers) with the camera standing still
+                gps::BoundingBox swept = getSweptBounds(entity, meshes[m].bounds);
+                casterBounds.push_back(swept);
+                sceneBounds.expand(swept);
+                continue;
+            }
+            gps::BoundingBox bounds = meshes[m].bounds.transformed(transform.model);
+            sceneBounds.expand(bounds);
+            if (renderable.visibleMeshes[m]) {
+                casterBounds.push_back(bounds);
+            }
+        }
+    }
+    if (!scatter.getBounds().isEmpty()) {
+        casterBounds.push_back(scatter.getBounds());
+        sceneBounds.expand(scatter.getBounds());
+    }
+    if (terrain.isLoaded()) {
+        sceneBounds.expand(terrain.getBounds());
+    }
+    for (uint32_t chunk : terrainShadowChunks) {
+        casterBounds.push_back(terrain.getChunkBounds(chunk));
+    }
+
+    float aspect = (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height;
+    glm::vec3 lightDirection = glm::normalize(-lightPos);
+    gps::computeShadowCascades(view, glm::radians(fieldOfView), aspect, nearPlane, getDrawDistance(),
+        lightDirection, casterBounds, sceneBounds, cascadeSettings, shadowCascades);
+}
 
+enum CasterFilter {
+    ALL_CASTERS,
+    STATIC_CASTERS,
+    DYNAMIC_CASTERS
+};
+
+void countTriangles(const gps::RenderableComponent& renderable, const std::vector<uint8_t>& visible, const std::vector<uint8_t>& lods, size_t& drawn, size_t& full) {
+    const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+    for (size_t m = 0; m < meshes.size(); m++) {
+        if (visible[m]) {
+            drawn += meshes[m].getTriangleCount(lods[m]);
+            full += meshes[m].getTriangleCount(0);
+        }
+    }
+}
+
+void renderEntitiesDepth(gps::Shader& depthShader, CasterFilter filter) {
+    depthShader.useShaderProgram();
     GLint modelLocDepth = glGetUniformLocation(depthShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLocDepth, 1, GL_FALSE, glm::value_ptr(modelMat));
 
-    doarMorisca.Draw(depthShader);
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        if (!renderable.castsShadow) {
+            continue;
+        }
+        if ((filter == STATIC_CASTERS && !renderable.isStatic) || (filter == DYNAMIC_CASTERS && renderable.isStatic)) {
+            continue;
+        }
+
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+        glUniformMatrix4fv(modelLocDepth, 1, GL_FALSE, glm::value_ptr(transform.model));
+
+        renderable.model->Draw(depthShader, renderable.shadowWholeMeshes, renderable.shadowLods);
+        countTriangles(renderable, renderable.shadowWholeMeshes, renderable.shadowLods, triangleStats.shadow, triangleStats.shadowFull);
+
+        // meshes split by the impostors: the near copies at their shadow level,
+        // the far ones at the coarsest, like the meshes that are wholly far
+        const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+        for (size_t m = 0; m < meshes.size(); m++) {
+            if (!renderable.visibleMeshes[m] || renderable.shadowWholeMeshes[m]) {
+                continue;
+            }
+            int farLod = meshes[m].getLodCount() - 1;
+            size_t nearCopies = sceneImpostors.getNearCopyCount(m);
+            size_t farCopies = sceneImpostors.getFarCopyCount(m);
+            renderable.model->DrawMeshCopies(depthShader, m, renderable.shadowLods[m],
+                sceneImpostors.getNearCopyBuffer(m), (GLsizei)nearCopies);
+            renderable.model->DrawMeshCopies(depthShader, m, farLod,
+                sceneImpostors.getFarCopyBuffer(m), (GLsizei)farCopies);
+
+            // getTriangleCount covers every copy, so scale it down to one
+            size_t copies = std::max(meshes[m].getInstanceTransforms().size(), (size_t)1);
+            triangleStats.shadow += meshes[m].getTriangleCount(renderable.shadowLods[m]) / copies * nearCopies
+                + meshes[m].getTriangleCount(farLod) / copies * farCopies;
+            triangleStats.shadowFull += meshes[m].getTriangleCount(0) / copies * (nearCopies + farCopies);
+        }
+    }
 }
 
-void renderScenaLit(gps::Shader& lightingShader,
-    const glm::mat4& modelMat,
-    const glm::mat3& normalMat) {
-    lightingShader.useShaderProgram();
+// Only the full detail level carries lightmap coordinates; coarser levels
+// fall back to the mesh's mean baked light. Instanced meshes share one set of
+// coordinates among their copies, so they use the probes like unbaked models.
+void setAmbientSource(const gps::Model3D& model, size_t meshIndex, int lod) {
+    GLuint lightmapTexture = model.getLightmapTexture();
+    if (!bakedLighting) {
+        glUniform1i(ambientSourceLoc, AMBIENT_FLAT);
+    }
+    else if (lightmapTexture == 0 || model.getMeshes()[meshIndex].getInstanceCount() > 0) {
+        glUniform1i(ambientSourceLoc, irradianceProbes.isLoaded() ? AMBIENT_PROBES : AMBIENT_FLAT);
+    }
+    else if (lod == 0) {
+        glActiveTexture(GL_TEXTURE0 + LIGHTMAP_TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_2D, lightmapTexture);
+        glUniform1i(ambientSourceLoc, AMBIENT_LIGHTMAP);
+    }
+    else {
+        glUniform3fv(bakedAmbientLoc, 1, glm::value_ptr(model.getLightmapAverage(meshIndex)));
+        glUniform1i(ambientSourceLoc, AMBIENT_BAKED_CONSTANT);
+    }
+}
 
-    GLint modelLocMain = glGetUniformLocation(lightingShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLocMain, 1, GL_FALSE, glm::value_ptr(modelMat));
+void drawLitMesh(gps::Shader& lightingShader, const gps::RenderableComponent& renderable, const gps::TransformComponent& transform, size_t meshIndex) {
+    const gps::Mesh& mesh = renderable.model->getMeshes()[meshIndex];
+    int lod = renderable.litLods[meshIndex];
+    setAmbientSource(*renderable.model, meshIndex, lod);
+    if (renderable.model == sceneImpostors.getModel() && sceneImpostors.isSplit(meshIndex)) {
+        // the far copies are impostors this frame
+        renderable.model->DrawMeshCopies(lightingShader, meshIndex, lod,
+            sceneImpostors.getNearCopyBuffer(meshIndex), (GLsizei)sceneImpostors.getNearCopyCount(meshIndex));
+        return;
+    }
+    if (!clusterCulling || lod != 0 || mesh.getClusters().empty()) {
+        renderable.model->DrawMesh(lightingShader, meshIndex, lod);
+        return;
+    }
+
+    static std::vector<GLsizei> counts;
+    static std::vector<const GLvoid*> offsets;
+    counts.clear();
+    offsets.clear();
+    gps::cullClusters(mesh.getClusters(), transform.model, clusterView, counts, offsets, clusterStats);
+    for (GLsizei count : counts) {
+        clusterTrianglesDrawn += count / 3;
+    }
+    renderable.model->DrawMeshRanges(lightingShader, meshIndex, counts, offsets);
+}
+
+void renderEntitiesLit(gps::Shader& lightingShader) {
+    clusterView.cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    gps::extractFrustumPlanes(projection * view, clusterView.frustumPlanes);
+    clusterView.occlusion = cullingMode == CULLING_SOFTWARE ? &occlusionBuffer : nullptr;
+    clusterStats = gps::ClusterCullStats();
+    clusterTrianglesDrawn = 0;
 
+    lightingShader.useShaderProgram();
+    GLint modelLocMain = glGetUniformLocation(lightingShader.shaderProgram, "model");
     GLint normalMatrixLocMain = glGetUniformLocation(lightingShader.shaderProgram, "normalMatrix");
-    glUniformMatrix3fv(normalMatrixLocMain, 1, GL_FALSE, glm::value_ptr(normalMat));
+    ambientSourceLoc = glGetUniformLocation(lightingShader.shaderProgram, "ambientSource");
+    bakedAmbientLoc = glGetUniformLocation(lightingShader.shaderProgram, "bakedAmbient");
+    glUniform1i(glGetUniformLocation(lightingShader.shaderProgram, "lightmap"), LIGHTMAP_TEXTURE_UNIT);
+    // bound even without probes, so the sampler3D never shares unit 0 with a sampler2D
+    irradianceProbes.bind(lightingShader.shaderProgram, PROBE_TEXTURE_UNIT);
+
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+
+        glUniformMatrix4fv(modelLocMain, 1, GL_FALSE, glm::value_ptr(transform.model));
+
+        // the view matrix is rigid, so the eye-space normal matrix is just a product
+        glm::mat3 normalMat = glm::mat3(view) * transform.normalMatrix;
+        glUniformMatrix3fv(normalMatrixLocMain, 1, GL_FALSE, glm::value_ptr(normalMat));
+
+        // per mesh, so each one can sit under its own conditional render or be split into clusters
+        gps::Entity entity = registry.renderables.entityAt(i);
+        for (size_t m = 0; m < renderable.litMeshes.size(); m++) {
+            if (!renderable.litMeshes[m]) {
+                continue;
+            }
+            bool conditional = cullingMode == CULLING_GPU_QUERIES && occlusionQueries.beginDraw(entity, m);
+            drawLitMesh(lightingShader, renderable, transform, m);
+            occlusionQueries.endDraw(conditional);
+        }
+        countTriangles(renderable, renderable.litMeshes, renderable.litLods, triangleStats.lit, triangleStats.litFull);
+    }
+
+    // other draws with this shader keep the flat ambient term
+    glUniform1i(ambientSourceLoc, AMBIENT_FLAT);
+}
 
-    scenaFinala.Draw(lightingShader);
+// Out of the lightmap's and the probes' reach, so only the flat ambient term
+void renderTerrainLit(gps::Shader& lightingShader) {
+    if (terrainLitChunks.empty()) {
+        return;
+    }
+    lightingShader.useShaderProgram();
+    glm::mat3 normalMat = glm::mat3(view);
+    glUniformMatrix3fv(glGetUniformLocation(lightingShader.shaderProgram, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(normalMat));
+    glUniform1i(ambientSourceLoc, AMBIENT_FLAT);
+    terrain.draw(lightingShader, terrainLitChunks);
+    size_t triangles = terrainLitChunks.size() * gps::Terrain::CHUNK_TRIANGLES;
+    triangleStats.lit += triangles;
+    triangleStats.litFull += triangles;
 }
 
-void renderDoarMoriscaLit(gps::Shader& lightingShader,
-    const glm::mat4& modelMat,
-    const glm::mat3& normalMat) {
+void renderScatterLit(gps::Shader& lightingShader) {
     lightingShader.useShaderProgram();
+    // no lightmap for the prototypes, so they are lit like the windmill
+    bool probes = bakedLighting && irradianceProbes.isLoaded();
+    glUniform1i(ambientSourceLoc, probes ? AMBIENT_PROBES : AMBIENT_FLAT);
+    scatter.draw(lightingShader, 0);
+    glUniform1i(ambientSourceLoc, AMBIENT_FLAT);
+}
 
-    GLint modelLocMain = glGetUniformLocation(lightingShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLocMain, 1, GL_FALSE, glm::value_ptr(modelMat));
+// Draws the casters whose bounds reach into a point light's range
+void renderEntitiesPointDepth(gps::Shader& shader, const glm::vec3& center, float radius) {
+    GLint modelLocDepth = glGetUniformLocation(shader.shaderProgram, "model");
 
-    GLint normalMatrixLocMain = glGetUniformLocation(lightingShader.shaderProgram, "normalMatrix");
-    glUniformMatrix3fv(normalMatrixLocMain, 1, GL_FALSE, glm::value_ptr(normalMat));
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        if (!renderable.castsShadow) {
+            continue;
+        }
+
+        const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+        if (!renderable.model->getBounds().transformed(transform.model).intersectsSphere(center, radius)) {
+            continue;
+        }
 
-    doarMorisca.Draw(lightingShader);
+        glUniformMatrix4fv(modelLocDepth, 1, GL_FALSE, glm::value_ptr(transform.model));
+        renderable.model->Draw(shader);
+    }
+}
+
+void renderPointShadows(const std::vector<uint32_t>& lightIds) {
+    // old and new bounds of every dynamic caster that moved since the last frame
+    std::vector<gps::BoundingBox> movedCasters;
+    movedCasters.swap(worldCellChanges);
+    for (size_t i = 0; i < registry.renderables.size(); i++) {
+        const gps::RenderableComponent& renderable = registry.renderables.at(i);
+        if (!renderable.castsShadow || renderable.isStatic) {
+            continue;
+        }
+
+        gps::Entity entity = registry.renderables.entityAt(i);
+        const glm::mat4& current = registry.transforms.get(entity).model;
+        const gps::BoundingBox& bounds = renderable.model->getBounds();
+        if (!casterTransforms.has(entity)) {
+            casterTransforms.add(entity, current);
+            movedCasters.push_back(bounds.transformed(current));
+            continue;
+        }
+
+        glm::mat4& last = casterTransforms.get(entity);
+        if (last != current) {
+            movedCasters.push_back(bounds.transformed(last));
+            movedCasters.push_back(bounds.transformed(current));
+            last = current;
+        }
+    }
+
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    pointShadows.update(lightIds, pointLights, cameraPosition, movedCasters, renderEntitiesPointDepth);
+}
+
+void updatePointLights() {
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+
+    pointLights.clear();
+    std::vector<uint32_t> lightIds;
+    for (size_t i = 0; i < registry.lights.size(); i++) {
+        const gps::LightComponent& light = registry.lights.at(i);
+        const gps::TransformComponent& transform = registry.transforms.get(registry.lights.entityAt(i));
+
+        gps::PointLight pointLight;
+        pointLight.position = glm::vec3(transform.model[3]);
+        pointLight.color = light.color;
+        pointLight.constant = light.constant;
+        pointLight.linear = light.linear;
+        pointLight.quadratic = light.quadratic;
+        // a light whose whole range is in full fog lights nothing visible
+        float range = gps::computeLightRange(pointLight, gps::LIGHT_RANGE_THRESHOLD);
+        pointLight.castsShadow = light.castsShadow && glm::length(pointLight.position - cameraPosition) - range < fogEnd;
+        pointLights.push_back(pointLight);
+        lightIds.push_back(registry.lights.entityAt(i));
+    }
+
+    renderPointShadows(lightIds);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    lightClusters.assignLights(view, pointLights);
+    auto stop = std::chrono::high_resolution_clock::now();
+    lightCullingMs = std::chrono::duration<double, std::milli>(stop - start).count();
+
+    lightClusters.upload(pointLights);
+}
+
+void spawnBenchmarkTorches(int count) {
+    gps::BoundingBox sceneBounds;
+    for (const gps::Mesh& mesh : scenaFinala.getMeshes()) {
+        sceneBounds.expand(mesh.bounds);
+    }
+
+    std::mt19937 random(count);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    while ((int)lightBenchmark.torches.size() < count) {
+        glm::vec3 position = sceneBounds.min + (sceneBounds.max - sceneBounds.min) * glm::vec3(unit(random), unit(random), unit(random));
+
+        gps::Entity torch = registry.create();
+        gps::TransformComponent transform;
+        transform.model = glm::translate(glm::mat4(1.0f), position);
+        transform.normalMatrix = glm::mat3(1.0f);
+        registry.transforms.add(torch, transform);
+
+        gps::LightComponent light;
+        light.color = glm::vec3(1.0f, 0.6f, 0.3f);
+        light.constant = 1.0f;
+        light.linear = 0.22f;
+        light.quadratic = 0.20f;
+        light.castsShadow = true;
+        registry.lights.add(torch, light);
+
+        lightBenchmark.torches.push_back(torch);
+    }
+}
+
+// Steps through lightBenchmarkCounts and prints the averages of each step
+void updateLightBenchmark(double frameSeconds) {
+    if (!lightBenchmark.active) {
+        return;
+    }
+
+    if (lightBenchmark.frame == 0) {
+        spawnBenchmarkTorches(lightBenchmarkCounts[lightBenchmark.step]);
+    }
+
+    lightBenchmark.frame++;
+    if (lightBenchmark.frame == lightBenchmarkWarmupFrames) {
+        lightBenchmark.frameMs = 0.0;
+        lightBenchmark.cullingMs = 0.0;
+        litPassTimer.reset();
+    }
+    else if (lightBenchmark.frame > lightBenchmarkWarmupFrames) {
+        lightBenchmark.frameMs += frameSeconds * 1000.0;
+        lightBenchmark.cullingMs += lightCullingMs;
+    }
+
+    if (lightBenchmark.frame == lightBenchmarkWarmupFrames + lightBenchmarkFrames) {
+        std::cout << "lights " << lightBenchmarkCounts[lightBenchmark.step]
+            << " | frame " << lightBenchmark.frameMs / lightBenchmarkFrames << " ms"
+            << " | CPU culling " << lightBenchmark.cullingMs / lightBenchmarkFrames << " ms"
+            << " | GPU lit pass " << litPassTimer.getAverageMs() << " ms"
+            << " | indices " << lightClusters.getIndexCount() << std::endl;
+
+        lightBenchmark.frame = 0;
+        lightBenchmark.step++;
+        if (lightBenchmark.step == lightBenchmarkSteps) {
+            glfwSetWindowShouldClose(myWindow.getWindow(), GL_TRUE);
+        }
+    }
+}
+
+void renderTerrainDepth(gps::Shader& depthShader) {
+    terrain.draw(depthShader, terrainShadowChunks);
+    size_t triangles = terrainShadowChunks.size() * gps::Terrain::CHUNK_TRIANGLES;
+    triangleStats.shadow += triangles;
+    triangleStats.shadowFull += triangles;
 }
 
 void renderShadowMap() {
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    updateShadowCascades();
 
-    depthShader.useShaderProgram();
+    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 
-    glm::mat4 lightSpaceTrMatrix = computeLightSpaceTrMatrix();
+    depthShader.useShaderProgram();
     GLint lightSpaceLoc = glGetUniformLocation(depthShader.shaderProgram, "lightSpaceTrMatrix");
-    glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrix));
 
-    glm::mat4 sceneModel = glm::mat4(1.0f);
-    renderScenaDepth(depthShader, sceneModel);
+    for (size_t c = 0; c < shadowCascades.size(); c++) {
+        glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(shadowCascades[c].lightSpaceTrMatrix));
+
+        // static casters are only redrawn when the light or the cascade fit changes
+        if (!staticCascadeValid[c] || staticCascadeMatrices[c] != shadowCascades[c].lightSpaceTrMatrix) {
+            glBindFramebuffer(GL_FRAMEBUFFER, staticShadowMapFBO);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthMapTexture, 0, (GLint)c);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            renderEntitiesDepth(depthShader, STATIC_CASTERS);
+            renderTerrainDepth(depthShader);
+            // every placement, not just the camera's culled set, so the
+            // instances just outside the view still cast onto visible ground
+            scatter.drawAll(depthShader, 1, myCamera.getPosition());
+
+            staticCascadeMatrices[c] = shadowCascades[c].lightSpaceTrMatrix;
+            staticCascadeValid[c] = true;
+        }
 
-    glm::mat4 wheelModel = glm::mat4(1.0f);
-    wheelModel = glm::translate(wheelModel, wheelPivotPoint);
-    wheelModel = glm::rotate(wheelModel, glm::radians(wheelRotationAngle), glm::vec3(1.0f, 0.0f, 0.0f));
-    wheelModel = glm::translate(wheelModel, -wheelPivotPoint);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, staticShadowMapFBO);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticDepthMapTexture, 0, (GLint)c);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, shadowMapFBO);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthMapTexture, 0, (GLint)c);
+        glBlitFramebuffer(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, 0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
 
-    renderDoarMoriscaDepth(depthShader, wheelModel);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+        renderEntitiesDepth(depthShader, DYNAMIC_CASTERS);
+    }
 
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
 }
 
-void renderFinalScene() {
-    myBasicShader.useShaderProgram();
+// Sun, cascaded shadow and fog uniforms, shared by the lit shaders
+void setSunUniforms(gps::Shader& shader) {
+    shader.useShaderProgram();
+    GLuint program = shader.shaderProgram;
+
+    glm::mat4 lightSpaceTrMatrices[gps::MAX_SHADOW_CASCADES];
+    float cascadeSplits[gps::MAX_SHADOW_CASCADES];
+    for (size_t c = 0; c < shadowCascades.size(); c++) {
+        lightSpaceTrMatrices[c] = shadowCascades[c].lightSpaceTrMatrix;
+        cascadeSplits[c] = shadowCascades[c].splitFar;
+    }
 
-    glm::mat4 lightSpaceTrMatrix = computeLightSpaceTrMatrix();
-    GLint lightSpaceLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix");
-    glUniformMatrix4fv(lightSpaceLoc, 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrix));
+    GLint lightSpaceLoc = glGetUniformLocation(program, "lightSpaceTrMatrices");
+    glUniformMatrix4fv(lightSpaceLoc, (GLsizei)shadowCascades.size(), GL_FALSE, glm::value_ptr(lightSpaceTrMatrices[0]));
+    GLint cascadeSplitsLoc = glGetUniformLocation(program, "cascadeSplits");
+    glUniform1fv(cascadeSplitsLoc, (GLsizei)shadowCascades.size(), cascadeSplits);
+    GLint cascadeCountLoc = glGetUniformLocation(program, "cascadeCount");
+    glUniform1i(cascadeCountLoc, (GLint)shadowCascades.size());
 
     glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    GLint shadowMapLoc = glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap");
+    glBindTexture(GL_TEXTURE_2D_ARRAY, depthMapTexture);
+    GLint shadowMapLoc = glGetUniformLocation(program, "shadowMap");
     glUniform1i(shadowMapLoc, 3);
 
-    GLint lightPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightPos");
+    GLint lightPosLoc = glGetUniformLocation(program, "lightPos");
     glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
+    glUniform3fv(glGetUniformLocation(program, "lightDir"), 1, glm::value_ptr(lightDir));
+    glUniform3fv(glGetUniformLocation(program, "lightColor"), 1, glm::value_ptr(lightColor));
 
-    GLint pointLightPosLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLightPos");
-    GLint pointLightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLightColor");
-    GLint pointLightConstantLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLightConstant");
-    GLint pointLightLinearLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLightLinear");
-    GLint pointLightQuadraticLoc = glGetUniformLocation(myBasicShader.shaderProgram, "pointLightQuadratic");
+    // the original light's flat ambient term, independent of distance
+    glm::vec3 pointLightAmbient = 0.1f * pointLightColor;
+    GLint pointLightAmbientLoc = glGetUniformLocation(program, "pointLightAmbient");
+    glUniform3fv(pointLightAmbientLoc, 1, glm::value_ptr(pointLightAmbient));
 
-    glUniform3fv(pointLightPosLoc, 1, glm::value_ptr(pointLightPos));
-    glUniform3fv(pointLightColorLoc, 1, glm::value_ptr(pointLightColor));
-    glUniform1f(pointLightConstantLoc, pointLightConstant);
-    glUniform1f(pointLightLinearLoc, pointLightLinear);
-    glUniform1f(pointLightQuadraticLoc, pointLightQuadratic);
-
-    glm::vec3 fogColor(0.7f, 0.7f, 0.7f); // Grey fog color            
-
-    GLint fogColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogColor");
+    GLint fogColorLoc = glGetUniformLocation(program, "fogColor");
     glUniform3fv(fogColorLoc, 1, glm::value_ptr(fogColor));
 
-    GLint fogStartLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogStart");
+    GLint fogStartLoc = glGetUniformLocation(program, "fogStart");
     glUniform1f(fogStartLoc, fogStart);
 
-    GLint fogEndLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogEnd");
+    GLint fogEndLoc = glGetUniformLocation(program, "fogEnd");
     glUniform1f(fogEndLoc, fogEnd);
+}
+
+bool boxInFrustum(const gps::BoundingBox& box, const glm::vec4 planes[6]) {
+    for (int p = 0; p < 6; p++) {
+        glm::vec3 normal = glm::vec3(planes[p]);
+        glm::vec3 farthest(normal.x > 0.0f ? box.max.x : box.min.x, normal.y > 0.0f ? box.max.y : box.min.y, normal.z > 0.0f ? box.max.z : box.min.z);
+        if (glm::dot(normal, farthest) + planes[p].w < 0.0f) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// The terrain seen by a panorama face, past the far field's clip distance
+gps::TerrainView getFarFieldTerrainView(const glm::mat4& faceView, const glm::mat4& faceProjection) {
+    gps::TerrainView terrainView;
+    terrainView.position = glm::vec3(glm::inverse(faceView)[3]);
+    gps::extractFrustumPlanes(faceProjection * faceView, terrainView.frustumPlanes);
+    terrainView.useFrustum = true;
+    // 90 degree faces: one unit at distance 1 covers half a face
+    terrainView.pixelsPerUnit = farField.getSettings().faceSize * 0.5f;
+    terrainView.maxPixelError = litLodErrorPixels;
+    terrainView.minDistance = farField.getClipDistance();
+    terrainView.maxDistance = fogEnd;
+    return terrainView;
+}
+
+// Renders the panorama faces due this frame: the static meshes reaching past
+// the far field's clip distance, without the sun shadows and point lights,
+// whose cascades and clusters only cover the camera's own view
+void renderFarFieldFaces() {
+    if (!farFieldEnabled) {
+        return;
+    }
+    glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+    farField.update(cameraPosition, lightAngle);
+
+    myBasicShader.useShaderProgram();
+    GLuint program = myBasicShader.shaderProgram;
+    GLint modelLocMain = glGetUniformLocation(program, "model");
+    GLint normalMatrixLocMain = glGetUniformLocation(program, "normalMatrix");
+    GLint clipDistanceLoc = glGetUniformLocation(program, "farFieldClipDistance");
+    GLint cascadeCountLoc = glGetUniformLocation(program, "cascadeCount");
+    ambientSourceLoc = glGetUniformLocation(program, "ambientSource");
+    bakedAmbientLoc = glGetUniformLocation(program, "bakedAmbient");
+    glUniform1i(glGetUniformLocation(program, "lightmap"), LIGHTMAP_TEXTURE_UNIT);
+    irradianceProbes.bind(program, PROBE_TEXTURE_UNIT);
+    GLint lightPosLoc = glGetUniformLocation(program, "lightPos");
+
+    float clipDistance = farField.getClipDistance();
+    float clipDistanceSquared = clipDistance * clipDistance;
+    float fogEndSquared = fogEnd * fogEnd;
+    // 90 degree faces: one unit at distance 1 covers half a face
+    float pixelsPerUnit = farField.getSettings().faceSize * 0.5f;
+
+    glm::mat4 faceView;
+    glm::mat4 faceProjection;
+    std::vector<uint32_t> terrainChunks;
+
+    // shown faces drawn with stand-in terrain keep their chunks queued
+    // through this selection and are redrawn once it is all resident
+    if (terrain.isLoaded()) {
+        for (int face = 0; face < 6; face++) {
+            if (!farField.isFaceIncomplete(face)) {
+                continue;
+            }
+            farField.getFaceCamera(face, faceView, faceProjection, fogEnd);
+            terrainChunks.clear();
+            if (terrain.select(getFarFieldTerrainView(faceView, faceProjection), terrainChunks)) {
+                farField.requestRedraw(face);
+            }
+        }
+    }
+
+    while (farField.beginFace(faceView, faceProjection, fogEnd)) {
+        glm::vec3 center = glm::vec3(glm::inverse(faceView)[3]);
+        glm::vec4 frustumPlanes[6];
+        gps::extractFrustumPlanes(faceProjection * faceView, frustumPlanes);
+
+        // every face of a refresh is lit by the sun it started with, the sun
+        // moving meanwhile only queues the next refresh
+        glm::vec3 faceSun = glm::vec3(getSunTransform(farField.getFaceLightAngle())[3]);
+        glUniform3fv(lightPosLoc, 1, glm::value_ptr(faceSun));
+        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(faceView));
+        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(faceProjection));
+        glUniform1f(clipDistanceLoc, clipDistance);
+        glUniform1i(cascadeCountLoc, 0);
+        glEnable(GL_CLIP_DISTANCE0);
+
+        for (size_t i = 0; i < registry.renderables.size(); i++) {
+            const gps::RenderableComponent& renderable = registry.renderables.at(i);
+            if (!renderable.isStatic) {
+                continue;
+            }
+            const gps::TransformComponent& transform = registry.transforms.get(registry.renderables.entityAt(i));
+            const std::vector<gps::Mesh>& meshes = renderable.model->getMeshes();
+            glUniformMatrix4fv(modelLocMain, 1, GL_FALSE, glm::value_ptr(transform.model));
+            glm::mat3 normalMat = glm::mat3(faceView) * transform.normalMatrix;
+            glUniformMatrix3fv(normalMatrixLocMain, 1, GL_FALSE, glm::value_ptr(normalMat));
+
+            float scale = std::max(glm::length(glm::vec3(transform.model[0])),
+                std::max(glm::length(glm::vec3(transform.model[1])), glm::length(glm::vec3(transform.model[2]))));
+
+            for (size_t m = 0; m < meshes.size(); m++) {
+                gps::BoundingBox bounds = meshes[m].bounds.transformed(transform.model);
+                float distanceSquared = bounds.distanceSquared(center);
+                if (bounds.farthestDistanceSquared(center) < clipDistanceSquared || distanceSquared > fogEndSquared
+                    || !boxInFrustum(bounds, frustumPlanes)) {
+                    continue;
+                }
+                float distance = std::max(std::sqrt(distanceSquared), clipDistance);
+                int lod = meshes[m].selectLod(litLodErrorPixels * distance / (pixelsPerUnit * scale));
+                setAmbientSource(*renderable.model, m, lod);
+                renderable.model->DrawMesh(myBasicShader, m, lod);
+            }
+        }
+
+        if (terrain.isLoaded()) {
+            terrainChunks.clear();
+            if (!terrain.select(getFarFieldTerrainView(faceView, faceProjection), terrainChunks)) {
+                farField.markFaceIncomplete();
+            }
+
+            glm::mat3 normalMat = glm::mat3(faceView);
+            glUniformMatrix3fv(normalMatrixLocMain, 1, GL_FALSE, glm::value_ptr(normalMat));
+            glUniform1i(ambientSourceLoc, AMBIENT_FLAT);
+            terrain.draw(myBasicShader, terrainChunks);
+        }
+
+        glDisable(GL_CLIP_DISTANCE0);
+        farField.endFace();
+    }
+
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    glUniform1f(clipDistanceLoc, 0.0f);
+    glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
+    glUniform1i(cascadeCountLoc, (GLint)shadowCascades.size());
+    glUniform1i(ambientSourceLoc, AMBIENT_FLAT);
+}
+
+void renderImpostorsLit() {
+    setSunUniforms(impostorShader);
+    GLuint program = impostorShader.shaderProgram;
+    bool probes = bakedLighting && irradianceProbes.isLoaded();
+    glUniform1i(glGetUniformLocation(program, "ambientSource"), probes ? AMBIENT_PROBES : AMBIENT_FLAT);
+    glUniform1i(glGetUniformLocation(program, "useBakedAmbient"), bakedLighting);
+    irradianceProbes.bind(program, PROBE_TEXTURE_UNIT);
+    sceneImpostors.draw(impostorShader, view, projection);
+}
+
+void renderFinalScene() {
+    setSunUniforms(myBasicShader);
+
+    GLint showCascadesLoc = glGetUniformLocation(myBasicShader.shaderProgram, "showCascades");
+    glUniform1i(showCascadesLoc, showCascades);
+    GLint shadowTapsLoc = glGetUniformLocation(myBasicShader.shaderProgram, "shadowTaps");
+    glUniform1i(shadowTapsLoc, shadowQualityTaps[shadowQuality]);
+
+    lightClusters.bind(myBasicShader.shaderProgram, 4,
+        (float)myWindow.getWindowDimensions().width, (float)myWindow.getWindowDimensions().height);
+    pointShadows.bind(myBasicShader.shaderProgram, 7);
+
+    renderFarFieldFaces();
+
+    // a single GL_TIME_ELAPSED query can be active at a time
+    gps::GpuTimer& timer = lightBenchmark.active ? litPassTimer : shadowQualityTimers[shadowQuality];
+    timer.begin();
+    renderEntitiesLit(myBasicShader);
+    renderTerrainLit(myBasicShader);
+    renderScatterLit(myBasicShader);
+    renderImpostorsLit();
+    if (farFieldEnabled) {
+        farField.draw(farFieldShader, view, projection, glm::vec3(glm::inverse(view)[3]));
+    }
+    timer.end();
+
+    if (cullingMode == CULLING_GPU_QUERIES) {
+        issueOcclusionQueries();
+        occludedMeshCount = occlusionQueries.getOccludedCount();
+    }
+}
+
+
+// A 16 km square centred on the village; the heightmap keeps a plateau
+// under the village at the height of its ground
+void initTerrain() {
+    terrain.load("models/terrain/terrain.r16", "models/terrain/snow.png", gps::TerrainSettings());
+}
+
+// Cells come and go with the camera; the panorama is redrawn with them
+void initWorldPartition() {
+    gps::WorldPartitionSettings settings;
+    settings.loadRadius = fogEnd + worldLoadMargin;
+    settings.unloadRadius = fogEnd + worldUnloadMargin;
+    // only cells reaching into the panorama refresh it, the lit pass draws the rest
+    worldPartition.init("models/world/world.cells", settings,
+        [](gps::Model3D& model) {
+            worldCellEntities[&model] = createModelEntity(&model, true);
+            worldCellChanges.push_back(model.getBounds());
+            farField.invalidateBounds(model.getBounds());
+        },
+        [](gps::Model3D& model) {
+            gps::Entity entity = worldCellEntities[&model];
+            occlusionQueries.release(entity);
+            registry.destroy(entity);
+            worldCellEntities.erase(&model);
+            worldCellChanges.push_back(model.getBounds());
+            farField.invalidateBounds(model.getBounds());
+        });
+}
 
-    glm::mat4 sceneModel = glm::mat4(1.0f);
-    glm::mat3 sceneNormalMat = glm::mat3(glm::inverseTranspose(view * sceneModel));
-    renderScenaLit(myBasicShader, sceneModel, sceneNormalMat);
+void initSnow(bool forceCpu) {
+    // vertex work on a software rasterizer costs as much as the CPU path
+    const char* renderer = (const char*)glGetString(GL_RENDERER);
+    if (forceCpu || (renderer && std::string(renderer).find("llvmpipe") != std::string::npos)) {
+        snowMode = SNOW_CPU;
+    }
 
-    glm::mat4 wheelModel = glm::mat4(1.0f);
-    wheelModel = glm::translate(wheelModel, wheelPivotPoint);
-    wheelModel = glm::rotate(wheelModel, glm::radians(wheelRotationAngle), glm::vec3(1.0f, 0.0f, 0.0f));
-    wheelModel = glm::translate(wheelModel, -wheelPivotPoint);
+    snow.init(SNOW_FLAKES, myCamera.getPosition());
+    // the same top surfaces walk mode stands on, so flakes stop on the hall roof
+    snow.setOccluder(groundHeights);
+    cpuSnow.init(CPU_SNOW_FLAKES, myCamera.getPosition());
+    cpuSnow.setOccluder(groundHeights);
+    cpuSnow.initBuffers();
+    snowTimer.init();
+    std::cout << "Snow: " << snowModeNames[snowMode] << std::endl;
+}
 
-    glm::mat3 wheelNormalMat = glm::mat3(glm::inverseTranspose(view * wheelModel));
-    renderDoarMoriscaLit(myBasicShader, wheelModel, wheelNormalMat);
+// Advances the flakes and draws them over the finished scene
+void renderSnow(float deltaTime, float time) {
+    if (snowMode == SNOW_OFF) {
+        return;
+    }
+    float pointScale = myWindow.getWindowDimensions().height / (2.0f * std::tan(glm::radians(fieldOfView) * 0.5f));
+    // a long frame (loading, a breakpoint) would fling every flake out of the box
+    deltaTime = std::min(deltaTime, 0.1f);
+    if (snowMode == SNOW_CPU) {
+        cpuSnow.update(deltaTime, myCamera.getPosition());
+        snowTimer.begin();
+        cpuSnow.render(view, projection, pointScale);
+        snowTimer.end();
+        return;
+    }
+    snowTimer.begin();
+    snow.update(deltaTime, time, myCamera.getPosition());
+    snow.render(view, projection, pointScale);
+    snowTimer.end();
 }
 
+void initScatter() {
+    scatter.addPrototype("pine", "models/scatter/pine.obj", 400.0f);
+    scatter.addPrototype("rock", "models/scatter/rock.obj", 200.0f);
+
+    // hand placed points replace the procedural rules
+    if (!scatter.loadPoints("models/scatter/scatter.points")) {
+        int pine = scatter.findPrototype("pine");
+        if (pine >= 0) {
+            gps::ScatterRule rule;
+            rule.density = 0.004f;
+            rule.minScale = 0.8f;
+            rule.maxScale = 1.5f;
+            rule.maxSlopeDegrees = 25.0f;
+            rule.footprint = 1.5f;
+            rule.seed = 7;
+            std::vector<gps::ScatterInstance> instances;
+            gps::scatterInstances(groundHeights, rule, instances);
+            scatter.addInstances(pine, instances);
+        }
+
+        int rock = scatter.findPrototype("rock");
+        if (rock >= 0) {
+            gps::ScatterRule rule;
+            rule.density = 0.002f;
+            rule.minScale = 0.4f;
+            rule.maxScale = 1.6f;
+            rule.maxSlopeDegrees = 40.0f;
+            rule.footprint = 0.75f;
+            rule.seed = 13;
+            std::vector<gps::ScatterInstance> instances;
+            gps::scatterInstances(groundHeights, rule, instances);
+            scatter.addInstances(rock, instances);
+        }
+    }
+    scatter.init();
+}
 
 void renderScene() {
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    triangleStats = TriangleStats();
+    worldPartition.update(myCamera.getPosition(), myCamera.getFrontDirection());
+    terrain.update();
+    updateVisibility();
+    scatter.cull(view, projection);
+    updateOcclusion();
+    updateImpostors();
+    // point shadow slots are assigned before the light data is uploaded
+    updatePointLights();
     renderShadowMap();
     renderFinalScene();
 }
 
 void cleanup() {
+    // their loader threads and GL objects go while the context is still current
+    worldPartition.shutdown();
+    terrain.shutdown();
     myWindow.Delete();
 }
 
 
-void initShadowMapping() {
-    glGenFramebuffers(1, &shadowMapFBO);
-
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+GLuint createShadowMapArray() {
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+    GLint internalFormat = shadowDepth16 ? GL_DEPTH_COMPONENT16 : GL_DEPTH_COMPONENT32F;
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internalFormat, SHADOW_WIDTH, SHADOW_HEIGHT, gps::MAX_SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    // depth comparison + linear filtering = 2x2 PCF per tap
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
     float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMapTexture, 0);
+    return texture;
+}
+
+GLuint createShadowMapFBO(GLuint texture) {
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, 0);
     glDrawBuffer(GL_NONE);
     glReadBuffer(GL_NONE);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    return fbo;
 }
 
-GLfloat wheelRotationSpeed = 30.0f;
+void initShadowMapping() {
+    depthMapTexture = createShadowMapArray();
+    shadowMapFBO = createShadowMapFBO(depthMapTexture);
+
+    staticDepthMapTexture = createShadowMapArray();
+    staticShadowMapFBO = createShadowMapFBO(staticDepthMapTexture);
+
+    pointShadows.init(pointShadowBudgetBytes);
+
+    for (int i = 0; i < SHADOW_QUALITY_COUNT; i++) {
+        shadowQualityTimers[i].init();
+    }
+    litPassTimer.init();
+}
+
+// after a depth format change
+void recreateShadowMaps() {
+    glDeleteFramebuffers(1, &shadowMapFBO);
+    glDeleteFramebuffers(1, &staticShadowMapFBO);
+    glDeleteTextures(1, &depthMapTexture);
+    glDeleteTextures(1, &staticDepthMapTexture);
+
+    depthMapTexture = createShadowMapArray();
+    shadowMapFBO = createShadowMapFBO(depthMapTexture);
+    staticDepthMapTexture = createShadowMapArray();
+    staticShadowMapFBO = createShadowMapFBO(staticDepthMapTexture);
+
+    for (int c = 0; c < gps::MAX_SHADOW_CASCADES; c++) {
+        staticCascadeValid[c] = false;
+    }
+}
 
 int main(int argc, const char* argv[]) {
 
+    if (argc > 1 && std::string(argv[1]) == "--bench-ecs") {
+        gps::benchmarkRotators(100000, 300);
+        return EXIT_SUCCESS;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-bvh") {
+        gps::benchmarkBvh("models/scenaFinala/finalScene.obj", "models/scenaFinala/", myCamera.getViewMatrix(), glm::radians(fieldOfView), 1024, 768);
+        return EXIT_SUCCESS;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "--bench-snow") {
+        gps::benchmarkSnow(1 << 20, 100);
+        return EXIT_SUCCESS;
+    }
+
+    lightBenchmark.active = argc > 1 && std::string(argv[1]) == "--bench-lights";
+
     try {
         initOpenGLWindow();
     }
@@ -685,10 +2226,18 @@ int main(int argc, const char* argv[]) {
 
     initOpenGLState();
     initModels();
+    initEntities();
+    initSceneGraph();
     initShaders();
     initUniforms();
 
     initShadowMapping();
+    occlusionQueries.init();
+    farField.init(gps::FarFieldSettings());
+    initScatter();
+    initTerrain();
+    initWorldPartition();
+    initSnow(argc > 1 && std::string(argv[1]) == "--cpu-snow");
 
     setWindowCallbacks();
 
@@ -697,6 +2246,12 @@ int main(int argc, const char* argv[]) {
 
     animationStartTime = glfwGetTime();
 
+    if (lightBenchmark.active) {
+        // fixed viewpoint, no vsync
+        isAnimationActive = GL_FALSE;
+        glfwSwapInterval(0);
+    }
+
     glCheckError();
 
     static double lastFrameTime = 0.0;
@@ -710,10 +2265,7 @@ int main(int argc, const char* argv[]) {
         double deltaTime = currentFrameTime - lastFrameTime;
         lastFrameTime = currentFrameTime;
 
-        wheelRotationAngle += wheelRotationSpeed * deltaTime;
-        if (wheelRotationAngle > 360.0f) {
-            wheelRotationAngle -= 360.0f;
-        }
+        gps::updateRotators(registry, (float)deltaTime);
 
         if (isAnimationActive) {
             if (elapsedTime >= totalAnimationTime) {
@@ -724,8 +2276,12 @@ int main(int argc, const char* argv[]) {
             }
         }
 
+        updateLightBenchmark(deltaTime);
+
         processMovement();
+        updateSceneGraph();
         renderScene();
+        renderSnow((float)deltaTime, (float)currentTime);
 
         glfwPollEvents();
         glfwSwapBuffers(myWindow.getWindow());
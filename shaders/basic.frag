@@ -3,8 +3,8 @@
 in vec3 fNormal;
 in vec4 fPosEye;
 in vec2 fTexCoords;
-in vec4 FragPosLightSpace;
 in vec3 fFragPosWorld;
+in vec2 fLightmapCoords;
 
 out vec4 fColor;
 
@@ -16,14 +16,73 @@ uniform vec3 lightPos;
 // Textures
 uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
-uniform sampler2D shadowMap;
-
-// Point light (punctiform)
-uniform vec3 pointLightPos;  
-uniform vec3 pointLightColor; 
-uniform float pointLightConstant;   
-uniform float pointLightLinear;     
-uniform float pointLightQuadratic;
+uniform sampler2DArrayShadow shadowMap;
+
+// Cascaded shadow maps
+#define MAX_CASCADES 4
+uniform mat4 lightSpaceTrMatrices[MAX_CASCADES];
+uniform float cascadeSplits[MAX_CASCADES];
+uniform int cascadeCount;
+uniform bool showCascades;
+
+// 1 = single hardware PCF lookup, 4/8/16 = rotated Poisson disk
+uniform int shadowTaps;
+
+// one disk per tier, each centred on its own (a prefix of a larger disk is not)
+const vec2 poissonDisk4[4] = vec2[](
+    vec2(-0.25000000f, -0.66000000f), vec2(0.66000000f, -0.25000000f),
+    vec2(0.25000000f, 0.66000000f), vec2(-0.66000000f, 0.25000000f));
+
+const vec2 poissonDisk8[8] = vec2[](
+    vec2(0.29214735f, 0.03798943f), vec2(-0.27714274f, 0.33048530f),
+    vec2(0.09101982f, -0.51888712f), vec2(0.44459183f, 0.56290698f),
+    vec2(-0.69638776f, -0.09264704f), vec2(0.74175228f, -0.40704196f),
+    vec2(-0.19185681f, 0.90847323f), vec2(-0.40412396f, -0.82127882f));
+
+const vec2 poissonDisk16[16] = vec2[](
+    vec2(-0.94201624f, -0.39906216f), vec2(0.94558609f, -0.76890725f),
+    vec2(-0.09418410f, -0.92938870f), vec2(0.34495938f, 0.29387760f),
+    vec2(-0.91588581f, 0.45771432f), vec2(-0.81544232f, -0.87912464f),
+    vec2(-0.38277543f, 0.27676845f), vec2(0.97484398f, 0.75648379f),
+    vec2(0.44323325f, -0.97511554f), vec2(0.53742981f, -0.47373420f),
+    vec2(-0.26496911f, -0.41893023f), vec2(0.79197514f, 0.19090188f),
+    vec2(-0.24188840f, 0.99706507f), vec2(-0.81409955f, 0.91437590f),
+    vec2(0.19984126f, 0.78641367f), vec2(0.14383161f, -0.14100790f));
+
+// Point lights (punctiform), culled per cluster on the CPU
+// lightData: 3 texels per light (position, range) (color, constant) (linear, quadratic, shadow slot, -)
+uniform samplerBuffer lightData;
+// cube map per shadowed light, storing distance / range
+uniform samplerCubeArrayShadow pointShadowMaps;
+// per cluster: (offset into clusterIndices, light count)
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterDims;
+uniform vec2 clusterTileSize;
+uniform float clusterNear;
+uniform float clusterSliceScale;
+uniform vec3 pointLightAmbient;
+// set while rendering FarField faces, whose pixels do not match the clusters
+uniform float farFieldClipDistance;
+
+// Baked sky and bounce light (LightmapBaker), replacing the flat ambient term
+#define AMBIENT_FLAT 0
+#define AMBIENT_LIGHTMAP 1
+#define AMBIENT_BAKED_CONSTANT 2
+#define AMBIENT_PROBES 3
+uniform int ambientSource;
+// RGBM: rgb * a * LIGHTMAP_RANGE
+uniform sampler2D lightmap;
+uniform vec3 bakedAmbient;
+const float LIGHTMAP_RANGE = 8.0f;
+
+// L1 irradiance probes: per channel (L0, L1) stacked along z, world space
+uniform sampler3D probeGrid;
+uniform vec3 probeGridOrigin;
+uniform float probeGridSpacing;
+uniform ivec3 probeGridSize;
+// rigid, so its transpose takes eye-space normals back to world space
+uniform mat4 view;
 
 // Fog uniforms
 uniform vec3 fogColor;    
@@ -37,21 +96,69 @@ vec3 specular;
 float specularStrength = 0.5f;
 float shininess = 32.0f;
 
-float computeShadow()
+int selectCascade()
+{
+    float viewDepth = -fPosEye.z;
+    for (int i = 0; i < cascadeCount; i++) {
+        if (viewDepth < cascadeSplits[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+float computeShadow(int cascade)
 {
-    vec3 normalizedCoords = FragPosLightSpace.xyz / FragPosLightSpace.w;
+    if (cascade < 0) {
+        return 0.0f;
+    }
+
+    vec4 fragPosLightSpace = lightSpaceTrMatrices[cascade] * vec4(fFragPosWorld, 1.0f);
+    vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
 
     normalizedCoords = normalizedCoords * 0.5 + 0.5;
 
-    float closestDepth = texture(shadowMap, normalizedCoords.xy).r;
+    if (normalizedCoords.z > 1.0f) {
+        return 0.0f;
+    }
 
     float currentDepth = normalizedCoords.z;
 
     float bias = max(0.05f * (1.0f - dot(normalize(fNormal), lightDir)), 0.005f);
 
-    float shadow = currentDepth - bias > closestDepth ? 1.0f : 0.0f;
+    float referenceDepth = currentDepth - bias;
+
+    if (shadowTaps <= 1) {
+        return 1.0f - texture(shadowMap, vec4(normalizedCoords.xy, cascade, referenceDepth));
+    }
 
-    return shadow;
+    // per-pixel rotation of the disk trades banding for noise
+    float angle = 6.2831853f * fract(sin(dot(gl_FragCoord.xy, vec2(12.9898f, 78.233f))) * 43758.5453f);
+    mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+    vec2 filterRadius = 1.5f / vec2(textureSize(shadowMap, 0).xy);
+
+    float lit = 0.0f;
+    for (int i = 0; i < shadowTaps; i++) {
+        vec2 tap = shadowTaps <= 4 ? poissonDisk4[i] : (shadowTaps <= 8 ? poissonDisk8[i] : poissonDisk16[i]);
+        vec2 offset = rotation * tap * filterRadius;
+        lit += texture(shadowMap, vec4(normalizedCoords.xy + offset, cascade, referenceDepth));
+    }
+
+    return 1.0f - lit / float(shadowTaps);
+}
+
+vec3 sampleProbes(vec3 worldPos, vec3 worldNormal)
+{
+    // clamped to the grid so filtering never crosses into another channel's block
+    vec3 cell = clamp((worldPos - probeGridOrigin) / probeGridSpacing, vec3(0.0f), vec3(probeGridSize - 1));
+    vec3 uvw = (cell + 0.5f) / vec3(probeGridSize.x, probeGridSize.y, 3 * probeGridSize.z);
+    vec4 red = texture(probeGrid, uvw);
+    vec4 green = texture(probeGrid, uvw + vec3(0.0f, 0.0f, 1.0f / 3.0f));
+    vec4 blue = texture(probeGrid, uvw + vec3(0.0f, 0.0f, 2.0f / 3.0f));
+    vec3 irradiance = vec3(red.x + dot(red.yzw, worldNormal),
+                           green.x + dot(green.yzw, worldNormal),
+                           blue.x + dot(blue.yzw, worldNormal));
+    return max(irradiance, 0.0f);
 }
 
 void computeLightComponents()
@@ -65,7 +172,19 @@ void computeLightComponents()
 
     vec3 viewDirN = normalize(cameraPosEye - fPosEye.xyz);
 
-    ambient = ambientStrength * lightColor;
+    if (ambientSource == AMBIENT_LIGHTMAP) {
+        vec4 rgbm = texture(lightmap, fLightmapCoords);
+        ambient = rgbm.rgb * rgbm.a * LIGHTMAP_RANGE;
+    }
+    else if (ambientSource == AMBIENT_BAKED_CONSTANT) {
+        ambient = bakedAmbient;
+    }
+    else if (ambientSource == AMBIENT_PROBES) {
+        ambient = sampleProbes(fFragPosWorld, transpose(mat3(view)) * normalEye);
+    }
+    else {
+        ambient = ambientStrength * lightColor;
+    }
 
     diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
 
@@ -74,26 +193,52 @@ void computeLightComponents()
     specular = specularStrength * specCoeff * lightColor;
 }
 
-vec3 computePointLight(vec3 fragPos, vec3 normal, vec3 viewDir) 
+int findCluster()
 {
-    vec3 toLight = pointLightPos - fragPos;
-    float dist   = length(toLight);
-    vec3 Lp      = normalize(toLight);
+    float viewDepth = -fPosEye.z;
+    int slice = int(max(log(viewDepth / clusterNear) * clusterSliceScale, 0.0f));
+    slice = min(slice, clusterDims.z - 1);
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterTileSize), clusterDims.xy - 1);
+    return tile.x + clusterDims.x * (tile.y + clusterDims.y * slice);
+}
 
-    float attenuation = 1.0 / (pointLightConstant 
-                             + pointLightLinear * dist 
-                             + pointLightQuadratic * dist * dist);
+vec3 computePointLights(vec3 fragPos, vec3 normal, vec3 viewDir)
+{
+    uvec2 cluster = texelFetch(clusterGrid, findCluster()).rg;
+
+    vec3 result = vec3(0.0f);
+    for (uint i = 0u; i < cluster.y; i++) {
+        int lightIndex = int(texelFetch(clusterIndices, int(cluster.x + i)).r);
+        vec4 positionRange = texelFetch(lightData, 3 * lightIndex);
+        vec3 lightPosition = positionRange.xyz;
+        vec4 colorConstant = texelFetch(lightData, 3 * lightIndex + 1);
+        vec3 linearQuadratic = texelFetch(lightData, 3 * lightIndex + 2).xyz;
+
+        vec3 toLight = lightPosition - fragPos;
+        float dist = length(toLight);
+        vec3 Lp = normalize(toLight);
 
-    float diff = max(dot(normal, Lp), 0.0);
-    vec3 diffusePL = pointLightColor * diff * attenuation;
+        float attenuation = 1.0 / (colorConstant.w
+                                 + linearQuadratic.x * dist
+                                 + linearQuadratic.y * dist * dist);
 
-    vec3 reflectDir = reflect(-Lp, normal);
-    float spec = pow(max(dot(viewDir, reflectDir), 0.0), 32.0); // Shininess = 32
-    vec3 specularPL = 0.5 * spec * pointLightColor * attenuation; // Specular strength = 0.5
+        // z holds the shadow slot, negative when the light has none
+        if (linearQuadratic.z >= 0.0) {
+            float referenceDepth = (dist - 0.15) / positionRange.w;
+            attenuation *= texture(pointShadowMaps, vec4(-toLight, linearQuadratic.z), referenceDepth);
+        }
 
-    vec3 ambientPL = 0.1 * pointLightColor;
+        float diffPL = max(dot(normal, Lp), 0.0);
+        vec3 diffusePL = colorConstant.rgb * diffPL * attenuation;
 
-    return ambientPL + diffusePL + specularPL;
+        vec3 reflectDir = reflect(-Lp, normal);
+        float specPL = pow(max(dot(viewDir, reflectDir), 0.0), 32.0); // Shininess = 32
+        vec3 specularPL = colorConstant.rgb * specPL * attenuation;
+
+        result += diffusePL + specularPL;
+    }
+
+    return result;
 }
 
 
@@ -101,31 +246,18 @@ void main()
 {
     computeLightComponents();
 
-    float shadow = computeShadow();
+    int cascade = selectCascade();
+    float shadow = computeShadow(cascade);
 
     ambient *= texture(diffuseTexture, fTexCoords).rgb;
     diffuse *= texture(diffuseTexture, fTexCoords).rgb;
     specular *= texture(specularTexture, fTexCoords).rgb;
 
-    vec3 toLight = pointLightPos - fFragPosWorld;
-    float dist = length(toLight);           
-    vec3 Lp = normalize(toLight);           
-
-    float attenuation = 1.0 / (pointLightConstant 
-                             + pointLightLinear * dist 
-                             + pointLightQuadratic * dist * dist);
-
-    float diffPL = max(dot(normalize(fNormal), Lp), 0.0);
-    vec3 diffusePL = pointLightColor * diffPL * attenuation;
-
     vec3 viewDir = normalize(-fFragPosWorld);
-    vec3 reflectDir = reflect(-Lp, normalize(fNormal));
-    float specPL = pow(max(dot(viewDir, reflectDir), 0.0), 32.0); // Shininess = 32
-    vec3 specularPL = pointLightColor * specPL * attenuation;
-
-    vec3 ambientPL = 0.1 * pointLightColor;
-
-    vec3 pointLightResult = ambientPL + diffusePL + specularPL;
+    vec3 pointLightResult = pointLightAmbient;
+    if (farFieldClipDistance == 0.0f) {
+        pointLightResult += computePointLights(fFragPosWorld, normalize(fNormal), viewDir);
+    }
 
     vec3 color = min((ambient + (1.0f - shadow) * diffuse) + (1.0f - shadow) * specular + pointLightResult, 1.0f);
     
@@ -133,5 +265,12 @@ void main()
     float fogFactor = clamp((fogEnd - distToCam) / (fogEnd - fogStart), 0.0, 1.0); // Linear fog
     vec3 finalColor = mix(fogColor, color, fogFactor);
 
+    if (showCascades && cascade >= 0) {
+        const vec3 cascadeColors[MAX_CASCADES] = vec3[](
+            vec3(1.0f, 0.2f, 0.2f), vec3(0.2f, 1.0f, 0.2f),
+            vec3(0.2f, 0.2f, 1.0f), vec3(1.0f, 1.0f, 0.2f));
+        finalColor = mix(finalColor, cascadeColors[cascade], 0.35f);
+    }
+
     fColor = vec4(finalColor, 1.0);
 }
@@ -3,39 +3,63 @@
 layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
+layout(location=3) in vec2 vLightmapCoords;
+// scattered instances (InstanceScatter): position and scale, cos and sin of the yaw
+layout(location=4) in vec4 vInstancePositionScale;
+layout(location=5) in vec4 vInstanceRotation;
+// duplicate shapes merged by Model3D: a rigid transform per copy, applied before model
+layout(location=6) in mat4 vInstanceModel;
 
 // Output for fragment shader
 out vec3 fNormal;
 out vec4 fPosEye;
 out vec2 fTexCoords;
-out vec4 FragPosLightSpace; 
 out vec3 fFragPosWorld;
+out vec2 fLightmapCoords;
 
 
 // Uniforms
 uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
-uniform mat4 lightSpaceTrMatrix;
 uniform mat3 normalMatrix;
+// placed by the instance attributes instead of model / normalMatrix
+uniform bool instanced;
+// set by Mesh::Draw for meshes merged from duplicate shapes
+uniform bool instancedMesh;
+// FarField faces clip what is closer to their centre than this; 0 elsewhere
+uniform float farFieldClipDistance;
+
+vec3 rotateY(vec3 v, vec2 cosSin)
+{
+    return vec3(cosSin.x * v.x + cosSin.y * v.z, v.y, -cosSin.y * v.x + cosSin.x * v.z);
+}
 
 void main() 
 {
     // World-space position
-    vec4 worldPos = model * vec4(vPosition, 1.0); 
+    vec4 localPos = instancedMesh ? vInstanceModel * vec4(vPosition, 1.0) : vec4(vPosition, 1.0);
+    vec4 worldPos = model * localPos;
+    if (instanced) {
+        worldPos = vec4(vInstancePositionScale.xyz + rotateY(vPosition * vInstancePositionScale.w, vInstanceRotation.xy), 1.0);
+    }
     fFragPosWorld = worldPos.xyz;
 
     // Eye-space position
     fPosEye = view * worldPos;
 
-    // Normal in eye space
-    fNormal = normalize(normalMatrix * vNormal);
+    // Normal in eye space; the instance transform is a rotation, its own normal matrix
+    vec3 localNormal = instancedMesh ? mat3(vInstanceModel) * vNormal : vNormal;
+    fNormal = normalize(normalMatrix * localNormal);
+    if (instanced) {
+        fNormal = normalize(mat3(view) * rotateY(vNormal, vInstanceRotation.xy));
+    }
 
     // Texture coordinates
     fTexCoords = vTexCoords;
+    fLightmapCoords = vLightmapCoords;
 
-    // Position in light space
-    FragPosLightSpace = lightSpaceTrMatrix * worldPos;
+    gl_ClipDistance[0] = length(fPosEye.xyz) - farFieldClipDistance;
 
     // Final vertex position in clip space
     gl_Position = projection * view * worldPos;
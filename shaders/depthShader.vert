@@ -1,10 +1,33 @@
 #version 410 core
 
 layout(location = 0) in vec3 vPosition;
+// scattered instances, see basic.vert
+layout(location = 4) in vec4 vInstancePositionScale;
+layout(location = 5) in vec4 vInstanceRotation;
+// duplicate shapes merged by Model3D, see basic.vert
+layout(location = 6) in mat4 vInstanceModel;
 
 uniform mat4 lightSpaceTrMatrix;
 uniform mat4 model;
+uniform bool instanced;
+uniform bool instancedMesh;
+// instances farther than this from the center are dropped, 0 keeps them all
+uniform vec3 instanceCullCenter;
+uniform float instanceCullDistance;
 
 void main() {
-    gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0);
+    if (instanced) {
+        if (instanceCullDistance > 0.0 && distance(vInstancePositionScale.xyz, instanceCullCenter) > instanceCullDistance) {
+            // outside the clip volume, so the whole triangle is clipped
+            gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+            return;
+        }
+        vec3 p = vPosition * vInstancePositionScale.w;
+        vec2 cosSin = vInstanceRotation.xy;
+        vec3 worldPos = vInstancePositionScale.xyz + vec3(cosSin.x * p.x + cosSin.y * p.z, p.y, -cosSin.y * p.x + cosSin.x * p.z);
+        gl_Position = lightSpaceTrMatrix * vec4(worldPos, 1.0);
+        return;
+    }
+    vec4 localPos = instancedMesh ? vInstanceModel * vec4(vPosition, 1.0) : vec4(vPosition, 1.0);
+    gl_Position = lightSpaceTrMatrix * model * localPos;
 }
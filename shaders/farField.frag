@@ -0,0 +1,21 @@
+#version 410 core
+
+in vec3 fDirection;
+
+out vec4 fColor;
+
+uniform samplerCube panorama;
+// camera position relative to the panorama's centre
+uniform vec3 cameraOffset;
+// the panorama is treated as painted on a sphere this far from its centre
+uniform float proxyRadius;
+
+void main()
+{
+    // where the view ray leaves the proxy sphere; the camera is always inside it
+    vec3 direction = normalize(fDirection);
+    float b = dot(cameraOffset, direction);
+    float c = dot(cameraOffset, cameraOffset) - proxyRadius * proxyRadius;
+    float t = -b + sqrt(max(b * b - c, 0.0));
+    fColor = vec4(texture(panorama, cameraOffset + t * direction).rgb, 1.0);
+}
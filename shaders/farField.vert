@@ -0,0 +1,14 @@
+#version 410 core
+
+// A triangle covering the screen at the far plane, see FarField::draw
+out vec3 fDirection;
+
+uniform mat4 inverseViewProjection;
+
+void main()
+{
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2) * 2.0 - 1.0;
+    vec4 world = inverseViewProjection * vec4(corner, 1.0, 1.0);
+    fDirection = world.xyz / world.w;
+    gl_Position = vec4(corner, 1.0, 1.0);
+}
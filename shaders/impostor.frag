@@ -0,0 +1,127 @@
+#version 410 core
+
+in vec2 fFrameCoords;
+flat in vec2 fFrame;
+flat in float fLayer;
+flat in float fRadius;
+flat in vec3 fFrameDirection;
+flat in vec3 fFrameRight;
+flat in vec3 fFrameUp;
+flat in mat4 fModel;
+flat in vec4 fBakedAmbient;
+
+out vec4 fColor;
+
+uniform sampler2DArray impostorAlbedo;
+uniform sampler2DArray impostorNormalDepth;
+uniform int frames;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+// Lighting, as in basic.frag
+uniform vec3 lightDir;
+uniform vec3 lightColor;
+uniform vec3 lightPos;
+uniform vec3 pointLightAmbient;
+
+uniform sampler2DArrayShadow shadowMap;
+#define MAX_CASCADES 4
+uniform mat4 lightSpaceTrMatrices[MAX_CASCADES];
+uniform float cascadeSplits[MAX_CASCADES];
+uniform int cascadeCount;
+
+// for the copies without baked light; the others use it when useBakedAmbient is set
+#define AMBIENT_FLAT 0
+#define AMBIENT_PROBES 3
+uniform int ambientSource;
+uniform bool useBakedAmbient;
+uniform sampler3D probeGrid;
+uniform vec3 probeGridOrigin;
+uniform float probeGridSpacing;
+uniform ivec3 probeGridSize;
+
+uniform vec3 fogColor;
+uniform float fogStart;
+uniform float fogEnd;
+
+const float ambientStrength = 0.2f;
+
+// A single hardware PCF tap: impostors are only drawn far away
+float computeShadow(vec3 worldPos, vec3 normalEye, float viewDepth)
+{
+    int cascade = -1;
+    for (int i = 0; i < cascadeCount; i++) {
+        if (viewDepth < cascadeSplits[i]) {
+            cascade = i;
+            break;
+        }
+    }
+    if (cascade < 0) {
+        return 0.0f;
+    }
+
+    vec4 fragPosLightSpace = lightSpaceTrMatrices[cascade] * vec4(worldPos, 1.0f);
+    vec3 normalizedCoords = fragPosLightSpace.xyz / fragPosLightSpace.w * 0.5 + 0.5;
+    if (normalizedCoords.z > 1.0f) {
+        return 0.0f;
+    }
+    float bias = max(0.05f * (1.0f - dot(normalEye, lightDir)), 0.005f);
+    return 1.0f - texture(shadowMap, vec4(normalizedCoords.xy, cascade, normalizedCoords.z - bias));
+}
+
+vec3 sampleProbes(vec3 worldPos, vec3 worldNormal)
+{
+    vec3 cell = clamp((worldPos - probeGridOrigin) / probeGridSpacing, vec3(0.0f), vec3(probeGridSize - 1));
+    vec3 uvw = (cell + 0.5f) / vec3(probeGridSize.x, probeGridSize.y, 3 * probeGridSize.z);
+    vec4 red = texture(probeGrid, uvw);
+    vec4 green = texture(probeGrid, uvw + vec3(0.0f, 0.0f, 1.0f / 3.0f));
+    vec4 blue = texture(probeGrid, uvw + vec3(0.0f, 0.0f, 2.0f / 3.0f));
+    vec3 irradiance = vec3(red.x + dot(red.yzw, worldNormal),
+                           green.x + dot(green.yzw, worldNormal),
+                           blue.x + dot(blue.yzw, worldNormal));
+    return max(irradiance, 0.0f);
+}
+
+void main()
+{
+    if (any(lessThan(fFrameCoords, vec2(0.0))) || any(greaterThan(fFrameCoords, vec2(1.0)))) {
+        discard;
+    }
+    vec3 atlasCoords = vec3((fFrame + fFrameCoords) / float(frames), fLayer);
+    vec4 albedo = texture(impostorAlbedo, atlasCoords);
+    vec4 normalDepth = texture(impostorNormalDepth, atlasCoords);
+    // the bake clears to zero, which no encoded normal is
+    if (albedo.a < 0.5 || normalDepth.xyz == vec3(0.0)) {
+        discard;
+    }
+
+    // the surface point the frame saw, so depth, shadows and fog match the mesh
+    vec2 planar = (fFrameCoords * 2.0 - 1.0) * fRadius;
+    vec3 localPos = planar.x * fFrameRight + planar.y * fFrameUp + fFrameDirection * fRadius * (1.0 - 2.0 * normalDepth.w);
+    vec3 worldPos = (fModel * vec4(localPos, 1.0)).xyz;
+    vec3 worldNormal = normalize(mat3(fModel) * (normalDepth.xyz * 2.0 - 1.0));
+
+    vec4 posEye = view * vec4(worldPos, 1.0);
+    vec4 clipPos = projection * posEye;
+    gl_FragDepth = clipPos.z / clipPos.w * 0.5 + 0.5;
+
+    vec3 normalEye = normalize(mat3(view) * worldNormal);
+    vec3 lightDirN = normalize(lightPos - posEye.xyz);
+
+    vec3 ambient = ambientStrength * lightColor;
+    if (useBakedAmbient && fBakedAmbient.a > 0.0) {
+        ambient = fBakedAmbient.rgb;
+    }
+    else if (ambientSource == AMBIENT_PROBES) {
+        ambient = sampleProbes(worldPos, worldNormal);
+    }
+    vec3 diffuse = max(dot(normalEye, lightDirN), 0.0f) * lightColor;
+    float shadow = computeShadow(worldPos, normalEye, -posEye.z);
+
+    vec3 color = min((ambient + (1.0f - shadow) * diffuse) * albedo.rgb + pointLightAmbient, 1.0f);
+
+    float distToCam = length(posEye.xyz);
+    float fogFactor = clamp((fogEnd - distToCam) / (fogEnd - fogStart), 0.0, 1.0);
+    fColor = vec4(mix(fogColor, color, fogFactor), 1.0);
+}
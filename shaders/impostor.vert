@@ -0,0 +1,85 @@
+#version 410 core
+
+// One camera-facing quad per copy of an impostor mesh, see ImpostorAtlas
+layout(location = 0) in vec2 vCorner;
+// impostor space (centred on the mesh's bounding sphere) to world
+layout(location = 1) in mat4 vModel;
+// x: atlas layer, y: radius
+layout(location = 5) in vec4 vParams;
+// rgb: mean lightmap light of the mesh, a: 1 when it has one
+layout(location = 6) in vec4 vBakedAmbient;
+
+// across the chosen frame, 0..1 over the sphere's diameter
+out vec2 fFrameCoords;
+flat out vec2 fFrame;
+flat out float fLayer;
+flat out float fRadius;
+flat out vec3 fFrameDirection;
+flat out vec3 fFrameRight;
+flat out vec3 fFrameUp;
+flat out mat4 fModel;
+flat out vec4 fBakedAmbient;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform vec3 cameraPosition;
+// frames per side of a layer
+uniform int frames;
+
+vec2 signNotZero(vec2 v)
+{
+    return vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+}
+
+// Octahedral map of the sphere, +Y at the centre; the same as ImpostorAtlas.cpp
+vec3 octDecode(vec2 e)
+{
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+    if (n.y < 0.0) {
+        n.xz = (1.0 - abs(e.yx)) * signNotZero(e);
+    }
+    return normalize(n);
+}
+
+vec2 octEncode(vec3 n)
+{
+    n /= abs(n.x) + abs(n.y) + abs(n.z);
+    vec2 e = n.xz;
+    if (n.y < 0.0) {
+        e = (1.0 - abs(e.yx)) * signNotZero(e);
+    }
+    return e;
+}
+
+// Screen axes of a camera looking back along direction, as glm::lookAt builds them for the bake
+void frameBasis(vec3 direction, out vec3 right, out vec3 up)
+{
+    vec3 upHint = abs(direction.y) > 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(0.0, 1.0, 0.0);
+    right = normalize(cross(-direction, upHint));
+    up = cross(right, -direction);
+}
+
+void main()
+{
+    vec3 center = vModel[3].xyz;
+    float radius = vParams.y;
+    vec3 toCamera = normalize(inverse(mat3(vModel)) * (cameraPosition - center));
+
+    vec2 frame = min(floor((octEncode(toCamera) * 0.5 + 0.5) * float(frames)), vec2(frames - 1));
+    fFrameDirection = octDecode((frame + 0.5) / float(frames) * 2.0 - 1.0);
+    frameBasis(fFrameDirection, fFrameRight, fFrameUp);
+
+    vec3 right;
+    vec3 up;
+    frameBasis(toCamera, right, up);
+    vec3 offset = (vCorner.x * right + vCorner.y * up) * radius;
+    // projected along the frame direction onto the frame's image
+    fFrameCoords = vec2(dot(offset, fFrameRight), dot(offset, fFrameUp)) / (2.0 * radius) + 0.5;
+
+    fFrame = frame;
+    fLayer = vParams.x;
+    fRadius = radius;
+    fModel = vModel;
+    fBakedAmbient = vBakedAmbient;
+    gl_Position = projection * view * vModel * vec4(offset, 1.0);
+}
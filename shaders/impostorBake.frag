@@ -0,0 +1,18 @@
+#version 410 core
+
+in vec3 fNormal;
+in vec2 fTexCoords;
+
+// albedo, alpha = coverage
+layout(location = 0) out vec4 fAlbedo;
+// model-space normal, alpha = depth across the bounding sphere
+layout(location = 1) out vec4 fNormalDepth;
+
+uniform sampler2D diffuseTexture;
+
+void main()
+{
+    fAlbedo = vec4(texture(diffuseTexture, fTexCoords).rgb, 1.0);
+    // orthographic, so the window depth is linear
+    fNormalDepth = vec4(normalize(fNormal) * 0.5 + 0.5, gl_FragCoord.z);
+}
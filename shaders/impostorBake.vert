@@ -0,0 +1,18 @@
+#version 410 core
+
+// One copy of a mesh seen from one impostor frame, see ImpostorAtlas::bake
+layout(location = 0) in vec3 vPosition;
+layout(location = 1) in vec3 vNormal;
+layout(location = 2) in vec2 vTexCoords;
+
+out vec3 fNormal;
+out vec2 fTexCoords;
+
+uniform mat4 viewProjection;
+
+void main()
+{
+    fNormal = vNormal;
+    fTexCoords = vTexCoords;
+    gl_Position = viewProjection * vec4(vPosition, 1.0);
+}
@@ -0,0 +1,14 @@
+#version 410 core
+
+// One scattered instance per vertex, handed to instanceCull.geom
+layout(location = 0) in vec4 vPositionScale;
+layout(location = 1) in vec4 vRotation;
+
+out vec4 gPositionScale;
+out vec4 gRotation;
+
+void main()
+{
+    gPositionScale = vPositionScale;
+    gRotation = vRotation;
+}
@@ -0,0 +1,10 @@
+#version 410 core
+
+layout(location = 0) in vec3 vPosition;
+
+// view projection * the box's placement of the unit cube
+uniform mat4 boxTransform;
+
+void main() {
+    gl_Position = boxTransform * vec4(vPosition, 1.0);
+}
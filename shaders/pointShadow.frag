@@ -0,0 +1,11 @@
+#version 410 core
+
+in vec3 fPosWorld;
+
+uniform vec3 lightPosition;
+uniform float lightRange;
+
+void main() {
+    // linear distance, so the lit pass can compare against length(fragment - light)
+    gl_FragDepth = length(fPosWorld - lightPosition) / lightRange;
+}
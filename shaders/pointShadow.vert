@@ -0,0 +1,14 @@
+#version 410 core
+
+layout(location = 0) in vec3 vPosition;
+// duplicate shapes merged by Model3D, see basic.vert
+layout(location = 6) in mat4 vInstanceModel;
+
+uniform mat4 model;
+uniform bool instancedMesh;
+
+void main() {
+    vec4 localPos = instancedMesh ? vInstanceModel * vec4(vPosition, 1.0) : vec4(vPosition, 1.0);
+    // world space; the geometry shader projects once per cube face
+    gl_Position = model * localPos;
+}
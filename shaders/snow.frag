@@ -0,0 +1,18 @@
+#version 410 core
+
+in float fAlpha;
+
+out vec4 fColor;
+
+uniform vec3 snowColor;
+
+void main()
+{
+    // soft round flake inside the point sprite
+    vec2 offset = gl_PointCoord * 2.0f - 1.0f;
+    float radiusSquared = dot(offset, offset);
+    if (radiusSquared > 1.0f) {
+        discard;
+    }
+    fColor = vec4(snowColor, (1.0f - radiusSquared) * fAlpha);
+}
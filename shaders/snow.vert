@@ -0,0 +1,23 @@
+#version 410 core
+
+layout(location = 0) in vec4 vPositionSeed;
+layout(location = 1) in vec4 vVelocitySize;
+
+out float fAlpha;
+
+uniform mat4 view;
+uniform mat4 projection;
+// pixels covered by one world unit at distance 1
+uniform float pointScale;
+// flakes fade out towards this distance
+uniform float fadeDistance;
+
+void main()
+{
+    vec4 positionEye = view * vec4(vPositionSeed.xyz, 1.0f);
+    gl_Position = projection * positionEye;
+
+    float distance = max(-positionEye.z, 0.01f);
+    gl_PointSize = max(vVelocitySize.w * pointScale / distance, 1.0f);
+    fAlpha = clamp(1.0f - distance / fadeDistance, 0.0f, 1.0f);
+}
@@ -0,0 +1,72 @@
+#version 410 core
+
+// One snowflake per vertex; the outputs are captured into the other buffer
+layout(location = 0) in vec4 vPositionSeed;
+layout(location = 1) in vec4 vVelocitySize;
+
+out vec4 tfPositionSeed;
+out vec4 tfVelocitySize;
+
+uniform float deltaTime;
+uniform float time;
+uniform uint frame;
+uniform vec3 cameraPosition;
+uniform vec3 wind;
+uniform float turbulence;
+uniform float fallSpeed;
+// flakes live in a box around the camera: half width (x, z) and half height (y)
+uniform vec3 volumeExtent;
+
+// heights of the topmost scene surfaces seen from above; flakes landing on
+// them (roofs, then the ground) respawn
+uniform sampler2D occluderHeights;
+uniform vec2 occluderOrigin;
+uniform vec2 occluderSize;
+
+float random(uint x)
+{
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return float(x) / 4294967296.0f;
+}
+
+void main()
+{
+    vec3 position = vPositionSeed.xyz;
+    float seed = vPositionSeed.w;
+    vec3 velocity = vVelocitySize.xyz;
+
+    // every flake flutters on its own phase and falls at its own speed
+    float phase = seed * 6.2831853f;
+    vec3 flutter = vec3(sin(time * 1.3f + phase), 0.0f, cos(time * 0.9f + phase * 1.7f)) * turbulence;
+    vec3 target = wind + flutter - vec3(0.0f, fallSpeed * (0.6f + 0.8f * fract(seed * 7.31f)), 0.0f);
+    velocity = mix(velocity, target, clamp(deltaTime * 2.0f, 0.0f, 1.0f));
+    position += velocity * deltaTime;
+
+    // horizontal wrap around the camera keeps the density even as it moves
+    vec2 offset = mod(position.xz - cameraPosition.xz + volumeExtent.xz, 2.0f * volumeExtent.xz) - volumeExtent.xz;
+    position.xz = cameraPosition.xz + offset;
+    if (position.y > cameraPosition.y + volumeExtent.y) {
+        position.y -= 2.0f * volumeExtent.y;
+    }
+
+    float surface = -1e9f;
+    vec2 occluderCoords = (position.xz - occluderOrigin) / occluderSize;
+    if (all(greaterThanEqual(occluderCoords, vec2(0.0f))) && all(lessThanEqual(occluderCoords, vec2(1.0f)))) {
+        surface = texture(occluderHeights, occluderCoords).r;
+    }
+
+    if (position.y < surface || position.y < cameraPosition.y - volumeExtent.y) {
+        uint key = uint(gl_VertexID) * 3u + frame * 2654435761u;
+        position = cameraPosition + vec3(random(key) * 2.0f - 1.0f,
+                                         1.0f - 0.2f * random(key + 1u),
+                                         random(key + 2u) * 2.0f - 1.0f) * volumeExtent;
+        velocity = target;
+    }
+
+    tfPositionSeed = vec4(position, seed);
+    tfVelocitySize = vec4(velocity, vVelocitySize.w);
+}